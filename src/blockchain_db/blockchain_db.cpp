@@ -125,9 +125,13 @@ uint64_t BlockchainDB::add_block( const block& blk
   TIME_MEASURE_FINISH(time1);
   time_blk_hash += time1;
 
+  uint64_t fee = 0;
+  for (const transaction& tx : txs)
+    fee += get_tx_fee(tx);
+
   // call out to subclass implementation to add the block & metadata
   time1 = epee::misc_utils::get_tick_count();
-  add_block(blk, block_size, cumulative_difficulty, coins_generated, blk_hash);
+  add_block(blk, block_size, cumulative_difficulty, coins_generated, fee, blk_hash);
   TIME_MEASURE_FINISH(time1);
   time_add_block1 += time1;
 
@@ -170,7 +174,14 @@ void BlockchainDB::pop_block(block& blk, std::vector<transaction>& txs)
 
   for (const auto& h : boost::adaptors::reverse(blk.tx_hashes))
   {
-    txs.push_back(get_tx(h));
+    // pruned txs can't be returned, only removed
+    blobdata bd;
+    if (get_tx_blob(h, bd))
+    {
+      txs.push_back(transaction());
+      if (!parse_and_validate_tx_from_blob(bd, txs.back()))
+        throw DB_ERROR("Failed to parse tx from blob retrieved from the db");
+    }
     remove_transaction(h);
   }
   remove_transaction(get_transaction_hash(blk.miner_tx));
@@ -183,7 +194,8 @@ bool BlockchainDB::is_open() const
 
 void BlockchainDB::remove_transaction(const crypto::hash& tx_hash)
 {
-  transaction tx = get_tx(tx_hash);
+  // the prefix has all that's needed to remove the tx
+  transaction tx = get_pruned_tx(tx_hash);
 
   for (const txin_v& tx_input : tx.vin)
   {
@@ -34,10 +34,10 @@
 #include <string>
 #include <exception>
 
-#include <boost/multi_index/hashed_index.hpp>
 #include <boost/bimap/bimap.hpp>
 #include "crypto/hash.h"
 #include "cryptonote_core/cryptonote_basic.h"
+#include "cryptonote_protocol/blobdatatype.h"
 #include "cryptonote_core/difficulty.h"
 #include "cryptonote_core/hardfork.h"
 
@@ -97,22 +97,6 @@
  *   KEY_IMAGE_EXISTS
  */
 
-struct alias {
-  std::string alias;
-  uint64_t height;
-  std::string address;
-};
-
-namespace bmi = boost::multi_index;
-
-using aliases = boost::multi_index_container<
-  alias,
-  bmi::indexed_by<
-    bmi::hashed_unique<bmi::member<alias, std::string, &alias::alias>>,
-    bmi::ordered_non_unique<bmi::member<alias, std::string, &alias::address>>
-  >
->;
-
 namespace cryptonote
 {
 
@@ -142,6 +126,46 @@ struct tx_data_t
 };
 #pragma pack(pop)
 
+#pragma pack(push, 1)
+/**
+ * @brief a fixed-width record of a block's header and metadata
+ *
+ * Holds all an RPC block header needs, so headers can be served without
+ * loading and parsing the block and its miner transaction.
+ */
+struct block_header_info
+{
+  uint64_t        height;                 //!< the block's height, first so it can serve as a sort key
+  uint64_t        timestamp;
+  uint64_t        coins;                  //!< the total coins generated as of this block
+  uint64_t        size;                   //!< the block's size, transactions included
+  difficulty_type difficulty;
+  difficulty_type cumulative_difficulty;
+  uint64_t        reward;                 //!< the sum of the miner transaction's outputs
+  uint64_t        fee;                    //!< the sum of the block's transaction fees
+  crypto::hash    hash;
+  crypto::hash    prev_id;
+  uint32_t        nonce;
+  uint32_t        tx_count;               //!< the number of transactions, not counting the miner transaction
+  uint8_t         major_version;
+  uint8_t         minor_version;
+};
+#pragma pack(pop)
+
+/**
+ * @brief a pending change to the persisted transaction pool
+ *
+ * A put stores the transaction's pool metadata and, unless blob is empty,
+ * its blob; an empty blob updates the metadata alone.
+ */
+struct txpool_tx_update
+{
+  crypto::hash txid;
+  bool         remove;                  //!< drop the transaction instead of storing it
+  blobdata     meta;                    //!< the serialized pool metadata
+  blobdata     blob;                    //!< the transaction blob, or empty to keep the stored one
+};
+
 /***********************************
  * Exception Definitions
  ***********************************/
@@ -343,12 +367,14 @@ class BlockchainDB
    * @param block_size the size of the block (transactions and all)
    * @param cumulative_difficulty the accumulated difficulty after this block
    * @param coins_generated the number of coins generated total after this block
+   * @param fee the sum of the fees of the block's transactions
    * @param blk_hash the hash of the block
    */
   virtual void add_block( const block& blk
                 , const size_t& block_size
                 , const difficulty_type& cumulative_difficulty
                 , const uint64_t& coins_generated
+                , const uint64_t& fee
                 , const crypto::hash& blk_hash
                 ) = 0;
 
@@ -357,7 +383,7 @@ class BlockchainDB
    *
    * The subclass implementing this will remove the block data from the top
    * block in the chain.  The data to be removed is that which was added in
-   * BlockchainDB::add_block(const block& blk, const size_t& block_size, const difficulty_type& cumulative_difficulty, const uint64_t& coins_generated, const crypto::hash& blk_hash)
+   * BlockchainDB::add_block(const block& blk, const size_t& block_size, const difficulty_type& cumulative_difficulty, const uint64_t& coins_generated, const uint64_t& fee, const crypto::hash& blk_hash)
    *
    * If any of this cannot be done, the subclass should throw the corresponding
    * subclass of DB_EXCEPTION
@@ -772,6 +798,19 @@ public:
    */
   virtual block get_block(const crypto::hash& h) const = 0;
 
+  /**
+   * @brief fetches the block with the given hash, as it is stored
+   *
+   * The subclass should return the serialized block without parsing it.
+   *
+   * If the block does not exist, the subclass should throw BLOCK_DNE
+   *
+   * @param h the hash to look for
+   *
+   * @return the block blob
+   */
+  virtual blobdata get_block_blob(const crypto::hash& h) const = 0;
+
   /**
    * @brief gets the height of the block with a given hash
    *
@@ -813,6 +852,21 @@ public:
    */
   virtual block get_block_from_height(const uint64_t& height) const = 0;
 
+  /**
+   * @brief fetch a block blob by height
+   *
+   * The subclass should return the serialized block at the given height
+   * without parsing it.
+   *
+   * If the block does not exist, that is to say if the blockchain is not
+   * that high, then the subclass should throw BLOCK_DNE
+   *
+   * @param height the height to look for
+   *
+   * @return the block blob
+   */
+  virtual blobdata get_block_blob_from_height(const uint64_t& height) const = 0;
+
   /**
    * @brief fetch a block's timestamp
    *
@@ -906,6 +960,36 @@ public:
    */
   virtual crypto::hash get_block_hash_from_height(const uint64_t& height) const = 0;
 
+  /**
+   * @brief fetch a block's header and metadata
+   *
+   * The subclass should return the fixed-width header record of the block
+   * with the given height, without loading the block itself.
+   *
+   * If the block does not exist, the subclass should throw BLOCK_DNE
+   *
+   * @param height the height requested
+   *
+   * @return the block's header record
+   */
+  virtual block_header_info get_block_header_info(const uint64_t& height) const = 0;
+
+  /**
+   * @brief fetch a list of block headers and metadata
+   *
+   * The subclass should return a vector of header records from blocks with
+   * heights starting at h1 and ending at h2, inclusively.
+   *
+   * If the height range requested goes past the end of the blockchain,
+   * the subclass should throw BLOCK_DNE.
+   *
+   * @param h1 the start height
+   * @param h2 the end height
+   *
+   * @return a vector of block header records
+   */
+  virtual std::vector<block_header_info> get_block_header_info_range(const uint64_t& h1, const uint64_t& h2) const = 0;
+
   /**
    * @brief fetch a list of blocks
    *
@@ -940,6 +1024,22 @@ public:
    */
   virtual std::vector<crypto::hash> get_hashes_range(const uint64_t& h1, const uint64_t& h2) const = 0;
 
+  /**
+   * @brief fetch a list of block blobs
+   *
+   * The subclass should return a vector of serialized blocks with heights
+   * starting at h1 and ending at h2, inclusively, without parsing them.
+   *
+   * If the height range requested goes past the end of the blockchain,
+   * the subclass should throw BLOCK_DNE.
+   *
+   * @param h1 the start height
+   * @param h2 the end height
+   *
+   * @return a vector of block blobs
+   */
+  virtual std::vector<blobdata> get_blocks_blobs_range(const uint64_t& h1, const uint64_t& h2) const = 0;
+
   /**
    * @brief fetch the top block's hash
    *
@@ -1036,6 +1136,90 @@ public:
    */
   virtual transaction get_tx(const crypto::hash& h) const = 0;
 
+  /**
+   * @brief fetches the transaction blob with the given hash
+   *
+   * The subclass should return the transaction stored which has the given
+   * hash, without parsing it.
+   *
+   * @param h the hash to look for
+   * @param tx return-by-reference the transaction blob
+   *
+   * @return true if the transaction was found, otherwise false
+   */
+  virtual bool get_tx_blob(const crypto::hash& h, blobdata& tx) const = 0;
+
+  /**
+   * @brief fetches the transaction with the given hash, without its prunable data
+   *
+   * The subclass should return the transaction prefix and, for ringct
+   * transactions, the rct base, which is all that is left of transactions
+   * whose prunable data was pruned.
+   *
+   * If the transaction does not exist, the subclass should throw TX_DNE.
+   *
+   * @param h the hash to look for
+   *
+   * @return the transaction, without its prunable data
+   */
+  virtual transaction get_pruned_tx(const crypto::hash& h) const = 0;
+
+  /**
+   * @brief fetches the blob of the transaction with the given hash, without its prunable data
+   *
+   * @param h the hash to look for
+   * @param tx return-by-reference the pruned transaction blob
+   *
+   * @return true if the transaction was found, otherwise false
+   */
+  virtual bool get_pruned_tx_blob(const crypto::hash& h, blobdata& tx) const = 0;
+
+  /**
+   * @brief fetches the prunable data of the transaction with the given hash
+   *
+   * Appending this to the pruned transaction blob gives the full one.
+   *
+   * @param h the hash to look for
+   * @param prunable return-by-reference the prunable data blob
+   *
+   * @return true if the transaction was found and is not pruned, otherwise false
+   */
+  virtual bool get_prunable_tx_blob(const crypto::hash& h, blobdata& prunable) const = 0;
+
+  /**
+   * @brief fetches the hash of the prunable data of the transaction with the given hash
+   *
+   * This is kept after the prunable data itself is pruned, so that the
+   * transaction hash can still be checked against the pruned transaction.
+   *
+   * @param tx_hash the hash to look for
+   * @param prunable_hash return-by-reference the hash of the prunable data
+   *
+   * @return true if the transaction was found, otherwise false
+   */
+  virtual bool get_prunable_tx_hash(const crypto::hash& tx_hash, crypto::hash& prunable_hash) const = 0;
+
+  /**
+   * @brief drops the prunable data of the transactions below a height
+   *
+   * The subclass should drop the prunable data of the transactions in the
+   * blocks below the given height, keeping the rest of them.  Those
+   * transactions can then only be fetched pruned.
+   *
+   * @param height the height below which to prune
+   *
+   * @return the number of transactions pruned
+   */
+  virtual uint64_t prune_blockchain(uint64_t height) = 0;
+
+  /**
+   * @brief gets the height below which transactions were pruned
+   *
+   * @return the height passed to the last prune_blockchain, or 0 if the
+   * blockchain was never pruned
+   */
+  virtual uint64_t get_pruned_height() const = 0;
+
   /**
    * @brief fetches the total number of transactions ever
    *
@@ -1188,6 +1372,24 @@ public:
    */
   virtual void get_output_key(const uint64_t &amount, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs) = 0;
 
+  /**
+   * @brief gets outputs' data for outputs of any amounts
+   *
+   * This function is a mirror of
+   * get_output_key(const uint64_t &amount, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs)
+   * but each output has its own amount.  The subclass should look them all
+   * up in one read transaction, and return them in the order requested.
+   *
+   * If any of the outputs cannot be found, the subclass should throw
+   * OUTPUT_DNE.
+   *
+   * @param amounts the outputs' amounts
+   * @param offsets the outputs' amount-specific indices, one per amount
+   * @param outputs return-by-reference a list of outputs' metadata
+   * @param tx_out_indices if not NULL, return-by-reference a list of tx hashes and output indices (as pairs)
+   */
+  virtual void get_output_keys(const std::vector<uint64_t> &amounts, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs, std::vector<tx_out_index> *tx_out_indices = NULL) const = 0;
+
   /*
    * FIXME: Need to check with git blame and ask what this does to
    * document it
@@ -1289,10 +1491,116 @@ public:
    */
   virtual bool for_all_outputs(std::function<bool(uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx)> f) const = 0;
 
-  virtual void load_aliases() = 0;
+  /**
+   * @brief runs a function over a range of blocks, split across threads
+   *
+   * The heights h1 through h2 are split into num_shards consecutive ranges,
+   * each walked on its own thread with its own read transaction.  The
+   * function is passed (shard, height, block_hash, block), so it must be
+   * safe to call concurrently from different shards; results kept per
+   * shard can be merged in shard order to get them in height order.
+   *
+   * Once any call to the function returns false, all shards stop early and
+   * the subclass returns false.  Otherwise, the subclass returns true.
+   *
+   * @param h1 the first height of the range
+   * @param h2 the last height of the range
+   * @param num_shards how many ranges to split into, 0 for one per core
+   * @param f the function to run
+   *
+   * @return false if the function returns false for any block, otherwise true
+   */
+  virtual bool for_blocks_parallel(uint64_t h1, uint64_t h2, size_t num_shards, std::function<bool(size_t, uint64_t, const crypto::hash&, const cryptonote::block&)> f) const = 0;
+
+  /**
+   * @brief runs a function over all transactions stored, split across threads
+   *
+   * As for_blocks_parallel, with the transactions split into num_shards
+   * ranges of transaction hashes.  The function is passed
+   * (shard, transaction_hash, transaction).
+   *
+   * @param num_shards how many ranges to split into, 0 for one per core
+   * @param f the function to run
+   *
+   * @return false if the function returns false for any transaction, otherwise true
+   */
+  virtual bool for_all_transactions_parallel(size_t num_shards, std::function<bool(size_t, const crypto::hash&, const cryptonote::transaction&)> f) const = 0;
+
+  /**
+   * @brief runs a function over all outputs stored, split across threads
+   *
+   * As for_blocks_parallel, with the outputs split into num_shards ranges
+   * of about the same number of outputs, in the order for_all_outputs
+   * visits them.  The function is passed
+   * (shard, amount, transaction_hash, tx_local_output_index).
+   *
+   * @param num_shards how many ranges to split into, 0 for one per core
+   * @param f the function to run
+   *
+   * @return false if the function returns false for any output, otherwise true
+   */
+  virtual bool for_all_outputs_parallel(size_t num_shards, std::function<bool(size_t, uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx)> f) const = 0;
+
+  /**
+   * @brief fetch the address an alias was registered for
+   *
+   * @param alias the alias to look up
+   * @param get_if_premature whether to return aliases which are not yet
+   * CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE blocks deep
+   *
+   * @return the address, or an empty string if there is no such alias
+   */
   virtual std::string get_alias_address(const std::string& alias, bool get_if_premature = true) const = 0;
+
+  /**
+   * @brief fetch the aliases registered for an address
+   *
+   * @param address the address to look up
+   *
+   * @return the aliases with the heights they were registered at, oldest first
+   */
   virtual std::vector<cryptonote::alias> get_address_aliases(const std::string& address) const = 0;
 
+  //
+  // Transaction pool persistence
+  //
+
+  /**
+   * @brief apply a batch of changes to the persisted transaction pool
+   *
+   * All updates are applied in a single write transaction, using the
+   * current batch transaction if the calling thread holds one.  Removing a
+   * transaction which is not stored is not an error.
+   *
+   * A caller without a write transaction of its own must not make the
+   * subclass resize the database, so the subclass may put the write off
+   * instead, e.g. while another writer is active, and return false; the
+   * caller should then try again later.
+   *
+   * If any of this cannot be done, the subclass should throw the
+   * corresponding subclass of DB_EXCEPTION
+   *
+   * @param updates the changes to apply, in order
+   *
+   * @return true if the changes were written, false if they were put off
+   */
+  virtual bool update_txpool_txes(const std::vector<txpool_tx_update>& updates) = 0;
+
+  /**
+   * @brief runs a function over all persisted pool transactions
+   *
+   * The subclass should run the passed function for each pool transaction
+   * it has stored, passing (txid, metadata, blob) as its parameters.
+   *
+   * If any call to the function returns false, the subclass should return
+   * false.  Otherwise, the subclass returns true.
+   *
+   * @param std::function f the function to run
+   *
+   * @return false if the function returns false for any transaction, otherwise true
+   */
+  virtual bool for_all_txpool_txes(std::function<bool(const crypto::hash&, const blobdata&, const blobdata&)> f) const = 0;
+
   //
   // Hard fork related storage
   //
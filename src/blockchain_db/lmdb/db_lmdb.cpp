@@ -31,14 +31,18 @@
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/current_function.hpp>
+#include <boost/thread/thread.hpp>
 #include <memory>  // std::unique_ptr
 #include <cstring>  // memcpy
 #include <random>
+#include <algorithm>
+#include <chrono>
 
 #include "cryptonote_core/cryptonote_format_utils.h"
 #include "crypto/crypto.h"
 #include "profile_tools.h"
 #include "common/base58.h"
+#include "common/util.h"
 
 #if defined(__i386) || defined(__x86_64)
 #define MISALIGNED_OK	1
@@ -48,7 +52,7 @@ using epee::string_tools::pod_to_hex;
 
 // Increase when the DB changes in a non backward compatible way, and there
 // is no automatic conversion, so that a full resync is needed.
-#define VERSION 0
+#define VERSION 4
 
 namespace
 {
@@ -157,6 +161,19 @@ int compare_string(const MDB_val *a, const MDB_val *b)
   return strcmp(va, vb);
 }
 
+// alias records: a uint64 height, then a string; sorted by height first
+int compare_alias_record(const MDB_val *a, const MDB_val *b)
+{
+  const int ret = compare_uint64(a, b);
+  if (ret)
+    return ret;
+  const size_t sa = a->mv_size - sizeof(uint64_t), sb = b->mv_size - sizeof(uint64_t);
+  const int cmp = memcmp((const char*)a->mv_data + sizeof(uint64_t), (const char*)b->mv_data + sizeof(uint64_t), std::min(sa, sb));
+  if (cmp)
+    return cmp;
+  return (sa < sb) ? -1 : sa > sb;
+}
+
 /* DB schema:
  *
  * Table            Key          Data
@@ -164,8 +181,11 @@ int compare_string(const MDB_val *a, const MDB_val *b)
  * blocks           block ID     block blob
  * block_heights    block hash   block height
  * block_info       block ID     {block metadata}
+ * block_header_info block ID    {block header and metadata}
  *
- * txs              txn ID       txn blob
+ * txs_pruned       txn ID       txn blob, without prunable data
+ * txs_prunable     txn ID       txn prunable data (gone once pruned)
+ * txs_prunable_hash txn ID      hash of txn prunable data
  * tx_indices       txn hash     {txn ID, metadata}
  * tx_outputs       txn ID       [txn amount output indices]
  *
@@ -174,6 +194,12 @@ int compare_string(const MDB_val *a, const MDB_val *b)
  *
  * spent_keys       input hash   -
  *
+ * aliases          alias        {height, address}
+ * alias_addresses  address hash [{height, alias}...]
+ *
+ * txpool_meta      txn hash     {pool metadata}
+ * txpool_blob      txn hash     txn blob
+ *
  * Note: where the data items are of uniform size, DUPFIXED tables have
  * been used to save space. In most of these cases, a dummy "zerokval"
  * key is used when accessing the table; the Key listed above will be
@@ -185,8 +211,12 @@ int compare_string(const MDB_val *a, const MDB_val *b)
 const char* const LMDB_BLOCKS = "blocks";
 const char* const LMDB_BLOCK_HEIGHTS = "block_heights";
 const char* const LMDB_BLOCK_INFO = "block_info";
+const char* const LMDB_BLOCK_HEADER_INFO = "block_header_info";
 
-const char* const LMDB_TXS = "txs";
+const char* const LMDB_TXS = "txs"; // before version 1, txn ID -> whole txn blob
+const char* const LMDB_TXS_PRUNED = "txs_pruned";
+const char* const LMDB_TXS_PRUNABLE = "txs_prunable";
+const char* const LMDB_TXS_PRUNABLE_HASH = "txs_prunable_hash";
 const char* const LMDB_TX_INDICES = "tx_indices";
 const char* const LMDB_TX_OUTPUTS = "tx_outputs";
 
@@ -199,10 +229,38 @@ const char* const LMDB_HF_VERSIONS = "hf_versions";
 
 const char* const LMDB_PROPERTIES = "properties";
 const char* const LMDB_ALIASES = "aliases";
+const char* const LMDB_ALIAS_ADDRESSES = "alias_addresses";
+
+const char* const LMDB_TXPOOL_META = "txpool_meta";
+const char* const LMDB_TXPOOL_BLOB = "txpool_blob";
 
 const char zerokey[8] = {0};
 const MDB_val zerokval = { sizeof(zerokey), (void *)zerokey };
 
+inline cryptonote::blobdata alias_record(uint64_t height, const std::string& s)
+{
+  cryptonote::blobdata bd(reinterpret_cast<const char*>(&height), sizeof(height));
+  bd += s;
+  return bd;
+}
+
+inline uint64_t alias_record_height(const MDB_val& v)
+{
+  uint64_t height;
+  memcpy(&height, v.mv_data, sizeof(height));
+  return height;
+}
+
+inline std::string alias_record_string(const MDB_val& v)
+{
+  return std::string((const char*)v.mv_data + sizeof(uint64_t), v.mv_size - sizeof(uint64_t));
+}
+
+inline crypto::hash alias_address_key(const std::string& address)
+{
+  return crypto::cn_fast_hash(address.data(), address.size());
+}
+
 const std::string lmdb_error(const std::string& error_string, int mdb_res)
 {
   const std::string full_string = error_string + mdb_strerror(mdb_res);
@@ -280,6 +338,70 @@ typedef struct outtx {
     uint64_t local_index;
 } outtx;
 
+// A run of consecutive outputs of one amount, by amount index. Parallel
+// output walks hand each shard a list of these.
+typedef struct output_segment {
+    uint64_t amount;
+    uint64_t first;
+    uint64_t count;
+} output_segment;
+
+namespace
+{
+
+// Number of shards to split a walk over num_items into: the caller's
+// choice, or one per core, but never more shards than items.
+size_t shard_count(size_t requested, uint64_t num_items)
+{
+  uint64_t shards = requested ? requested : tools::get_max_concurrency();
+  shards = std::min<uint64_t>(shards, num_items);
+  return std::max<uint64_t>(shards, 1);
+}
+
+// A cursor owned by a shard walk rather than shared through m_cursors, so
+// lookups made by the caller's function can't move it.
+class walk_cursor
+{
+public:
+  walk_cursor(MDB_txn *txn, MDB_dbi dbi) : m_cur(nullptr)
+  {
+    int result = mdb_cursor_open(txn, dbi, &m_cur);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to open cursor: ", result).c_str()));
+  }
+  ~walk_cursor() { mdb_cursor_close(m_cur); }
+  operator MDB_cursor*() const { return m_cur; }
+
+private:
+  MDB_cursor *m_cur;
+};
+
+// Loads the tx stored under tx_id. Pruned txs come back without their
+// prunable data. Returns false if there is no such tx.
+bool load_stored_tx(MDB_cursor *cur_pruned, MDB_cursor *cur_prunable, uint64_t tx_id, transaction &tx)
+{
+  MDB_val_set(k, tx_id);
+  MDB_val v;
+  int ret = mdb_cursor_get(cur_pruned, &k, &v, MDB_SET);
+  if (ret == MDB_NOTFOUND)
+    return false;
+  if (ret)
+    throw0(DB_ERROR(lmdb_error("Failed to enumerate transactions: ", ret).c_str()));
+  blobdata bd;
+  bd.assign(reinterpret_cast<char*>(v.mv_data), v.mv_size);
+  ret = mdb_cursor_get(cur_prunable, &k, &v, MDB_SET);
+  if (ret && ret != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Failed to enumerate transactions: ", ret).c_str()));
+  const bool pruned = ret == MDB_NOTFOUND;
+  if (!pruned)
+    bd.append(reinterpret_cast<char*>(v.mv_data), v.mv_size);
+  if (!(pruned ? parse_and_validate_tx_base_from_blob(bd, tx) : parse_and_validate_tx_from_blob(bd, tx)))
+    throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
+  return true;
+}
+
+}
+
 std::atomic<uint64_t> mdb_txn_safe::num_active_txns{0};
 std::atomic_flag mdb_txn_safe::creation_gate = ATOMIC_FLAG_INIT;
 
@@ -378,15 +500,31 @@ void mdb_txn_safe::wait_no_active_txns()
   while (num_active_txns > 0);
 }
 
+bool mdb_txn_safe::wait_no_active_txns(uint64_t max_wait_ms)
+{
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(max_wait_ms);
+  while (num_active_txns > 0)
+  {
+    if (std::chrono::steady_clock::now() >= deadline)
+      return false;
+    boost::this_thread::yield();
+  }
+  return true;
+}
+
 void mdb_txn_safe::allow_new_txns()
 {
   creation_gate.clear();
 }
 
-void BlockchainLMDB::do_resize(uint64_t increase_size)
+bool BlockchainLMDB::do_resize(uint64_t increase_size, uint64_t max_wait_ms)
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  const auto lock_start = std::chrono::steady_clock::now();
   CRITICAL_REGION_LOCAL(m_synchronization_lock);
+  const uint64_t lock_wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - lock_start).count();
+  if (lock_wait_ms > 0)
+    LOG_PRINT_L1("LMDB resize waited " << lock_wait_ms << "ms for a background sync of the map");
   const uint64_t add_size = 1LL << 30;
 
   // check disk capacity
@@ -397,7 +535,7 @@ void BlockchainLMDB::do_resize(uint64_t increase_size)
     if(si.available < add_size)
     {
       LOG_PRINT_RED_L0("!! WARNING: Insufficient free space to extend database !!: " << si.available / 1LL << 20L);
-      return;
+      return false;
     }
   }
   catch(...)
@@ -429,6 +567,7 @@ void BlockchainLMDB::do_resize(uint64_t increase_size)
 
   if (m_write_txn != nullptr)
   {
+    mdb_txn_safe::allow_new_txns();
     if (m_batch_active)
     {
       throw0(DB_ERROR("lmdb resizing not yet supported when batch transactions enabled!"));
@@ -439,7 +578,17 @@ void BlockchainLMDB::do_resize(uint64_t increase_size)
     }
   }
 
-  mdb_txn_safe::wait_no_active_txns();
+  if (max_wait_ms > 0)
+  {
+    if (!mdb_txn_safe::wait_no_active_txns(max_wait_ms))
+    {
+      mdb_txn_safe::allow_new_txns();
+      LOG_PRINT_L1("LMDB resize postponed, readers still active after " << max_wait_ms << "ms");
+      return false;
+    }
+  }
+  else
+    mdb_txn_safe::wait_no_active_txns();
 
   int result = mdb_env_set_mapsize(m_env, new_mapsize);
   if (result)
@@ -448,6 +597,81 @@ void BlockchainLMDB::do_resize(uint64_t increase_size)
   LOG_PRINT_GREEN("LMDB Mapsize increased." << "  Old: " << mei.me_mapsize / (1024 * 1024) << "MiB" << ", New: " << new_mapsize / (1024 * 1024) << "MiB", LOG_LEVEL_0);
 
   mdb_txn_safe::allow_new_txns();
+  return true;
+}
+
+void BlockchainLMDB::start_background_sync(int mdb_flags)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  if (!(mdb_flags & MDB_NOMETASYNC) || (mdb_flags & (MDB_NOSYNC | MDB_RDONLY)))
+    return;
+
+  m_commits = 0;
+  m_durable_commits = 0;
+  m_sync_result = 0;
+  m_sync_stop = false;
+  m_sync_thread = boost::thread(&BlockchainLMDB::sync_worker, this);
+  LOG_PRINT_L1("Syncing LMDB meta pages in the background");
+}
+
+// Flushes whatever has been committed so far, each time the writer reports
+// new commits. Commits are only atomic, not durable, until this has run.
+void BlockchainLMDB::sync_worker()
+{
+  // With MDB_WRITEMAP the sync msyncs the map itself, which do_resize()
+  // unmaps and maps again in mdb_env_set_mapsize, so the two must not
+  // overlap. Otherwise the sync only flushes the file, and holding
+  // m_synchronization_lock through it would just make a resize on the
+  // writer wait for a whole fsync.
+  unsigned int env_flags = 0;
+  mdb_env_get_flags(m_env, &env_flags);
+  const bool syncs_map = env_flags & MDB_WRITEMAP;
+
+  boost::unique_lock<boost::mutex> lock(m_sync_mutex);
+  while (true)
+  {
+    while (!m_sync_stop && m_durable_commits == m_commits)
+      m_sync_cond.wait(lock);
+    if (m_sync_stop)
+      return;
+
+    const uint64_t commits = m_commits;
+    lock.unlock();
+    int result;
+    if (syncs_map)
+    {
+      CRITICAL_REGION_LOCAL(m_synchronization_lock);
+      result = mdb_env_sync(m_env, true);
+    }
+    else
+      result = mdb_env_sync(m_env, true);
+    lock.lock();
+
+    if (result)
+    {
+      LOG_PRINT_L0(lmdb_error("Background sync of the database failed: ", result));
+      m_sync_result = result;
+    }
+    else
+      m_durable_commits = commits;
+    m_sync_cond.notify_all();
+  }
+}
+
+// Called by the writer after each block or batch commit, once its txn state
+// has been reset, as this throws if a background sync failed. Hands the
+// commit to the sync thread without waiting for it: the next commit flushes
+// this one's meta page anyway, so only the last commit is ever at risk.
+void BlockchainLMDB::commit_done()
+{
+  if (!m_sync_thread.joinable())
+    return;
+
+  boost::unique_lock<boost::mutex> lock(m_sync_mutex);
+  ++m_commits;
+  m_sync_cond.notify_all();
+  if (m_sync_result)
+    throw0(DB_ERROR(lmdb_error("Failed to sync database: ", m_sync_result).c_str()));
 }
 
 // threshold_size is used for batch transactions
@@ -534,6 +758,72 @@ void BlockchainLMDB::check_and_resize_for_batch(uint64_t batch_num_blocks)
   }
 }
 
+// Grows the map ahead of need, from the rate the recent blocks filled it.
+// A resize has to wait for all readers to finish, so while there is still
+// room it is only tried for a short while and put off if readers are busy;
+// it only waits for as long as it takes once the map is nearly full.
+void BlockchainLMDB::check_and_resize_for_growth()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+#if defined(ENABLE_AUTO_RESIZE)
+  MDB_envinfo mei;
+
+  mdb_env_info(m_env, &mei);
+
+  MDB_stat mst;
+
+  mdb_env_stat(m_env, &mst);
+
+  uint64_t size_used = mst.ms_psize * mei.me_last_pgno;
+
+  // the space used only moves on commits, so the rate is taken between
+  // samples where it did
+  if (m_growth_size_used == 0 || m_height < m_growth_height)
+  {
+    m_growth_height = m_height;
+    m_growth_size_used = size_used;
+  }
+  else if (size_used > m_growth_size_used && m_height > m_growth_height)
+  {
+    uint64_t rate = (size_used - m_growth_size_used) / (m_height - m_growth_height);
+    m_bytes_per_block = m_bytes_per_block ? (3 * m_bytes_per_block + rate) / 4 : rate;
+    m_growth_height = m_height;
+    m_growth_size_used = size_used;
+    LOG_PRINT_L2("LMDB map growth rate: " << m_bytes_per_block << " bytes per block");
+  }
+
+  // batch txns are sized when they start
+  if (m_batch_active)
+    return;
+
+  if (m_bytes_per_block == 0)
+  {
+    if (need_resize())
+    {
+      LOG_PRINT_L0("LMDB memory map needs to be resized, doing that now.");
+      do_resize();
+    }
+    return;
+  }
+
+  uint64_t size_free = mei.me_mapsize > size_used ? mei.me_mapsize - size_used : 0;
+  uint64_t lookahead_size = m_bytes_per_block * RESIZE_LOOKAHEAD_BLOCKS;
+  if (size_free >= lookahead_size)
+    return;
+
+  uint64_t increase_size = std::max<uint64_t>(2 * lookahead_size, 1LL << 30);
+  if (size_free < m_bytes_per_block * RESIZE_URGENT_BLOCKS)
+  {
+    LOG_PRINT_L0("LMDB memory map is nearly full, resizing now.");
+    do_resize(increase_size);
+  }
+  else if (do_resize(increase_size, RESIZE_MAX_WAIT_MS))
+  {
+    LOG_PRINT_L1("LMDB memory map grown ahead of need");
+  }
+#endif
+}
+
 uint64_t BlockchainLMDB::get_estimated_batch_size(uint64_t batch_num_blocks) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -543,6 +833,15 @@ uint64_t BlockchainLMDB::get_estimated_batch_size(uint64_t batch_num_blocks) con
   // Takes into account "reasonable" block size increases in batch.
   float batch_safety_factor = 1.7f;
   float batch_fudge_factor = batch_safety_factor * batch_num_blocks;
+
+  // once the write rate has been measured, it already includes the db overhead
+  if (m_bytes_per_block > 0)
+  {
+    threshold_size = m_bytes_per_block * batch_fudge_factor;
+    LOG_PRINT_L1("estimated batch size from recent write rate: " << threshold_size);
+    return threshold_size;
+  }
+
   // estimate of stored block expanded from raw block, including denormalization and db overhead.
   // Note that this probably doesn't grow linearly with block size.
   float db_expand_factor = 4.5f;
@@ -596,7 +895,7 @@ uint64_t BlockchainLMDB::get_estimated_batch_size(uint64_t batch_num_blocks) con
 }
 
 void BlockchainLMDB::add_block(const block& blk, const size_t& block_size, const difficulty_type& cumulative_difficulty, const uint64_t& coins_generated,
-    const crypto::hash& blk_hash)
+    const uint64_t& fee, const crypto::hash& blk_hash)
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
@@ -629,6 +928,17 @@ void BlockchainLMDB::add_block(const block& blk, const size_t& block_size, const
 
   CURSOR(blocks)
   CURSOR(block_info)
+  CURSOR(block_header_info)
+
+  difficulty_type prev_cumulative_difficulty = 0;
+  if (m_height > 0)
+  {
+    MDB_val_copy<uint64_t> prev_height(m_height - 1);
+    MDB_val prev = prev_height;
+    if ((result = mdb_cursor_get(m_cur_block_info, (MDB_val *)&zerokval, &prev, MDB_GET_BOTH)))
+      throw0(DB_ERROR(lmdb_error("Failed to get top block info to compute new block's difficulty: ", result).c_str()));
+    prev_cumulative_difficulty = ((const mdb_block_info *)prev.mv_data)->bi_diff;
+  }
 
   MDB_val_copy<blobdata> blob(block_to_blob(blk));
   result = mdb_cursor_put(m_cur_blocks, &key, &blob, MDB_APPEND);
@@ -648,6 +958,29 @@ void BlockchainLMDB::add_block(const block& blk, const size_t& block_size, const
   if (result)
     throw0(DB_ERROR(lmdb_error("Failed to add block info to db transaction: ", result).c_str()));
 
+  block_header_info bhi;
+  bhi.height = m_height;
+  bhi.timestamp = blk.timestamp;
+  bhi.coins = bi.bi_coins;
+  bhi.size = block_size;
+  bhi.difficulty = cumulative_difficulty - prev_cumulative_difficulty;
+  bhi.cumulative_difficulty = cumulative_difficulty;
+  bhi.reward = 0;
+  for (const tx_out& out : blk.miner_tx.vout)
+    bhi.reward += out.amount;
+  bhi.fee = fee;
+  bhi.hash = blk_hash;
+  bhi.prev_id = blk.prev_id;
+  bhi.nonce = blk.nonce;
+  bhi.tx_count = blk.tx_hashes.size();
+  bhi.major_version = blk.major_version;
+  bhi.minor_version = blk.minor_version;
+
+  MDB_val_set(val_bhi, bhi);
+  result = mdb_cursor_put(m_cur_block_header_info, (MDB_val *)&zerokval, &val_bhi, MDB_APPENDDUP);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to add block header info to db transaction: ", result).c_str()));
+
   result = mdb_cursor_put(m_cur_block_heights, (MDB_val *)&zerokval, &val_h, 0);
   if (result)
     throw0(DB_ERROR(lmdb_error("Failed to add block height by hash to db transaction: ", result).c_str()));
@@ -668,6 +1001,7 @@ void BlockchainLMDB::remove_block()
 
   mdb_txn_cursors *m_cursors = &m_wcursors;
   CURSOR(block_info)
+  CURSOR(block_header_info)
   CURSOR(block_heights)
   CURSOR(blocks)
   MDB_val_copy<uint64_t> k(m_height - 1);
@@ -692,6 +1026,13 @@ void BlockchainLMDB::remove_block()
 
   if ((result = mdb_cursor_del(m_cur_block_info, 0)))
       throw1(DB_ERROR(lmdb_error("Failed to add removal of block info to db transaction: ", result).c_str()));
+
+  MDB_val_copy<uint64_t> hk(m_height - 1);
+  h = hk;
+  if ((result = mdb_cursor_get(m_cur_block_header_info, (MDB_val *)&zerokval, &h, MDB_GET_BOTH)))
+      throw1(DB_ERROR(lmdb_error("Failed to locate block header info for removal: ", result).c_str()));
+  if ((result = mdb_cursor_del(m_cur_block_header_info, 0)))
+      throw1(DB_ERROR(lmdb_error("Failed to add removal of block header info to db transaction: ", result).c_str()));
 }
 
 uint64_t BlockchainLMDB::add_transaction_data(const crypto::hash& blk_hash, const transaction& tx, const crypto::hash& tx_hash)
@@ -726,12 +1067,30 @@ uint64_t BlockchainLMDB::add_transaction_data(const crypto::hash& blk_hash, cons
   if (result)
     throw0(DB_ERROR(lmdb_error("Failed to add tx data to db transaction: ", result).c_str()));
 
-  CURSOR(txs)
+  // the prunable data follows the rest of the tx in its blob
+  blobdata pruned_blob;
+  const blobdata blob = tx_to_blob(tx);
+  if (!tx_to_pruned_blob(tx, pruned_blob) || pruned_blob.size() > blob.size())
+    throw0(DB_ERROR("Failed to serialize pruned tx"));
+  const blobdata prunable_blob = blob.substr(pruned_blob.size());
+  crypto::hash prunable_hash = get_transaction_prunable_hash(tx, prunable_blob);
+
+  CURSOR(txs_pruned)
+  CURSOR(txs_prunable)
+  CURSOR(txs_prunable_hash)
   MDB_val_set(val_tx_id, tx_id);
-  MDB_val_copy<blobdata> blob(tx_to_blob(tx));
-  result = mdb_cursor_put(m_cur_txs, &val_tx_id, &blob, MDB_APPEND);
+  MDB_val_copy<blobdata> pruned(pruned_blob);
+  result = mdb_cursor_put(m_cur_txs_pruned, &val_tx_id, &pruned, MDB_APPEND);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to add pruned tx blob to db transaction: ", result).c_str()));
+  MDB_val_copy<blobdata> prunable(prunable_blob);
+  result = mdb_cursor_put(m_cur_txs_prunable, &val_tx_id, &prunable, MDB_APPEND);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to add prunable tx blob to db transaction: ", result).c_str()));
+  MDB_val_set(val_prunable_hash, prunable_hash);
+  result = mdb_cursor_put(m_cur_txs_prunable_hash, &val_tx_id, &val_prunable_hash, MDB_APPEND);
   if (result)
-    throw0(DB_ERROR(lmdb_error("Failed to add tx blob to db transaction: ", result).c_str()));
+    throw0(DB_ERROR(lmdb_error("Failed to add prunable tx hash to db transaction: ", result).c_str()));
 
   std::vector<tx_extra_field> tx_extra_fields;
   if (parse_tx_extra(tx.extra, tx_extra_fields)) {
@@ -743,17 +1102,21 @@ uint64_t BlockchainLMDB::add_transaction_data(const crypto::hash& blk_hash, cons
       alias.nonce.erase(alias.nonce.begin());
       cryptonote::convert_alias(alias.nonce);
       CURSOR(aliases)
+      CURSOR(alias_addresses)
       MDB_val_copy<const char*> k(alias.nonce.data());
       address.nonce.erase(address.nonce.begin());
-      std::string value{std::to_string(m_height) + address.nonce};
-      MDB_val_copy<const char*> v(value.data());
+      MDB_val_copy<blobdata> v(alias_record(m_height, address.nonce));
       result = mdb_cursor_put(m_cur_aliases, &k, &v, MDB_NOOVERWRITE);
       if (result == MDB_KEYEXIST)
         throw0(DB_ERROR(("Alias " + alias.nonce + " already exists in database.").data())); // this should never happen
       else if (result)
         throw0(DB_ERROR(lmdb_error("Failed to add alias-address pair to db aliases: ", result).c_str()));
-      else if (!m_aliases_multi_index.insert({alias.nonce, m_height, address.nonce}).second)
-        throw0(DB_ERROR(("Alias " + alias.nonce + " already exists in cache.").data())); // this should never happen, TODO consider unrolling transaction
+      crypto::hash address_key = alias_address_key(address.nonce);
+      MDB_val_set(ka, address_key);
+      MDB_val_copy<blobdata> va(alias_record(m_height, std::string(alias.nonce.c_str())));
+      result = mdb_cursor_put(m_cur_alias_addresses, &ka, &va, MDB_NODUPDATA);
+      if (result)
+        throw0(DB_ERROR(lmdb_error("Failed to add alias to db alias addresses: ", result).c_str()));
     }
   }
 
@@ -780,12 +1143,27 @@ void BlockchainLMDB::remove_transaction_data(const crypto::hash& tx_hash, const
   txindex *tip = (txindex *)val_h.mv_data;
   MDB_val_set(val_tx_id, tip->data.tx_id);
 
-  CURSOR(txs)
-  if ((result = mdb_cursor_get(m_cur_txs, &val_tx_id, NULL, MDB_SET)))
-    throw1(DB_ERROR(lmdb_error("Failed to locate tx for removal: ", result).c_str()));
-  result = mdb_cursor_del(m_cur_txs, 0);
+  CURSOR(txs_pruned)
+  if ((result = mdb_cursor_get(m_cur_txs_pruned, &val_tx_id, NULL, MDB_SET)))
+    throw1(DB_ERROR(lmdb_error("Failed to locate pruned tx for removal: ", result).c_str()));
+  result = mdb_cursor_del(m_cur_txs_pruned, 0);
+  if (result)
+    throw1(DB_ERROR(lmdb_error("Failed to add removal of pruned tx to db transaction: ", result).c_str()));
+
+  // not there if the tx was pruned
+  CURSOR(txs_prunable)
+  result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, NULL, MDB_SET);
+  if (result == 0)
+    result = mdb_cursor_del(m_cur_txs_prunable, 0);
+  if (result && result != MDB_NOTFOUND)
+    throw1(DB_ERROR(lmdb_error("Failed to add removal of prunable tx to db transaction: ", result).c_str()));
+
+  CURSOR(txs_prunable_hash)
+  if ((result = mdb_cursor_get(m_cur_txs_prunable_hash, &val_tx_id, NULL, MDB_SET)))
+    throw1(DB_ERROR(lmdb_error("Failed to locate prunable tx hash for removal: ", result).c_str()));
+  result = mdb_cursor_del(m_cur_txs_prunable_hash, 0);
   if (result)
-    throw1(DB_ERROR(lmdb_error("Failed to add removal of tx to db transaction: ", result).c_str()));
+    throw1(DB_ERROR(lmdb_error("Failed to add removal of prunable tx hash to db transaction: ", result).c_str()));
 
   remove_tx_outputs(tip->data.tx_id, tx);
 
@@ -832,14 +1210,21 @@ void BlockchainLMDB::remove_transaction_data(const crypto::hash& tx_hash, const
             LOG_PRINT_L2("Alias " + alias.nonce + " is not signed with keys for address " + address.nonce + ", signature was " + signature.nonce + ".");
           else {
             CURSOR(aliases)
+            CURSOR(alias_addresses)
             MDB_val_copy<const char*> k(alias.nonce.data());
-            if ((result = mdb_cursor_get(m_cur_aliases, &k, NULL, MDB_SET)))
+            MDB_val v;
+            if ((result = mdb_cursor_get(m_cur_aliases, &k, &v, MDB_SET)))
               throw1(DB_ERROR(lmdb_error("Failed to locate alias for removal in database: ", result).c_str())); // this should never happen
+            crypto::hash address_key = alias_address_key(alias_record_string(v));
+            MDB_val_set(ka, address_key);
+            MDB_val_copy<blobdata> va(alias_record(alias_record_height(v), std::string(alias.nonce.c_str())));
             result = mdb_cursor_del(m_cur_aliases, 0);
             if (result)
               throw1(DB_ERROR(lmdb_error("Failed to add removal of alias-address pair to db transaction: ", result).c_str()));
-            else if (!m_aliases_multi_index.get<0>().erase(alias.nonce))
-              throw1(DB_ERROR(("Alias for removal " + alias.nonce + " not found in cache.").data())); // this should never happen, TODO consider unrolling transaction
+            if ((result = mdb_cursor_get(m_cur_alias_addresses, &ka, &va, MDB_GET_BOTH)))
+              throw1(DB_ERROR(lmdb_error("Failed to locate alias address for removal in database: ", result).c_str())); // this should never happen
+            if ((result = mdb_cursor_del(m_cur_alias_addresses, 0)))
+              throw1(DB_ERROR(lmdb_error("Failed to add removal of alias address to db transaction: ", result).c_str()));
           }
         }
       }
@@ -1096,6 +1481,14 @@ BlockchainLMDB::BlockchainLMDB(bool batch_transactions)
   m_height = 0;
   m_cum_size = 0;
   m_cum_count = 0;
+  m_growth_height = 0;
+  m_growth_size_used = 0;
+  m_bytes_per_block = 0;
+
+  m_commits = 0;
+  m_durable_commits = 0;
+  m_sync_result = 0;
+  m_sync_stop = false;
 
   m_hardfork = nullptr;
 }
@@ -1139,6 +1532,11 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
     throw0(DB_ERROR(lmdb_error("Failed to set max number of dbs: ", result).c_str()));
 
   size_t mapsize = DEFAULT_MAPSIZE;
+#if defined(ENABLE_AUTO_RESIZE) && !defined(_WIN32)
+  // unlike on Windows, the file only grows as pages get written
+  if (sizeof(size_t) >= 8 && !(mdb_flags & MDB_RDONLY))
+    mapsize = RESERVED_MAPSIZE;
+#endif
 
   if (auto result = mdb_env_open(m_env, filename.c_str(), mdb_flags, 0644))
     throw0(DB_ERROR(lmdb_error("Failed to open lmdb environment: ", result).c_str()));
@@ -1175,9 +1573,12 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
   // uses macros to avoid having to change things on too many places
   lmdb_db_open(txn, LMDB_BLOCKS, MDB_INTEGERKEY | MDB_CREATE, m_blocks, "Failed to open db handle for m_blocks");
   lmdb_db_open(txn, LMDB_BLOCK_INFO, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_block_info, "Failed to open db handle for m_block_info");
+  lmdb_db_open(txn, LMDB_BLOCK_HEADER_INFO, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_block_header_info, "Failed to open db handle for m_block_header_info");
   lmdb_db_open(txn, LMDB_BLOCK_HEIGHTS, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_block_heights, "Failed to open db handle for m_block_heights");
 
-  lmdb_db_open(txn, LMDB_TXS, MDB_INTEGERKEY | MDB_CREATE, m_txs, "Failed to open db handle for m_txs");
+  lmdb_db_open(txn, LMDB_TXS_PRUNED, MDB_INTEGERKEY | MDB_CREATE, m_txs_pruned, "Failed to open db handle for m_txs_pruned");
+  lmdb_db_open(txn, LMDB_TXS_PRUNABLE, MDB_INTEGERKEY | MDB_CREATE, m_txs_prunable, "Failed to open db handle for m_txs_prunable");
+  lmdb_db_open(txn, LMDB_TXS_PRUNABLE_HASH, MDB_INTEGERKEY | MDB_CREATE, m_txs_prunable_hash, "Failed to open db handle for m_txs_prunable_hash");
   lmdb_db_open(txn, LMDB_TX_INDICES, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_tx_indices, "Failed to open db handle for m_tx_indices");
   lmdb_db_open(txn, LMDB_TX_OUTPUTS, MDB_INTEGERKEY | MDB_CREATE, m_tx_outputs, "Failed to open db handle for m_tx_outputs");
 
@@ -1190,6 +1591,10 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
 
   lmdb_db_open(txn, LMDB_PROPERTIES, MDB_CREATE, m_properties, "Failed to open db handle for m_properties");
   lmdb_db_open(txn, LMDB_ALIASES, MDB_CREATE, m_aliases, "Failed to open db handle for m_aliases");
+  lmdb_db_open(txn, LMDB_ALIAS_ADDRESSES, MDB_CREATE | MDB_DUPSORT, m_alias_addresses, "Failed to open db handle for m_alias_addresses");
+
+  lmdb_db_open(txn, LMDB_TXPOOL_META, MDB_CREATE, m_txpool_meta, "Failed to open db handle for m_txpool_meta");
+  lmdb_db_open(txn, LMDB_TXPOOL_BLOB, MDB_CREATE, m_txpool_blob, "Failed to open db handle for m_txpool_blob");
 
   mdb_set_dupsort(txn, m_spent_keys, compare_hash32);
   mdb_set_dupsort(txn, m_block_heights, compare_hash32);
@@ -1197,9 +1602,13 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
   mdb_set_dupsort(txn, m_output_amounts, compare_uint64);
   mdb_set_dupsort(txn, m_output_txs, compare_uint64);
   mdb_set_dupsort(txn, m_block_info, compare_uint64);
+  mdb_set_dupsort(txn, m_block_header_info, compare_uint64);
 
   mdb_set_compare(txn, m_properties, compare_string);
   mdb_set_compare(txn, m_aliases, compare_string);
+  mdb_set_dupsort(txn, m_alias_addresses, compare_alias_record);
+  mdb_set_compare(txn, m_txpool_meta, compare_hash32);
+  mdb_set_compare(txn, m_txpool_blob, compare_hash32);
 
   // get and keep current height
   MDB_stat db_stats;
@@ -1209,8 +1618,8 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
   m_height = db_stats.ms_entries;
 
   // get and keep current number of txs
-  if ((result = mdb_stat(txn, m_txs, &db_stats)))
-    throw0(DB_ERROR(lmdb_error("Failed to query m_txs: ", result).c_str()));
+  if ((result = mdb_stat(txn, m_txs_pruned, &db_stats)))
+    throw0(DB_ERROR(lmdb_error("Failed to query m_txs_pruned: ", result).c_str()));
   m_num_txs = db_stats.ms_entries;
 
   // get and keep current number of outputs
@@ -1231,10 +1640,16 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
       compatible = false;
     }
 #if VERSION > 0
+    else if (*(const uint32_t*)v.mv_data < VERSION && (mdb_flags & MDB_RDONLY))
+    {
+      LOG_PRINT_RED_L0("Existing lmdb database needs to be converted, which cannot be done on a read only database.");
+      compatible = false;
+    }
     else if (*(const uint32_t*)v.mv_data < VERSION)
     {
       txn.commit();
       m_open = true;
+      start_background_sync(mdb_flags);
       migrate(*(const uint32_t *)v.mv_data);
       return;
     }
@@ -1274,6 +1689,7 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
   txn.commit();
 
   m_open = true;
+  start_background_sync(mdb_flags);
   // from here, init should be finished
 }
 
@@ -1285,6 +1701,18 @@ void BlockchainLMDB::close()
     LOG_PRINT_L3("close() first calling batch_abort() due to active batch transaction");
     batch_abort();
   }
+  if (m_sync_thread.joinable())
+  {
+    {
+      boost::lock_guard<boost::mutex> lock(m_sync_mutex);
+      m_sync_stop = true;
+    }
+    m_sync_cond.notify_all();
+    m_sync_thread.join();
+    m_sync_stop = false;
+  }
+  // the walk threads' read txns go when they exit, before the env does
+  m_walk_threads.reset();
   this->sync();
   m_tinfo.reset();
 
@@ -1319,10 +1747,16 @@ void BlockchainLMDB::reset()
     throw0(DB_ERROR(lmdb_error("Failed to drop m_blocks: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_block_info, 0))
     throw0(DB_ERROR(lmdb_error("Failed to drop m_block_info: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_block_header_info, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_block_header_info: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_block_heights, 0))
     throw0(DB_ERROR(lmdb_error("Failed to drop m_block_heights: ", result).c_str()));
-  if (auto result = mdb_drop(txn, m_txs, 0))
-    throw0(DB_ERROR(lmdb_error("Failed to drop m_txs: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_txs_pruned, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_txs_pruned: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_txs_prunable, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_txs_prunable: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_txs_prunable_hash, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_txs_prunable_hash: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_tx_indices, 0))
     throw0(DB_ERROR(lmdb_error("Failed to drop m_tx_indices: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_tx_outputs, 0))
@@ -1339,6 +1773,12 @@ void BlockchainLMDB::reset()
     throw0(DB_ERROR(lmdb_error("Failed to drop m_properties: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_aliases, 0))
     throw0(DB_ERROR(lmdb_error("Failed to drop m_aliases: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_alias_addresses, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_alias_addresses: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_txpool_meta, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_txpool_meta: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_txpool_blob, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_txpool_blob: ", result).c_str()));
 
   // init with current version
   MDB_val_copy<const char*> k("version");
@@ -1351,6 +1791,9 @@ void BlockchainLMDB::reset()
   m_num_outputs = 0;
   m_cum_size = 0;
   m_cum_count = 0;
+  m_growth_height = 0;
+  m_growth_size_used = 0;
+  m_bytes_per_block = 0;
 }
 
 std::vector<std::string> BlockchainLMDB::get_filenames() const
@@ -1481,6 +1924,14 @@ block BlockchainLMDB::get_block(const crypto::hash& h) const
   return get_block_from_height(get_block_height(h));
 }
 
+blobdata BlockchainLMDB::get_block_blob(const crypto::hash& h) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  return get_block_blob_from_height(get_block_height(h));
+}
+
 uint64_t BlockchainLMDB::get_block_height(const crypto::hash& h) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -1516,6 +1967,20 @@ block BlockchainLMDB::get_block_from_height(const uint64_t& height) const
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  blobdata bd = get_block_blob_from_height(height);
+
+  block b;
+  if (!parse_and_validate_block_from_blob(bd, b))
+    throw0(DB_ERROR("Failed to parse block from blob retrieved from the db"));
+
+  return b;
+}
+
+blobdata BlockchainLMDB::get_block_blob_from_height(const uint64_t& height) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
   TXN_PREFIX_RDONLY();
   RCURSOR(blocks);
 
@@ -1532,13 +1997,9 @@ block BlockchainLMDB::get_block_from_height(const uint64_t& height) const
   blobdata bd;
   bd.assign(reinterpret_cast<char*>(result.mv_data), result.mv_size);
 
-  block b;
-  if (!parse_and_validate_block_from_blob(bd, b))
-    throw0(DB_ERROR("Failed to parse block from blob retrieved from the db"));
-
   TXN_POSTFIX_RDONLY();
 
-  return b;
+  return bd;
 }
 
 uint64_t BlockchainLMDB::get_block_timestamp(const uint64_t& height) const
@@ -1687,6 +2148,61 @@ crypto::hash BlockchainLMDB::get_block_hash_from_height(const uint64_t& height)
   return ret;
 }
 
+block_header_info BlockchainLMDB::get_block_header_info(const uint64_t& height) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(block_header_info);
+
+  MDB_val_set(result, height);
+  auto get_result = mdb_cursor_get(m_cur_block_header_info, (MDB_val *)&zerokval, &result, MDB_GET_BOTH);
+  if (get_result == MDB_NOTFOUND)
+  {
+    throw0(BLOCK_DNE(std::string("Attempt to get block header from height ").append(boost::lexical_cast<std::string>(height)).append(" failed -- block header not in db").c_str()));
+  }
+  else if (get_result)
+    throw0(DB_ERROR(lmdb_error("Error attempting to retrieve a block header from the db: ", get_result).c_str()));
+
+  block_header_info ret = *(const block_header_info *)result.mv_data;
+  TXN_POSTFIX_RDONLY();
+  return ret;
+}
+
+std::vector<block_header_info> BlockchainLMDB::get_block_header_info_range(const uint64_t& h1, const uint64_t& h2) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+  std::vector<block_header_info> v;
+  if (h2 < h1)
+    return v;
+  v.reserve(h2 - h1 + 1);
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(block_header_info);
+
+  // the records are sorted by height under a single key, so walk the dups;
+  // MDB_NEXT_DUP writes the key back, so it can't be zerokval itself
+  MDB_val k = zerokval;
+  MDB_val_set(result, h1);
+  auto get_result = mdb_cursor_get(m_cur_block_header_info, &k, &result, MDB_GET_BOTH);
+  for (uint64_t height = h1; height <= h2; ++height)
+  {
+    if (height != h1)
+      get_result = mdb_cursor_get(m_cur_block_header_info, &k, &result, MDB_NEXT_DUP);
+    if (get_result == MDB_NOTFOUND)
+      throw0(BLOCK_DNE(std::string("Attempt to get block header from height ").append(boost::lexical_cast<std::string>(height)).append(" failed -- block header not in db").c_str()));
+    else if (get_result)
+      throw0(DB_ERROR(lmdb_error("Error attempting to retrieve a block header from the db: ", get_result).c_str()));
+
+    v.push_back(*(const block_header_info *)result.mv_data);
+  }
+
+  TXN_POSTFIX_RDONLY();
+  return v;
+}
+
 std::vector<block> BlockchainLMDB::get_blocks_range(const uint64_t& h1, const uint64_t& h2) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -1701,6 +2217,39 @@ std::vector<block> BlockchainLMDB::get_blocks_range(const uint64_t& h1, const ui
   return v;
 }
 
+std::vector<blobdata> BlockchainLMDB::get_blocks_blobs_range(const uint64_t& h1, const uint64_t& h2) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+  std::vector<blobdata> v;
+  if (h2 < h1)
+    return v;
+  v.reserve(h2 - h1 + 1);
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(blocks);
+
+  // blocks are keyed by height, so walk the cursor instead of a lookup per block
+  MDB_val_copy<uint64_t> key(h1);
+  MDB_val k, result;
+  auto get_result = mdb_cursor_get(m_cur_blocks, &key, &result, MDB_SET);
+  for (uint64_t height = h1; height <= h2; ++height)
+  {
+    if (height != h1)
+      get_result = mdb_cursor_get(m_cur_blocks, &k, &result, MDB_NEXT);
+    if (get_result == MDB_NOTFOUND)
+      throw0(BLOCK_DNE(std::string("Attempt to get block from height ").append(boost::lexical_cast<std::string>(height)).append(" failed -- block not in db").c_str()));
+    else if (get_result)
+      throw0(DB_ERROR("Error attempting to retrieve a block from the db"));
+
+    v.push_back(blobdata(reinterpret_cast<char*>(result.mv_data), result.mv_size));
+  }
+
+  TXN_POSTFIX_RDONLY();
+
+  return v;
+}
+
 std::vector<crypto::hash> BlockchainLMDB::get_hashes_range(const uint64_t& h1, const uint64_t& h2) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -1756,7 +2305,6 @@ bool BlockchainLMDB::tx_exists(const crypto::hash& h) const
 
   TXN_PREFIX_RDONLY();
   RCURSOR(tx_indices);
-  RCURSOR(txs);
 
   MDB_val_set(key, h);
   bool tx_found = false;
@@ -1769,7 +2317,7 @@ bool BlockchainLMDB::tx_exists(const crypto::hash& h) const
     throw0(DB_ERROR(lmdb_error(std::string("DB error attempting to fetch transaction index from hash ") + epee::string_tools::pod_to_hex(h) + ": ", get_result).c_str()));
 
   // This isn't needed as part of the check. we're not checking consistency of db.
-  // get_result = mdb_cursor_get(m_cur_txs, &val_tx_index, &result, MDB_SET);
+  // get_result = mdb_cursor_get(m_cur_txs_pruned, &val_tx_index, &result, MDB_SET);
   TIME_MEASURE_FINISH(time1);
   time_tx_exists += time1;
 
@@ -1849,43 +2397,237 @@ transaction BlockchainLMDB::get_tx(const crypto::hash& h) const
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  blobdata bd;
+  if (!get_tx_blob(h, bd))
+    throw2(TX_DNE(std::string("tx with hash ").append(epee::string_tools::pod_to_hex(h)).append(" not found in db").c_str()));
+
+  transaction tx;
+  if (!parse_and_validate_tx_from_blob(bd, tx))
+    throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
+
+  return tx;
+}
+
+bool BlockchainLMDB::get_tx_blob(const crypto::hash& h, blobdata& bd) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
   TXN_PREFIX_RDONLY();
   RCURSOR(tx_indices);
-  RCURSOR(txs);
+  RCURSOR(txs_pruned);
+  RCURSOR(txs_prunable);
 
   MDB_val_set(v, h);
-  MDB_val result;
+  MDB_val result0, result1;
   auto get_result = mdb_cursor_get(m_cur_tx_indices, (MDB_val *)&zerokval, &v, MDB_GET_BOTH);
   if (get_result == 0)
   {
     txindex *tip = (txindex *)v.mv_data;
     MDB_val_set(val_tx_id, tip->data.tx_id);
-    get_result = mdb_cursor_get(m_cur_txs, &val_tx_id, &result, MDB_SET);
+    get_result = mdb_cursor_get(m_cur_txs_pruned, &val_tx_id, &result0, MDB_SET);
+    if (get_result == 0)
+      get_result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, &result1, MDB_SET);
   }
   if (get_result == MDB_NOTFOUND)
-    throw2(TX_DNE(std::string("tx with hash ").append(epee::string_tools::pod_to_hex(h)).append(" not found in db").c_str()));
+    return false;
   else if (get_result)
     throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx from hash", get_result).c_str()));
 
-  blobdata bd;
-  bd.assign(reinterpret_cast<char*>(result.mv_data), result.mv_size);
-
-  transaction tx;
-  if (!parse_and_validate_tx_from_blob(bd, tx))
-    throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
+  bd.assign(reinterpret_cast<char*>(result0.mv_data), result0.mv_size);
+  bd.append(reinterpret_cast<char*>(result1.mv_data), result1.mv_size);
 
   TXN_POSTFIX_RDONLY();
 
-  return tx;
+  return true;
 }
 
-uint64_t BlockchainLMDB::get_tx_count() const
+transaction BlockchainLMDB::get_pruned_tx(const crypto::hash& h) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
-  TXN_PREFIX_RDONLY();
-
+  blobdata bd;
+  if (!get_pruned_tx_blob(h, bd))
+    throw2(TX_DNE(std::string("tx with hash ").append(epee::string_tools::pod_to_hex(h)).append(" not found in db").c_str()));
+
+  transaction tx;
+  if (!parse_and_validate_tx_base_from_blob(bd, tx))
+    throw0(DB_ERROR("Failed to parse pruned tx from blob retrieved from the db"));
+
+  return tx;
+}
+
+bool BlockchainLMDB::get_pruned_tx_blob(const crypto::hash& h, blobdata& bd) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(tx_indices);
+  RCURSOR(txs_pruned);
+
+  MDB_val_set(v, h);
+  MDB_val result;
+  auto get_result = mdb_cursor_get(m_cur_tx_indices, (MDB_val *)&zerokval, &v, MDB_GET_BOTH);
+  if (get_result == 0)
+  {
+    txindex *tip = (txindex *)v.mv_data;
+    MDB_val_set(val_tx_id, tip->data.tx_id);
+    get_result = mdb_cursor_get(m_cur_txs_pruned, &val_tx_id, &result, MDB_SET);
+  }
+  if (get_result == MDB_NOTFOUND)
+    return false;
+  else if (get_result)
+    throw0(DB_ERROR(lmdb_error("DB error attempting to fetch pruned tx from hash", get_result).c_str()));
+
+  bd.assign(reinterpret_cast<char*>(result.mv_data), result.mv_size);
+
+  TXN_POSTFIX_RDONLY();
+
+  return true;
+}
+
+bool BlockchainLMDB::get_prunable_tx_blob(const crypto::hash& h, blobdata& bd) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(tx_indices);
+  RCURSOR(txs_prunable);
+
+  MDB_val_set(v, h);
+  MDB_val result;
+  auto get_result = mdb_cursor_get(m_cur_tx_indices, (MDB_val *)&zerokval, &v, MDB_GET_BOTH);
+  if (get_result == 0)
+  {
+    txindex *tip = (txindex *)v.mv_data;
+    MDB_val_set(val_tx_id, tip->data.tx_id);
+    get_result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, &result, MDB_SET);
+  }
+  if (get_result == MDB_NOTFOUND)
+    return false;
+  else if (get_result)
+    throw0(DB_ERROR(lmdb_error("DB error attempting to fetch prunable tx from hash", get_result).c_str()));
+
+  bd.assign(reinterpret_cast<char*>(result.mv_data), result.mv_size);
+
+  TXN_POSTFIX_RDONLY();
+
+  return true;
+}
+
+bool BlockchainLMDB::get_prunable_tx_hash(const crypto::hash& tx_hash, crypto::hash& prunable_hash) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(tx_indices);
+  RCURSOR(txs_prunable_hash);
+
+  MDB_val_set(v, tx_hash);
+  MDB_val result;
+  auto get_result = mdb_cursor_get(m_cur_tx_indices, (MDB_val *)&zerokval, &v, MDB_GET_BOTH);
+  if (get_result == 0)
+  {
+    txindex *tip = (txindex *)v.mv_data;
+    MDB_val_set(val_tx_id, tip->data.tx_id);
+    get_result = mdb_cursor_get(m_cur_txs_prunable_hash, &val_tx_id, &result, MDB_SET);
+  }
+  if (get_result == MDB_NOTFOUND)
+    return false;
+  else if (get_result)
+    throw0(DB_ERROR(lmdb_error("DB error attempting to fetch prunable tx hash from hash", get_result).c_str()));
+
+  prunable_hash = *(const crypto::hash *)result.mv_data;
+
+  TXN_POSTFIX_RDONLY();
+
+  return true;
+}
+
+uint64_t BlockchainLMDB::prune_blockchain(uint64_t height)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  if (height > m_height)
+    height = m_height;
+  if (height <= get_pruned_height())
+    return 0;
+
+  // tx IDs follow the order txs were added in, so the txs below height are
+  // those before the miner tx of the block at height
+  uint64_t tx_id_limit = m_num_txs;
+  if (height < m_height)
+  {
+    const block b = get_block_from_height(height);
+    if (!tx_exists(get_transaction_hash(b.miner_tx), tx_id_limit))
+      throw0(DB_ERROR("Miner tx of block to prune up to not found in db"));
+  }
+
+  TXN_BLOCK_PREFIX(0);
+
+  MDB_cursor *c_prunable;
+  int result = mdb_cursor_open(*txn_ptr, m_txs_prunable, &c_prunable);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to open a cursor for txs_prunable: ", result).c_str()));
+
+  uint64_t pruned = 0;
+  MDB_val k, v;
+  while ((result = mdb_cursor_get(c_prunable, &k, &v, MDB_FIRST)) == 0)
+  {
+    if (*(const uint64_t *)k.mv_data >= tx_id_limit)
+      break;
+    if ((result = mdb_cursor_del(c_prunable, 0)))
+      break;
+    ++pruned;
+  }
+  mdb_cursor_close(c_prunable);
+  if (result && result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Failed to prune txs: ", result).c_str()));
+
+  MDB_val_copy<const char*> pk("pruned_height");
+  MDB_val_copy<uint64_t> pv(height);
+  if ((result = mdb_put(*txn_ptr, m_properties, &pk, &pv, 0)))
+    throw0(DB_ERROR(lmdb_error("Failed to write pruned height to db transaction: ", result).c_str()));
+
+  TXN_BLOCK_POSTFIX_SUCCESS();
+
+  LOG_PRINT_L1("Pruned " << pruned << " txs below height " << height);
+  return pruned;
+}
+
+uint64_t BlockchainLMDB::get_pruned_height() const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+
+  uint64_t height = 0;
+  MDB_val_copy<const char*> k("pruned_height");
+  MDB_val v;
+  auto get_result = mdb_get(m_txn, m_properties, &k, &v);
+  if (get_result == 0)
+    height = *(const uint64_t *)v.mv_data;
+  else if (get_result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Failed to retrieve pruned height: ", get_result).c_str()));
+
+  TXN_POSTFIX_RDONLY();
+
+  return height;
+}
+
+uint64_t BlockchainLMDB::get_tx_count() const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+
   MDB_stat db_stats;
   if (mdb_stat(m_txn, m_tx_indices, &db_stats))
     throw0(DB_ERROR("Failed to query m_tx_indices"));
@@ -1964,7 +2706,7 @@ output_data_t BlockchainLMDB::get_output_key(const uint64_t &global_index) const
   TXN_PREFIX_RDONLY();
   RCURSOR(output_txs);
   RCURSOR(tx_indices);
-  RCURSOR(txs);
+  RCURSOR(txs_pruned);
 
   output_data_t od;
   MDB_val_set(v, global_index);
@@ -1984,7 +2726,7 @@ output_data_t BlockchainLMDB::get_output_key(const uint64_t &global_index) const
   txindex *tip = (txindex *)val_h.mv_data;
   MDB_val_set(val_tx_id, tip->data.tx_id);
   MDB_val result;
-  get_result = mdb_cursor_get(m_cur_txs, &val_tx_id, &result, MDB_SET);
+  get_result = mdb_cursor_get(m_cur_txs_pruned, &val_tx_id, &result, MDB_SET);
   if (get_result == MDB_NOTFOUND)
     throw1(TX_DNE(std::string("tx with hash ").append(epee::string_tools::pod_to_hex(ot->tx_hash)).append(" not found in db").c_str()));
   else if (get_result)
@@ -1994,7 +2736,7 @@ output_data_t BlockchainLMDB::get_output_key(const uint64_t &global_index) const
   bd.assign(reinterpret_cast<char*>(result.mv_data), result.mv_size);
 
   transaction tx;
-  if (!parse_and_validate_tx_from_blob(bd, tx))
+  if (!parse_and_validate_tx_base_from_blob(bd, tx))
     throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
 
   const tx_out tx_output = tx.vout[ot->local_index];
@@ -2209,7 +2951,8 @@ bool BlockchainLMDB::for_all_transactions(std::function<bool(const crypto::hash&
   check_open();
 
   TXN_PREFIX_RDONLY();
-  RCURSOR(txs);
+  RCURSOR(txs_pruned);
+  RCURSOR(txs_prunable);
   RCURSOR(tx_indices);
 
   MDB_val k;
@@ -2228,18 +2971,10 @@ bool BlockchainLMDB::for_all_transactions(std::function<bool(const crypto::hash&
 
     txindex *ti = (txindex *)v.mv_data;
     const crypto::hash hash = ti->key;
-    k.mv_data = (void *)&ti->data.tx_id;
-    k.mv_size = sizeof(ti->data.tx_id);
-    ret = mdb_cursor_get(m_cur_txs, &k, &v, MDB_SET);
-    if (ret == MDB_NOTFOUND)
-      break;
-    if (ret)
-      throw0(DB_ERROR(lmdb_error("Failed to enumerate transactions: ", ret).c_str()));
-    blobdata bd;
-    bd.assign(reinterpret_cast<char*>(v.mv_data), v.mv_size);
+    // pruned txs are passed without their prunable data
     transaction tx;
-    if (!parse_and_validate_tx_from_blob(bd, tx))
-      throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
+    if (!load_stored_tx(m_cur_txs_pruned, m_cur_txs_prunable, ti->data.tx_id, tx))
+      break;
     if (!f(hash, tx)) {
       ret = false;
       break;
@@ -2251,48 +2986,172 @@ bool BlockchainLMDB::for_all_transactions(std::function<bool(const crypto::hash&
   return ret;
 }
 
-void BlockchainLMDB::load_aliases() {
+std::string BlockchainLMDB::get_alias_address(const std::string& alias, bool get_if_premature = true) const {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
   TXN_PREFIX_RDONLY();
   RCURSOR(aliases);
 
-  MDB_val k, v;
-
-  int ret = mdb_cursor_get(m_cur_aliases, &k, &v, MDB_FIRST);
-  while (ret != MDB_NOTFOUND) {
-    if (ret)
-      throw0(DB_ERROR("failed to enumerate aliases"));
-    size_t height_length = v.mv_size - 99/*length of address + '\0'*/;
-    std::string height(reinterpret_cast<char*>(v.mv_data), height_length);
-    std::string address(reinterpret_cast<char*>((char*)v.mv_data + height_length), 98);
-    m_aliases_multi_index.insert({std::string(reinterpret_cast<char*>(k.mv_data), k.mv_size - 1), std::stoull(height), address}); // LUKAS TODO make more neat
-    ret = mdb_cursor_get(m_cur_aliases, &k, &v, MDB_NEXT);
+  std::string address;
+  MDB_val_copy<const char*> k(alias.c_str());
+  MDB_val v;
+  auto get_result = mdb_cursor_get(m_cur_aliases, &k, &v, MDB_SET);
+  if (get_result == 0)
+  {
+    if (get_if_premature || m_height >= alias_record_height(v) + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE)
+      address = alias_record_string(v);
   }
+  else if (get_result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Error attempting to retrieve an alias from the db: ", get_result).c_str()));
 
   TXN_POSTFIX_RDONLY();
-}
-
-std::string BlockchainLMDB::get_alias_address(const std::string& alias, bool get_if_premature = true) const {
-  auto it = m_aliases_multi_index.get<0>().find(alias);
-  if (it != m_aliases_multi_index.get<0>().end() && (get_if_premature || m_height >= it->height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE))
-    return it->address;
-  return "";
+  return address;
 }
 
 std::vector<cryptonote::alias> BlockchainLMDB::get_address_aliases(const std::string& address) const {
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(alias_addresses);
+
+  // the aliases of an address are sorted by height
   std::vector<cryptonote::alias> aliases;
-  auto range = m_aliases_multi_index.get<1>().equal_range(address);
-  for (auto it = range.first; it != range.second; ++it)
-    aliases.push_back({it->alias, it->height});
-  std::sort(aliases.begin(), aliases.end(),
-    [](const cryptonote::alias& first, const cryptonote::alias& second) {
-      return first.height < second.height;
-    });
+  crypto::hash address_key = alias_address_key(address);
+  MDB_val_set(k, address_key);
+  MDB_val v;
+  auto get_result = mdb_cursor_get(m_cur_alias_addresses, &k, &v, MDB_SET);
+  while (get_result == 0)
+  {
+    aliases.push_back({alias_record_string(v), alias_record_height(v)});
+    get_result = mdb_cursor_get(m_cur_alias_addresses, &k, &v, MDB_NEXT_DUP);
+  }
+  if (get_result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Error attempting to retrieve aliases from the db: ", get_result).c_str()));
+
+  TXN_POSTFIX_RDONLY();
   return aliases;
 }
 
+// Called from the pool's writer thread, which never holds the block write
+// txn, so this normally commits a txn of its own.  That thread must never
+// resize the map, since the block writer may be in the middle of a txn, so
+// the write is put off instead while the map is short or another writer is
+// active; the block writer grows the map as it goes.
+bool BlockchainLMDB::update_txpool_txes(const std::vector<txpool_tx_update>& updates)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  mdb_txn_safe auto_txn;
+  mdb_txn_safe* txn_ptr = &auto_txn;
+  const bool own_txn = !(m_write_txn && m_writer == boost::this_thread::get_id());
+  if (!own_txn)
+    txn_ptr = m_write_txn;
+  else
+  {
+    if (m_write_txn || m_batch_active)
+    {
+      LOG_PRINT_L2("Another db writer is active, putting off pool changes");
+      return false;
+    }
+
+    uint64_t size_needed = TXPOOL_WRITE_MIN_FREE;
+    for (const txpool_tx_update& u : updates)
+      size_needed += 2 * (u.meta.size() + u.blob.size());
+    MDB_envinfo mei;
+    mdb_env_info(m_env, &mei);
+    MDB_stat mst;
+    mdb_env_stat(m_env, &mst);
+    uint64_t size_used = mst.ms_psize * mei.me_last_pgno;
+    if (mei.me_mapsize < size_used + size_needed)
+    {
+      LOG_PRINT_L1("LMDB memory map is short of space, putting off pool changes");
+      return false;
+    }
+
+    if (auto mdb_res = mdb_txn_begin(m_env, NULL, 0, auto_txn))
+      throw0(DB_ERROR(lmdb_error(std::string("Failed to create a transaction for the db in ")+__FUNCTION__+": ", mdb_res).c_str()));
+  }
+
+  for (const txpool_tx_update& u : updates)
+  {
+    MDB_val_set(k, u.txid);
+    int result;
+    if (u.remove)
+    {
+      if ((result = mdb_del(*txn_ptr, m_txpool_meta, &k, NULL)) && result != MDB_NOTFOUND)
+        throw1(DB_ERROR(lmdb_error("Failed to remove a pool tx's metadata from the db: ", result).c_str()));
+      if ((result = mdb_del(*txn_ptr, m_txpool_blob, &k, NULL)) && result != MDB_NOTFOUND)
+        throw1(DB_ERROR(lmdb_error("Failed to remove a pool tx's blob from the db: ", result).c_str()));
+      continue;
+    }
+    MDB_val vmeta = {u.meta.size(), (void *)u.meta.data()};
+    if ((result = mdb_put(*txn_ptr, m_txpool_meta, &k, &vmeta, 0)))
+      throw1(DB_ERROR(lmdb_error("Failed to add a pool tx's metadata to the db: ", result).c_str()));
+    if (!u.blob.empty())
+    {
+      MDB_val vblob = {u.blob.size(), (void *)u.blob.data()};
+      if ((result = mdb_put(*txn_ptr, m_txpool_blob, &k, &vblob, 0)))
+        throw1(DB_ERROR(lmdb_error("Failed to add a pool tx's blob to the db: ", result).c_str()));
+    }
+  }
+
+  if (own_txn)
+  {
+    auto_txn.commit();
+    commit_done();
+  }
+  return true;
+}
+
+bool BlockchainLMDB::for_all_txpool_txes(std::function<bool(const crypto::hash&, const cryptonote::blobdata&, const cryptonote::blobdata&)> f) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(txpool_meta);
+  RCURSOR(txpool_blob);
+
+  MDB_val k;
+  MDB_val v;
+  bool ret = true;
+
+  MDB_cursor_op op = MDB_FIRST;
+  while (1)
+  {
+    int result = mdb_cursor_get(m_cur_txpool_meta, &k, &v, op);
+    op = MDB_NEXT;
+    if (result == MDB_NOTFOUND)
+      break;
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to enumerate txpool tx metadata: ", result).c_str()));
+    const crypto::hash txid = *(const crypto::hash*)k.mv_data;
+    const cryptonote::blobdata meta((const char*)v.mv_data, v.mv_size);
+
+    MDB_val vblob;
+    result = mdb_cursor_get(m_cur_txpool_blob, &k, &vblob, MDB_SET);
+    if (result == MDB_NOTFOUND)
+    {
+      LOG_PRINT_L0("Pool tx " << txid << " has metadata but no blob in the db, skipping");
+      continue;
+    }
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to get txpool tx blob: ", result).c_str()));
+    const cryptonote::blobdata blob((const char*)vblob.mv_data, vblob.mv_size);
+    if (!f(txid, meta, blob))
+    {
+      ret = false;
+      break;
+    }
+  }
+
+  TXN_POSTFIX_RDONLY();
+  return ret;
+}
+
 bool BlockchainLMDB::for_all_outputs(std::function<bool(uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx)> f) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -2328,6 +3187,233 @@ bool BlockchainLMDB::for_all_outputs(std::function<bool(uint64_t amount, const c
   return ret;
 }
 
+// Runs fn(shard) for every shard on m_walk_threads, which is started on first
+// use and kept for later walks. Each pool thread keeps its own read txn,
+// which is reset when its shard is done. The first exception thrown by a
+// shard is rethrown here once all shards are done.
+void BlockchainLMDB::run_shards(size_t num_shards, const std::function<void(size_t)> &fn) const
+{
+  tools::thread_group *threads;
+  {
+    boost::lock_guard<boost::mutex> lock(m_walk_threads_lock);
+    if (!m_walk_threads)
+      m_walk_threads.reset(new tools::thread_group(tools::get_max_concurrency()));
+    threads = m_walk_threads.get();
+  }
+
+  std::vector<std::exception_ptr> errors(num_shards);
+  size_t remaining = num_shards;
+  boost::mutex done_lock;
+  boost::condition_variable done;
+  for (size_t shard = 0; shard < num_shards; ++shard)
+  {
+    threads->dispatch([&, shard]() {
+      try { fn(shard); }
+      catch (...) { errors[shard] = std::current_exception(); }
+      boost::lock_guard<boost::mutex> lock(done_lock);
+      if (--remaining == 0)
+        done.notify_all();
+    });
+  }
+
+  // the caller only waits: running a shard here could reuse, and move, the
+  // cursors of a read txn it has open
+  {
+    boost::unique_lock<boost::mutex> lock(done_lock);
+    while (remaining)
+      done.wait(lock);
+  }
+  for (const auto &e: errors)
+    if (e)
+      std::rethrow_exception(e);
+}
+
+bool BlockchainLMDB::for_blocks_parallel(uint64_t h1, uint64_t h2, size_t num_shards, std::function<bool(size_t, uint64_t, const crypto::hash&, const cryptonote::block&)> f) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  if (h1 > h2)
+    return true;
+  const uint64_t num_blocks = h2 - h1 + 1;
+  num_shards = shard_count(num_shards, num_blocks);
+
+  std::atomic<bool> stop(false);
+  run_shards(num_shards, [&](size_t shard) {
+    const uint64_t first = h1 + num_blocks * shard / num_shards;
+    const uint64_t end = h1 + num_blocks * (shard + 1) / num_shards;
+
+    TXN_PREFIX_RDONLY();
+    walk_cursor cur(m_txn, m_blocks);
+
+    MDB_val_copy<uint64_t> k(first);
+    MDB_val v;
+    MDB_cursor_op op = MDB_SET_RANGE;
+    while (!stop)
+    {
+      int ret = mdb_cursor_get(cur, &k, &v, op);
+      op = MDB_NEXT;
+      if (ret == MDB_NOTFOUND)
+        break;
+      if (ret)
+        throw0(DB_ERROR(lmdb_error("Failed to enumerate blocks: ", ret).c_str()));
+      const uint64_t height = *(const uint64_t*)k.mv_data;
+      if (height >= end)
+        break;
+      blobdata bd;
+      bd.assign(reinterpret_cast<char*>(v.mv_data), v.mv_size);
+      block b;
+      if (!parse_and_validate_block_from_blob(bd, b))
+        throw0(DB_ERROR("Failed to parse block from blob retrieved from the db"));
+      crypto::hash hash;
+      if (!get_block_hash(b, hash))
+        throw0(DB_ERROR("Failed to get block hash from blob retrieved from the db"));
+      if (!f(shard, height, hash, b))
+        stop = true;
+    }
+
+    TXN_POSTFIX_RDONLY();
+  });
+
+  return !stop;
+}
+
+bool BlockchainLMDB::for_all_transactions_parallel(size_t num_shards, std::function<bool(size_t, const crypto::hash&, const cryptonote::transaction&)> f) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  // tx hashes are uniformly distributed, so splitting the hash space on the
+  // word tx_indices sorts by first gives shards of about the same size
+  num_shards = shard_count(num_shards, get_tx_count());
+
+  std::atomic<bool> stop(false);
+  run_shards(num_shards, [&](size_t shard) {
+    crypto::hash first = null_hash;
+    ((uint32_t*)&first)[7] = ((uint64_t)shard << 32) / num_shards;
+    const uint64_t end = ((uint64_t)(shard + 1) << 32) / num_shards;
+
+    TXN_PREFIX_RDONLY();
+    walk_cursor cur(m_txn, m_tx_indices);
+    RCURSOR(txs_pruned);
+    RCURSOR(txs_prunable);
+
+    MDB_val k = zerokval;
+    MDB_val_set(v, first);
+    MDB_cursor_op op = MDB_GET_BOTH_RANGE;
+    while (!stop)
+    {
+      int ret = mdb_cursor_get(cur, &k, &v, op);
+      op = MDB_NEXT_DUP;
+      if (ret == MDB_NOTFOUND)
+        break;
+      if (ret)
+        throw0(DB_ERROR(lmdb_error("Failed to enumerate transactions: ", ret).c_str()));
+      const txindex *ti = (const txindex *)v.mv_data;
+      if (((const uint32_t*)&ti->key)[7] >= end)
+        break;
+      const crypto::hash hash = ti->key;
+      transaction tx;
+      if (!load_stored_tx(m_cur_txs_pruned, m_cur_txs_prunable, ti->data.tx_id, tx))
+        throw0(DB_ERROR("Failed to enumerate transactions: tx index without tx"));
+      if (!f(shard, hash, tx))
+        stop = true;
+    }
+
+    TXN_POSTFIX_RDONLY();
+  });
+
+  return !stop;
+}
+
+bool BlockchainLMDB::for_all_outputs_parallel(size_t num_shards, std::function<bool(size_t, uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx)> f) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  // Most outputs share very few amounts (all RingCT outputs are amount 0),
+  // so shards are cut by output count, splitting an amount across shards
+  // by amount index where needed.
+  std::vector<std::pair<uint64_t, uint64_t>> amounts;
+  uint64_t num_outputs = 0;
+  {
+    TXN_PREFIX_RDONLY();
+    RCURSOR(output_amounts);
+
+    MDB_val k;
+    MDB_val v;
+    MDB_cursor_op op = MDB_FIRST;
+    while (1)
+    {
+      int ret = mdb_cursor_get(m_cur_output_amounts, &k, &v, op);
+      op = MDB_NEXT_NODUP;
+      if (ret == MDB_NOTFOUND)
+        break;
+      if (ret)
+        throw0(DB_ERROR(lmdb_error("Failed to enumerate outputs: ", ret).c_str()));
+      mdb_size_t num_elems = 0;
+      ret = mdb_cursor_count(m_cur_output_amounts, &num_elems);
+      if (ret)
+        throw0(DB_ERROR(lmdb_error("Failed to count outputs: ", ret).c_str()));
+      amounts.push_back(std::make_pair(*(const uint64_t*)k.mv_data, (uint64_t)num_elems));
+      num_outputs += num_elems;
+    }
+
+    TXN_POSTFIX_RDONLY();
+  }
+  if (num_outputs == 0)
+    return true;
+
+  num_shards = shard_count(num_shards, num_outputs);
+  const uint64_t per_shard = (num_outputs + num_shards - 1) / num_shards;
+  std::vector<std::vector<output_segment>> shards(num_shards);
+  size_t fill_shard = 0;
+  uint64_t filled = 0;
+  for (const auto &a: amounts)
+  {
+    for (uint64_t first = 0; first < a.second; )
+    {
+      const uint64_t count = std::min(a.second - first, per_shard - filled);
+      shards[fill_shard].push_back({a.first, first, count});
+      first += count;
+      filled += count;
+      if (filled == per_shard && fill_shard + 1 < num_shards)
+      {
+        ++fill_shard;
+        filled = 0;
+      }
+    }
+  }
+
+  std::atomic<bool> stop(false);
+  run_shards(num_shards, [&](size_t shard) {
+    TXN_PREFIX_RDONLY();
+    walk_cursor cur(m_txn, m_output_amounts);
+
+    for (const output_segment &seg: shards[shard])
+    {
+      MDB_val_copy<uint64_t> k(seg.amount);
+      MDB_val_set(v, seg.first);
+      MDB_cursor_op op = MDB_GET_BOTH;
+      for (uint64_t i = 0; i < seg.count && !stop; ++i)
+      {
+        int ret = mdb_cursor_get(cur, &k, &v, op);
+        op = MDB_NEXT_DUP;
+        if (ret)
+          throw0(DB_ERROR(lmdb_error("Failed to enumerate outputs: ", ret).c_str()));
+        const outkey *ok = (const outkey *)v.mv_data;
+        tx_out_index toi = get_output_tx_and_index_from_global(ok->output_id);
+        if (!f(shard, seg.amount, toi.first, toi.second))
+          stop = true;
+      }
+    }
+
+    TXN_POSTFIX_RDONLY();
+  });
+
+  return !stop;
+}
+
 // batch_num_blocks: (optional) Used to check if resize needed before batch transaction starts.
 void BlockchainLMDB::batch_start(uint64_t batch_num_blocks)
 {
@@ -2387,6 +3473,7 @@ void BlockchainLMDB::batch_commit()
   delete m_write_batch_txn;
   m_write_batch_txn = nullptr;
   memset(&m_wcursors, 0, sizeof(m_wcursors));
+  commit_done();
 }
 
 void BlockchainLMDB::batch_stop()
@@ -2411,6 +3498,7 @@ void BlockchainLMDB::batch_stop()
   m_batch_active = false;
   memset(&m_wcursors, 0, sizeof(m_wcursors));
   LOG_PRINT_L3("batch transaction: end");
+  commit_done();
 }
 
 void BlockchainLMDB::batch_abort()
@@ -2551,6 +3639,7 @@ void BlockchainLMDB::block_txn_stop()
       delete m_write_txn;
       m_write_txn = nullptr;
       memset(&m_wcursors, 0, sizeof(m_wcursors));
+      commit_done();
 	}
   }
   else if (m_tinfo->m_ti_rtxn)
@@ -2593,15 +3682,10 @@ uint64_t BlockchainLMDB::add_block(const block& blk, const size_t& block_size, c
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
-  if (m_height % 1000 == 0)
-  {
-    // for batch mode, DB resize check is done at start of batch transaction
-    if (! m_batch_active && need_resize())
-    {
-      LOG_PRINT_L0("LMDB memory map needs to be resized, doing that now.");
-      do_resize();
-    }
-  }
+  // for batch mode, DB resize check is done at start of batch transaction,
+  // but the write rate is still sampled
+  if (m_height % 100 == 0)
+    check_and_resize_for_growth();
 
   uint64_t num_txs = m_num_txs;
   uint64_t num_outputs = m_num_outputs;
@@ -2752,6 +3836,101 @@ void BlockchainLMDB::get_output_tx_and_index(const uint64_t& amount, const std::
   LOG_PRINT_L3("db3: " << db3);
 }
 
+void BlockchainLMDB::get_output_keys(const std::vector<uint64_t> &amounts, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs, std::vector<tx_out_index> *tx_out_indices) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  TIME_MEASURE_START(db3);
+  check_open();
+
+  if (amounts.size() != offsets.size())
+    throw0(DB_ERROR("Mismatched amounts and offsets sizes"));
+
+  outputs.resize(amounts.size());
+  if (tx_out_indices)
+    tx_out_indices->resize(amounts.size());
+
+  // visit the outputs in key order, so that runs of consecutive indices are
+  // a cursor step each, and the rest land close to the previous lookup
+  std::vector<size_t> order(amounts.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return amounts[a] < amounts[b] || (amounts[a] == amounts[b] && offsets[a] < offsets[b]);
+  });
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(output_amounts);
+  RCURSOR(output_txs);
+
+  const size_t *prev = NULL;
+  for (const size_t &n : order)
+  {
+    const uint64_t amount = amounts[n];
+    const uint64_t index = offsets[n];
+
+    if (prev && amounts[*prev] == amount && offsets[*prev] == index)
+    {
+      outputs[n] = outputs[*prev];
+      if (tx_out_indices)
+        (*tx_out_indices)[n] = (*tx_out_indices)[*prev];
+      prev = &n;
+      continue;
+    }
+
+    MDB_val_set(k, amount);
+    MDB_val v;
+    int get_result = MDB_NOTFOUND;
+    if (prev && amounts[*prev] == amount && offsets[*prev] + 1 == index)
+    {
+      get_result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_NEXT_DUP);
+      if (get_result == 0 && ((const outkey *)v.mv_data)->amount_index != index)
+        get_result = MDB_NOTFOUND;
+    }
+    if (get_result)
+    {
+      MDB_val_set(vi, index);
+      get_result = mdb_cursor_get(m_cur_output_amounts, &k, &vi, MDB_GET_BOTH);
+      v = vi;
+    }
+    if (get_result == MDB_NOTFOUND)
+      throw1(OUTPUT_DNE((std::string("Attempting to get output pubkey by amount ") + boost::lexical_cast<std::string>(amount) + ", index " + boost::lexical_cast<std::string>(index) + ", but key does not exist").c_str()));
+    else if (get_result)
+      throw0(DB_ERROR(lmdb_error("Error attempting to retrieve an output pubkey from the db", get_result).c_str()));
+
+    output_data_t &data = outputs[n];
+    if (amount == 0)
+    {
+      const outkey *okp = (const outkey *)v.mv_data;
+      data = okp->data;
+    }
+    else
+    {
+      const pre_rct_outkey *okp = (const pre_rct_outkey *)v.mv_data;
+      memcpy(&data, &okp->data, sizeof(pre_rct_output_data_t));
+      data.commitment = rct::zeroCommit(amount);
+    }
+
+    if (tx_out_indices)
+    {
+      MDB_val_set(vt, ((const outkey *)v.mv_data)->output_id);
+      get_result = mdb_cursor_get(m_cur_output_txs, (MDB_val *)&zerokval, &vt, MDB_GET_BOTH);
+      if (get_result == MDB_NOTFOUND)
+        throw1(OUTPUT_DNE("output with given index not in db"));
+      else if (get_result)
+        throw0(DB_ERROR("DB error attempting to fetch output tx hash"));
+
+      const outtx *ot = (const outtx *)vt.mv_data;
+      (*tx_out_indices)[n] = tx_out_index(ot->tx_hash, ot->local_index);
+    }
+    prev = &n;
+  }
+
+  TXN_POSTFIX_RDONLY();
+
+  TIME_MEASURE_FINISH(db3);
+  LOG_PRINT_L3("db3: " << db3);
+}
+
 std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> BlockchainLMDB::get_output_histogram(const std::vector<uint64_t> &amounts, bool unlocked, uint64_t recent_cutoff) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -2930,10 +4109,347 @@ void BlockchainLMDB::fixup()
 
 #define LOGIF(y)    if (y <= epee::log_space::log_singletone::get_log_detalisation_level())
 
+void BlockchainLMDB::migrate_0_1()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  const uint64_t chunk_size = 1000;
+  uint64_t copied = 0;
+  int result;
+  MDB_dbi o_txs;
+  MDB_val k, v;
+
+  LOG_PRINT_YELLOW("Migrating blockchain from DB version 0 to 1 - this may take a while:", LOG_LEVEL_0);
+  LOG_PRINT_L0("splitting transactions into pruned and prunable data...");
+
+  // copied in chunks, each in its own txn, so the map can be resized in
+  // between; a chunk picks up after the last tx copied
+  bool done = false;
+  while (!done)
+  {
+    if (need_resize())
+    {
+      LOG_PRINT_L0("LMDB memory map needs to be resized, doing that now.");
+      do_resize();
+    }
+
+    mdb_txn_safe txn;
+    if ((result = mdb_txn_begin(m_env, NULL, 0, txn)))
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+    lmdb_db_open(txn, LMDB_TXS, MDB_INTEGERKEY, o_txs, "Failed to open db handle for txs");
+
+    MDB_cursor *c_old, *c_pruned, *c_prunable, *c_prunable_hash;
+    if ((result = mdb_cursor_open(txn, o_txs, &c_old)))
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for txs: ", result).c_str()));
+    if ((result = mdb_cursor_open(txn, m_txs_pruned, &c_pruned)))
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for txs_pruned: ", result).c_str()));
+    if ((result = mdb_cursor_open(txn, m_txs_prunable, &c_prunable)))
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for txs_prunable: ", result).c_str()));
+    if ((result = mdb_cursor_open(txn, m_txs_prunable_hash, &c_prunable_hash)))
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for txs_prunable_hash: ", result).c_str()));
+
+    result = mdb_cursor_get(c_pruned, &k, &v, MDB_LAST);
+    if (result == 0)
+    {
+      uint64_t next_tx_id = *(const uint64_t *)k.mv_data + 1;
+      MDB_val_set(kr, next_tx_id);
+      result = mdb_cursor_get(c_old, &kr, &v, MDB_SET_RANGE);
+      k = kr;
+    }
+    else if (result == MDB_NOTFOUND)
+      result = mdb_cursor_get(c_old, &k, &v, MDB_FIRST);
+
+    for (uint64_t n = 0; n < chunk_size; ++n)
+    {
+      if (n > 0)
+        result = mdb_cursor_get(c_old, &k, &v, MDB_NEXT);
+      if (result == MDB_NOTFOUND)
+      {
+        done = true;
+        break;
+      }
+      if (result)
+        throw0(DB_ERROR(lmdb_error("Failed to get a record from txs: ", result).c_str()));
+
+      const blobdata bd(reinterpret_cast<const char*>(v.mv_data), v.mv_size);
+      transaction tx;
+      blobdata pruned_blob;
+      if (!parse_and_validate_tx_from_blob(bd, tx) || !tx_to_pruned_blob(tx, pruned_blob) || pruned_blob.size() > bd.size())
+        throw0(DB_ERROR("Failed to split tx from blob retrieved from the db"));
+      const blobdata prunable_blob = bd.substr(pruned_blob.size());
+      crypto::hash prunable_hash = get_transaction_prunable_hash(tx, prunable_blob);
+
+      MDB_val_copy<blobdata> pruned(pruned_blob);
+      if ((result = mdb_cursor_put(c_pruned, &k, &pruned, MDB_APPEND)))
+        throw0(DB_ERROR(lmdb_error("Failed to put a record into txs_pruned: ", result).c_str()));
+      MDB_val_copy<blobdata> prunable(prunable_blob);
+      if ((result = mdb_cursor_put(c_prunable, &k, &prunable, MDB_APPEND)))
+        throw0(DB_ERROR(lmdb_error("Failed to put a record into txs_prunable: ", result).c_str()));
+      MDB_val_set(val_prunable_hash, prunable_hash);
+      if ((result = mdb_cursor_put(c_prunable_hash, &k, &val_prunable_hash, MDB_APPEND)))
+        throw0(DB_ERROR(lmdb_error("Failed to put a record into txs_prunable_hash: ", result).c_str()));
+      ++copied;
+    }
+
+    mdb_cursor_close(c_old);
+    mdb_cursor_close(c_pruned);
+    mdb_cursor_close(c_prunable);
+    mdb_cursor_close(c_prunable_hash);
+    txn.commit();
+
+    LOGIF(1) {
+      if (copied % (chunk_size * 100) == 0)
+        LOG_PRINT_L1(copied << " txs split...");
+    }
+  }
+
+  mdb_txn_safe txn;
+  if ((result = mdb_txn_begin(m_env, NULL, 0, txn)))
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+  lmdb_db_open(txn, LMDB_TXS, MDB_INTEGERKEY, o_txs, "Failed to open db handle for txs");
+  if ((result = mdb_drop(txn, o_txs, 1)))
+    throw0(DB_ERROR(lmdb_error("Failed to delete old txs table: ", result).c_str()));
+
+  MDB_stat db_stats;
+  if ((result = mdb_stat(txn, m_txs_pruned, &db_stats)))
+    throw0(DB_ERROR(lmdb_error("Failed to query m_txs_pruned: ", result).c_str()));
+  m_num_txs = db_stats.ms_entries;
+
+  MDB_val_copy<const char*> vk("version");
+  MDB_val_copy<uint32_t> vv(1);
+  if ((result = mdb_put(txn, m_properties, &vk, &vv, 0)))
+    throw0(DB_ERROR(lmdb_error("Failed to update version for the db: ", result).c_str()));
+  txn.commit();
+
+  LOG_PRINT_L0("Migrated " << copied << " txs");
+}
+
+void BlockchainLMDB::migrate_1_2()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  const uint64_t chunk_size = 1000;
+  uint64_t height = 0;
+  int result;
+  MDB_val k, v;
+
+  LOG_PRINT_YELLOW("Migrating blockchain from DB version 1 to 2 - this may take a while:", LOG_LEVEL_0);
+  LOG_PRINT_L0("building block header records...");
+
+  // built in chunks, each in its own txn, so the map can be resized in
+  // between; a chunk picks up after the last header written
+  while (true)
+  {
+    if (need_resize())
+    {
+      LOG_PRINT_L0("LMDB memory map needs to be resized, doing that now.");
+      do_resize();
+    }
+
+    mdb_txn_safe txn;
+    if ((result = mdb_txn_begin(m_env, NULL, 0, txn)))
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+
+    MDB_cursor *c_blocks, *c_block_info, *c_block_header_info, *c_tx_indices, *c_txs_pruned;
+    if ((result = mdb_cursor_open(txn, m_blocks, &c_blocks)))
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for blocks: ", result).c_str()));
+    if ((result = mdb_cursor_open(txn, m_block_info, &c_block_info)))
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for block_info: ", result).c_str()));
+    if ((result = mdb_cursor_open(txn, m_block_header_info, &c_block_header_info)))
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for block_header_info: ", result).c_str()));
+    if ((result = mdb_cursor_open(txn, m_tx_indices, &c_tx_indices)))
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for tx_indices: ", result).c_str()));
+    if ((result = mdb_cursor_open(txn, m_txs_pruned, &c_txs_pruned)))
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for txs_pruned: ", result).c_str()));
+
+    result = mdb_cursor_get(c_block_header_info, &k, &v, MDB_LAST);
+    if (result == 0)
+      height = ((const block_header_info *)v.mv_data)->height + 1;
+    else if (result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to get the last record from block_header_info: ", result).c_str()));
+
+    difficulty_type prev_cumulative_difficulty = 0;
+    if (height > 0)
+    {
+      MDB_val_copy<uint64_t> prev_height(height - 1);
+      v = prev_height;
+      if ((result = mdb_cursor_get(c_block_info, (MDB_val *)&zerokval, &v, MDB_GET_BOTH)))
+        throw0(DB_ERROR(lmdb_error("Failed to get a record from block_info: ", result).c_str()));
+      prev_cumulative_difficulty = ((const mdb_block_info *)v.mv_data)->bi_diff;
+    }
+
+    const uint64_t chunk_end = std::min(height + chunk_size, m_height);
+    for (; height < chunk_end; ++height)
+    {
+      MDB_val_copy<uint64_t> key(height);
+      if ((result = mdb_cursor_get(c_blocks, &key, &v, MDB_SET)))
+        throw0(DB_ERROR(lmdb_error("Failed to get a record from blocks: ", result).c_str()));
+      block blk;
+      if (!parse_and_validate_block_from_blob(blobdata(reinterpret_cast<const char*>(v.mv_data), v.mv_size), blk))
+        throw0(DB_ERROR("Failed to parse block from blob retrieved from the db"));
+
+      v = key;
+      if ((result = mdb_cursor_get(c_block_info, (MDB_val *)&zerokval, &v, MDB_GET_BOTH)))
+        throw0(DB_ERROR(lmdb_error("Failed to get a record from block_info: ", result).c_str()));
+      const mdb_block_info *bi = (const mdb_block_info *)v.mv_data;
+
+      block_header_info bhi;
+      bhi.height = height;
+      bhi.timestamp = bi->bi_timestamp;
+      bhi.coins = bi->bi_coins;
+      bhi.size = bi->bi_size;
+      bhi.difficulty = bi->bi_diff - prev_cumulative_difficulty;
+      bhi.cumulative_difficulty = bi->bi_diff;
+      bhi.reward = 0;
+      for (const tx_out& out : blk.miner_tx.vout)
+        bhi.reward += out.amount;
+      bhi.fee = 0;
+      bhi.hash = bi->bi_hash;
+      bhi.prev_id = blk.prev_id;
+      bhi.nonce = blk.nonce;
+      bhi.tx_count = blk.tx_hashes.size();
+      bhi.major_version = blk.major_version;
+      bhi.minor_version = blk.minor_version;
+      prev_cumulative_difficulty = bi->bi_diff;
+
+      // the fee only needs the pruned part of the txs
+      for (const crypto::hash& tx_hash : blk.tx_hashes)
+      {
+        MDB_val_set(val_h, tx_hash);
+        if ((result = mdb_cursor_get(c_tx_indices, (MDB_val *)&zerokval, &val_h, MDB_GET_BOTH)))
+          throw0(DB_ERROR(lmdb_error(std::string("Failed to get tx index for tx hash ") + epee::string_tools::pod_to_hex(tx_hash) + ": ", result).c_str()));
+        MDB_val_set(val_tx_id, ((const txindex *)val_h.mv_data)->data.tx_id);
+        if ((result = mdb_cursor_get(c_txs_pruned, &val_tx_id, &v, MDB_SET)))
+          throw0(DB_ERROR(lmdb_error("Failed to get a record from txs_pruned: ", result).c_str()));
+        transaction tx;
+        if (!parse_and_validate_tx_base_from_blob(blobdata(reinterpret_cast<const char*>(v.mv_data), v.mv_size), tx))
+          throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
+        bhi.fee += get_tx_fee(tx);
+      }
+
+      MDB_val_set(val_bhi, bhi);
+      if ((result = mdb_cursor_put(c_block_header_info, (MDB_val *)&zerokval, &val_bhi, MDB_APPENDDUP)))
+        throw0(DB_ERROR(lmdb_error("Failed to put a record into block_header_info: ", result).c_str()));
+    }
+
+    mdb_cursor_close(c_blocks);
+    mdb_cursor_close(c_block_info);
+    mdb_cursor_close(c_block_header_info);
+    mdb_cursor_close(c_tx_indices);
+    mdb_cursor_close(c_txs_pruned);
+
+    if (height == m_height)
+    {
+      MDB_val_copy<const char*> vk("version");
+      MDB_val_copy<uint32_t> vv(2);
+      if ((result = mdb_put(txn, m_properties, &vk, &vv, 0)))
+        throw0(DB_ERROR(lmdb_error("Failed to update version for the db: ", result).c_str()));
+      txn.commit();
+      break;
+    }
+    txn.commit();
+
+    LOGIF(1) {
+      if (height % (chunk_size * 100) == 0)
+        LOG_PRINT_L1(height << " block headers built...");
+    }
+  }
+
+  LOG_PRINT_L0("Built " << m_height << " block header records");
+}
+
+void BlockchainLMDB::migrate_2_3()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  int result;
+  MDB_val k, v;
+
+  LOG_PRINT_YELLOW("Migrating blockchain from DB version 2 to 3 - this may take a while:", LOG_LEVEL_0);
+  LOG_PRINT_L0("converting aliases to the binary format and indexing them by address...");
+
+  if (need_resize())
+  {
+    LOG_PRINT_L0("LMDB memory map needs to be resized, doing that now.");
+    do_resize();
+  }
+
+  mdb_txn_safe txn;
+  if ((result = mdb_txn_begin(m_env, NULL, 0, txn)))
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+
+  // before version 3, the data was the height as a decimal string followed
+  // by the 98 character address and a NUL
+  std::vector<std::pair<std::string, std::pair<uint64_t, std::string>>> old_aliases;
+  MDB_cursor *c_aliases;
+  if ((result = mdb_cursor_open(txn, m_aliases, &c_aliases)))
+    throw0(DB_ERROR(lmdb_error("Failed to open a cursor for aliases: ", result).c_str()));
+  result = mdb_cursor_get(c_aliases, &k, &v, MDB_FIRST);
+  while (result == 0)
+  {
+    const size_t address_size = 98;
+    if (v.mv_size <= address_size + 1)
+      throw0(DB_ERROR("Unexpected alias record size in the db"));
+    const size_t height_size = v.mv_size - address_size - 1;
+    const std::string height((const char*)v.mv_data, height_size);
+    const std::string address((const char*)v.mv_data + height_size, address_size);
+    old_aliases.push_back({std::string((const char*)k.mv_data), {std::stoull(height), address}});
+    result = mdb_cursor_get(c_aliases, &k, &v, MDB_NEXT);
+  }
+  if (result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Failed to enumerate aliases: ", result).c_str()));
+  mdb_cursor_close(c_aliases);
+
+  for (const auto& a : old_aliases)
+  {
+    MDB_val_copy<const char*> ka(a.first.c_str());
+    MDB_val_copy<blobdata> va(alias_record(a.second.first, a.second.second));
+    if ((result = mdb_put(txn, m_aliases, &ka, &va, 0)))
+      throw0(DB_ERROR(lmdb_error("Failed to put a record into aliases: ", result).c_str()));
+    crypto::hash address_key = alias_address_key(a.second.second);
+    MDB_val_set(kaa, address_key);
+    MDB_val_copy<blobdata> vaa(alias_record(a.second.first, a.first));
+    if ((result = mdb_put(txn, m_alias_addresses, &kaa, &vaa, MDB_NODUPDATA)))
+      throw0(DB_ERROR(lmdb_error("Failed to put a record into alias_addresses: ", result).c_str()));
+  }
+
+  MDB_val_copy<const char*> vk("version");
+  MDB_val_copy<uint32_t> vv(3);
+  if ((result = mdb_put(txn, m_properties, &vk, &vv, 0)))
+    throw0(DB_ERROR(lmdb_error("Failed to update version for the db: ", result).c_str()));
+  txn.commit();
+
+  LOG_PRINT_L0("Migrated " << old_aliases.size() << " aliases");
+}
+
+void BlockchainLMDB::migrate_3_4()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  int result;
+
+  // the txpool tables themselves are created when the db is opened
+  LOG_PRINT_YELLOW("Migrating blockchain from DB version 3 to 4:", LOG_LEVEL_0);
+  LOG_PRINT_L0("the transaction pool is now kept in the db; an old poolstate.bin is no longer read");
+
+  mdb_txn_safe txn;
+  if ((result = mdb_txn_begin(m_env, NULL, 0, txn)))
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+
+  MDB_val_copy<const char*> vk("version");
+  MDB_val_copy<uint32_t> vv(4);
+  if ((result = mdb_put(txn, m_properties, &vk, &vv, 0)))
+    throw0(DB_ERROR(lmdb_error("Failed to update version for the db: ", result).c_str()));
+  txn.commit();
+}
+
 void BlockchainLMDB::migrate(const uint32_t oldversion)
 {
   switch(oldversion) {
   case 0:
+    migrate_0_1(); /* FALLTHRU */
+  case 1:
+    migrate_1_2(); /* FALLTHRU */
+  case 2:
+    migrate_2_3(); /* FALLTHRU */
+  case 3:
+    migrate_3_4(); /* FALLTHRU */
   default:
     ;
   }
@@ -32,6 +32,7 @@
 #include "blockchain_db/blockchain_db.h"
 #include "cryptonote_protocol/blobdatatype.h" // for type blobdata
 #include "ringct/rctTypes.h"
+#include "common/thread_group.h"
 #include <boost/thread/tss.hpp>
 
 #include <lmdb.h>
@@ -46,11 +47,14 @@ typedef struct mdb_txn_cursors
   MDB_cursor *m_txc_blocks;
   MDB_cursor *m_txc_block_heights;
   MDB_cursor *m_txc_block_info;
+  MDB_cursor *m_txc_block_header_info;
 
   MDB_cursor *m_txc_output_txs;
   MDB_cursor *m_txc_output_amounts;
 
-  MDB_cursor *m_txc_txs;
+  MDB_cursor *m_txc_txs_pruned;
+  MDB_cursor *m_txc_txs_prunable;
+  MDB_cursor *m_txc_txs_prunable_hash;
   MDB_cursor *m_txc_tx_indices;
   MDB_cursor *m_txc_tx_outputs;
 
@@ -59,19 +63,29 @@ typedef struct mdb_txn_cursors
   MDB_cursor *m_txc_hf_versions;
 
   MDB_cursor *m_txc_aliases;
+  MDB_cursor *m_txc_alias_addresses;
+
+  MDB_cursor *m_txc_txpool_meta;
+  MDB_cursor *m_txc_txpool_blob;
 } mdb_txn_cursors;
 
 #define m_cur_blocks	m_cursors->m_txc_blocks
 #define m_cur_block_heights	m_cursors->m_txc_block_heights
 #define m_cur_block_info	m_cursors->m_txc_block_info
+#define m_cur_block_header_info	m_cursors->m_txc_block_header_info
 #define m_cur_output_txs	m_cursors->m_txc_output_txs
 #define m_cur_output_amounts	m_cursors->m_txc_output_amounts
-#define m_cur_txs	m_cursors->m_txc_txs
+#define m_cur_txs_pruned	m_cursors->m_txc_txs_pruned
+#define m_cur_txs_prunable	m_cursors->m_txc_txs_prunable
+#define m_cur_txs_prunable_hash	m_cursors->m_txc_txs_prunable_hash
 #define m_cur_tx_indices	m_cursors->m_txc_tx_indices
 #define m_cur_tx_outputs	m_cursors->m_txc_tx_outputs
 #define m_cur_spent_keys	m_cursors->m_txc_spent_keys
 #define m_cur_hf_versions	m_cursors->m_txc_hf_versions
 #define m_cur_aliases m_cursors->m_txc_aliases
+#define m_cur_alias_addresses m_cursors->m_txc_alias_addresses
+#define m_cur_txpool_meta	m_cursors->m_txc_txpool_meta
+#define m_cur_txpool_blob	m_cursors->m_txc_txpool_blob
 
 typedef struct mdb_rflags
 {
@@ -79,14 +93,20 @@ typedef struct mdb_rflags
   bool m_rf_blocks;
   bool m_rf_block_heights;
   bool m_rf_block_info;
+  bool m_rf_block_header_info;
   bool m_rf_output_txs;
   bool m_rf_output_amounts;
-  bool m_rf_txs;
+  bool m_rf_txs_pruned;
+  bool m_rf_txs_prunable;
+  bool m_rf_txs_prunable_hash;
   bool m_rf_tx_indices;
   bool m_rf_tx_outputs;
   bool m_rf_spent_keys;
   bool m_rf_hf_versions;
   bool m_rf_aliases;
+  bool m_rf_alias_addresses;
+  bool m_rf_txpool_meta;
+  bool m_rf_txpool_blob;
 } mdb_rflags;
 
 typedef struct mdb_threadinfo
@@ -125,6 +145,7 @@ struct mdb_txn_safe
 
   static void prevent_new_txns();
   static void wait_no_active_txns();
+  static bool wait_no_active_txns(uint64_t max_wait_ms);
   static void allow_new_txns();
 
   mdb_threadinfo* m_tinfo;
@@ -177,12 +198,16 @@ public:
 
   virtual block get_block(const crypto::hash& h) const;
 
+  virtual blobdata get_block_blob(const crypto::hash& h) const;
+
   virtual uint64_t get_block_height(const crypto::hash& h) const;
 
   virtual block_header get_block_header(const crypto::hash& h) const;
 
   virtual block get_block_from_height(const uint64_t& height) const;
 
+  virtual blobdata get_block_blob_from_height(const uint64_t& height) const;
+
   virtual uint64_t get_block_timestamp(const uint64_t& height) const;
 
   virtual uint64_t get_top_block_timestamp() const;
@@ -197,10 +222,16 @@ public:
 
   virtual crypto::hash get_block_hash_from_height(const uint64_t& height) const;
 
+  virtual block_header_info get_block_header_info(const uint64_t& height) const;
+
+  virtual std::vector<block_header_info> get_block_header_info_range(const uint64_t& h1, const uint64_t& h2) const;
+
   virtual std::vector<block> get_blocks_range(const uint64_t& h1, const uint64_t& h2) const;
 
   virtual std::vector<crypto::hash> get_hashes_range(const uint64_t& h1, const uint64_t& h2) const;
 
+  virtual std::vector<blobdata> get_blocks_blobs_range(const uint64_t& h1, const uint64_t& h2) const;
+
   virtual crypto::hash top_block_hash() const;
 
   virtual block get_top_block() const;
@@ -214,6 +245,20 @@ public:
 
   virtual transaction get_tx(const crypto::hash& h) const;
 
+  virtual bool get_tx_blob(const crypto::hash& h, blobdata& tx) const;
+
+  virtual transaction get_pruned_tx(const crypto::hash& h) const;
+
+  virtual bool get_pruned_tx_blob(const crypto::hash& h, blobdata& tx) const;
+
+  virtual bool get_prunable_tx_blob(const crypto::hash& h, blobdata& prunable) const;
+
+  virtual bool get_prunable_tx_hash(const crypto::hash& tx_hash, crypto::hash& prunable_hash) const;
+
+  virtual uint64_t prune_blockchain(uint64_t height);
+
+  virtual uint64_t get_pruned_height() const;
+
   virtual uint64_t get_tx_count() const;
 
   virtual std::vector<transaction> get_tx_list(const std::vector<crypto::hash>& hlist) const;
@@ -225,6 +270,7 @@ public:
   virtual output_data_t get_output_key(const uint64_t& amount, const uint64_t& index);
   virtual output_data_t get_output_key(const uint64_t& global_index) const;
   virtual void get_output_key(const uint64_t &amount, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs);
+  virtual void get_output_keys(const std::vector<uint64_t> &amounts, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs, std::vector<tx_out_index> *tx_out_indices = NULL) const;
 
   virtual tx_out_index get_output_tx_and_index_from_global(const uint64_t& index) const;
   virtual void get_output_tx_and_index_from_global(const std::vector<uint64_t> &global_indices,
@@ -242,10 +288,16 @@ public:
   virtual bool for_all_transactions(std::function<bool(const crypto::hash&, const cryptonote::transaction&)>) const;
   virtual bool for_all_outputs(std::function<bool(uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx)> f) const;
 
-  virtual void load_aliases();
+  virtual bool for_blocks_parallel(uint64_t h1, uint64_t h2, size_t num_shards, std::function<bool(size_t, uint64_t, const crypto::hash&, const cryptonote::block&)> f) const;
+  virtual bool for_all_transactions_parallel(size_t num_shards, std::function<bool(size_t, const crypto::hash&, const cryptonote::transaction&)> f) const;
+  virtual bool for_all_outputs_parallel(size_t num_shards, std::function<bool(size_t, uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx)> f) const;
+
   virtual std::string get_alias_address(const std::string& alias, bool get_if_premature) const;
   virtual std::vector<cryptonote::alias> get_address_aliases(const std::string& address) const;
 
+  virtual bool update_txpool_txes(const std::vector<txpool_tx_update>& updates);
+  virtual bool for_all_txpool_txes(std::function<bool(const crypto::hash&, const cryptonote::blobdata&, const cryptonote::blobdata&)> f) const;
+
   virtual uint64_t add_block( const block& blk
                             , const size_t& block_size
                             , const difficulty_type& cumulative_difficulty
@@ -281,16 +333,28 @@ public:
   std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> get_output_histogram(const std::vector<uint64_t> &amounts, bool unlocked, uint64_t recent_cutoff) const;
 
 private:
-  void do_resize(uint64_t size_increase=0);
+  // max_wait_ms, if given, bounds how long new readers are held off while
+  // waiting for active ones to finish; the resize is skipped if they don't
+  bool do_resize(uint64_t size_increase=0, uint64_t max_wait_ms=0);
+
+  void start_background_sync(int mdb_flags);
+  void commit_done();
+  void sync_worker();
+
+  // runs fn(shard) for each of num_shards shards of a parallel walk, and
+  // returns once all are done; fn must not start a parallel walk itself
+  void run_shards(size_t num_shards, const std::function<void(size_t)> &fn) const;
 
   bool need_resize(uint64_t threshold_size=0) const;
   void check_and_resize_for_batch(uint64_t batch_num_blocks);
+  void check_and_resize_for_growth();
   uint64_t get_estimated_batch_size(uint64_t batch_num_blocks) const;
 
   virtual void add_block( const block& blk
                 , const size_t& block_size
                 , const difficulty_type& cumulative_difficulty
                 , const uint64_t& coins_generated
+                , const uint64_t& fee
                 , const crypto::hash& block_hash
                 );
 
@@ -353,13 +417,28 @@ private:
   // migrate from older DB version to current
   void migrate(const uint32_t oldversion);
 
+  // split the txs table into pruned and prunable data
+  void migrate_0_1();
+
+  // build the block_header_info table from the stored blocks
+  void migrate_1_2();
+
+  // store aliases in binary form and index them by address
+  void migrate_2_3();
+
+  // add the txpool_meta and txpool_blob tables
+  void migrate_3_4();
+
   MDB_env* m_env;
 
   MDB_dbi m_blocks;
   MDB_dbi m_block_heights;
   MDB_dbi m_block_info;
+  MDB_dbi m_block_header_info;
 
-  MDB_dbi m_txs;
+  MDB_dbi m_txs_pruned;
+  MDB_dbi m_txs_prunable;
+  MDB_dbi m_txs_prunable_hash;
   MDB_dbi m_tx_indices;
   MDB_dbi m_tx_outputs;
 
@@ -372,14 +451,19 @@ private:
 
   MDB_dbi m_properties;
   MDB_dbi m_aliases;
+  MDB_dbi m_alias_addresses;
 
-  aliases m_aliases_multi_index;
+  MDB_dbi m_txpool_meta;
+  MDB_dbi m_txpool_blob;
 
   uint64_t m_height;
   uint64_t m_num_txs;
   uint64_t m_num_outputs;
   mutable uint64_t m_cum_size;	// used in batch size estimation
   mutable int m_cum_count;
+  uint64_t m_growth_height;	// height and map space used when the write rate was last sampled
+  uint64_t m_growth_size_used;
+  uint64_t m_bytes_per_block;	// recent write rate, 0 until sampled
   std::string m_folder;
   mdb_txn_safe* m_write_txn; // may point to either a short-lived txn or a batch txn
   mdb_txn_safe* m_write_batch_txn; // persist batch txn outside of BlockchainLMDB
@@ -391,6 +475,22 @@ private:
   mdb_txn_cursors m_wcursors;
   mutable boost::thread_specific_ptr<mdb_threadinfo> m_tinfo;
 
+  // With MDB_NOMETASYNC (but not MDB_NOSYNC), a commit only flushes its data
+  // pages and m_sync_thread flushes the meta page behind it. Each commit's
+  // data flush also flushes the meta page of the one before, so a crash can
+  // only lose the last commit, and never leaves the db inconsistent.
+  boost::thread m_sync_thread;
+  boost::mutex m_sync_mutex;
+  boost::condition_variable m_sync_cond;
+  uint64_t m_commits;	// write txns committed since open
+  uint64_t m_durable_commits;	// of those, how many are known to be on disk
+  int m_sync_result;	// error from the last background sync, 0 if none
+  bool m_sync_stop;
+
+  // threads for the parallel walks, started on first use
+  mutable std::unique_ptr<tools::thread_group> m_walk_threads;
+  mutable boost::mutex m_walk_threads_lock;
+
 #if defined(__arm__)
   // force a value so it can compile with 32-bit ARM
   constexpr static uint64_t DEFAULT_MAPSIZE = 1LL << 31;
@@ -403,6 +503,21 @@ private:
 #endif
 
   constexpr static float RESIZE_PERCENT = 0.8f;
+
+  // the map is only address space until written to, so 64-bit hosts
+  // reserve this much up front to keep resizes rare
+  constexpr static uint64_t RESERVED_MAPSIZE = 1LL << 37;
+
+  // blocks of writes the free map space should cover; below the first the
+  // map is grown early, below the second it is grown right away
+  constexpr static uint64_t RESIZE_LOOKAHEAD_BLOCKS = 20000;
+  constexpr static uint64_t RESIZE_URGENT_BLOCKS = 1000;
+
+  // how long an early resize may hold off new readers
+  constexpr static uint64_t RESIZE_MAX_WAIT_MS = 20;
+
+  // free map space pool writes leave on top of twice their own size
+  constexpr static uint64_t TXPOOL_WRITE_MIN_FREE = 1 << 24;
 };
 
 }  // namespace cryptonote
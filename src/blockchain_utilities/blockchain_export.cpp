@@ -42,6 +42,7 @@ int main(int argc, char* argv[]) {
   uint32_t log_level = 0;
   uint64_t block_stop = 0;
   bool blocks_dat = false;
+  bool compress = false;
 
   tools::sanitize_locale();
 
@@ -60,6 +61,7 @@ int main(int argc, char* argv[]) {
       , false
   };
   const command_line::arg_descriptor<bool> arg_blocks_dat = {"blocksdat", "Output in blocks.dat format", blocks_dat};
+  const command_line::arg_descriptor<bool> arg_compress = {"compress", "Output a bootstrap file with compressed multi-block chunks", compress};
 
   command_line::add_arg(desc_cmd_sett, command_line::arg_data_dir, default_data_path.string());
   command_line::add_arg(desc_cmd_sett, command_line::arg_testnet_data_dir, default_testnet_data_path.string());
@@ -68,6 +70,7 @@ int main(int argc, char* argv[]) {
   command_line::add_arg(desc_cmd_sett, arg_log_level);
   command_line::add_arg(desc_cmd_sett, arg_block_stop);
   command_line::add_arg(desc_cmd_sett, arg_blocks_dat);
+  command_line::add_arg(desc_cmd_sett, arg_compress);
 
   command_line::add_arg(desc_cmd_only, command_line::arg_help);
 
@@ -101,6 +104,7 @@ int main(int argc, char* argv[]) {
 
   bool opt_testnet = command_line::get_arg(vm, arg_testnet_on);
   bool opt_blocks_dat = command_line::get_arg(vm, arg_blocks_dat);
+  bool opt_compress = command_line::get_arg(vm, arg_compress);
 
   std::string m_config_folder;
 
@@ -110,7 +114,7 @@ int main(int argc, char* argv[]) {
   if (command_line::has_arg(vm, arg_output_file))
     output_file_path = boost::filesystem::path(command_line::get_arg(vm, arg_output_file));
   else
-    output_file_path = boost::filesystem::path(m_config_folder) / "export" / BLOCKCHAIN_RAW;
+    output_file_path = boost::filesystem::path(m_config_folder) / "export" / (opt_compress ? BLOCKCHAIN_RAW_COMPRESSED : BLOCKCHAIN_RAW);
   LOG_PRINT_L0("Export output file: " << output_file_path.string());
 
   // If we wanted to use the memory pool, we would set up a fake_core.
@@ -163,7 +167,7 @@ int main(int argc, char* argv[]) {
   else
   {
     BootstrapFile bootstrap;
-    r = bootstrap.store_blockchain_raw(core_storage, NULL, output_file_path, block_stop);
+    r = bootstrap.store_blockchain_raw(core_storage, NULL, output_file_path, block_stop, opt_compress);
   }
   CHECK_AND_ASSERT_MES(r, false, "Failed to export blockchain raw data");
   LOG_PRINT_L0("Blockchain raw data exported OK");
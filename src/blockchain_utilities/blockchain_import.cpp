@@ -31,6 +31,7 @@
 #include <cstdio>
 #include <algorithm>
 #include <fstream>
+#include <memory>
 
 #include <boost/filesystem.hpp>
 #include "bootstrap_file.h"
@@ -65,6 +66,10 @@ uint64_t db_batch_size = 100;
 // frequently saved
 uint64_t db_batch_size_verify = 5000;
 
+// when verifying, number of blocks whose PoW hashes and spent outputs are
+// worked out together, in parallel, before they are added
+uint64_t verify_span_size = 100;
+
 std::string refresh_string = "\r                                    \r";
 }
 
@@ -180,6 +185,87 @@ int pop_blocks(FakeCore& simple_core, int num_blocks)
   return num_blocks;
 }
 
+// Adds one block from the bootstrap file. h is the one-based height of the
+// block. Returns 0 if the block was added, otherwise the quit code: 1 if
+// what was added so far can be committed, 2 if not.
+template <typename FakeCore>
+int import_block(FakeCore& simple_core, const bootstrap::block_package& bp, uint64_t h)
+{
+  const block& b = bp.block;
+  LOG_PRINT_L2("block prev_id: " << b.prev_id << ENDL);
+
+  std::vector<transaction> txs;
+
+  // tx number 1: coinbase tx
+  // tx number 2 onwards: archived_txs
+  unsigned int tx_num = 1;
+  for (const transaction& tx : bp.txs)
+  {
+    ++tx_num;
+    // add blocks with verification.
+    // for Blockchain and blockchain_storage add_new_block().
+    if (opt_verify)
+    {
+      uint8_t version = simple_core.m_storage.get_current_hard_fork_version();
+      tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+      bool r = true;
+      r = simple_core.m_pool.add_tx(tx, tvc, true, true, version);
+      if (!r)
+      {
+        LOG_PRINT_RED_L0("failed to add transaction to transaction pool, height=" << h <<", tx_num=" << tx_num);
+        return 1;
+      }
+    }
+    else
+    {
+      // for add_block() method, without (much) processing.
+      // don't add coinbase transaction to txs.
+      //
+      // because add_block() calls
+      // add_transaction(blk_hash, blk.miner_tx) first, and
+      // then a for loop for the transactions in txs.
+      txs.push_back(tx);
+    }
+  }
+
+  if (opt_verify)
+  {
+    block_verification_context bvc = boost::value_initialized<block_verification_context>();
+    simple_core.m_storage.add_new_block(b, bvc);
+
+    if (bvc.m_verifivation_failed)
+    {
+      LOG_PRINT_L0("Failed to add block to blockchain, verification failed, height = " << h);
+      LOG_PRINT_L0("skipping rest of file");
+      // ok to commit previously batched data because it failed only in
+      // verification of potential new block with nothing added to batch
+      // yet
+      return 1;
+    }
+    if (! bvc.m_added_to_main_chain)
+    {
+      LOG_PRINT_L0("Failed to add block to blockchain, height = " << h);
+      LOG_PRINT_L0("skipping rest of file");
+      // make sure we don't commit partial block data
+      return 2;
+    }
+  }
+  else
+  {
+    try
+    {
+      simple_core.add_block(b, bp.block_size, bp.cumulative_difficulty, bp.coins_generated, txs);
+    }
+    catch (const std::exception& e)
+    {
+      std::cout << refresh_string;
+      LOG_PRINT_RED_L0("Error adding block to blockchain: " << e.what());
+      return 2; // make sure we don't commit partial block data
+    }
+  }
+  return 0;
+}
+
 template <typename FakeCore>
 int import_from_file(FakeCore& simple_core, const std::string& import_file_path, uint64_t block_stop=0)
 {
@@ -207,24 +293,9 @@ int import_from_file(FakeCore& simple_core, const std::string& import_file_path,
   std::cout << "Preparing to read blocks..." << ENDL;
   std::cout << ENDL;
 
-  std::ifstream import_file;
-  import_file.open(import_file_path, std::ios_base::binary | std::ifstream::in);
-
   uint64_t h = 0;
   uint64_t num_imported = 0;
-  if (import_file.fail())
-  {
-    LOG_PRINT_L0("import_file.open() fail");
-    return false;
-  }
-
-  // 4 byte magic + (currently) 1024 byte header structures
-  bootstrap.seek_to_first_chunk(import_file);
-
-  block b;
-  transaction tx;
   int quit = 0;
-  uint64_t bytes_read = 0;
 
   uint64_t start_height = 1;
   if (opt_resume)
@@ -255,246 +326,146 @@ int import_from_file(FakeCore& simple_core, const std::string& import_file_path,
   if (use_batch)
     simple_core.batch_start(db_batch_size);
 
+  // Blocks are hashed with all cores, and the db is only synced at batch
+  // commits. Below the compiled-in block hashes, blocks are checked against
+  // those and their txs' signatures aren't checked, as when syncing.
+  if (opt_verify)
+    simple_core.m_storage.set_user_options(tools::get_max_concurrency(), 0, db_nosync, true);
+
   LOG_PRINT_L0("Reading blockchain from bootstrap file...");
   std::cout << ENDL;
 
-  // Within the loop, we skip to start_height before we start adding.
-  // TODO: Not a bottleneck, but we can use what's done in count_blocks() and
-  // only do the chunk size reads, skipping the chunk content reads until we're
-  // at start_height.
+  // The file is read and parsed ahead of the import on other threads,
+  // starting at start_height. Compressed files are read through their chunk
+  // index, with chunks decompressed on several threads.
+  std::unique_ptr<BootstrapReader> reader;
+  if (bootstrap.compressed())
+    reader.reset(new BootstrapChunkReader(import_file_path, bootstrap.get_chunk_index(), start_height));
+  else
+    reader.reset(new BootstrapRawReader(import_file_path, start_height));
+  h = start_height;
+
+  // time spent per stage, in ms
+  uint64_t read_time = 0;
+  uint64_t prepare_time = 0;
+  uint64_t add_time = 0;
+  uint64_t commit_time = 0;
+  const uint64_t import_start = epee::misc_utils::get_tick_count();
+
+  // When verifying, blocks are added a span at a time, as the daemon does
+  // when syncing: the span's PoW hashes and the outputs its txs spend are
+  // worked out on several threads first, then the blocks are added in order.
+  const size_t span_size = opt_verify ? verify_span_size : 1;
+  std::vector<bootstrap::block_package> span;
+  bool end_of_file = false;
+  int display_interval = 1000;
+  int progress_interval = 10;
   while (! quit)
   {
-    uint32_t chunk_size;
-    std::string buffer(sizeof(chunk_size), '\0');
-    import_file.read(&buffer.front(), sizeof(chunk_size));
-    // TODO: bootstrap.read_chunk();
-    if (! import_file) {
-      std::cout << refresh_string;
-      LOG_PRINT_L0("End of file reached");
-      quit = 1;
-      break;
-    }
-    bytes_read += sizeof(chunk_size);
-
-    if (! ::serialization::parse_binary(buffer, chunk_size))
+    uint64_t t = epee::misc_utils::get_tick_count();
+    span.clear();
+    while (span.size() < span_size && h + span.size() <= block_stop)
     {
-      throw std::runtime_error("Error in deserialization of chunk size");
+      bootstrap::block_package bp;
+      try
+      {
+        if (! reader->read_block(bp))
+        {
+          end_of_file = true;
+          break;
+        }
+      }
+      catch (const std::exception& e)
+      {
+        std::cout << refresh_string;
+        LOG_PRINT_RED_L0("exception while reading from file, height=" << h + span.size() << ": " << e.what());
+        return 2;
+      }
+      span.push_back(std::move(bp));
     }
-    LOG_PRINT_L3("chunk_size: " << chunk_size);
+    read_time += epee::misc_utils::get_tick_count() - t;
 
-    if (chunk_size > MAX_BLOCK_SIZE_NOT_CHECKED)
+    if (opt_verify && span.size() > 1)
     {
-      LOG_PRINT_L0("NOTE: chunk_size " << chunk_size << " > " << MAX_BLOCK_SIZE_NOT_CHECKED);
-    }
-    else if (chunk_size == 0) {
-      LOG_PRINT_L0("ERROR: chunk_size == 0");
-      return 2;
-    }
-    buffer.assign(chunk_size, '\0');
-    import_file.read(&buffer.front(), chunk_size);
-    if (!import_file) {
-      LOG_PRINT_L0("ERROR: unexpected end of file: bytes read before error: "
-          << import_file.gcount() << " of chunk_size " << chunk_size);
-      return 2;
+      t = epee::misc_utils::get_tick_count();
+      std::list<block_complete_entry> blocks;
+      for (const auto& bp : span)
+      {
+        block_complete_entry entry;
+        entry.block = block_to_blob(bp.block);
+        for (const auto& tx : bp.txs)
+          entry.txs.push_back(tx_to_blob(tx));
+        blocks.push_back(std::move(entry));
+      }
+      simple_core.m_storage.prepare_handle_incoming_blocks(blocks);
+      prepare_time += epee::misc_utils::get_tick_count() - t;
     }
-    bytes_read += chunk_size;
-    LOG_PRINT_L3("Total bytes read: " << bytes_read);
 
-    if (h + NUM_BLOCKS_PER_CHUNK < start_height + 1)
-    {
-      h += NUM_BLOCKS_PER_CHUNK;
-      continue;
-    }
-    if (h > block_stop)
+    for (const auto& bp : span)
     {
-      std::cout << refresh_string << "block " << h-1
-        << " / " << block_stop
-        << std::flush;
-      std::cout << ENDL << ENDL;
-      LOG_PRINT_L0("Specified block number reached - stopping.  block: " << h-1 << "  total blocks: " << h);
-      quit = 1;
-      break;
-    }
+      ++h;
+      if ((h-1) % display_interval == 0)
+      {
+        std::cout << refresh_string;
+        LOG_PRINT_L0("loading block number " << h-1);
+      }
+      else
+      {
+        LOG_PRINT_L3("loading block number " << h-1);
+      }
+      if ((h-1) % progress_interval == 0)
+      {
+        std::cout << refresh_string << "block " << h-1
+          << " / " << block_stop
+          << std::flush;
+      }
 
-    try
-    {
-      bootstrap::block_package bp;
-      if (! ::serialization::parse_binary(buffer, bp))
-        throw std::runtime_error("Error in deserialization of chunk");
+      t = epee::misc_utils::get_tick_count();
+      quit = import_block(simple_core, bp, h);
+      add_time += epee::misc_utils::get_tick_count() - t;
+      if (quit)
+        break;
+      ++num_imported;
 
-      int display_interval = 1000;
-      int progress_interval = 10;
-      // NOTE: use of NUM_BLOCKS_PER_CHUNK is a placeholder in case multi-block chunks are later supported.
-      for (int chunk_ind = 0; chunk_ind < NUM_BLOCKS_PER_CHUNK; ++chunk_ind)
+      if (use_batch)
       {
-        ++h;
-        if ((h-1) % display_interval == 0)
+        if ((h-1) % db_batch_size == 0)
         {
+          t = epee::misc_utils::get_tick_count();
           std::cout << refresh_string;
-          LOG_PRINT_L0("loading block number " << h-1);
-        }
-        else
-        {
-          LOG_PRINT_L3("loading block number " << h-1);
-        }
-        b = bp.block;
-        LOG_PRINT_L2("block prev_id: " << b.prev_id << ENDL);
-
-        if ((h-1) % progress_interval == 0)
-        {
-          std::cout << refresh_string << "block " << h-1
-            << " / " << block_stop
-            << std::flush;
-        }
-
-        std::vector<transaction> txs;
-        std::vector<transaction> archived_txs;
-
-        archived_txs = bp.txs;
-
-        // std::cout << refresh_string;
-        // LOG_PRINT_L1("txs: " << archived_txs.size());
-
-        // if archived_txs is invalid
-        // {
-        //   std::cout << refresh_string;
-        //   LOG_PRINT_RED_L0("exception while de-archiving txs, height=" << h);
-        //   quit = 1;
-        //   break;
-        // }
-
-        // tx number 1: coinbase tx
-        // tx number 2 onwards: archived_txs
-        unsigned int tx_num = 1;
-        for (const transaction& tx : archived_txs)
-        {
-          ++tx_num;
-          // if tx is invalid
-          // {
-          //   LOG_PRINT_RED_L0("exception while indexing tx from txs, height=" << h <<", tx_num=" << tx_num);
-          //   quit = 1;
-          //   break;
-          // }
-
-          // std::cout << refresh_string;
-          // LOG_PRINT_L1("tx hash: " << get_transaction_hash(tx));
-
-          // crypto::hash hsh = null_hash;
-          // size_t blob_size = 0;
-          // NOTE: all tx hashes except for coinbase tx are available in the block data
-          // get_transaction_hash(tx, hsh, blob_size);
-          // LOG_PRINT_L0("tx " << tx_num << "  " << hsh << " : " << ENDL);
-          // LOG_PRINT_L0(obj_to_json_str(tx) << ENDL);
-
-          // add blocks with verification.
-          // for Blockchain and blockchain_storage add_new_block().
-          if (opt_verify)
-          {
-            // crypto::hash hsh = null_hash;
-            // size_t blob_size = 0;
-            // get_transaction_hash(tx, hsh, blob_size);
-
-
-            uint8_t version = simple_core.m_storage.get_current_hard_fork_version();
-            tx_verification_context tvc = AUTO_VAL_INIT(tvc);
-            bool r = true;
-            r = simple_core.m_pool.add_tx(tx, tvc, true, true, version);
-            if (!r)
-            {
-              LOG_PRINT_RED_L0("failed to add transaction to transaction pool, height=" << h <<", tx_num=" << tx_num);
-              quit = 1;
-              break;
-            }
-          }
-          else
-          {
-            // for add_block() method, without (much) processing.
-            // don't add coinbase transaction to txs.
-            //
-            // because add_block() calls
-            // add_transaction(blk_hash, blk.miner_tx) first, and
-            // then a for loop for the transactions in txs.
-            txs.push_back(tx);
-          }
-        }
-
-        if (opt_verify)
-        {
-          block_verification_context bvc = boost::value_initialized<block_verification_context>();
-          simple_core.m_storage.add_new_block(b, bvc);
-
-          if (bvc.m_verifivation_failed)
-          {
-            LOG_PRINT_L0("Failed to add block to blockchain, verification failed, height = " << h);
-            LOG_PRINT_L0("skipping rest of file");
-            // ok to commit previously batched data because it failed only in
-            // verification of potential new block with nothing added to batch
-            // yet
-            quit = 1;
-            break;
-          }
-          if (! bvc.m_added_to_main_chain)
-          {
-            LOG_PRINT_L0("Failed to add block to blockchain, height = " << h);
-            LOG_PRINT_L0("skipping rest of file");
-            // make sure we don't commit partial block data
-            quit = 2;
-            break;
-          }
-        }
-        else
-        {
-          size_t block_size;
-          difficulty_type cumulative_difficulty;
-          uint64_t coins_generated;
-
-          block_size = bp.block_size;
-          cumulative_difficulty = bp.cumulative_difficulty;
-          coins_generated = bp.coins_generated;
-
-          // std::cout << refresh_string;
-          // LOG_PRINT_L2("block_size: " << block_size);
-          // LOG_PRINT_L2("cumulative_difficulty: " << cumulative_difficulty);
-          // LOG_PRINT_L2("coins_generated: " << coins_generated);
-
-          try
-          {
-            simple_core.add_block(b, block_size, cumulative_difficulty, coins_generated, txs);
-          }
-          catch (const std::exception& e)
-          {
-            std::cout << refresh_string;
-            LOG_PRINT_RED_L0("Error adding block to blockchain: " << e.what());
-            quit = 2; // make sure we don't commit partial block data
-            break;
-          }
-        }
-        ++num_imported;
-
-        if (use_batch)
-        {
-          if ((h-1) % db_batch_size == 0)
-          {
-            std::cout << refresh_string;
-            // zero-based height
-            std::cout << ENDL << "[- batch commit at height " << h-1 << " -]" << ENDL;
-            simple_core.batch_stop();
-            simple_core.batch_start(db_batch_size);
-            std::cout << ENDL;
-            simple_core.m_storage.get_db().show_stats();
-          }
+          // zero-based height
+          std::cout << ENDL << "[- batch commit at height " << h-1 << " -]" << ENDL;
+          simple_core.batch_stop();
+          simple_core.batch_start(db_batch_size);
+          commit_time += epee::misc_utils::get_tick_count() - t;
+          std::cout << ENDL;
+          simple_core.m_storage.get_db().show_stats();
         }
       }
     }
-    catch (const std::exception& e)
+    if (opt_verify && span.size() > 1)
+      simple_core.m_storage.cleanup_handle_incoming_blocks();
+
+    if (quit)
+      break;
+    if (end_of_file)
     {
       std::cout << refresh_string;
-      LOG_PRINT_RED_L0("exception while reading from file, height=" << h << ": " << e.what());
-      return 2;
+      LOG_PRINT_L0("End of file reached");
+      quit = 1;
+    }
+    else if (h > block_stop)
+    {
+      std::cout << refresh_string << "block " << h-1
+        << " / " << block_stop
+        << std::flush;
+      std::cout << ENDL << ENDL;
+      LOG_PRINT_L0("Specified block number reached - stopping.  block: " << h-1 << "  total blocks: " << h);
+      quit = 1;
     }
   } // while
 
-  import_file.close();
+  reader.reset();
 
   if (use_batch)
   {
@@ -505,7 +476,9 @@ int import_from_file(FakeCore& simple_core, const std::string& import_file_path,
     }
     else
     {
+      const uint64_t t = epee::misc_utils::get_tick_count();
       simple_core.batch_stop();
+      commit_time += epee::misc_utils::get_tick_count() - t;
     }
     simple_core.m_storage.get_db().show_stats();
     LOG_PRINT_L0("Number of blocks imported: " << num_imported);
@@ -513,6 +486,15 @@ int import_from_file(FakeCore& simple_core, const std::string& import_file_path,
       // TODO: if there was an error, the last added block is probably at zero-based height h-2
       LOG_PRINT_L0("Finished at block: " << h-1 << "  total blocks: " << h);
   }
+
+  const uint64_t import_time = epee::misc_utils::get_tick_count() - import_start;
+  LOG_PRINT_L0("Imported " << num_imported << " blocks in " << import_time / 1000.0 << " s ("
+      << (import_time ? num_imported * 1000.0 / import_time : 0) << " blocks/s)");
+  LOG_PRINT_L0("  waiting for file:  " << read_time << " ms");
+  if (opt_verify)
+    LOG_PRINT_L0("  preparing spans:   " << prepare_time << " ms");
+  LOG_PRINT_L0("  adding blocks:     " << add_time << " ms");
+  LOG_PRINT_L0("  batch commits:     " << commit_time << " ms");
   std::cout << ENDL;
   return 0;
 }
@@ -31,4 +31,9 @@
 #include "version.h"
 
 #define NUM_BLOCKS_PER_CHUNK 1
+#define NUM_BLOCKS_PER_EXPORT_BATCH 1000 // blocks read in parallel before being written in order
+#define NUM_BLOCKS_PER_COMPRESSED_CHUNK 100
+#define NUM_COMPRESSED_CHUNKS_READ_AHEAD 4 // per decompression thread
+#define NUM_RAW_BLOCKS_READ_AHEAD 1000
 #define BLOCKCHAIN_RAW "blockchain.raw"
+#define BLOCKCHAIN_RAW_COMPRESSED "blockchain.rawz"
@@ -32,6 +32,7 @@
 
 #include "bootstrap_file.h"
 
+#include <zlib.h>
 
 namespace po = boost::program_options;
 
@@ -43,9 +44,45 @@ namespace
   // This number was picked by taking the leading 4 bytes from this output:
   // echo Monero bootstrap file | sha1sum
   const uint32_t blockchain_raw_magic = 0x28721586;
+  // Compressed bootstrap files get their own magic so older importers
+  // reject them rather than misreading the chunks.
+  const uint32_t blockchain_raw_compressed_magic = 0x28721587;
   const uint32_t header_size = 1024;
+  // a compressed file ends with the position of its chunk index and the magic
+  const uint32_t compressed_trailer_size = sizeof(uint64_t) + sizeof(uint32_t);
+  // each compressed chunk starts with its compressed and uncompressed sizes
+  const uint32_t compressed_chunk_header_size = 2 * sizeof(uint32_t);
 
   std::string refresh_string = "\r                                    \r";
+
+  std::string compress_chunk(const char* data, size_t size)
+  {
+    uLongf compressed_size = compressBound(size);
+    std::string compressed(compressed_size, '\0');
+    int ret = compress2((Bytef*)&compressed.front(), &compressed_size, (const Bytef*)data, size, Z_DEFAULT_COMPRESSION);
+    if (ret != Z_OK)
+      throw std::runtime_error("Error compressing chunk: " + std::to_string(ret));
+    compressed.resize(compressed_size);
+    return compressed;
+  }
+
+  std::string uncompress_chunk(const std::string& compressed, uint32_t uncompressed_size)
+  {
+    uLongf size = uncompressed_size;
+    std::string data(uncompressed_size, '\0');
+    int ret = uncompress((Bytef*)&data.front(), &size, (const Bytef*)compressed.data(), compressed.size());
+    if (ret != Z_OK || size != uncompressed_size)
+      throw std::runtime_error("Error uncompressing chunk: " + std::to_string(ret));
+    return data;
+  }
+
+  uint64_t chunk_index_pos(const bootstrap::chunk_index& index)
+  {
+    if (index.chunks.empty())
+      return sizeof(uint32_t) + header_size;
+    const bootstrap::chunk_info& last = index.chunks.back();
+    return last.pos + compressed_chunk_header_size + last.compressed_size;
+  }
 }
 
 
@@ -77,6 +114,7 @@ bool BootstrapFile::open_writer(const boost::filesystem::path& file_path)
 
   bool do_initialize_file = false;
   uint64_t num_blocks = 0;
+  const bool compress = m_compressed;
 
   if (! boost::filesystem::exists(file_path))
   {
@@ -87,12 +125,24 @@ bool BootstrapFile::open_writer(const boost::filesystem::path& file_path)
   else
   {
     num_blocks = count_blocks(file_path.string());
+    if (m_compressed != compress)
+    {
+      LOG_PRINT_RED_L0("existing file is " << (m_compressed ? "" : "not ") << "compressed, can't append to it");
+      return false;
+    }
     LOG_PRINT_L0("appending to existing file with height: " << num_blocks-1 << "  total blocks: " << num_blocks);
   }
   m_height = num_blocks;
 
   if (do_initialize_file)
     m_raw_data_file->open(file_path.string(), std::ios_base::binary | std::ios_base::out | std::ios::trunc);
+  else if (m_compressed)
+  {
+    // new chunks go where the chunk index was, and a new index is written on close
+    boost::filesystem::resize_file(file_path, chunk_index_pos(m_chunk_index));
+    m_raw_data_file->open(file_path.string(), std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+    m_raw_data_file->seekp(0, std::ios_base::end);
+  }
   else
     m_raw_data_file->open(file_path.string(), std::ios_base::binary | std::ios_base::out | std::ios::app | std::ios::ate);
 
@@ -112,7 +162,7 @@ bool BootstrapFile::open_writer(const boost::filesystem::path& file_path)
 
 bool BootstrapFile::initialize_file()
 {
-  const uint32_t file_magic = blockchain_raw_magic;
+  const uint32_t file_magic = m_compressed ? blockchain_raw_compressed_magic : blockchain_raw_magic;
 
   std::string blob;
   if (! ::serialization::dump_binary(file_magic, blob))
@@ -122,8 +172,8 @@ bool BootstrapFile::initialize_file()
   *m_raw_data_file << blob;
 
   bootstrap::file_info bfi;
-  bfi.major_version = 0;
-  bfi.minor_version = 1;
+  bfi.major_version = m_compressed ? 1 : 0;
+  bfi.minor_version = m_compressed ? 0 : 1;
   bfi.header_size = header_size;
 
   bootstrap::blocks_info bbi;
@@ -171,6 +221,44 @@ void BootstrapFile::flush_chunk()
 {
   m_output_stream->flush();
 
+  if (m_compressed)
+  {
+    bootstrap::chunk_info ci;
+    if (m_chunk_index.chunks.empty())
+      ci.block_first = m_height;
+    else
+      ci.block_first = m_chunk_index.chunks.back().block_first + m_chunk_index.chunks.back().num_blocks;
+    ci.num_blocks = m_chunk_blocks;
+    ci.pos = m_raw_data_file->tellp();
+    ci.uncompressed_size = m_buffer.size();
+    const std::string compressed = compress_chunk(m_buffer.data(), m_buffer.size());
+    ci.compressed_size = compressed.size();
+
+    std::string blob;
+    if (! ::serialization::dump_binary(ci.compressed_size, blob))
+      throw std::runtime_error("Error in serialization of chunk size");
+    *m_raw_data_file << blob;
+    if (! ::serialization::dump_binary(ci.uncompressed_size, blob))
+      throw std::runtime_error("Error in serialization of chunk size");
+    *m_raw_data_file << blob;
+    m_raw_data_file->write(compressed.data(), compressed.size());
+    m_raw_data_file->flush();
+    if (m_raw_data_file->fail()) {
+      LOG_PRINT_RED_L0("Error writing chunk:  height: " << m_cur_height << "  chunk_size: " << ci.compressed_size);
+      throw std::runtime_error("Error writing chunk");
+    }
+    m_chunk_index.chunks.push_back(ci);
+    if (ci.compressed_size > m_max_chunk)
+      m_max_chunk = ci.compressed_size;
+    LOG_PRINT_L1("flushed chunk:  blocks: " << ci.num_blocks << "  size: " << ci.uncompressed_size << "  compressed: " << ci.compressed_size);
+
+    m_chunk_blocks = 0;
+    m_buffer.clear();
+    delete m_output_stream;
+    m_output_stream = new boost::iostreams::stream<boost::iostreams::back_insert_device<buffer_type>>(m_buffer);
+    return;
+  }
+
   uint32_t chunk_size = m_buffer.size();
   // LOG_PRINT_L0("chunk_size " << chunk_size);
 
@@ -197,13 +285,64 @@ void BootstrapFile::flush_chunk()
     throw std::runtime_error("Error writing chunk");
   }
 
+  m_chunk_blocks = 0;
   m_buffer.clear();
   delete m_output_stream;
   m_output_stream = new boost::iostreams::stream<boost::iostreams::back_insert_device<buffer_type>>(m_buffer);
   LOG_PRINT_L1("flushed chunk:  chunk_size: " << chunk_size);
 }
 
-void BootstrapFile::write_block(block& block)
+void BootstrapFile::write_chunk_index()
+{
+  const uint64_t index_pos = m_raw_data_file->tellp();
+  *m_raw_data_file << t_serializable_object_to_blob(m_chunk_index);
+
+  std::string blob;
+  if (! ::serialization::dump_binary(index_pos, blob))
+    throw std::runtime_error("Error in serialization of chunk index position");
+  *m_raw_data_file << blob;
+  const uint32_t file_magic = blockchain_raw_compressed_magic;
+  if (! ::serialization::dump_binary(file_magic, blob))
+    throw std::runtime_error("Error in serialization of file magic");
+  *m_raw_data_file << blob;
+}
+
+bootstrap::chunk_index BootstrapFile::read_chunk_index(std::ifstream& import_file)
+{
+  import_file.seekg(0, std::ios_base::end);
+  const uint64_t file_size = import_file.tellg();
+  if (file_size < sizeof(uint32_t) + header_size + compressed_trailer_size)
+    throw std::runtime_error("Compressed bootstrap file has no chunk index");
+
+  std::string str1(compressed_trailer_size, '\0');
+  import_file.seekg(file_size - compressed_trailer_size);
+  import_file.read(&str1.front(), compressed_trailer_size);
+  if (! import_file)
+    throw std::runtime_error("Error reading expected number of bytes");
+  uint64_t index_pos;
+  uint32_t file_magic;
+  if (! ::serialization::parse_binary(str1.substr(0, sizeof(index_pos)), index_pos) ||
+      ! ::serialization::parse_binary(str1.substr(sizeof(index_pos)), file_magic))
+    throw std::runtime_error("Error in deserialization of chunk index position");
+  if (file_magic != blockchain_raw_compressed_magic || index_pos > file_size - compressed_trailer_size)
+    throw std::runtime_error("Compressed bootstrap file is truncated or has no chunk index");
+
+  str1.assign(file_size - compressed_trailer_size - index_pos, '\0');
+  import_file.seekg(index_pos);
+  import_file.read(&str1.front(), str1.size());
+  if (! import_file)
+    throw std::runtime_error("Error reading expected number of bytes");
+  bootstrap::chunk_index index;
+  if (! ::serialization::parse_binary(str1, index))
+    throw std::runtime_error("Error in deserialization of chunk index");
+  if (chunk_index_pos(index) != index_pos)
+    throw std::runtime_error("Chunk index does not match the chunks in the file");
+  return index;
+}
+
+// Serializes a block with its txs and extra block data. Only reads from the
+// db, so it can be called from the threads of a parallel block walk.
+blobdata BootstrapFile::get_block_package(const block& block) const
 {
   bootstrap::block_package bp;
   bp.block = block;
@@ -241,12 +380,28 @@ void BootstrapFile::write_block(block& block)
     bp.coins_generated = coins_generated;
   }
 
-  blobdata bd = t_serializable_object_to_blob(bp);
-  m_output_stream->write((const char*)bd.data(), bd.size());
+  return t_serializable_object_to_blob(bp);
+}
+
+void BootstrapFile::write_block(const blobdata& block_package)
+{
+  // a compressed chunk holds several blocks, so each is prefixed with its size
+  if (m_compressed)
+  {
+    const uint32_t block_size = block_package.size();
+    std::string blob;
+    if (! ::serialization::dump_binary(block_size, blob))
+      throw std::runtime_error("Error in serialization of block size");
+    *m_output_stream << blob;
+  }
+  m_output_stream->write((const char*)block_package.data(), block_package.size());
+  ++m_chunk_blocks;
 }
 
 bool BootstrapFile::close()
 {
+  if (m_compressed)
+    write_chunk_index();
   if (m_raw_data_file->fail())
     return false;
 
@@ -257,10 +412,13 @@ bool BootstrapFile::close()
 }
 
 
-bool BootstrapFile::store_blockchain_raw(Blockchain* _blockchain_storage, tx_memory_pool* _tx_pool, boost::filesystem::path& output_file, uint64_t requested_block_stop)
+bool BootstrapFile::store_blockchain_raw(Blockchain* _blockchain_storage, tx_memory_pool* _tx_pool, boost::filesystem::path& output_file, uint64_t requested_block_stop, bool compress)
 {
   uint64_t num_blocks_written = 0;
   m_max_chunk = 0;
+  m_chunk_blocks = 0;
+  m_compressed = compress;
+  m_chunk_index.chunks.clear();
   m_blockchain_storage = _blockchain_storage;
   m_tx_pool = _tx_pool;
   uint64_t progress_interval = 100;
@@ -270,7 +428,16 @@ bool BootstrapFile::store_blockchain_raw(Blockchain* _blockchain_storage, tx_mem
     LOG_PRINT_RED_L0("failed to open raw file for write");
     return false;
   }
-  block b;
+
+  // a bootstrap file holds whole txs, which a pruned db no longer has below
+  // its pruned height, and importing pruned txs would fail verification
+  const uint64_t pruned_height = m_blockchain_storage->get_db().get_pruned_height();
+  if (pruned_height > m_height)
+  {
+    LOG_PRINT_RED_L0("The source blockchain is pruned below height " << pruned_height
+        << ", its transactions can't be exported from height " << m_height << ". Export from an unpruned blockchain instead.");
+    return false;
+  }
 
   // block_start, block_stop use 0-based height. m_height uses 1-based height. So to resume export
   // from last exported block, block_start doesn't need to add 1 here, as it's already at the next
@@ -288,24 +455,40 @@ bool BootstrapFile::store_blockchain_raw(Blockchain* _blockchain_storage, tx_mem
     block_stop = m_blockchain_storage->get_current_blockchain_height() - 1;
     LOG_PRINT_L0("Using block height of source blockchain: " << block_stop);
   }
-  for (m_cur_height = block_start; m_cur_height <= block_stop; ++m_cur_height)
+  const uint32_t blocks_per_chunk = m_compressed ? NUM_BLOCKS_PER_COMPRESSED_CHUNK : NUM_BLOCKS_PER_CHUNK;
+  std::vector<blobdata> block_packages;
+  for (m_cur_height = block_start; m_cur_height <= block_stop; )
   {
-    // this method's height refers to 0-based height (genesis block = height 0)
-    crypto::hash hash = m_blockchain_storage->get_block_id_by_height(m_cur_height);
-    m_blockchain_storage->get_block_by_hash(hash, b);
-    write_block(b);
-    if (m_cur_height % NUM_BLOCKS_PER_CHUNK == 0) {
-      flush_chunk();
-      num_blocks_written += NUM_BLOCKS_PER_CHUNK;
-    }
-    if (m_cur_height % progress_interval == 0) {
-      std::cout << refresh_string;
-      std::cout << "block " << m_cur_height << "/" << block_stop << std::flush;
+    // block packages are built in parallel a batch at a time, then written
+    // in height order
+    const uint64_t batch_start = m_cur_height;
+    const uint64_t batch_stop = std::min(block_stop, batch_start + NUM_BLOCKS_PER_EXPORT_BATCH - 1);
+    block_packages.clear();
+    block_packages.resize(batch_stop - batch_start + 1);
+    m_blockchain_storage->get_db().for_blocks_parallel(batch_start, batch_stop, 0,
+        [&](size_t shard, uint64_t height, const crypto::hash &hash, const block &b) {
+      block_packages[height - batch_start] = get_block_package(b);
+      return true;
+    });
+
+    for (const blobdata &block_package: block_packages)
+    {
+      // this method's height refers to 0-based height (genesis block = height 0)
+      write_block(block_package);
+      if (m_chunk_blocks == blocks_per_chunk) {
+        num_blocks_written += m_chunk_blocks;
+        flush_chunk();
+      }
+      if (m_cur_height % progress_interval == 0) {
+        std::cout << refresh_string;
+        std::cout << "block " << m_cur_height << "/" << block_stop << std::flush;
+      }
+      ++m_cur_height;
     }
   }
-  // NOTE: use of NUM_BLOCKS_PER_CHUNK is a placeholder in case multi-block chunks are later supported.
-  if (m_cur_height % NUM_BLOCKS_PER_CHUNK != 0)
+  if (m_chunk_blocks > 0)
   {
+    num_blocks_written += m_chunk_blocks;
     flush_chunk();
   }
   // print message for last block, which may not have been printed yet due to progress_interval
@@ -333,13 +516,14 @@ uint64_t BootstrapFile::seek_to_first_chunk(std::ifstream& import_file)
   if (! ::serialization::parse_binary(str1, file_magic))
     throw std::runtime_error("Error in deserialization of file_magic");
 
-  if (file_magic != blockchain_raw_magic)
+  if (file_magic != blockchain_raw_magic && file_magic != blockchain_raw_compressed_magic)
   {
     LOG_PRINT_RED_L0("bootstrap file not recognized");
     throw std::runtime_error("Aborting");
   }
   else
     LOG_PRINT_L0("bootstrap file recognized");
+  m_compressed = file_magic == blockchain_raw_compressed_magic;
 
   uint32_t buflen_file_info;
 
@@ -392,6 +576,22 @@ uint64_t BootstrapFile::count_blocks(const std::string& import_file_path)
   uint64_t full_header_size; // 4 byte magic + length of header structures
   full_header_size = seek_to_first_chunk(import_file);
 
+  if (m_compressed)
+  {
+    // the chunk index has the block counts, no need to scan the chunks
+    m_chunk_index = read_chunk_index(import_file);
+    for (const auto& ci : m_chunk_index.chunks)
+      h += ci.num_blocks;
+    import_file.close();
+
+    std::cout << ENDL;
+    std::cout << "Compressed bootstrap file" << ENDL;
+    std::cout << "Number of chunks: " << m_chunk_index.chunks.size() << ENDL;
+    std::cout << "Number of blocks: " << h << ENDL;
+    std::cout << ENDL;
+    return h;
+  }
+
   LOG_PRINT_L0("Scanning blockchain from bootstrap file...");
   block b;
   bool quit = false;
@@ -464,3 +664,246 @@ uint64_t BootstrapFile::count_blocks(const std::string& import_file_path)
   // one-based height.
   return h;
 }
+
+BootstrapRawReader::BootstrapRawReader(const std::string& file_path, uint64_t start_height)
+  : m_file_path(file_path)
+  , m_start_height(start_height)
+  , m_done(false)
+  , m_stop(false)
+{
+  m_thread = boost::thread(boost::bind(&BootstrapRawReader::worker, this));
+}
+
+BootstrapRawReader::~BootstrapRawReader()
+{
+  {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_all();
+  m_thread.join();
+}
+
+void BootstrapRawReader::worker()
+{
+  std::string error;
+  try
+  {
+    std::ifstream import_file(m_file_path, std::ios_base::binary | std::ifstream::in);
+    if (import_file.fail())
+      throw std::runtime_error("Failed to open " + m_file_path);
+    BootstrapFile bootstrap;
+    bootstrap.seek_to_first_chunk(import_file);
+
+    uint64_t h = 0;
+    std::string buffer;
+    while (true)
+    {
+      uint32_t chunk_size;
+      buffer.assign(sizeof(chunk_size), '\0');
+      import_file.read(&buffer.front(), sizeof(chunk_size));
+      if (! import_file)
+        break;
+      if (! ::serialization::parse_binary(buffer, chunk_size))
+        throw std::runtime_error("Error in deserialization of chunk size");
+      LOG_PRINT_L3("chunk_size: " << chunk_size);
+
+      if (chunk_size > MAX_BLOCK_SIZE_NOT_CHECKED)
+        LOG_PRINT_L0("NOTE: chunk_size " << chunk_size << " > " << MAX_BLOCK_SIZE_NOT_CHECKED);
+      else if (chunk_size == 0)
+        throw std::runtime_error("chunk_size == 0");
+
+      // blocks below start_height are skipped without being read
+      if (h < m_start_height)
+      {
+        import_file.seekg(chunk_size, std::ios_base::cur);
+        if (! import_file)
+          throw std::runtime_error("unexpected end of file at height " + std::to_string(h));
+        h += NUM_BLOCKS_PER_CHUNK;
+        continue;
+      }
+
+      buffer.assign(chunk_size, '\0');
+      import_file.read(&buffer.front(), chunk_size);
+      if (! import_file)
+        throw std::runtime_error("unexpected end of file: bytes read before error: " +
+            std::to_string(import_file.gcount()) + " of chunk_size " + std::to_string(chunk_size));
+      bootstrap::block_package bp;
+      if (! ::serialization::parse_binary(buffer, bp))
+        throw std::runtime_error("Error in deserialization of chunk");
+      h += NUM_BLOCKS_PER_CHUNK;
+
+      boost::unique_lock<boost::mutex> lock(m_mutex);
+      while (!m_stop && m_ready.size() >= NUM_RAW_BLOCKS_READ_AHEAD)
+        m_cond.wait(lock);
+      if (m_stop)
+        return;
+      m_ready.push_back(std::move(bp));
+      m_cond.notify_all();
+    }
+  }
+  catch (const std::exception& e)
+  {
+    error = e.what();
+  }
+
+  boost::unique_lock<boost::mutex> lock(m_mutex);
+  m_error = error;
+  m_done = true;
+  m_cond.notify_all();
+}
+
+bool BootstrapRawReader::read_block(bootstrap::block_package& bp)
+{
+  boost::unique_lock<boost::mutex> lock(m_mutex);
+  while (m_ready.empty() && !m_done)
+    m_cond.wait(lock);
+  if (!m_ready.empty())
+  {
+    bp = std::move(m_ready.front());
+    m_ready.pop_front();
+    m_cond.notify_all();
+    return true;
+  }
+  if (!m_error.empty())
+    throw std::runtime_error(m_error);
+  return false;
+}
+
+BootstrapChunkReader::BootstrapChunkReader(const std::string& file_path, const bootstrap::chunk_index& index,
+    uint64_t start_height, size_t num_threads)
+  : m_file_path(file_path)
+  , m_skip_blocks(0)
+  , m_next_chunk(0)
+  , m_read_chunk(0)
+  , m_stop(false)
+  , m_current_pos(0)
+{
+  // chunks wholly before start_height are never read
+  for (const auto& ci : index.chunks)
+  {
+    if (ci.block_first + ci.num_blocks <= start_height)
+      continue;
+    if (m_chunks.empty() && ci.block_first < start_height)
+      m_skip_blocks = start_height - ci.block_first;
+    m_chunks.push_back(ci);
+  }
+
+  if (num_threads == 0)
+    num_threads = tools::get_max_concurrency();
+  num_threads = std::max<size_t>(1, std::min(num_threads, m_chunks.size()));
+  m_read_ahead = num_threads * NUM_COMPRESSED_CHUNKS_READ_AHEAD;
+  for (size_t i = 0; i < num_threads; ++i)
+    m_threads.create_thread(boost::bind(&BootstrapChunkReader::worker, this));
+}
+
+BootstrapChunkReader::~BootstrapChunkReader()
+{
+  {
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_all();
+  m_threads.join_all();
+}
+
+std::vector<bootstrap::block_package> BootstrapChunkReader::load_chunk(std::ifstream& file, const bootstrap::chunk_info& ci) const
+{
+  std::string str1(compressed_chunk_header_size, '\0');
+  file.seekg(ci.pos);
+  file.read(&str1.front(), compressed_chunk_header_size);
+  if (! file)
+    throw std::runtime_error("Error reading expected number of bytes");
+  uint32_t compressed_size, uncompressed_size;
+  if (! ::serialization::parse_binary(str1.substr(0, sizeof(uint32_t)), compressed_size) ||
+      ! ::serialization::parse_binary(str1.substr(sizeof(uint32_t)), uncompressed_size))
+    throw std::runtime_error("Error in deserialization of chunk size");
+  if (compressed_size != ci.compressed_size || uncompressed_size != ci.uncompressed_size)
+    throw std::runtime_error("Chunk sizes do not match the chunk index at block " + std::to_string(ci.block_first));
+
+  str1.assign(compressed_size, '\0');
+  file.read(&str1.front(), compressed_size);
+  if (! file)
+    throw std::runtime_error("Error reading expected number of bytes");
+  const std::string data = uncompress_chunk(str1, uncompressed_size);
+
+  std::vector<bootstrap::block_package> packages(ci.num_blocks);
+  size_t pos = 0;
+  for (auto& bp : packages)
+  {
+    uint32_t block_size;
+    if (data.size() - pos < sizeof(block_size) ||
+        ! ::serialization::parse_binary(data.substr(pos, sizeof(block_size)), block_size))
+      throw std::runtime_error("Error in deserialization of block size");
+    pos += sizeof(block_size);
+    if (data.size() - pos < block_size || ! ::serialization::parse_binary(data.substr(pos, block_size), bp))
+      throw std::runtime_error("Error in deserialization of chunk");
+    pos += block_size;
+  }
+  return packages;
+}
+
+void BootstrapChunkReader::worker()
+{
+  std::ifstream file(m_file_path, std::ios_base::binary | std::ifstream::in);
+  while (true)
+  {
+    size_t chunk;
+    {
+      boost::unique_lock<boost::mutex> lock(m_mutex);
+      // don't get more than m_read_ahead chunks ahead of the reader
+      while (!m_stop && m_next_chunk < m_chunks.size() && m_next_chunk >= m_read_chunk + m_read_ahead)
+        m_cond.wait(lock);
+      if (m_stop || m_next_chunk >= m_chunks.size())
+        return;
+      chunk = m_next_chunk++;
+    }
+
+    std::vector<bootstrap::block_package> packages;
+    std::string error;
+    try
+    {
+      if (file.fail())
+        throw std::runtime_error("Failed to open " + m_file_path);
+      packages = load_chunk(file, m_chunks[chunk]);
+    }
+    catch (const std::exception& e)
+    {
+      error = e.what();
+    }
+
+    {
+      boost::unique_lock<boost::mutex> lock(m_mutex);
+      if (!error.empty() && m_error.empty())
+        m_error = error;
+      m_ready[chunk] = std::move(packages);
+    }
+    m_cond.notify_all();
+    if (!error.empty())
+      return;
+  }
+}
+
+bool BootstrapChunkReader::read_block(bootstrap::block_package& bp)
+{
+  while (m_current_pos >= m_current.size())
+  {
+    if (m_read_chunk >= m_chunks.size())
+      return false;
+    {
+      boost::unique_lock<boost::mutex> lock(m_mutex);
+      while (m_error.empty() && m_ready.find(m_read_chunk) == m_ready.end())
+        m_cond.wait(lock);
+      if (!m_error.empty())
+        throw std::runtime_error(m_error);
+      auto it = m_ready.find(m_read_chunk);
+      m_current = std::move(it->second);
+      m_ready.erase(it);
+      m_current_pos = m_read_chunk == 0 ? m_skip_blocks : 0;
+      ++m_read_chunk;
+    }
+    m_cond.notify_all();
+  }
+  bp = std::move(m_current[m_current_pos++]);
+  return true;
+}
@@ -41,12 +41,18 @@
 #include <cstdio>
 #include <fstream>
 #include <boost/iostreams/copy.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <atomic>
+#include <deque>
+#include <map>
 
 #include "common/command_line.h"
 #include "version.h"
 
 #include "blockchain_utilities.h"
+#include "bootstrap_serialization.h"
 
 
 using namespace cryptonote;
@@ -59,8 +65,13 @@ public:
   uint64_t count_blocks(const std::string& dir_path);
   uint64_t seek_to_first_chunk(std::ifstream& import_file);
 
+  // whether the file last scanned by count_blocks/seek_to_first_chunk is compressed
+  bool compressed() const { return m_compressed; }
+  // chunk index of the compressed file last scanned by count_blocks
+  const bootstrap::chunk_index& get_chunk_index() const { return m_chunk_index; }
+
   bool store_blockchain_raw(cryptonote::Blockchain* cs, cryptonote::tx_memory_pool* txp,
-      boost::filesystem::path& output_file, uint64_t use_block_height=0);
+      boost::filesystem::path& output_file, uint64_t use_block_height=0, bool compress=false);
 
 protected:
 
@@ -76,12 +87,87 @@ protected:
   bool open_writer(const boost::filesystem::path& file_path);
   bool initialize_file();
   bool close();
-  void write_block(block& block);
+  blobdata get_block_package(const block& block) const;
+  void write_block(const blobdata& block_package);
   void flush_chunk();
+  void write_chunk_index();
+  bootstrap::chunk_index read_chunk_index(std::ifstream& import_file);
 
 private:
 
   uint64_t m_height;
   uint64_t m_cur_height; // tracks current height during export
   uint32_t m_max_chunk;
+  uint32_t m_chunk_blocks; // blocks written to the current chunk
+  bool m_compressed;
+  bootstrap::chunk_index m_chunk_index;
+};
+
+// Reads the blocks of a bootstrap file in order, from a given height on,
+// with the file read and parsed ahead of the caller on other threads.
+class BootstrapReader
+{
+public:
+  virtual ~BootstrapReader() {}
+
+  // gets the next block, returns false past the last one. Throws if the
+  // file can't be read.
+  virtual bool read_block(bootstrap::block_package& bp) = 0;
+};
+
+// Reads an uncompressed bootstrap file on one IO thread.
+class BootstrapRawReader : public BootstrapReader
+{
+public:
+  BootstrapRawReader(const std::string& file_path, uint64_t start_height);
+  ~BootstrapRawReader();
+
+  bool read_block(bootstrap::block_package& bp);
+
+private:
+  void worker();
+
+  const std::string m_file_path;
+  const uint64_t m_start_height;
+
+  boost::mutex m_mutex;
+  boost::condition_variable m_cond;
+  std::deque<bootstrap::block_package> m_ready;
+  std::string m_error;
+  bool m_done;
+  bool m_stop;
+  boost::thread m_thread;
+};
+
+// Reads a compressed bootstrap file. Worker threads read and decompress
+// chunks ahead of the reader, each with its own handle on the file.
+class BootstrapChunkReader : public BootstrapReader
+{
+public:
+  BootstrapChunkReader(const std::string& file_path, const bootstrap::chunk_index& index,
+      uint64_t start_height, size_t num_threads=0);
+  ~BootstrapChunkReader();
+
+  bool read_block(bootstrap::block_package& bp);
+
+private:
+  void worker();
+  std::vector<bootstrap::block_package> load_chunk(std::ifstream& file, const bootstrap::chunk_info& ci) const;
+
+  const std::string m_file_path;
+  std::vector<bootstrap::chunk_info> m_chunks;
+  uint64_t m_skip_blocks; // blocks before start_height in the first chunk
+  size_t m_read_ahead;
+
+  boost::mutex m_mutex;
+  boost::condition_variable m_cond;
+  size_t m_next_chunk; // next chunk for a worker to load
+  size_t m_read_chunk; // next chunk for the reader
+  std::map<size_t, std::vector<bootstrap::block_package>> m_ready;
+  std::string m_error;
+  bool m_stop;
+  boost::thread_group m_threads;
+
+  std::vector<bootstrap::block_package> m_current;
+  size_t m_current_pos;
 };
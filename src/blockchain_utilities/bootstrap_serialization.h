@@ -83,6 +83,34 @@ namespace cryptonote
       END_SERIALIZE()
     };
 
+    // where a chunk of a compressed bootstrap file is, and the blocks it holds
+    struct chunk_info
+    {
+      uint64_t block_first;
+      uint32_t num_blocks;
+      uint64_t pos;
+      uint32_t compressed_size;
+      uint32_t uncompressed_size;
+
+      BEGIN_SERIALIZE_OBJECT()
+        VARINT_FIELD(block_first);
+        VARINT_FIELD(num_blocks);
+        VARINT_FIELD(pos);
+        VARINT_FIELD(compressed_size);
+        VARINT_FIELD(uncompressed_size);
+      END_SERIALIZE()
+    };
+
+    // the chunk index at the end of a compressed bootstrap file
+    struct chunk_index
+    {
+      std::vector<chunk_info> chunks;
+
+      BEGIN_SERIALIZE_OBJECT()
+        FIELD(chunks);
+      END_SERIALIZE()
+    };
+
   }
 
 }
@@ -48,7 +48,7 @@ struct fake_core_db
   // for multi_db_runtime:
   fake_core_db(const boost::filesystem::path &path, const bool use_testnet=false, const bool do_batch=true, const int db_flags=0) : m_pool(m_storage), m_storage(m_pool)
   {
-    m_pool.init(path.string());
+    m_pool.init(false);
 
     BlockchainDB* db = nullptr;
     db = new BlockchainLMDB();
@@ -90,7 +90,7 @@ namespace command_line
   };
   const command_line::arg_descriptor<std::string> arg_db_sync_mode = {
     "db-sync-mode"
-  , "Specify sync option, using format [safe|fast|fastest]:[sync|async]:[nblocks_per_sync]."
+  , "Specify sync option, using format [safe|fast|fastest]:[sync|async]:[nblocks_per_sync], or safe:background to sync commits from a background thread (atomic; the most recent commit may be lost on crash)."
   , "fast:async:1000"
   };
   const command_line::arg_descriptor<uint64_t> arg_fast_block_sync = {
@@ -113,6 +113,21 @@ namespace command_line
   , "How many blocks to sync at once during chain synchronization."
   , BLOCKS_SYNCHRONIZING_DEFAULT_COUNT
   };
+  const command_line::arg_descriptor<uint64_t> arg_ring_precomp_cache_size  = {
+    "ring-precomp-cache-size"
+  , "Max memory in MB for cached ring member precomputations used when verifying signatures, 0 to disable."
+  , RING_PRECOMP_CACHE_DEFAULT_SIZE
+  };
+  const command_line::arg_descriptor<bool> arg_prune_blockchain  = {
+    "prune-blockchain"
+  , "Drop the range proofs and signatures of transactions deeper than --prune-blockchain-depth blocks."
+  , false
+  };
+  const command_line::arg_descriptor<uint64_t> arg_prune_blockchain_depth  = {
+    "prune-blockchain-depth"
+  , "How many blocks below the top keep their transactions whole when pruning, at least the default."
+  , CRYPTONOTE_PRUNING_DEFAULT_DEPTH
+  };
   const command_line::arg_descriptor<bool> arg_print_genesis_tx = {
 	  "print-genesis-tx"
 	  , "Prints genesis' block tx hex to insert it to config and exits"
@@ -218,5 +218,8 @@ namespace command_line
   extern const arg_descriptor<uint64_t> arg_prep_blocks_threads;
   extern const arg_descriptor<uint64_t> arg_show_time_stats;
   extern const arg_descriptor<size_t> arg_block_sync_size;
+  extern const arg_descriptor<uint64_t> arg_ring_precomp_cache_size;
+  extern const arg_descriptor<bool> arg_prune_blockchain;
+  extern const arg_descriptor<uint64_t> arg_prune_blockchain_depth;
   extern const arg_descriptor<bool> arg_print_genesis_tx;
 }
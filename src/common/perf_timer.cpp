@@ -26,6 +26,7 @@
 // STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
 // THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <sstream>
 #include "perf_timer.h"
 
 namespace tools
@@ -44,4 +45,39 @@ void set_performance_timer_log_level(int level)
   performance_timer_log_level = level;
 }
 
+LockHoldHistogram::LockHoldHistogram(const std::string &s): name(s), total_us(0)
+{
+  for (size_t i = 0; i < BUCKETS; ++i)
+    counts[i] = 0;
+}
+
+void LockHoldHistogram::add(uint64_t us)
+{
+  size_t bucket = 0;
+  while (us >> bucket && bucket < BUCKETS - 1)
+    ++bucket;
+  ++counts[bucket];
+  total_us += us;
+}
+
+std::string LockHoldHistogram::print() const
+{
+  std::stringstream ss;
+  uint64_t n = 0;
+  for (size_t i = 0; i < BUCKETS; ++i)
+    n += counts[i];
+  ss << name << ": held " << n << " times, " << total_us / 1000 << " ms in total";
+  for (size_t i = 0; i < BUCKETS; ++i)
+  {
+    const uint64_t count = counts[i];
+    if (!count)
+      continue;
+    if (i == BUCKETS - 1)
+      ss << std::endl << "  >= " << (1ull << (i - 1)) << " us: " << count;
+    else
+      ss << std::endl << "  < " << (1ull << i) << " us: " << count;
+  }
+  return ss.str();
+}
+
 }
@@ -29,6 +29,8 @@
 #pragma once
 
 #include <string>
+#include <atomic>
+#include <chrono>
 #include <stdio.h>
 #include "misc_log_ex.h"
 
@@ -86,6 +88,42 @@ private:
 
 void set_performance_timer_log_level(int level);
 
+// Counts how long a lock was held, in power of two microsecond buckets
+class LockHoldHistogram
+{
+public:
+  static const size_t BUCKETS = 24; // the last one takes everything from 2^22 us (~4 s) up
+
+  LockHoldHistogram(const std::string &s);
+
+  void add(uint64_t us);
+  std::string print() const;
+
+private:
+  std::string name;
+  std::atomic<uint64_t> counts[BUCKETS];
+  std::atomic<uint64_t> total_us;
+};
+
+// Holds a lock of type lock_t on a mutex, and records in a histogram for how long
+template<typename lock_t>
+class TimedLock
+{
+public:
+  template<typename mutex_t>
+  TimedLock(mutex_t &m, LockHoldHistogram &h): lock(m), histogram(h), start(std::chrono::steady_clock::now()) {}
+
+  ~TimedLock()
+  {
+    histogram.add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+  }
+
+private:
+  lock_t lock;
+  LockHoldHistogram &histogram;
+  std::chrono::steady_clock::time_point start;
+};
+
 #define PERF_TIMER(name) tools::PerformanceTimer pt_##name(#name, tools::performance_timer_log_level)
 #define PERF_TIMER_L(name, l) tools::PerformanceTimer pt_##name(#name, l)
 
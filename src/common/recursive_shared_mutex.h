@@ -0,0 +1,93 @@
+// Copyright (c) 2016, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <boost/thread/shared_mutex.hpp>
+
+namespace tools
+{
+
+// A shared mutex whose exclusive owner may lock it again, exclusively or
+// shared, without deadlocking. Other threads share it as usual. A thread
+// holding it only shared must not ask for it exclusively.
+class recursive_shared_mutex
+{
+public:
+  recursive_shared_mutex(): owner(std::thread::id()), depth(0) {}
+  recursive_shared_mutex(const recursive_shared_mutex&) = delete;
+  recursive_shared_mutex& operator=(const recursive_shared_mutex&) = delete;
+
+  void lock()
+  {
+    if (owned())
+    {
+      ++depth;
+      return;
+    }
+    mutex.lock();
+    owner = std::this_thread::get_id();
+    depth = 1;
+  }
+
+  void unlock()
+  {
+    if (--depth)
+      return;
+    owner = std::thread::id();
+    mutex.unlock();
+  }
+
+  void lock_shared()
+  {
+    if (owned())
+      ++depth;
+    else
+      mutex.lock_shared();
+  }
+
+  void unlock_shared()
+  {
+    if (owned())
+      unlock();
+    else
+      mutex.unlock_shared();
+  }
+
+private:
+  // only the owner stores its own id, so no other thread can see it here
+  bool owned() const { return owner == std::this_thread::get_id(); }
+
+  boost::shared_mutex mutex;
+  std::atomic<std::thread::id> owner;
+  unsigned depth;  // exclusive and shared locks taken by the owner
+};
+
+}
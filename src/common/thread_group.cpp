@@ -61,6 +61,7 @@ thread_group::data::data(std::size_t count)
   , last(std::addressof(head))
   , mutex()
   , has_work()
+  , pending(0)
   , stop(false) {
   threads.reserve(count);
   while (count--) {
@@ -86,6 +87,7 @@ std::unique_ptr<thread_group::data::work> thread_group::data::get_next() noexcep
   std::unique_ptr<work> rc = std::move(head.ptr);
   if (rc != nullptr) {
     head.ptr = std::move(rc->next.ptr);
+    --pending;
     if (head.ptr == nullptr) {
       last = std::addressof(head);
     }
@@ -144,6 +146,7 @@ void thread_group::data::dispatch(std::function<void()> f) {
 
     last->ptr = std::move(latest);
     last = latest_node;
+    ++pending;
   }
   has_work.notify_one();
 }
@@ -31,6 +31,7 @@
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
+#include <atomic>
 #include <cstddef>
 #include <functional>
 #include <thread>
@@ -73,6 +74,14 @@ public:
     return 0;
   }
 
+  //! \return Number of dispatched functions not yet picked up by a thread.
+  std::size_t queued() const noexcept {
+    if (internal) {
+      return internal->queued();
+    }
+    return 0;
+  }
+
   //! \return True iff a function was available and executed (on `this_thread`).
   bool try_run_one() noexcept {
     if (internal) {
@@ -105,6 +114,10 @@ private:
       return threads.size();
     }
 
+    std::size_t queued() const noexcept {
+      return pending;
+    }
+
     bool try_run_one() noexcept;
     void dispatch(std::function<void()> f);
 
@@ -132,6 +145,7 @@ private:
     node* last;
     boost::condition_variable has_work;
     boost::mutex mutex;
+    std::atomic<std::size_t> pending;
     bool stop;
   };
 
@@ -74,7 +74,7 @@ namespace crypto {
   inline void generate_chacha8_key(const void *data, size_t size, chacha8_key& key) {
     static_assert(sizeof(chacha8_key) <= sizeof(hash), "Size of hash must be at least that of chacha8_key");
     uint8_t pwd_hash[HASH_SIZE];
-	cn_pow_hash_v1 kdf_hash;
+	cn_pow_hash_v1 kdf_hash = cn_pow_hash_v1::make_oneshot();
 	kdf_hash.hash(data, size, pwd_hash);
     memcpy(&key, pwd_hash, sizeof(key));
     memset(pwd_hash, 0, sizeof(pwd_hash));
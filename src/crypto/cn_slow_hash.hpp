@@ -129,6 +129,25 @@ private:
 	void* base_ptr;
 };
 
+// What the scratchpad memory is backed by, from worst to best
+enum cn_pad_backing
+{
+	cn_pad_heap,	// regular pages
+	cn_pad_thp,		// transparent hugepages, requested with madvise
+	cn_pad_hugetlb	// explicit hugepages, from MAP_HUGETLB
+};
+
+// Allocates a scratchpad on the largest pages available, locked in memory if
+// the limits allow it, and faulted in on the calling thread so it lives on
+// that thread's NUMA node
+void* cn_pad_alloc(size_t size, cn_pad_backing& backing);
+void cn_pad_free(void* ptr, size_t size, cn_pad_backing backing);
+const char* cn_pad_backing_name(cn_pad_backing backing);
+
+// Number of inputs (1, 2 or 4) a hashing thread should interleave, so that
+// the scratchpads of all threads still fit in the last level cache
+size_t cn_slow_hash_optimal_lanes(size_t memory, size_t threads);
+
 template<size_t MEMORY, size_t ITER, size_t VERSION> class cn_slow_hashe;
 using cn_pow_hash_v1 = cn_slow_hashe<2*1024*1024, 0x80000, 0>;
 using cn_pow_hash_v2 = cn_slow_hashe<4*1024*1024, 0x40000, 1>;
@@ -138,13 +157,15 @@ using cn_pow_hash_v2 = cn_slow_hashe<4*1024*1024, 0x40000, 1>;
     class cn_slow_hashe
     {
     public:
+        static constexpr size_t pad_size = MEMORY;
+
         cn_slow_hashe() : borrowed_pad(false)
         {
-            lpad.set(boost::alignment::aligned_alloc(4096, MEMORY));
+            lpad.set(cn_pad_alloc(MEMORY, backing));
             spad.set(boost::alignment::aligned_alloc(4096, 4096));
         }
 
-	cn_slow_hashe (cn_slow_hashe&& other) noexcept : lpad(other.lpad.as_byte()), spad(other.spad.as_byte()), borrowed_pad(other.borrowed_pad)
+	cn_slow_hashe (cn_slow_hashe&& other) noexcept : lpad(other.lpad.as_byte()), spad(other.spad.as_byte()), backing(other.backing), borrowed_pad(other.borrowed_pad)
 	{
 		other.lpad.set(nullptr);
 		other.spad.set(nullptr);
@@ -154,7 +175,15 @@ using cn_pow_hash_v2 = cn_slow_hashe<4*1024*1024, 0x40000, 1>;
 	// It is caller's responsibility to ensure that v2 object is not hashing at the same time!!
 	static cn_pow_hash_v1 make_borrowed(cn_pow_hash_v2& t)
 	{
-		return cn_pow_hash_v1(t.lpad.as_void(), t.spad.as_void());
+		return cn_pow_hash_v1(t.lpad.as_void(), t.spad.as_void(), true);
+	}
+
+	// Factory function for a context used for a single hash, like a key
+	// derivation. Its scratchpad is plain heap memory: mapping, locking and
+	// faulting in hugepages is only worth it for contexts that stay around
+	static cn_slow_hashe make_oneshot()
+	{
+		return cn_slow_hashe(boost::alignment::aligned_alloc(4096, MEMORY), boost::alignment::aligned_alloc(4096, 4096), false);
 	}
 
 	cn_slow_hashe& operator= (cn_slow_hashe&& other) noexcept
@@ -165,7 +194,10 @@ using cn_pow_hash_v2 = cn_slow_hashe<4*1024*1024, 0x40000, 1>;
 		free_mem();
 		lpad.set(other.lpad.as_void());
 		spad.set(other.spad.as_void());
+		backing = other.backing;
 		borrowed_pad = other.borrowed_pad;
+		other.lpad.set(nullptr);
+		other.spad.set(nullptr);
 		return *this;
 	}
 
@@ -187,6 +219,28 @@ using cn_pow_hash_v2 = cn_slow_hashe<4*1024*1024, 0x40000, 1>;
 
         void software_hash(const void *in, size_t len, void *out);
 
+        // Hashes in[i] into out[i] with ctx[i] for i < n. On AES-NI hardware
+        // inputs are processed two or four at a time with their main loops
+        // interleaved, so one lane's AES and multiply latency hides behind
+        // the others'
+        static void hash_lanes(cn_slow_hashe* const* ctx, const void* const* in, const size_t* len, void* const* out, size_t n)
+        {
+            if(n == 0)
+                return;
+            size_t i = 0;
+            if (hw_check_aes() && !ctx[0]->check_override())
+            {
+                for (; n - i >= 4; i += 4)
+                    hardware_hash_lanes<4>(ctx + i, in + i, len + i, out + i);
+                for (; n - i >= 2; i += 2)
+                    hardware_hash_lanes<2>(ctx + i, in + i, len + i, out + i);
+            }
+            for (; i < n; i++)
+                ctx[i]->hash(in[i], len[i], out[i]);
+        }
+
+        cn_pad_backing pad_backing() const { return backing; }
+
 #if !defined(HAS_INTEL_HW) && !defined(HAS_ARM_HW)
         inline void hardware_hash(const void* in, size_t len, void* out) { assert(false); }
 #else
@@ -200,12 +254,13 @@ private:
 	friend cn_pow_hash_v1;
 	friend cn_pow_hash_v2;
 
-	// Constructor enabling v1 hash to borrow v2's buffer
-	cn_slow_hashe(void* lptr, void* sptr)
+	// Constructor enabling v1 hash to borrow v2's buffer, or to own heap buffers
+	cn_slow_hashe(void* lptr, void* sptr, bool borrowed)
 	{
 		lpad.set(lptr);
 		spad.set(sptr);
-		borrowed_pad = true;
+		backing = cn_pad_heap;
+		borrowed_pad = borrowed;
 	}
 
 	inline bool check_override()
@@ -227,8 +282,8 @@ private:
 		if(!borrowed_pad)
 		{
 			if(lpad.as_void() != nullptr)
-				boost::alignment::aligned_free(lpad.as_void());
-			if(lpad.as_void() != nullptr)
+				cn_pad_free(lpad.as_void(), MEMORY, backing);
+			if(spad.as_void() != nullptr)
 				boost::alignment::aligned_free(spad.as_void());
 		}
 
@@ -241,9 +296,13 @@ private:
 #if !defined(HAS_INTEL_HW) && !defined(HAS_ARM_HW)
 	inline void explode_scratchpad_hard() { assert(false); }
 	inline void implode_scratchpad_hard() { assert(false); }
+	template<size_t LANES>
+	static inline void hardware_hash_lanes(cn_slow_hashe* const* ctx, const void* const* in, const size_t* len, void* const* out) { assert(false); }
 #else
 	void explode_scratchpad_hard();
 	void implode_scratchpad_hard();
+	template<size_t LANES>
+	static void hardware_hash_lanes(cn_slow_hashe* const* ctx, const void* const* in, const size_t* len, void* const* out);
 #endif
 
 	void explode_scratchpad_soft();
@@ -251,6 +310,7 @@ private:
 
 	cn_sptr lpad;
 	cn_sptr spad;
+	cn_pad_backing backing;
 	bool borrowed_pad;
 };
 
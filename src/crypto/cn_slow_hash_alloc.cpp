@@ -0,0 +1,110 @@
+// Copyright (c) 2018, The CitiCash Project
+// Copyright (c) 2017, SUMOKOIN
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Parts of this file are originally copyright (c) 2012-2013, The Cryptonote developers
+
+#include "cn_slow_hash.hpp"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+constexpr size_t HUGEPAGE_SIZE = 2 * 1024 * 1024;
+
+// The kernel places a page on the NUMA node of the thread that first faults
+// it in, so touch the whole pad now, from the thread that will hash with it
+inline void prefault(void* ptr, size_t size)
+{
+	memset(ptr, 0, size);
+}
+}
+
+void* cn_pad_alloc(size_t size, cn_pad_backing& backing)
+{
+#if defined(__linux__)
+	void* ptr;
+#if defined(MAP_HUGETLB)
+	// Explicit hugepages are never swapped, no need to lock them
+	if(size % HUGEPAGE_SIZE == 0)
+	{
+		ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(ptr != MAP_FAILED)
+		{
+			backing = cn_pad_hugetlb;
+			prefault(ptr, size);
+			return ptr;
+		}
+	}
+#endif
+	ptr = boost::alignment::aligned_alloc(HUGEPAGE_SIZE, size);
+	if(ptr == nullptr)
+		return nullptr;
+
+	backing = cn_pad_heap;
+#if defined(MADV_HUGEPAGE)
+	if(madvise(ptr, size, MADV_HUGEPAGE) == 0)
+		backing = cn_pad_thp;
+#endif
+	// Fails past RLIMIT_MEMLOCK, which only costs us the guarantee
+	mlock(ptr, size);
+	prefault(ptr, size);
+	return ptr;
+#else
+	backing = cn_pad_heap;
+	return boost::alignment::aligned_alloc(4096, size);
+#endif
+}
+
+void cn_pad_free(void* ptr, size_t size, cn_pad_backing backing)
+{
+#if defined(__linux__)
+	if(backing == cn_pad_hugetlb)
+	{
+		munmap(ptr, size);
+		return;
+	}
+	munlock(ptr, size);
+#endif
+	boost::alignment::aligned_free(ptr);
+}
+
+const char* cn_pad_backing_name(cn_pad_backing backing)
+{
+	switch(backing)
+	{
+	case cn_pad_hugetlb:
+		return "hugetlb pages";
+	case cn_pad_thp:
+		return "transparent hugepages";
+	default:
+		return "regular pages";
+	}
+}
@@ -313,6 +313,27 @@ extern "C" void groestl(const unsigned char*, unsigned long long, unsigned char*
 extern "C" size_t jh_hash(int, const unsigned char*, unsigned long long, unsigned char*);
 extern "C" size_t skein_hash(int, const unsigned char*, size_t, unsigned char*);
 
+inline void finish_hash(cn_sptr& spad, void* out)
+{
+	keccakf(spad.as_uqword(), 24);
+
+	switch(spad.as_byte(0) & 3)
+	{
+	case 0:
+		blake256_hash((uint8_t*)out, spad.as_byte(), 200);
+		break;
+	case 1:
+		groestl(spad.as_byte(), 200 * 8, (uint8_t*)out);
+		break;
+	case 2:
+		jh_hash(32 * 8, spad.as_byte(), 8 * 200, (uint8_t*)out);
+		break;
+	case 3:
+		skein_hash(8 * 32, spad.as_byte(), 8 * 200, (uint8_t*)out);
+		break;
+	}
+}
+
 inline uint64_t xmm_extract_64(__m128i x)
 {
 #ifdef BUILD32
@@ -378,26 +399,151 @@ void cn_slow_hashe<MEMORY,ITER,VERSION>::hardware_hash(const void* in, size_t le
 
 	implode_scratchpad_hard();
 
-	keccakf(spad.as_uqword(), 24);
+	finish_hash(spad, out);
+}
 
-	switch(spad.as_byte(0) & 3)
+template<size_t MEMORY, size_t ITER, size_t VERSION>
+template<size_t LANES>
+void cn_slow_hashe<MEMORY,ITER,VERSION>::hardware_hash_lanes(cn_slow_hashe* const* ctx, const void* const* in, const size_t* len, void* const* out)
+{
+	uint64_t al[LANES], ah[LANES], idx[LANES];
+	__m128i bx[LANES];
+
+	for(size_t l = 0; l < LANES; l++)
 	{
-	case 0:
-		blake256_hash((uint8_t*)out, spad.as_byte(), 200);
-		break;
-	case 1:
-		groestl(spad.as_byte(), 200 * 8, (uint8_t*)out);
-		break;
-	case 2:
-		jh_hash(32 * 8, spad.as_byte(), 8 * 200, (uint8_t*)out);
-		break;
-	case 3:
-		skein_hash(8 * 32, spad.as_byte(), 8 * 200, (uint8_t*)out);
-		break;
+		keccak((const uint8_t *)in[l], len[l], ctx[l]->spad.as_byte(), 200);
+
+		ctx[l]->explode_scratchpad_hard();
+
+		uint64_t* h = ctx[l]->spad.as_uqword();
+
+		al[l] = h[0] ^ h[4];
+		ah[l] = h[1] ^ h[5];
+		bx[l] = _mm_set_epi64x(h[3] ^ h[7], h[2] ^ h[6]);
+
+		idx[l] = h[0] ^ h[4];
+	}
+
+	// Same steps as hardware_hash, each one done for all lanes before the next
+	for(size_t i = 0; i < ITER; i++)
+	{
+		__m128i cx[LANES];
+
+		for(size_t l = 0; l < LANES; l++)
+		{
+			cx[l] = _mm_load_si128(ctx[l]->scratchpad_ptr(idx[l]).as_xmm());
+			cx[l] = _mm_aesenc_si128(cx[l], _mm_set_epi64x(ah[l], al[l]));
+		}
+
+		for(size_t l = 0; l < LANES; l++)
+		{
+			_mm_store_si128(ctx[l]->scratchpad_ptr(idx[l]).as_xmm(), _mm_xor_si128(bx[l], cx[l]));
+			idx[l] = xmm_extract_64(cx[l]);
+			bx[l] = cx[l];
+		}
+
+		for(size_t l = 0; l < LANES; l++)
+		{
+			cn_sptr p = ctx[l]->scratchpad_ptr(idx[l]);
+
+			uint64_t hi, lo, cl, ch;
+			cl = p.as_uqword(0);
+			ch = p.as_uqword(1);
+
+			lo = _umul128(idx[l], cl, &hi);
+
+			al[l] += hi;
+			ah[l] += lo;
+			p.as_uqword(0) = al[l];
+			p.as_uqword(1) = ah[l];
+			ah[l] ^= ch;
+			al[l] ^= cl;
+			idx[l] = al[l];
+		}
+
+		if(VERSION > 0)
+		{
+			for(size_t l = 0; l < LANES; l++)
+			{
+				cn_sptr p = ctx[l]->scratchpad_ptr(idx[l]);
+				int64_t n  = p.as_qword(0);
+				int32_t d  = p.as_dword(2);
+				int64_t q = n / (d | 5);
+				p.as_qword(0) = n ^ q;
+				idx[l] = d ^ q;
+			}
+		}
+	}
+
+	for(size_t l = 0; l < LANES; l++)
+	{
+		ctx[l]->implode_scratchpad_hard();
+
+		finish_hash(ctx[l]->spad, out[l]);
 	}
 }
 
 template class cn_slow_hashe<2*1024*1024, 0x80000, 0>;
 template class cn_slow_hashe<4*1024*1024, 0x40000, 1>;
 
+template void cn_pow_hash_v1::hardware_hash_lanes<2>(cn_pow_hash_v1* const*, const void* const*, const size_t*, void* const*);
+template void cn_pow_hash_v1::hardware_hash_lanes<4>(cn_pow_hash_v1* const*, const void* const*, const size_t*, void* const*);
+template void cn_pow_hash_v2::hardware_hash_lanes<2>(cn_pow_hash_v2* const*, const void* const*, const size_t*, void* const*);
+template void cn_pow_hash_v2::hardware_hash_lanes<4>(cn_pow_hash_v2* const*, const void* const*, const size_t*, void* const*);
+
+// Size of the last level cache, from the deterministic cache parameters leaf
+// on Intel and the extended L3 leaf on AMD; 0 if neither is available
+static size_t last_level_cache_size()
+{
+	int32_t cpu_info[4];
+	size_t size = 0;
+
+	cpuid(0, 0, cpu_info);
+	if(cpu_info[0] >= 4)
+	{
+		for(int32_t i = 0; ; i++)
+		{
+			cpuid(4, i, cpu_info);
+			if((cpu_info[0] & 0x1f) == 0)
+				break;
+			const size_t ways = ((uint32_t)cpu_info[1] >> 22) + 1;
+			const size_t partitions = (((uint32_t)cpu_info[1] >> 12) & 0x3ff) + 1;
+			const size_t line = ((uint32_t)cpu_info[1] & 0xfff) + 1;
+			const size_t sets = (uint32_t)cpu_info[2] + 1;
+			size = ways * partitions * line * sets;
+		}
+	}
+
+	if(size == 0)
+	{
+		cpuid(0x80000000, 0, cpu_info);
+		if((uint32_t)cpu_info[0] >= 0x80000006)
+		{
+			cpuid(0x80000006, 0, cpu_info);
+			size = size_t((uint32_t)cpu_info[3] >> 18) * 512 * 1024;
+		}
+	}
+	return size;
+}
+
+size_t cn_slow_hash_optimal_lanes(size_t memory, size_t threads)
+{
+	if(!hw_check_aes() || threads == 0)
+		return 1;
+
+	const size_t per_thread = last_level_cache_size() / threads;
+	if(per_thread >= 4 * memory)
+		return 4;
+	if(per_thread >= 2 * memory)
+		return 2;
+	return 1;
+}
+
+#else
+
+size_t cn_slow_hash_optimal_lanes(size_t memory, size_t threads)
+{
+	return 1;
+}
+
 #endif
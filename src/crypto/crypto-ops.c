@@ -1194,16 +1194,23 @@ B is the Ed25519 base point (x,4/5) with x positive.
 */
 
 void ge_double_scalarmult_base_vartime(ge_p2 *r, const unsigned char *a, const ge_p3 *A, const unsigned char *b) {
+  ge_dsmp Ai; /* A, 3A, 5A, 7A, 9A, 11A, 13A, 15A */
+
+  ge_dsm_precomp(Ai, A);
+  ge_double_scalarmult_base_precomp_vartime(r, a, Ai, b);
+}
+
+/* Same as above, with A already run through ge_dsm_precomp */
+
+void ge_double_scalarmult_base_precomp_vartime(ge_p2 *r, const unsigned char *a, const ge_dsmp Ai, const unsigned char *b) {
   signed char aslide[256];
   signed char bslide[256];
-  ge_dsmp Ai; /* A, 3A, 5A, 7A, 9A, 11A, 13A, 15A */
   ge_p1p1 t;
   ge_p3 u;
   int i;
 
   slide(aslide, a);
   slide(bslide, b);
-  ge_dsm_precomp(Ai, A);
 
   ge_p2_0(r);
 
@@ -2001,16 +2008,21 @@ void ge_scalarmult(ge_p2 *r, const unsigned char *a, const ge_p3 *A) {
 }
 
 void ge_double_scalarmult_precomp_vartime(ge_p2 *r, const unsigned char *a, const ge_p3 *A, const unsigned char *b, const ge_dsmp Bi) {
+  ge_dsmp Ai; /* A, 3A, 5A, 7A, 9A, 11A, 13A, 15A */
+
+  ge_dsm_precomp(Ai, A);
+  ge_double_scalarmult_precomp2_vartime(r, a, Ai, b, Bi);
+}
+
+void ge_double_scalarmult_precomp2_vartime(ge_p2 *r, const unsigned char *a, const ge_dsmp Ai, const unsigned char *b, const ge_dsmp Bi) {
   signed char aslide[256];
   signed char bslide[256];
-  ge_dsmp Ai; /* A, 3A, 5A, 7A, 9A, 11A, 13A, 15A */
   ge_p1p1 t;
   ge_p3 u;
   int i;
 
   slide(aslide, a);
   slide(bslide, b);
-  ge_dsm_precomp(Ai, A);
 
   ge_p2_0(r);
 
@@ -79,6 +79,8 @@ enum {
 };
 
 void cn_fast_hash(const void *data, size_t length, char *hash);
+void cn_fast_hash_multi(const void *const *data, const size_t *length, char *const *hash, size_t count);
+const char *cn_fast_hash_multi_impl(void);
 void cn_slow_hash(const void *data, size_t length, char *hash);
 
 void hash_extra_blake(const void *data, size_t length, char *hash);
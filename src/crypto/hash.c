@@ -48,3 +48,20 @@ void cn_fast_hash(const void *data, size_t length, char *hash) {
   hash_process(&state, data, length);
   memcpy(hash, &state, HASH_SIZE);
 }
+
+void cn_fast_hash_multi(const void *const *data, const size_t *length, char *const *hash, size_t count) {
+  uint8_t states[4][sizeof(union hash_state)];
+  uint8_t *md[4] = { states[0], states[1], states[2], states[3] };
+  size_t i, lane, n;
+
+  for (i = 0; i < count; i += n) {
+    n = count - i < 4 ? count - i : 4;
+    keccak_x4((const uint8_t *const *) data + i, length + i, md, sizeof(union hash_state), n);
+    for (lane = 0; lane < n; lane++)
+      memcpy(hash[i + lane], states[lane], HASH_SIZE);
+  }
+}
+
+const char *cn_fast_hash_multi_impl(void) {
+  return keccak_x4_impl_name();
+}
@@ -0,0 +1,250 @@
+// keccak-x4.c
+// Multi-buffer Keccak: four independent states are permuted together, one
+// 64-bit word of each state per vector element, so a single AVX2 register
+// holds the same word of all four states.
+
+#include "hash-ops.h"
+#include "initializer.h"
+#include "keccak.h"
+
+extern const uint64_t keccakf_rndc[24];
+
+typedef void (*keccakf_x4_fn)(void *st, int rounds);
+
+// permutes the four states one after the other
+static void keccakf_x4_scalar(void *st, int rounds)
+{
+    uint64_t (*words)[4] = (uint64_t (*)[4]) st;
+    uint64_t lane_st[25];
+    int lane, w;
+
+    for (lane = 0; lane < 4; lane++) {
+        for (w = 0; w < 25; w++)
+            lane_st[w] = words[w][lane];
+        keccakf(lane_st, rounds);
+        for (w = 0; w < 25; w++)
+            words[w][lane] = lane_st[w];
+    }
+}
+
+#if defined(__GNUC__)
+
+typedef uint64_t v4u64 __attribute__((vector_size(32)));
+
+#define ROTL64X4(x, y) (((x) << (y)) | ((x) >> (64 - (y))))
+
+#define RHO_PI(j, r) \
+    bc[0] = st[j]; \
+    st[j] = ROTL64X4(t, r); \
+    t = bc[0];
+
+// the same rounds as keccakf, with the Rho Pi loop unrolled so every rotation
+// is by a constant. Always inlined so each target below gets its own code
+static inline __attribute__((always_inline)) void keccakf_x4_rounds(v4u64 st[25], int rounds)
+{
+    int i, j, round;
+    v4u64 t, bc[5];
+
+    for (round = 0; round < rounds; round++) {
+
+        // Theta
+        for (i = 0; i < 5; i++)
+            bc[i] = st[i] ^ st[i + 5] ^ st[i + 10] ^ st[i + 15] ^ st[i + 20];
+
+        for (i = 0; i < 5; i++) {
+            t = bc[(i + 4) % 5] ^ ROTL64X4(bc[(i + 1) % 5], 1);
+            for (j = 0; j < 25; j += 5)
+                st[j + i] ^= t;
+        }
+
+        // Rho Pi
+        t = st[1];
+        RHO_PI(10, 1)  RHO_PI(7, 3)   RHO_PI(11, 6)  RHO_PI(17, 10)
+        RHO_PI(18, 15) RHO_PI(3, 21)  RHO_PI(5, 28)  RHO_PI(16, 36)
+        RHO_PI(8, 45)  RHO_PI(21, 55) RHO_PI(24, 2)  RHO_PI(4, 14)
+        RHO_PI(15, 27) RHO_PI(23, 41) RHO_PI(19, 56) RHO_PI(13, 8)
+        RHO_PI(12, 25) RHO_PI(2, 43)  RHO_PI(20, 62) RHO_PI(14, 18)
+        RHO_PI(22, 39) RHO_PI(9, 61)  RHO_PI(6, 20)  RHO_PI(1, 44)
+
+        //  Chi
+        for (j = 0; j < 25; j += 5) {
+            for (i = 0; i < 5; i++)
+                bc[i] = st[j + i];
+            for (i = 0; i < 5; i++)
+                st[j + i] ^= (~bc[(i + 1) % 5]) & bc[(i + 2) % 5];
+        }
+
+        //  Iota
+        st[0] ^= keccakf_rndc[round];
+    }
+}
+
+static void keccakf_x4_generic(void *st, int rounds)
+{
+    keccakf_x4_rounds((v4u64 *) st, rounds);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void keccakf_x4_avx2(void *st, int rounds)
+{
+    keccakf_x4_rounds((v4u64 *) st, rounds);
+}
+
+// AVX-512VL gives single instruction rotates (vprolq) and Chi (vpternlogq)
+__attribute__((target("avx512f,avx512vl")))
+static void keccakf_x4_avx512(void *st, int rounds)
+{
+    keccakf_x4_rounds((v4u64 *) st, rounds);
+}
+#endif
+
+#define KECCAK_X4_STATE_DECL v4u64 st[25]
+#define KECCAK_X4_WORD(w, lane) st[w][lane]
+
+#else
+
+#define KECCAK_X4_STATE_DECL uint64_t st[25][4]
+#define KECCAK_X4_WORD(w, lane) st[w][lane]
+
+#endif
+
+static keccakf_x4_fn keccakf_x4_impl = keccakf_x4_scalar;
+static const char *keccakf_x4_name = "scalar";
+
+// next rsiz bytes of input block b, padded if it is the last one
+static const uint8_t *keccak_block(const uint8_t *in, size_t inlen, size_t b, size_t rsiz, uint8_t *temp)
+{
+    size_t off = b * rsiz;
+
+    if (inlen - off >= rsiz)
+        return in + off;
+
+    memcpy(temp, in + off, inlen - off);
+    temp[inlen - off] = 1;
+    memset(temp + inlen - off + 1, 0, rsiz - (inlen - off) - 1);
+    temp[rsiz - 1] |= 0x80;
+    return temp;
+}
+
+static void keccak_x4_with(keccakf_x4_fn impl, const uint8_t *const in[4], const size_t inlen[4],
+    uint8_t *const md[4], int mdlen, size_t n)
+{
+    KECCAK_X4_STATE_DECL;
+    uint8_t temp[4][144];
+    uint64_t lane_st[25], word;
+    size_t i, b, lane, rsiz, rsizw, blocks[4], common;
+    const uint8_t *block;
+
+    rsiz = sizeof(lane_st) == (size_t) mdlen ? HASH_DATA_AREA : 200 - 2 * mdlen;
+    rsizw = rsiz / 8;
+
+    // every input is absorbed as its full blocks plus one padded block
+    common = (size_t) -1;
+    for (lane = 0; lane < n; lane++) {
+        blocks[lane] = inlen[lane] / rsiz + 1;
+        if (blocks[lane] < common)
+            common = blocks[lane];
+    }
+
+    memset(st, 0, sizeof(st));
+
+    for (b = 0; b < common; b++) {
+        for (lane = 0; lane < n; lane++) {
+            block = keccak_block(in[lane], inlen[lane], b, rsiz, temp[lane]);
+            for (i = 0; i < rsizw; i++) {
+                memcpy(&word, block + i * 8, 8);
+                KECCAK_X4_WORD(i, lane) ^= word;
+            }
+        }
+        impl(st, KECCAK_ROUNDS);
+    }
+
+    // inputs longer than the shortest one finish on their own
+    for (lane = 0; lane < n; lane++) {
+        for (i = 0; i < 25; i++)
+            lane_st[i] = KECCAK_X4_WORD(i, lane);
+
+        for (b = common; b < blocks[lane]; b++) {
+            block = keccak_block(in[lane], inlen[lane], b, rsiz, temp[lane]);
+            for (i = 0; i < rsizw; i++) {
+                memcpy(&word, block + i * 8, 8);
+                lane_st[i] ^= word;
+            }
+            keccakf(lane_st, KECCAK_ROUNDS);
+        }
+
+        memcpy(md[lane], lane_st, mdlen);
+    }
+}
+
+void keccak_x4(const uint8_t *const in[4], const size_t inlen[4], uint8_t *const md[4], int mdlen, size_t n)
+{
+    keccak_x4_with(keccakf_x4_impl, in, inlen, md, mdlen, n);
+}
+
+const char *keccak_x4_impl_name(void)
+{
+    return keccakf_x4_name;
+}
+
+// hashes inputs of mixed lengths with impl and compares them to keccak()
+static int keccak_x4_selftest(keccakf_x4_fn impl)
+{
+    static const size_t lengths[][4] = {
+        { 0, 0, 0, 0 },
+        { 64, 64, 64, 64 },
+        { 135, 136, 137, 1 },
+        { 300, 76, 43, 272 },
+    };
+    static const int mdlens[] = { 200, 32 };
+    uint8_t data[4][300];
+    uint8_t out[4][200], expected[200];
+    const uint8_t *in[4];
+    uint8_t *md[4];
+    size_t i, k, lane, n;
+
+    for (lane = 0; lane < 4; lane++) {
+        for (i = 0; i < sizeof(data[lane]); i++)
+            data[lane][i] = (uint8_t) (i * 7 + lane * 31 + 1);
+        in[lane] = data[lane];
+        md[lane] = out[lane];
+    }
+
+    for (k = 0; k < sizeof(mdlens) / sizeof(mdlens[0]); k++) {
+        for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+            for (n = 1; n <= 4; n++) {
+                keccak_x4_with(impl, in, lengths[i], md, mdlens[k], n);
+                for (lane = 0; lane < n; lane++) {
+                    keccak(in[lane], lengths[i][lane], expected, mdlens[k]);
+                    if (memcmp(out[lane], expected, mdlens[k]) != 0)
+                        return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+// picks the widest implementation the cpu supports that passes the self test
+INITIALIZER(init_keccak_x4) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && keccak_x4_selftest(keccakf_x4_avx512)) {
+    keccakf_x4_impl = keccakf_x4_avx512;
+    keccakf_x4_name = "avx512";
+    return;
+  }
+  if (__builtin_cpu_supports("avx2") && keccak_x4_selftest(keccakf_x4_avx2)) {
+    keccakf_x4_impl = keccakf_x4_avx2;
+    keccakf_x4_name = "avx2";
+    return;
+  }
+#endif
+#if defined(__GNUC__)
+  if (keccak_x4_selftest(keccakf_x4_generic)) {
+    keccakf_x4_impl = keccakf_x4_generic;
+    keccakf_x4_name = "generic";
+  }
+#endif
+}
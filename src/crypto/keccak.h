@@ -23,4 +23,10 @@ void keccakf(uint64_t st[25], int norounds);
 
 void keccak1600(const uint8_t *in, size_t inlen, uint8_t *md);
 
+// compute the keccak hashes of the first n (at most 4) inputs at once
+void keccak_x4(const uint8_t *const in[4], const size_t inlen[4], uint8_t *const md[4], int mdlen, size_t n);
+
+// name of the keccak_x4 permutation picked at startup
+const char *keccak_x4_impl_name(void);
+
 #endif
@@ -63,6 +63,26 @@ size_t tree_hash_cnt(size_t count) {
 	return cnt;
 }
 
+/***
+* Hash pairs of consecutive hashes from in into out, four pairs at a time. out may be in,
+* as every pair of a batch is read before any of its hashes are written
+*/
+static void tree_hash_pairs(const char (*in)[HASH_SIZE], char (*out)[HASH_SIZE], size_t pairs) {
+  const void *data[4];
+  const size_t length[4] = { 2 * HASH_SIZE, 2 * HASH_SIZE, 2 * HASH_SIZE, 2 * HASH_SIZE };
+  char *hash[4];
+  size_t j, k, n;
+
+  for (j = 0; j < pairs; j += n) {
+    n = pairs - j < 4 ? pairs - j : 4;
+    for (k = 0; k < n; ++k) {
+      data[k] = in[2 * (j + k)];
+      hash[k] = out[j + k];
+    }
+    cn_fast_hash_multi(data, length, hash, n);
+  }
+}
+
 void tree_hash(const char (*hashes)[HASH_SIZE], size_t count, char *root_hash) {
 // The blockchain block at height 202612 http://monerochain.info/block/bbd604d2ba11ba27935e006ed39c9bfdd99b76bf4a50654bc1e1e61217962698
 // contained 514 transactions, that triggered bad calculation of variable "cnt" in the original version of this function
@@ -83,8 +103,6 @@ void tree_hash(const char (*hashes)[HASH_SIZE], size_t count, char *root_hash) {
   } else if (count == 2) {
     cn_fast_hash(hashes, 2 * HASH_SIZE, root_hash);
   } else {
-    size_t i, j;
-
     size_t cnt = tree_hash_cnt( count );
     size_t max_size_t = (size_t) -1; // max allowed value of size_t
     assert( cnt < max_size_t/2 ); // reasonable size to avoid any overflows. /2 is extra; Anyway should be limited much stronger by logical code
@@ -96,16 +114,11 @@ void tree_hash(const char (*hashes)[HASH_SIZE], size_t count, char *root_hash) {
 
     memcpy(ints, hashes, (2 * cnt - count) * HASH_SIZE);
 
-    for (i = 2 * cnt - count, j = 2 * cnt - count; j < cnt; i += 2, ++j) {
-      cn_fast_hash(hashes[i], 64, ints[j]);
-    }
-    assert(i == count);
+    tree_hash_pairs(hashes + 2 * cnt - count, ints + 2 * cnt - count, count - cnt);
 
     while (cnt > 2) {
       cnt >>= 1;
-      for (i = 0, j = 0; j < cnt; i += 2, ++j) {
-        cn_fast_hash(ints[i], 64, ints[j]);
-      }
+      tree_hash_pairs((const char (*)[HASH_SIZE]) ints, ints, cnt);
     }
 
     cn_fast_hash(ints[0], 64, root_hash);
@@ -86,6 +86,7 @@
 
 #define BLOCKS_IDS_SYNCHRONIZING_DEFAULT_COUNT          10000  //by default, blocks ids count in synchronizing
 #define BLOCKS_SYNCHRONIZING_DEFAULT_COUNT              10    //by default, blocks count in blocks downloading
+#define BLOCKS_SYNCHRONIZING_MAX_QUEUED_SPANS           2     //downloaded spans of blocks waiting for the core before no more are requested ahead
 #define CRYPTONOTE_PROTOCOL_HOP_RELAX_COUNT             3      //value of hop, after which we use only announce of new block
 
 #define CRYPTONOTE_MEMPOOL_TX_LIVETIME                  86400 //seconds, one day
@@ -93,6 +94,13 @@
 
 #define COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT           1000
 
+#define RING_PRECOMP_CACHE_DEFAULT_SIZE                 64         //megabytes of cached ring member precomputations
+
+#define CRYPTONOTE_PRUNING_DEFAULT_DEPTH                5000       //blocks below the top whose txs keep their prunable data when pruning
+#define CRYPTONOTE_PRUNING_STEP                         100        //blocks pruned at once
+
+#define BLOCK_HEADER_CACHE_SIZE                         4096       //top block headers kept in memory for header queries
+
 #define P2P_LOCAL_WHITE_PEERLIST_LIMIT                  1000
 #define P2P_LOCAL_GRAY_PEERLIST_LIMIT                   5000
 
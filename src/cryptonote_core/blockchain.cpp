@@ -56,6 +56,7 @@
 #include "cryptonote_core/cryptonote_core.h"
 #include "ringct/rctSigs.h"
 #include "common/perf_timer.h"
+#include "common/task_region.h"
 #if defined(PER_BLOCK_CHECKPOINT)
 #include "blocks/blocks.h"
 #endif
@@ -78,6 +79,9 @@ DISABLE_VS_WARNINGS(4267)
 // used to overestimate the block reward when estimating a per kB to use
 #define BLOCK_REWARD_OVERESTIMATE   ((uint64_t)(16000000000))
 
+// number of txes whose ringct signatures are remembered as valid
+#define VERIFIED_SIGNATURES_CACHE_SIZE 16384
+
 static const struct {
   uint8_t version;
   uint64_t height;
@@ -106,7 +110,8 @@ static const struct {
 //------------------------------------------------------------------
 Blockchain::Blockchain(tx_memory_pool& tx_pool) :
   m_db(), m_tx_pool(tx_pool), m_hardfork(NULL), m_timestamps_and_difficulties_height(0), m_current_block_cumul_sz_limit(0), m_is_in_checkpoint_zone(false),
-  m_is_blockchain_storing(false), m_max_prepare_blocks_threads(4), m_db_blocks_per_sync(1), m_db_sync_mode(db_async), m_fast_sync(true), m_show_time_stats(false), m_sync_counter(0), m_cancel(false)
+  m_is_blockchain_storing(false), m_max_prepare_blocks_threads(4), m_db_blocks_per_sync(1), m_prune_depth(0), m_pruned_height(0), m_db_sync_mode(db_async), m_fast_sync(true), m_show_time_stats(false), m_sync_counter(0), m_cancel(false),
+  m_longhash_jobs(0), m_longhash_start(0), m_longhash_next_parse(0), m_longhash_parsed(0), m_longhash_skip(false), m_longhash_next(0), m_sync_pow_blocks(0), m_sync_pow_time(0), m_sync_verify_blocks(0), m_sync_verify_time(0)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
 }
@@ -344,6 +349,9 @@ bool Blockchain::init(BlockchainDB* db, const bool testnet, const cryptonote::te
     m_db->fixup();
   }
 
+  m_pruned_height = m_db->get_pruned_height();
+  prune_blockchain();
+
   m_db->block_txn_start(true);
   // check how far behind we are
   uint64_t top_block_timestamp = m_db->get_top_block_timestamp();
@@ -364,6 +372,8 @@ bool Blockchain::init(BlockchainDB* db, const bool testnet, const cryptonote::te
 #endif
 
   LOG_PRINT_GREEN("Blockchain initialized. last block: " << m_db->height() - 1 << ", " << epee::misc_utils::get_time_interval_string(timestamp_diff) << " time ago, current difficulty: " << get_difficulty_for_next_block(), LOG_LEVEL_0);
+  LOG_PRINT_L0("PoW scratchpads use " << cn_pad_backing_name(m_pow_ctx.pad_backing()));
+  LOG_PRINT_L1("Batched keccak uses the " << crypto::cn_fast_hash_multi_impl() << " implementation");
   m_db->block_txn_stop();
 
   return true;
@@ -420,6 +430,9 @@ bool Blockchain::deinit()
   m_async_pool.join_all();
   m_async_service.stop();
 
+  // background longhash batches reference members, let them wind down
+  wait_longhash_workers();
+
   // as this should be called if handling a SIGSEGV, need to check
   // if m_db is a NULL pointer (and thus may have caused the illegal
   // memory operation), otherwise we may cause a loop.
@@ -457,6 +470,9 @@ block Blockchain::pop_block_from_blockchain()
 
   m_timestamps_and_difficulties_height = 0;
 
+  // forget signatures verified against the chain as it was before the reorg
+  clear_verified_signatures();
+
   block popped_block;
   std::vector<transaction> popped_txs;
 
@@ -507,6 +523,10 @@ block Blockchain::pop_block_from_blockchain()
     }
   }
   update_next_cumulative_size_limit();
+  if (!m_header_cache.empty() && m_header_cache.back().height == m_db->height())
+    m_header_cache.pop_back();
+  else
+    m_header_cache.clear();
   m_tx_pool.on_blockchain_dec(m_db->height()-1, get_tail_id());
 
   return popped_block;
@@ -619,6 +639,43 @@ crypto::hash Blockchain::get_block_id_by_height(uint64_t height) const
   return null_hash;
 }
 //------------------------------------------------------------------
+bool Blockchain::get_block_header_info_range(uint64_t start_height, uint64_t end_height, std::vector<block_header_info>& infos) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  const uint64_t height = m_db->height();
+  if (start_height > end_height || end_height >= height)
+    return false;
+
+  try
+  {
+    if (m_header_cache.empty() || m_header_cache.back().height + 1 != height)
+    {
+      const uint64_t count = std::min<uint64_t>(height, BLOCK_HEADER_CACHE_SIZE);
+      m_header_cache = m_db->get_block_header_info_range(height - count, height - 1);
+    }
+
+    infos.clear();
+    infos.reserve(end_height - start_height + 1);
+    const uint64_t cache_start = m_header_cache.front().height;
+    if (start_height < cache_start)
+    {
+      infos = m_db->get_block_header_info_range(start_height, std::min(end_height, cache_start - 1));
+      start_height = cache_start;
+    }
+    if (end_height >= start_height)
+      infos.insert(infos.end(), m_header_cache.begin() + (start_height - cache_start), m_header_cache.begin() + (end_height - cache_start + 1));
+  }
+  catch (const std::exception& e)
+  {
+    LOG_PRINT_L0("Something went wrong fetching block headers from height " << start_height << " to " << end_height << ": " << e.what());
+    m_header_cache.clear();
+    return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------
 bool Blockchain::get_block_by_hash(const crypto::hash &h, block &blk) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
@@ -1036,6 +1093,12 @@ uint64_t Blockchain::get_current_cumulative_blocksize_limit() const
 // nor any of the makefiles, howeve.  Need to look into whether or not it's
 // necessary at all.
 bool Blockchain::create_block_template(block& b, const account_public_address& miner_address, difficulty_type& diffic, uint64_t& height, const blobdata& ex_nonce)
+{
+  uint64_t template_version;
+  return create_block_template(b, miner_address, diffic, height, ex_nonce, template_version);
+}
+//------------------------------------------------------------------
+bool Blockchain::create_block_template(block& b, const account_public_address& miner_address, difficulty_type& diffic, uint64_t& height, const blobdata& ex_nonce, uint64_t& template_version)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   size_t median_size;
@@ -1069,18 +1132,21 @@ bool Blockchain::create_block_template(block& b, const account_public_address& m
   size_t txs_size;
   uint64_t fee;
   uint8_t hf_version = m_hardfork->get_current_version();
-  if (!m_tx_pool.fill_block_template(b, median_size, already_generated_coins, txs_size, fee, height))
+  if (!m_tx_pool.fill_block_template(b, median_size, already_generated_coins, txs_size, fee, height, template_version))
   {
     return false;
   }
 #if defined(DEBUG_CREATE_BLOCK_TEMPLATE)
   size_t real_txs_size = 0;
   uint64_t real_fee = 0;
-  CRITICAL_REGION_BEGIN(m_tx_pool.m_transactions_lock);
+  {
+  boost::shared_lock<tools::recursive_shared_mutex> pool_lock(m_tx_pool.m_transactions_lock);
   for(crypto::hash &cur_hash: b.tx_hashes)
   {
-    auto cur_res = m_tx_pool.m_transactions.find(cur_hash);
-    if (cur_res == m_tx_pool.m_transactions.end())
+    auto &shard = m_tx_pool.get_shard(cur_hash);
+    boost::shared_lock<boost::shared_mutex> shard_lock(shard.lock);
+    auto cur_res = shard.txs.find(cur_hash);
+    if (cur_res == shard.txs.end())
     {
       LOG_ERROR("Creating block template: error: transaction not found");
       continue;
@@ -1088,25 +1154,31 @@ bool Blockchain::create_block_template(block& b, const account_public_address& m
     tx_memory_pool::tx_details &cur_tx = cur_res->second;
     real_txs_size += cur_tx.blob_size;
     real_fee += cur_tx.fee;
-    if (cur_tx.blob_size != get_object_blobsize(cur_tx.tx))
+    transaction tx;
+    if (!parse_and_validate_tx_from_blob(cur_tx.tx_blob, tx))
+    {
+      LOG_ERROR("Creating block template: error: cannot parse transaction");
+      continue;
+    }
+    if (cur_tx.blob_size != get_object_blobsize(tx))
     {
       LOG_ERROR("Creating block template: error: invalid transaction size");
     }
-    if (cur_tx.tx.version == 1)
+    if (tx.version == 1)
     {
       uint64_t inputs_amount;
-      if (!get_inputs_money_amount(cur_tx.tx, inputs_amount))
+      if (!get_inputs_money_amount(tx, inputs_amount))
       {
         LOG_ERROR("Creating block template: error: cannot get inputs amount");
       }
-      else if (cur_tx.fee != inputs_amount - get_outs_money_amount(cur_tx.tx))
+      else if (cur_tx.fee != inputs_amount - get_outs_money_amount(tx))
       {
         LOG_ERROR("Creating block template: error: invalid fee");
       }
     }
     else
     {
-      if (cur_tx.fee != cur_tx.tx.rct_signatures.txnFee)
+      if (cur_tx.fee != tx.rct_signatures.txnFee)
       {
         LOG_ERROR("Creating block template: error: invalid fee");
       }
@@ -1120,7 +1192,7 @@ bool Blockchain::create_block_template(block& b, const account_public_address& m
   {
     LOG_ERROR("Creating block template: error: wrongly calculated fee");
   }
-  CRITICAL_REGION_END();
+  }
   LOG_PRINT_L1("Creating block template: height " << height <<
       ", median size " << median_size <<
       ", already generated coins " << already_generated_coins <<
@@ -1444,22 +1516,55 @@ bool Blockchain::handle_get_objects(NOTIFY_REQUEST_GET_OBJECTS::request& arg, NO
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
   m_db->block_txn_start(true);
   rsp.current_blockchain_height = get_current_blockchain_height();
-  std::list<block> blocks;
-  get_blocks(arg.blocks, blocks, rsp.missed_ids);
 
-  for (const auto& bl: blocks)
+  // blocks and transactions are sent as they are stored, the blocks are
+  // only parsed for their tx hashes
+  for (const auto& block_hash: arg.blocks)
   {
+    blobdata block_blob;
+    try
+    {
+      // blocks whose txs were pruned can't be sent whole, report them as
+      // missed so the peer fetches them from someone else
+      if (m_pruned_height && m_db->get_block_height(block_hash) < m_pruned_height)
+      {
+        LOG_PRINT_L1("Block " << block_hash << " is below the pruned height " << m_pruned_height << ", not sending it");
+        rsp.missed_ids.push_back(block_hash);
+        continue;
+      }
+      block_blob = m_db->get_block_blob(block_hash);
+    }
+    catch (const BLOCK_DNE& e)
+    {
+      rsp.missed_ids.push_back(block_hash);
+      continue;
+    }
+    catch (const std::exception& e)
+    {
+      LOG_ERROR("Failed to get block " << block_hash << " from the db: " << e.what());
+      rsp.missed_ids.push_back(block_hash);
+      continue;
+    }
+
+    block bl;
+    if (!parse_and_validate_block_from_blob(block_blob, bl))
+    {
+      LOG_ERROR("Failed to parse block from blob retrieved from the db: " << block_hash);
+      rsp.missed_ids.push_back(block_hash);
+      continue;
+    }
+
     std::list<crypto::hash> missed_tx_ids;
-    std::list<transaction> txs;
+    std::list<blobdata> txs;
 
     // FIXME: s/rsp.missed_ids/missed_tx_id/ ?  Seems like rsp.missed_ids
     //        is for missed blocks, not missed transactions as well.
-    get_transactions(bl.tx_hashes, txs, missed_tx_ids);
+    get_transactions_blobs(bl.tx_hashes, txs, missed_tx_ids);
 
     if (missed_tx_ids.size() != 0)
     {
       LOG_ERROR("Error retrieving blocks, missed " << missed_tx_ids.size()
-          << " transactions for block with hash: " << get_block_hash(bl)
+          << " transactions for block with hash: " << block_hash
           << std::endl
       );
 
@@ -1473,18 +1578,11 @@ bool Blockchain::handle_get_objects(NOTIFY_REQUEST_GET_OBJECTS::request& arg, NO
 
     rsp.blocks.push_back(block_complete_entry());
     block_complete_entry& e = rsp.blocks.back();
-    //pack block
-    e.block = t_serializable_object_to_blob(bl);
-    //pack transactions
-    for (transaction& tx: txs)
-      e.txs.push_back(t_serializable_object_to_blob(tx));
+    e.block = std::move(block_blob);
+    e.txs = std::move(txs);
   }
   //get another transactions, if need
-  std::list<transaction> txs;
-  get_transactions(arg.txs, txs, rsp.missed_ids);
-  //pack aside transactions
-  for (const auto& tx: txs)
-    rsp.txs.push_back(t_serializable_object_to_blob(tx));
+  get_transactions_blobs(arg.txs, rsp.txs, rsp.missed_ids);
 
   m_db->block_txn_stop();
   return true;
@@ -1616,7 +1714,7 @@ bool Blockchain::get_random_outs_for_amounts(const COMMAND_RPC_GET_RANDOM_OUTPUT
 //------------------------------------------------------------------
 // This function adds the ringct output at index i to the list
 // unlocked and other such checks should be done by here.
-void Blockchain::add_out_to_get_rct_random_outs(std::list<COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry>& outs, uint64_t amount, size_t i) const
+void Blockchain::add_out_to_get_rct_random_outs(std::list<COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry>& outs, uint64_t amount, size_t i, const output_data_t &data) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
@@ -1624,7 +1722,6 @@ void Blockchain::add_out_to_get_rct_random_outs(std::list<COMMAND_RPC_GET_RANDOM
   COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry& oen = *outs.insert(outs.end(), COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry());
   oen.amount = amount;
   oen.global_amount_index = i;
-  output_data_t data = m_db->get_output_key(amount, i);
   oen.out_key = data.pubkey;
   oen.commitment = data.commitment;
 }
@@ -1645,28 +1742,30 @@ bool Blockchain::get_random_rct_outs(const COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::r
   // outpouts are sorted by height
   while (num_outs > 0)
   {
-    const tx_out_index toi = m_db->get_output_tx_and_index(0, num_outs - 1);
-    const uint64_t height = m_db->get_tx_block_height(toi.first);
-    if (height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE <= m_db->height())
+    const output_data_t data = m_db->get_output_key(0, num_outs - 1);
+    if (data.height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE <= m_db->height())
       break;
     --num_outs;
   }
 
   std::unordered_set<uint64_t> seen_indices;
+  std::vector<uint64_t> indices;
+  std::vector<output_data_t> outputs;
 
   // if there aren't enough outputs to mix with (or just enough),
   // use all of them.  Eventually this should become impossible.
   if (num_outs <= req.outs_count)
   {
     for (uint64_t i = 0; i < num_outs; i++)
-    {
-      // get tx_hash, tx_out_index from DB
-      tx_out_index toi = m_db->get_output_tx_and_index(0, i);
+      indices.push_back(i);
+    m_db->get_output_keys(std::vector<uint64_t>(indices.size(), 0), indices, outputs);
 
+    for (size_t n = 0; n < indices.size(); n++)
+    {
       // if tx is unlocked, add output to result_outs
-      if (is_tx_spendtime_unlocked(m_db->get_tx_unlock_time(toi.first)))
+      if (is_tx_spendtime_unlocked(outputs[n].unlock_time))
       {
-        add_out_to_get_rct_random_outs(res.outs, 0, i);
+        add_out_to_get_rct_random_outs(res.outs, 0, indices[n], outputs[n]);
       }
     }
   }
@@ -1681,32 +1780,41 @@ bool Blockchain::get_random_rct_outs(const COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::r
         break;
       }
 
-      // get a random output index from the DB.  If we've already seen it,
-      // return to the top of the loop and try again, otherwise add it to the
-      // list of output indices we've seen.
+      // draw as many new outputs as are still missing, and look them all up
+      // at once. Locked ones are skipped, and replaced in the next round
+      indices.clear();
+      while (indices.size() < req.outs_count - res.outs.size() && seen_indices.size() < num_outs)
+      {
+        // get a random output index from the DB.  If we've already seen it,
+        // return to the top of the loop and try again, otherwise add it to the
+        // list of output indices we've seen.
 
-      // triangular distribution over [a,b) with a=0, mode c=b=up_index_limit
-      uint64_t r = crypto::rand<uint64_t>() % ((uint64_t)1 << 53);
-      double frac = std::sqrt((double)r / ((uint64_t)1 << 53));
-      uint64_t i = (uint64_t)(frac*num_outs);
-      // just in case rounding up to 1 occurs after sqrt
-      if (i == num_outs)
-        --i;
+        // triangular distribution over [a,b) with a=0, mode c=b=up_index_limit
+        uint64_t r = crypto::rand<uint64_t>() % ((uint64_t)1 << 53);
+        double frac = std::sqrt((double)r / ((uint64_t)1 << 53));
+        uint64_t i = (uint64_t)(frac*num_outs);
+        // just in case rounding up to 1 occurs after sqrt
+        if (i == num_outs)
+          --i;
 
-      if (seen_indices.count(i))
-      {
-        continue;
+        if (seen_indices.count(i))
+        {
+          continue;
+        }
+        seen_indices.emplace(i);
+        indices.push_back(i);
       }
-      seen_indices.emplace(i);
 
-      // get tx_hash, tx_out_index from DB
-      tx_out_index toi = m_db->get_output_tx_and_index(0, i);
+      m_db->get_output_keys(std::vector<uint64_t>(indices.size(), 0), indices, outputs);
 
-      // if the output's transaction is unlocked, add the output's index to
-      // our list.
-      if (is_tx_spendtime_unlocked(m_db->get_tx_unlock_time(toi.first)))
+      for (size_t n = 0; n < indices.size(); n++)
       {
-        add_out_to_get_rct_random_outs(res.outs, 0, i);
+        // if the output's transaction is unlocked, add the output's index to
+        // our list.
+        if (is_tx_spendtime_unlocked(outputs[n].unlock_time))
+        {
+          add_out_to_get_rct_random_outs(res.outs, 0, indices[n], outputs[n]);
+        }
       }
     }
   }
@@ -1738,7 +1846,7 @@ bool Blockchain::get_random_rct_outs(const COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::r
       {
         const COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::out_entry oe = res2.outs[list_idx].outs.back();
         res2.outs[list_idx].outs.pop_back();
-        add_out_to_get_rct_random_outs(res.outs, res2.outs[list_idx].amount, oe.global_amount_index);
+        add_out_to_get_rct_random_outs(res.outs, res2.outs[list_idx].amount, oe.global_amount_index, m_db->get_output_key(res2.outs[list_idx].amount, oe.global_amount_index));
       }
     }
   }
@@ -1754,13 +1862,22 @@ bool Blockchain::get_outs(const COMMAND_RPC_GET_OUTPUTS_BIN::request& req, COMMA
 
   res.outs.clear();
   res.outs.reserve(req.outputs.size());
+
+  // look all the outputs up at once; each carries its tx's unlock time
+  std::vector<uint64_t> amounts, offsets;
+  amounts.reserve(req.outputs.size());
+  offsets.reserve(req.outputs.size());
   for (const auto &i: req.outputs)
   {
-    // get tx_hash, tx_out_index from DB
-    const output_data_t od = m_db->get_output_key(i.amount, i.index);
-    tx_out_index toi = m_db->get_output_tx_and_index(i.amount, i.index);
-    bool unlocked = is_tx_spendtime_unlocked(m_db->get_tx_unlock_time(toi.first));
+    amounts.push_back(i.amount);
+    offsets.push_back(i.index);
+  }
+  std::vector<output_data_t> outputs;
+  m_db->get_output_keys(amounts, offsets, outputs);
 
+  for (const output_data_t &od: outputs)
+  {
+    bool unlocked = is_tx_spendtime_unlocked(od.unlock_time);
     res.outs.push_back({od.pubkey, od.commitment, unlocked});
   }
   return true;
@@ -1893,6 +2010,30 @@ bool Blockchain::get_transactions(const t_ids_container& txs_ids, t_tx_container
   return true;
 }
 //------------------------------------------------------------------
+template<class t_ids_container, class t_tx_container, class t_missed_container>
+bool Blockchain::get_transactions_blobs(const t_ids_container& txs_ids, t_tx_container& txs, t_missed_container& missed_txs) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  for (const auto& tx_hash : txs_ids)
+  {
+    try
+    {
+      blobdata tx;
+      if (m_db->get_tx_blob(tx_hash, tx))
+        txs.push_back(std::move(tx));
+      else
+        missed_txs.push_back(tx_hash);
+    }
+    catch (const std::exception& e)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------
 void Blockchain::print_blockchain(uint64_t start_index, uint64_t end_index) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
@@ -1907,7 +2048,8 @@ void Blockchain::print_blockchain(uint64_t start_index, uint64_t end_index) cons
 
   for(size_t i = start_index; i <= h && i != end_index; i++)
   {
-    ss << "height " << i << ", timestamp " << m_db->get_block_timestamp(i) << ", cumul_dif " << m_db->get_block_cumulative_difficulty(i) << ", size " << m_db->get_block_size(i) << "\nid\t\t" << m_db->get_block_hash_from_height(i) << "\ndifficulty\t\t" << m_db->get_block_difficulty(i) << ", nonce " << m_db->get_block_from_height(i).nonce << ", tx_count " << m_db->get_block_from_height(i).tx_hashes.size() << std::endl;
+    const block_header_info bhi = m_db->get_block_header_info(i);
+    ss << "height " << i << ", timestamp " << bhi.timestamp << ", cumul_dif " << bhi.cumulative_difficulty << ", size " << bhi.size << "\nid\t\t" << bhi.hash << "\ndifficulty\t\t" << bhi.difficulty << ", nonce " << bhi.nonce << ", tx_count " << bhi.tx_count << std::endl;
   }
   LOG_PRINT_L1("Current blockchain:" << std::endl << ss.str());
   LOG_PRINT_L0("Blockchain printed with log level 1");
@@ -1934,7 +2076,39 @@ void Blockchain::print_blockchain_index() const
 void Blockchain::print_blockchain_outs(const std::string& file) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
-  return;
+
+  // each shard collects its outputs grouped by amount; shards come in
+  // output order, so an amount split between shards is merged back here
+  typedef std::vector<std::pair<uint64_t, std::string>> amount_groups;
+  const size_t num_shards = tools::get_max_concurrency();
+  std::vector<amount_groups> shards(num_shards);
+  m_db->for_all_outputs_parallel(num_shards, [&](size_t shard, uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx) {
+    amount_groups &groups = shards[shard];
+    if (groups.empty() || groups.back().first != amount)
+      groups.push_back(std::make_pair(amount, std::string()));
+    groups.back().second += "\t" + epee::string_tools::pod_to_hex(tx_hash) + ": " + std::to_string(tx_idx) + "\n";
+    return true;
+  });
+
+  std::stringstream ss;
+  bool first = true;
+  uint64_t last_amount = 0;
+  for (const amount_groups &groups: shards)
+  {
+    for (const auto &group: groups)
+    {
+      if (first || group.first != last_amount)
+        ss << "amount: " << group.first << ENDL;
+      ss << group.second;
+      first = false;
+      last_amount = group.first;
+    }
+  }
+
+  if (!epee::file_io_utils::save_string_to_file(file, ss.str()))
+    LOG_PRINT_L0("Failed to save blockchain outputs to " << file);
+  else
+    LOG_PRINT_L0("Blockchain outputs saved to " << file);
 }
 //------------------------------------------------------------------
 // Find the split point between us and foreign blockchain and return
@@ -1951,6 +2125,14 @@ bool Blockchain::find_blockchain_supplement(const std::list<crypto::hash>& qbloc
     return false;
   }
 
+  // a pruned node can't serve the blocks the peer would ask for next, so
+  // it doesn't offer a chain starting below its pruned height
+  if (resp.start_height < m_pruned_height)
+  {
+    LOG_PRINT_L1("Split point " << resp.start_height << " is below the pruned height " << m_pruned_height << ", can't serve this chain");
+    return false;
+  }
+
   resp.total_height = get_current_blockchain_height();
   size_t count = 0;
   for(size_t i = resp.start_height; i < resp.total_height && count < BLOCKS_IDS_SYNCHRONIZING_DEFAULT_COUNT; i++, count++)
@@ -2000,6 +2182,91 @@ bool Blockchain::find_blockchain_supplement(const uint64_t req_start_block, cons
   return true;
 }
 //------------------------------------------------------------------
+// as above, but the blocks and transactions are returned as stored, so
+// serving them costs a copy rather than a parse and a serialization; the
+// hashes found while parsing each block (miner tx first) are handed back
+// so the caller does not need to parse the blob again
+bool Blockchain::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<block_complete_entry>& blocks, std::list<std::vector<crypto::hash> >& tx_hashes, uint64_t& total_height, uint64_t& start_height, size_t max_count) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  // if a specific start height has been requested
+  if(req_start_block > 0)
+  {
+    // if requested height is higher than our chain, return false -- we can't help
+    if (req_start_block >= m_db->height())
+    {
+      return false;
+    }
+    start_height = req_start_block;
+  }
+  else
+  {
+    if(!find_blockchain_supplement(qblock_ids, start_height))
+    {
+      return false;
+    }
+  }
+
+  m_db->block_txn_start(true);
+  total_height = get_current_blockchain_height();
+  if (start_height < total_height && max_count > 0)
+  {
+    const uint64_t end_height = std::min<uint64_t>(total_height, start_height + max_count) - 1;
+    std::vector<blobdata> blobs = m_db->get_blocks_blobs_range(start_height, end_height);
+    uint64_t height = start_height;
+    for (blobdata& blob: blobs)
+    {
+      // only the tx hashes are needed from the block itself
+      block b;
+      if (!parse_and_validate_block_from_blob(blob, b))
+      {
+        LOG_ERROR("internal error, invalid block blob in db");
+        m_db->block_txn_stop();
+        return false;
+      }
+      blocks.resize(blocks.size()+1);
+      block_complete_entry& entry = blocks.back();
+      entry.block = std::move(blob);
+      tx_hashes.resize(tx_hashes.size()+1);
+      tx_hashes.back().reserve(b.tx_hashes.size() + 1);
+      tx_hashes.back().push_back(get_transaction_hash(b.miner_tx));
+      tx_hashes.back().insert(tx_hashes.back().end(), b.tx_hashes.begin(), b.tx_hashes.end());
+      std::list<crypto::hash> mis;
+      if (height++ < m_pruned_height)
+      {
+        // what is left of pruned txs is enough for wallets, and the
+        // prunable hashes let them check the txs against the block
+        entry.pruned = true;
+        entry.prunable_hashes.reserve(b.tx_hashes.size());
+        for (const crypto::hash& h: b.tx_hashes)
+        {
+          blobdata tx;
+          crypto::hash prunable_hash;
+          if (m_db->get_pruned_tx_blob(h, tx) && m_db->get_prunable_tx_hash(h, prunable_hash))
+          {
+            entry.txs.push_back(std::move(tx));
+            entry.prunable_hashes.push_back(prunable_hash);
+          }
+          else
+            mis.push_back(h);
+        }
+      }
+      else
+        get_transactions_blobs(b.tx_hashes, entry.txs, mis);
+      if (!mis.empty())
+      {
+        LOG_ERROR("internal error, transaction from block not found");
+        m_db->block_txn_stop();
+        return false;
+      }
+    }
+  }
+  m_db->block_txn_stop();
+  return true;
+}
+//------------------------------------------------------------------
 bool Blockchain::add_block_as_invalid(const block& bl, const crypto::hash& h)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
@@ -2140,7 +2407,7 @@ bool Blockchain::get_tx_outputs_gindexs(const crypto::hash& tx_id, std::vector<u
   if (indexs.empty())
   {
     // empty indexs is only valid if the vout is empty, which is legal but rare
-    cryptonote::transaction tx = m_db->get_tx(tx_id);
+    cryptonote::transaction tx = m_db->get_pruned_tx(tx_id);
     CHECK_AND_ASSERT_MES(tx.vout.empty(), false, "internal error: global indexes for transaction " << tx_id << " is empty, and tx vout is not");
   }
 
@@ -2300,12 +2567,48 @@ bool Blockchain::expand_transaction_2(transaction &tx, const crypto::hash &tx_pr
   return true;
 }
 //------------------------------------------------------------------
+crypto::hash Blockchain::get_verified_signatures_key(const transaction& tx, const std::vector<std::vector<rct::ctkey>>& pubkeys) const
+{
+  // the tx hash covers the signatures themselves, the pubkeys the outputs
+  // they were resolved against, which may change if the chain reorganizes
+  std::string blob;
+  const crypto::hash tx_hash = get_transaction_hash(tx);
+  blob.append((const char*)&tx_hash, sizeof(tx_hash));
+  for (const auto &ring : pubkeys)
+  {
+    for (const auto &member : ring)
+    {
+      blob.append((const char*)&member.dest, sizeof(member.dest));
+      blob.append((const char*)&member.mask, sizeof(member.mask));
+    }
+  }
+  return crypto::cn_fast_hash(blob.data(), blob.size());
+}
+//------------------------------------------------------------------
+void Blockchain::add_verified_signatures(const crypto::hash& key)
+{
+  if (!m_verified_signatures.insert(key).second)
+    return;
+  m_verified_signatures_order.push_back(key);
+  while (m_verified_signatures_order.size() > VERIFIED_SIGNATURES_CACHE_SIZE)
+  {
+    m_verified_signatures.erase(m_verified_signatures_order.front());
+    m_verified_signatures_order.pop_front();
+  }
+}
+//------------------------------------------------------------------
+void Blockchain::clear_verified_signatures()
+{
+  m_verified_signatures.clear();
+  m_verified_signatures_order.clear();
+}
+//------------------------------------------------------------------
 // This function validates transaction inputs and their keys.
 // FIXME: consider moving functionality specific to one input into
 //        check_tx_input() rather than here, and use this function simply
 //        to iterate the inputs as necessary (splitting the task
 //        using threads, etc.)
-bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc, uint64_t* pmax_used_block_height)
+bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc, uint64_t* pmax_used_block_height, bool* rct_verification_deferred)
 {
   PERF_TIMER(check_tx_inputs);
   LOG_PRINT_L3("Blockchain::" << __func__);
@@ -2397,39 +2700,19 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
     assert(it != m_check_txin_table.end());
   }
 
+  // resolve all the rings in one db lookup, unless that was done for the
+  // whole block already (see prepare_handle_incoming_blocks)
+  const bool ring_members_prefetched = prefetch_ring_members(tx, tx_prefix_hash);
+  epee::misc_utils::auto_scope_leave_caller scan_table_cleanup = epee::misc_utils::create_scope_leave_handler([&]() {
+    if (ring_members_prefetched)
+      m_scan_table.erase(tx_prefix_hash);
+  });
+
   uint64_t t_t1 = 0;
   std::vector<std::vector<rct::ctkey>> pubkeys(tx.vin.size());
   std::vector < uint64_t > results;
   results.resize(tx.vin.size(), 0);
 
-  int threads = tools::get_max_concurrency();
-
-  boost::asio::io_service ioservice;
-  boost::thread_group threadpool;
-  bool ioservice_active = false;
-
-  std::unique_ptr < boost::asio::io_service::work > work(new boost::asio::io_service::work(ioservice));
-  if(threads > 1)
-  {
-    for (int i = 0; i < threads; i++)
-    {
-      threadpool.create_thread(boost::bind(&boost::asio::io_service::run, &ioservice));
-    }
-    ioservice_active = true;
-  }
-
-#define KILL_IOSERVICE()  \
-        if(ioservice_active) \
-        { \
-            work.reset(); \
-            while (!ioservice.stopped()) ioservice.poll(); \
-            threadpool.join_all(); \
-            ioservice.stop(); \
-            ioservice_active = false; \
-        }
-
-  epee::misc_utils::auto_scope_leave_caller ioservice_killer = epee::misc_utils::create_scope_leave_handler([&]() { KILL_IOSERVICE(); });
-
   for (const auto& txin : tx.vin)
   {
     // make sure output being spent is of type txin_to_key, rather than
@@ -2486,8 +2769,6 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
     sig_index++;
   }
 
-  KILL_IOSERVICE();
-
   if (!expand_transaction_2(tx, tx_prefix_hash, pubkeys))
   {
     LOG_PRINT_L1("Failed to expand rct signatures!");
@@ -2497,6 +2778,14 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
   // from version 2, check ringct signatures
   // obviously, the original and simple rct APIs use a mixRing that's indexes
   // in opposite orders, because it'd be too simple otherwise...
+  // signatures already verified against these same ring members (typically
+  // when the tx entered the pool) are not verified again
+  const crypto::hash sigs_key = get_verified_signatures_key(tx, pubkeys);
+  const bool sigs_verified = m_verified_signatures.find(sigs_key) != m_verified_signatures.end();
+  if (rct_verification_deferred)
+    *rct_verification_deferred = !sigs_verified;
+  const bool verify_sigs = !sigs_verified && !rct_verification_deferred;
+
   const rct::rctSig &rv = tx.rct_signatures;
   switch (rv.type)
   {
@@ -2554,7 +2843,7 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
       }
     }
 
-    if (!rct::verRctSimple(rv))
+    if (verify_sigs && !rct::verRctSimple(rv, m_verification_threads))
     {
       LOG_PRINT_L1("Failed to check ringct signatures!");
       return false;
@@ -2612,7 +2901,7 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
       }
     }
 
-    if (!rct::verRct(rv))
+    if (verify_sigs && !rct::verRct(rv, m_verification_threads))
     {
       LOG_PRINT_L1("Failed to check ringct signatures!");
       return false;
@@ -2624,6 +2913,9 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
     return false;
   }
 
+  if (verify_sigs)
+    add_verified_signatures(sigs_key);
+
   return true;
 }
 
@@ -2742,6 +3034,53 @@ bool Blockchain::is_tx_spendtime_unlocked(uint64_t unlock_time) const
   return false;
 }
 //------------------------------------------------------------------
+bool Blockchain::prefetch_ring_members(const transaction& tx, const crypto::hash& tx_prefix_hash)
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+
+  if (m_scan_table.find(tx_prefix_hash) != m_scan_table.end())
+    return false;
+
+  std::unordered_map<crypto::key_image, std::vector<output_data_t>> rings;
+  std::vector<uint64_t> amounts;
+  std::vector<uint64_t> offsets;
+  for (const auto& txin : tx.vin)
+  {
+    // bad inputs are rejected by the caller
+    if (txin.type() != typeid(txin_to_key))
+      return false;
+    const txin_to_key& in_to_key = boost::get<txin_to_key>(txin);
+    if (!rings.emplace(in_to_key.k_image, std::vector<output_data_t>()).second)
+      return false;
+    for (const uint64_t offset : relative_output_offsets_to_absolute(in_to_key.key_offsets))
+    {
+      amounts.push_back(in_to_key.amount);
+      offsets.push_back(offset);
+    }
+  }
+
+  std::vector<output_data_t> outputs;
+  try
+  {
+    m_db->get_output_keys(amounts, offsets, outputs);
+  }
+  catch (const std::exception& e)
+  {
+    LOG_PRINT_L1("Failed to prefetch ring members: " << e.what());
+    return false;
+  }
+
+  auto it = outputs.begin();
+  for (const auto& txin : tx.vin)
+  {
+    const txin_to_key& in_to_key = boost::get<txin_to_key>(txin);
+    rings[in_to_key.k_image].assign(it, it + in_to_key.key_offsets.size());
+    it += in_to_key.key_offsets.size();
+  }
+  m_scan_table.emplace(tx_prefix_hash, std::move(rings));
+  return true;
+}
+//------------------------------------------------------------------
 // This function locates all outputs associated with a given input (mixins)
 // and validates that they exist and are usable. It also checks the ring
 // signature for each input.
@@ -2986,11 +3325,9 @@ leave:
   else
 #endif
   {
-    auto it = m_blocks_longhash_table.find(id);
-    if (it != m_blocks_longhash_table.end())
+    if (get_precomputed_longhash(id, proof_of_work))
     {
       precomputed = true;
-      proof_of_work = it->second;
     }
     else
 	{
@@ -3036,6 +3373,7 @@ leave:
   size_t cumulative_block_size = coinbase_blob_size;
 
   std::vector<transaction> txs;
+  std::vector<size_t> deferred_txs;
   key_images_container keys;
 
   uint64_t fee_summary = 0;
@@ -3111,8 +3449,10 @@ leave:
 #endif
     {
       // validate that transaction inputs and the keys spending them are correct.
+      // ringct signatures of all txes are verified together once the block's txes are collected
       tx_verification_context tvc;
-      if(!check_tx_inputs(tx, tvc)) {
+      bool rct_verification_deferred = false;
+      if(!check_tx_inputs(txs.back(), tvc, NULL, &rct_verification_deferred)) {
         LOG_PRINT_L1("Block with id: " << id  << " has at least one transaction (id: " << tx_id << ") with wrong inputs.");
 
         //TODO: why is this done?  make sure that keeping invalid blocks makes sense.
@@ -3122,6 +3462,8 @@ leave:
         return_tx_to_pool(txs);
         goto leave;
       }
+      if (rct_verification_deferred)
+        deferred_txs.push_back(txs.size() - 1);
     }
 #if defined(PER_BLOCK_CHECKPOINT)
     else
@@ -3171,6 +3513,44 @@ leave:
 
   m_blocks_txs_check.clear();
 
+  if (!deferred_txs.empty())
+  {
+    TIME_MEASURE_START(ee);
+    std::vector<const rct::rctSig *> rvs;
+    rvs.reserve(deferred_txs.size());
+    for (size_t i : deferred_txs)
+      rvs.push_back(&txs[i].rct_signatures);
+
+    std::vector<bool> results;
+    if (!rct::verRctBatch(rvs, results, m_verification_threads))
+    {
+      // the txes with wrong signatures are known, so only the others go
+      // back to the pool
+      std::vector<bool> failed(txs.size(), false);
+      for (size_t i = 0; i < results.size(); ++i)
+      {
+        if (!results[i])
+        {
+          failed[deferred_txs[i]] = true;
+          LOG_PRINT_L1("Block with id: " << id  << " has at least one transaction (id: " << bl.tx_hashes[deferred_txs[i]] << ") with wrong ringct signatures, dropping it.");
+        }
+      }
+      std::vector<transaction> valid_txs;
+      for (size_t i = 0; i < txs.size(); ++i)
+        if (!failed[i])
+          valid_txs.push_back(std::move(txs[i]));
+
+      //TODO: why is this done?  make sure that keeping invalid blocks makes sense.
+      add_block_as_invalid(bl, id);
+      LOG_PRINT_L1("Block with id " << id << " added as invalid because of wrong inputs in transactions");
+      bvc.m_verifivation_failed = true;
+      return_tx_to_pool(valid_txs);
+      goto leave;
+    }
+    TIME_MEASURE_FINISH(ee);
+    t_checktx += ee;
+  }
+
   TIME_MEASURE_START(vmt);
   uint64_t base_reward = 0;
   uint64_t height = m_db->height();
@@ -3236,6 +3616,16 @@ leave:
   // do this after updating the hard fork state since the size limit may change due to fork
   update_next_cumulative_size_limit();
 
+  // only extend the header cache while it still ends at the previous top
+  if (!m_header_cache.empty() && m_header_cache.back().height + 2 == new_height)
+  {
+    m_header_cache.push_back(m_db->get_block_header_info(new_height - 1));
+    if (m_header_cache.size() >= 2 * BLOCK_HEADER_CACHE_SIZE)
+      m_header_cache.erase(m_header_cache.begin(), m_header_cache.end() - BLOCK_HEADER_CACHE_SIZE);
+  }
+
+  prune_blockchain();
+
   LOG_PRINT_L1("+++++ BLOCK SUCCESSFULLY ADDED" << std::endl << "id:\t" << id << std::endl << "PoW:\t" << proof_of_work << std::endl << "HEIGHT " << new_height-1 << ", difficulty:\t" << current_diffic << std::endl << "block reward: " << print_money(fee_summary + base_reward) << "(" << print_money(base_reward) << " + " << print_money(fee_summary) << "), coinbase_blob_size: " << coinbase_blob_size << ", cumulative size: " << cumulative_block_size << ", " << block_processing_time << "(" << target_calculating_time << "/" << longhash_calculating_time << ")ms");
   if(m_show_time_stats)
   {
@@ -3248,6 +3638,8 @@ leave:
 
   bvc.m_added_to_main_chain = true;
   ++m_sync_counter;
+  ++m_sync_verify_blocks;
+  m_sync_verify_time += block_processing_time - longhash_calculating_time + addblock;
 
   // appears to be a NOP *and* is called elsewhere.  wat?
   m_tx_pool.on_blockchain_inc(new_height, id);
@@ -3265,6 +3657,27 @@ bool Blockchain::update_next_cumulative_size_limit()
   return true;
 }
 //------------------------------------------------------------------
+void Blockchain::prune_blockchain()
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  if (!m_prune_depth)
+    return;
+
+  const uint64_t height = m_db->height();
+  if (height <= m_prune_depth || height - m_prune_depth < m_pruned_height + CRYPTONOTE_PRUNING_STEP)
+    return;
+
+  try
+  {
+    m_db->prune_blockchain(height - m_prune_depth);
+    m_pruned_height = height - m_prune_depth;
+  }
+  catch (const std::exception& e)
+  {
+    LOG_ERROR("Error pruning blockchain below height " << height - m_prune_depth << ", what = " << e.what());
+  }
+}
+//------------------------------------------------------------------
 bool Blockchain::add_new_block(const block& bl_, block_verification_context& bvc)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
@@ -3346,23 +3759,122 @@ bool Blockchain::update_checkpoints(const std::string& file_path)
 }
 
 //------------------------------------------------------------------
-void Blockchain::block_longhash_worker(cn_pow_hash_v2& hash_ctx, const std::vector<block> &blocks, std::unordered_map<crypto::hash, crypto::hash> &map)
+void Blockchain::block_longhash_worker(size_t lanes)
 {
-  TIME_MEASURE_START(t);
+  // the contexts are created here rather than by the caller, so their pads
+  // are first touched by, and so land on the NUMA node of, the pool thread
+  // which hashes with them
+  if (!m_hash_ctxes.get())
+    m_hash_ctxes.reset(new std::vector<cn_pow_hash_v2>());
+  std::vector<cn_pow_hash_v2> &hash_ctxes = *m_hash_ctxes;
+  if (hash_ctxes.size() < lanes)
+    hash_ctxes.resize(lanes);
+
+  std::vector<cn_pow_hash_v2*> ctx(lanes);
+  for (size_t i = 0; i < lanes; ++i)
+    ctx[i] = &hash_ctxes[i];
+  std::vector<const void*> in(lanes);
+  std::vector<size_t> len(lanes);
+  std::vector<void*> out(lanes);
+  std::vector<crypto::hash> ids(lanes), pows(lanes);
+
+  // parse first, so the blocks can be checked before hashing them
+  const size_t n_blocks = m_longhash_blocks.size();
+  size_t k;
+  while ((k = m_longhash_next_parse++) < n_blocks)
+  {
+    longhash_block &lb = m_longhash_blocks[k];
+    block b;
+    lb.parsed = parse_and_validate_block_from_blob(lb.blob, b);
+    if (lb.parsed)
+    {
+      lb.id = get_block_hash(b);
+      lb.prev_id = b.prev_id;
+      lb.blob = get_block_hashing_blob(b);
+    }
+    boost::unique_lock<boost::mutex> lock(m_longhash_lock);
+    if (++m_longhash_parsed == n_blocks)
+      m_longhash_ready.notify_all();
+  }
+  {
+    boost::unique_lock<boost::mutex> lock(m_longhash_lock);
+    while (m_longhash_parsed != n_blocks)
+      m_longhash_ready.wait(lock);
+  }
 
   //FIXME: height should be changing here, as get_block_longhash expects
   //       the height of the block passed to it
-  for (const auto & block : blocks)
+  size_t first;
+  while (!m_cancel && !m_longhash_skip && (first = m_longhash_next.fetch_add(lanes)) < n_blocks)
   {
-    if (m_cancel)
-       return;
-    crypto::hash id = get_block_hash(block);
-    crypto::hash pow;
-	get_block_longhash(block, hash_ctx, pow);
-    map.emplace(id, pow);
+    size_t n = 0;
+    for (k = first; k < first + lanes && k < n_blocks; ++k)
+    {
+      const longhash_block &lb = m_longhash_blocks[k];
+      if (!lb.parsed)
+        continue;
+      ids[n] = lb.id;
+      in[n] = lb.blob.data();
+      len[n] = lb.blob.size();
+      out[n] = pows[n].data;
+      ++n;
+    }
+    if (n == 0)
+      continue;
+    cn_pow_hash_v2::hash_lanes(ctx.data(), in.data(), len.data(), out.data(), n);
+
+    boost::unique_lock<boost::mutex> lock(m_longhash_lock);
+    for (size_t i = 0; i < n; ++i)
+      m_blocks_longhash_table.emplace(ids[i], pows[i]);
+    m_longhash_ready.notify_all();
+  }
+
+  boost::unique_lock<boost::mutex> lock(m_longhash_lock);
+  if (--m_longhash_jobs == 0)
+  {
+    m_sync_pow_blocks += m_blocks_longhash_table.size();
+    m_sync_pow_time += epee::misc_utils::get_tick_count() - m_longhash_start;
   }
+  m_longhash_ready.notify_all();
+}
+
+//------------------------------------------------------------------
+bool Blockchain::get_precomputed_longhash(const crypto::hash &id, crypto::hash &pow)
+{
+  boost::unique_lock<boost::mutex> lock(m_longhash_lock);
+  while (true)
+  {
+    auto it = m_blocks_longhash_table.find(id);
+    if (it != m_blocks_longhash_table.end())
+    {
+      pow = it->second;
+      return true;
+    }
+    if (m_longhash_jobs == 0)
+      return false;
 
-  TIME_MEASURE_FINISH(t);
+    // the batch with this block may still be queued behind other work, so
+    // help out rather than just wait
+    lock.unlock();
+    const bool ran = m_verification_threads.try_run_one();
+    lock.lock();
+    if (!ran && m_longhash_jobs != 0 && m_blocks_longhash_table.find(id) == m_blocks_longhash_table.end())
+      m_longhash_ready.wait(lock);
+  }
+}
+
+//------------------------------------------------------------------
+void Blockchain::wait_longhash_workers()
+{
+  boost::unique_lock<boost::mutex> lock(m_longhash_lock);
+  while (m_longhash_jobs != 0)
+  {
+    lock.unlock();
+    const bool ran = m_verification_threads.try_run_one();
+    lock.lock();
+    if (!ran && m_longhash_jobs != 0)
+      m_longhash_ready.wait(lock);
+  }
 }
 
 //------------------------------------------------------------------
@@ -3399,7 +3911,9 @@ bool Blockchain::cleanup_handle_incoming_blocks(bool force_sync)
   }
 
   TIME_MEASURE_FINISH(t1);
+  wait_longhash_workers();
   m_blocks_longhash_table.clear();
+  m_longhash_blocks.clear();
   m_scan_table.clear();
   m_blocks_txs_check.clear();
   m_check_txin_table.clear();
@@ -3444,6 +3958,9 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
   if ((m_db->height() + blocks_entry.size()) < m_blocks_hash_check.size())
     return true;
 
+  // a previous batch may still be hashing if its blocks were not all handled
+  wait_longhash_workers();
+
   bool blocks_exist = false;
   uint64_t threads = tools::get_max_concurrency();
 
@@ -3453,94 +3970,83 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
     if(threads > m_max_prepare_blocks_threads)
       threads = m_max_prepare_blocks_threads;
 
-    uint64_t height = m_db->height();
-    std::vector<boost::thread *> thread_list;
-    int batches = blocks_entry.size() / threads;
-    int extra = blocks_entry.size() % threads;
-    LOG_PRINT_L1("block_batches: " << batches);
-    std::vector<std::unordered_map<crypto::hash, crypto::hash>> maps(threads);
-    std::vector < std::vector < block >> blocks(threads);
-    auto it = blocks_entry.begin();
-
+    if(threads > blocks_entry.size())
+      threads = blocks_entry.size();
+
+    // the workers parse the blocks as well as hash them, and are held back
+    // from hashing until the blocks are checked below
+    m_longhash_blocks.clear();
+    m_longhash_blocks.reserve(blocks_entry.size());
+    for (const auto &entry : blocks_entry)
+      m_longhash_blocks.push_back({entry.block, null_hash, null_hash, false});
+    m_blocks_longhash_table.clear();
+
+    // each worker hashes up to lanes blocks at once, as long as all their
+    // scratchpads fit in the cache
+    const size_t lanes = cn_slow_hash_optimal_lanes(cn_pow_hash_v2::pad_size, threads);
+
+    // workers claim blocks as they go, so a slow block only holds up the
+    // worker hashing it. Don't wait for the hashes: the first blocks can be
+    // verified (and the output scan below done) while the rest are hashed
+    m_longhash_next_parse = 0;
+    m_longhash_parsed = 0;
+    m_longhash_skip = false;
+    m_longhash_next = 0;
+    m_longhash_jobs = threads;
+    m_longhash_start = epee::misc_utils::get_tick_count();
     for (uint64_t i = 0; i < threads; i++)
     {
-      for (int j = 0; j < batches; j++)
-      {
-        block block;
-
-        if (!parse_and_validate_block_from_blob(it->block, block))
-        {
-          std::advance(it, 1);
-          continue;
-        }
-
-        // check first block and skip all blocks if its not chained properly
-        if (i == 0 && j == 0)
-        {
-          crypto::hash tophash = m_db->top_block_hash();
-          if (block.prev_id != tophash)
-          {
-            LOG_PRINT_L1("Skipping prepare blocks. New blocks don't belong to chain.");
-            return true;
-          }
-        }
-        if (have_block(get_block_hash(block)))
-        {
-          blocks_exist = true;
-          break;
-        }
+      m_verification_threads.dispatch([this, lanes] {
+        block_longhash_worker(lanes);
+      });
+    }
 
-        blocks[i].push_back(block);
-        std::advance(it, 1);
+    {
+      boost::unique_lock<boost::mutex> lock(m_longhash_lock);
+      while (m_longhash_parsed != m_longhash_blocks.size())
+      {
+        lock.unlock();
+        const bool ran = m_verification_threads.try_run_one();
+        lock.lock();
+        if (!ran && m_longhash_parsed != m_longhash_blocks.size())
+          m_longhash_ready.wait(lock);
       }
     }
 
-    for (int i = 0; i < extra && !blocks_exist; i++)
+    // every block is checked, not just the first: a span which extends our
+    // chain may still overlap blocks we got meanwhile from another peer
+    bool first = true;
+    bool chained = true;
+    for (const longhash_block &lb : m_longhash_blocks)
     {
-      block block;
+      if (!lb.parsed)
+        continue;
 
-      if (!parse_and_validate_block_from_blob(it->block, block))
+      // skip all blocks if the first one is not chained properly
+      if (first && lb.prev_id != m_db->top_block_hash())
       {
-        std::advance(it, 1);
-        continue;
+        chained = false;
+        break;
       }
+      first = false;
 
-      if (have_block(get_block_hash(block)))
+      if (have_block(lb.id))
       {
         blocks_exist = true;
         break;
       }
-
-      blocks[i].push_back(block);
-      std::advance(it, 1);
     }
 
-    if (!blocks_exist)
+    if (!chained || blocks_exist)
     {
+      // the hashes would not be used, so don't wait for them either
+      m_longhash_skip = true;
+      wait_longhash_workers();
       m_blocks_longhash_table.clear();
-
-	  if(m_hash_ctxes_multi.size() < threads)
-		m_hash_ctxes_multi.resize(threads);
-
-      for (uint64_t i = 0; i < threads; i++)
-      {
-        thread_list.push_back(new boost::thread(&Blockchain::block_longhash_worker, this, std::ref(m_hash_ctxes_multi[i]), std::cref(blocks[i]), std::ref(maps[i])));
-      }
-
-      for (size_t j = 0; j < thread_list.size(); j++)
-      {
-        thread_list[j]->join();
-        delete thread_list[j];
-      }
-
-      thread_list.clear();
-
-      if (m_cancel)
-         return false;
-
-      for (const auto & map : maps)
+      if (!chained)
       {
-        m_blocks_longhash_table.insert(map.begin(), map.end());
+        LOG_PRINT_L1("Skipping prepare blocks. New blocks don't belong to chain.");
+        return true;
       }
     }
   }
@@ -3582,7 +4088,10 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
             return false; \
         } while(0); \
 
-  // generate sorted tables for all amounts and absolute offsets
+  // parse the txs of all the incoming blocks once, and hash them together
+  std::vector<transaction> txs;
+  std::vector<crypto::hash> tx_hashes;
+  std::vector<crypto::hash> tx_prefix_hashes;
   for (const auto &entry : blocks_entry)
   {
     if (m_cancel)
@@ -3590,67 +4099,73 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
 
     for (const auto &tx_blob : entry.txs)
     {
-      crypto::hash tx_hash = null_hash;
-      crypto::hash tx_prefix_hash = null_hash;
-      transaction tx;
-
-      if (!parse_and_validate_tx_from_blob(tx_blob, tx, tx_hash, tx_prefix_hash))
+      txs.push_back(transaction());
+      if (!parse_and_validate_tx_from_blob(tx_blob, txs.back()))
         SCAN_TABLE_QUIT("Could not parse tx from incoming blocks.");
+    }
+  }
+  if (!get_transaction_hashes(txs, tx_hashes, tx_prefix_hashes))
+    SCAN_TABLE_QUIT("Could not hash txs from incoming blocks.");
 
-      auto its = m_scan_table.find(tx_prefix_hash);
-      if (its != m_scan_table.end())
-        SCAN_TABLE_QUIT("Duplicate tx found from incoming blocks.");
+  // generate sorted tables for all amounts and absolute offsets
+  for (size_t i = 0; i < txs.size(); ++i)
+  {
+    const transaction &tx = txs[i];
+    const crypto::hash &tx_prefix_hash = tx_prefix_hashes[i];
 
-      m_scan_table.emplace(tx_prefix_hash, std::unordered_map<crypto::key_image, std::vector<output_data_t>>());
-      its = m_scan_table.find(tx_prefix_hash);
-      assert(its != m_scan_table.end());
+    auto its = m_scan_table.find(tx_prefix_hash);
+    if (its != m_scan_table.end())
+      SCAN_TABLE_QUIT("Duplicate tx found from incoming blocks.");
 
-      // get all amounts from tx.vin(s)
-      for (const auto &txin : tx.vin)
-      {
-        const txin_to_key &in_to_key = boost::get < txin_to_key > (txin);
+    m_scan_table.emplace(tx_prefix_hash, std::unordered_map<crypto::key_image, std::vector<output_data_t>>());
+    its = m_scan_table.find(tx_prefix_hash);
+    assert(its != m_scan_table.end());
 
-        // check for duplicate
-        auto it = its->second.find(in_to_key.k_image);
-        if (it != its->second.end())
-          SCAN_TABLE_QUIT("Duplicate key_image found from incoming blocks.");
+    // get all amounts from tx.vin(s)
+    for (const auto &txin : tx.vin)
+    {
+      const txin_to_key &in_to_key = boost::get < txin_to_key > (txin);
 
-        amounts.push_back(in_to_key.amount);
-      }
+      // check for duplicate
+      auto it = its->second.find(in_to_key.k_image);
+      if (it != its->second.end())
+        SCAN_TABLE_QUIT("Duplicate key_image found from incoming blocks.");
 
-      // sort and remove duplicate amounts from amounts list
-      std::sort(amounts.begin(), amounts.end());
-      auto last = std::unique(amounts.begin(), amounts.end());
-      amounts.erase(last, amounts.end());
+      amounts.push_back(in_to_key.amount);
+    }
 
-      // add amount to the offset_map and tx_map
-      for (const uint64_t &amount : amounts)
-      {
-        if (offset_map.find(amount) == offset_map.end())
-          offset_map.emplace(amount, std::vector<uint64_t>());
+    // sort and remove duplicate amounts from amounts list
+    std::sort(amounts.begin(), amounts.end());
+    auto last = std::unique(amounts.begin(), amounts.end());
+    amounts.erase(last, amounts.end());
 
-        if (tx_map.find(amount) == tx_map.end())
-          tx_map.emplace(amount, std::vector<output_data_t>());
-      }
+    // add amount to the offset_map and tx_map
+    for (const uint64_t &amount : amounts)
+    {
+      if (offset_map.find(amount) == offset_map.end())
+        offset_map.emplace(amount, std::vector<uint64_t>());
 
-      // add new absolute_offsets to offset_map
-      for (const auto &txin : tx.vin)
-      {
-        const txin_to_key &in_to_key = boost::get < txin_to_key > (txin);
-        // no need to check for duplicate here.
-        auto absolute_offsets = relative_output_offsets_to_absolute(in_to_key.key_offsets);
-        for (const auto & offset : absolute_offsets)
-          offset_map[in_to_key.amount].push_back(offset);
+      if (tx_map.find(amount) == tx_map.end())
+        tx_map.emplace(amount, std::vector<output_data_t>());
+    }
 
-      }
+    // add new absolute_offsets to offset_map
+    for (const auto &txin : tx.vin)
+    {
+      const txin_to_key &in_to_key = boost::get < txin_to_key > (txin);
+      // no need to check for duplicate here.
+      auto absolute_offsets = relative_output_offsets_to_absolute(in_to_key.key_offsets);
+      for (const auto & offset : absolute_offsets)
+        offset_map[in_to_key.amount].push_back(offset);
 
-      // sort and remove duplicate absolute_offsets in offset_map
-      for (auto &offsets : offset_map)
-      {
-        std::sort(offsets.second.begin(), offsets.second.end());
-        auto last = std::unique(offsets.second.begin(), offsets.second.end());
-        offsets.second.erase(last, offsets.second.end());
-      }
+    }
+
+    // sort and remove duplicate absolute_offsets in offset_map
+    for (auto &offsets : offset_map)
+    {
+      std::sort(offsets.second.begin(), offsets.second.end());
+      auto last = std::unique(offsets.second.begin(), offsets.second.end());
+      offsets.second.erase(last, offsets.second.end());
     }
   }
 
@@ -3661,26 +4176,19 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
   if (!m_db->can_thread_bulk_indices())
     threads = 1;
 
-  if (threads > 1)
+  if (threads > 1 && amounts.size() > 1)
   {
-    boost::asio::io_service ioservice;
-    boost::thread_group threadpool;
-    std::unique_ptr < boost::asio::io_service::work > work(new boost::asio::io_service::work(ioservice));
-
-    for (uint64_t i = 0; i < threads; i++)
-    {
-      threadpool.create_thread(boost::bind(&boost::asio::io_service::run, &ioservice));
-    }
-
-    for (size_t i = 0; i < amounts.size(); i++)
-    {
-      uint64_t amount = amounts[i];
-      ioservice.dispatch(boost::bind(&Blockchain::output_scan_worker, this, amount, std::cref(offset_map[amount]), std::ref(tx_map[amount]), std::ref(transactions[i])));
-    }
-
-    work.reset();
-    threadpool.join_all();
-    ioservice.stop();
+    tools::task_region(m_verification_threads, [&] (tools::task_region_handle& region) {
+      for (size_t i = 0; i < amounts.size(); i++)
+      {
+        const uint64_t amount = amounts[i];
+        const std::vector<uint64_t> &offsets = offset_map[amount];
+        std::vector<output_data_t> &outputs = tx_map[amount];
+        region.run([this, i, amount, &offsets, &outputs, &transactions] {
+          output_scan_worker(amount, offsets, outputs, transactions[i]);
+        });
+      }
+    });
   }
   else
   {
@@ -3694,55 +4202,48 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
   int total_txs = 0;
 
   // now generate a table for each tx_prefix and k_image hashes
-  for (const auto &entry : blocks_entry)
+  for (size_t i = 0; i < txs.size(); ++i)
   {
     if (m_cancel)
       return false;
 
-    for (const auto &tx_blob : entry.txs)
-    {
-      crypto::hash tx_hash = null_hash;
-      crypto::hash tx_prefix_hash = null_hash;
-      transaction tx;
+    const transaction &tx = txs[i];
+    const crypto::hash &tx_prefix_hash = tx_prefix_hashes[i];
 
-      if (!parse_and_validate_tx_from_blob(tx_blob, tx, tx_hash, tx_prefix_hash))
-        SCAN_TABLE_QUIT("Could not parse tx from incoming blocks.");
+    ++total_txs;
+    auto its = m_scan_table.find(tx_prefix_hash);
+    if (its == m_scan_table.end())
+      SCAN_TABLE_QUIT("Tx not found on scan table from incoming blocks.");
 
-      ++total_txs;
-      auto its = m_scan_table.find(tx_prefix_hash);
-      if (its == m_scan_table.end())
-        SCAN_TABLE_QUIT("Tx not found on scan table from incoming blocks.");
+    for (const auto &txin : tx.vin)
+    {
+      const txin_to_key &in_to_key = boost::get < txin_to_key > (txin);
+      auto needed_offsets = relative_output_offsets_to_absolute(in_to_key.key_offsets);
 
-      for (const auto &txin : tx.vin)
+      std::vector<output_data_t> outputs;
+      for (const uint64_t & offset_needed : needed_offsets)
       {
-        const txin_to_key &in_to_key = boost::get < txin_to_key > (txin);
-        auto needed_offsets = relative_output_offsets_to_absolute(in_to_key.key_offsets);
+        size_t pos = 0;
+        bool found = false;
 
-        std::vector<output_data_t> outputs;
-        for (const uint64_t & offset_needed : needed_offsets)
+        for (const uint64_t &offset_found : offset_map[in_to_key.amount])
         {
-          size_t pos = 0;
-          bool found = false;
-
-          for (const uint64_t &offset_found : offset_map[in_to_key.amount])
+          if (offset_needed == offset_found)
           {
-            if (offset_needed == offset_found)
-            {
-              found = true;
-              break;
-            }
-
-            ++pos;
+            found = true;
+            break;
           }
 
-          if (found && pos < tx_map[in_to_key.amount].size())
-            outputs.push_back(tx_map[in_to_key.amount].at(pos));
-          else
-            break;
+          ++pos;
         }
 
-        its->second.emplace(in_to_key.k_image, outputs);
+        if (found && pos < tx_map[in_to_key.amount].size())
+          outputs.push_back(tx_map[in_to_key.amount].at(pos));
+        else
+          break;
       }
+
+      its->second.emplace(in_to_key.k_image, outputs);
     }
   }
 
@@ -3806,30 +4307,36 @@ void Blockchain::load_compiled_in_block_hashes()
           p += sizeof(hash.data);
           m_blocks_hash_check.push_back(hash);
         }
-
-        // FIXME: clear tx_pool because the process might have been
-        // terminated and caused it to store txs kept by blocks.
-        // The core will not call check_tx_inputs(..) for these
-        // transactions in this case. Consequently, the sanity check
-        // for tx hashes will fail in handle_block_to_main_chain(..)
-        std::list<transaction> txs;
-        m_tx_pool.get_transactions(txs);
-
-        size_t blob_size;
-        uint64_t fee;
-        bool relayed;
-        transaction pool_tx;
-        for(const transaction &tx : txs)
-        {
-          crypto::hash tx_hash = get_transaction_hash(tx);
-          m_tx_pool.take_tx(tx_hash, pool_tx, blob_size, fee, relayed);
-        }
       }
     }
   }
 }
 #endif
 
+void Blockchain::flush_pool_for_precomputed_blocks()
+{
+  if (m_db->height() >= m_blocks_hash_check.size())
+    return;
+
+  // FIXME: clear tx_pool because the process might have been
+  // terminated and caused it to store txs kept by blocks.
+  // The core will not call check_tx_inputs(..) for these
+  // transactions in this case. Consequently, the sanity check
+  // for tx hashes will fail in handle_block_to_main_chain(..)
+  std::list<transaction> txs;
+  m_tx_pool.get_transactions(txs);
+
+  size_t blob_size;
+  uint64_t fee;
+  bool relayed;
+  transaction pool_tx;
+  for(const transaction &tx : txs)
+  {
+    crypto::hash tx_hash = get_transaction_hash(tx);
+    m_tx_pool.take_tx(tx_hash, pool_tx, blob_size, fee, relayed);
+  }
+}
+
 bool Blockchain::for_all_key_images(std::function<bool(const crypto::key_image&)> f) const
 {
   return m_db->for_all_key_images(f);
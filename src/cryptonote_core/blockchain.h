@@ -38,7 +38,11 @@
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
 #include <atomic>
+#include <deque>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -46,6 +50,7 @@
 #include "string_tools.h"
 #include "cryptonote_basic.h"
 #include "common/util.h"
+#include "common/thread_group.h"
 #include "cryptonote_protocol/cryptonote_protocol_defs.h"
 #include "rpc/core_rpc_server_commands_defs.h"
 #include "difficulty.h"
@@ -203,6 +208,21 @@ namespace cryptonote
          */
         bool get_block_by_hash(const crypto::hash &h, block &blk) const;
 
+        /**
+         * @brief gets the header records of a range of main chain blocks
+         *
+         * The top BLOCK_HEADER_CACHE_SIZE headers are served from memory,
+         * older ones are read from the header table without loading the
+         * blocks.
+         *
+         * @param start_height the height of the first block
+         * @param end_height the height of the last block, inclusive
+         * @param infos return-by-reference the header records, in height order
+         *
+         * @return false if the range is invalid or past the top, else true
+         */
+        bool get_block_header_info_range(uint64_t start_height, uint64_t end_height, std::vector<block_header_info>& infos) const;
+
         /**
          * @brief get all block hashes (main chain, alt chains, and invalid blocks)
          *
@@ -329,6 +349,23 @@ namespace cryptonote
          */
         bool create_block_template(block& b, const account_public_address& miner_address, difficulty_type& di, uint64_t& height, const blobdata& ex_nonce);
 
+        /**
+         * @brief creates a new block to mine against
+         *
+         * As above, also returning the version of the pool's block template
+         * the transactions were taken from.
+         *
+         * @param b return-by-reference block to be filled in
+         * @param miner_address address new coins for the block will go to
+         * @param di return-by-reference tells the miner what the difficulty target is
+         * @param height return-by-reference tells the miner what height it's mining against
+         * @param ex_nonce extra data to be added to the miner transaction's extra
+         * @param template_version return-by-reference the pool's block template version
+         *
+         * @return true if block template filled in successfully, else false
+         */
+        bool create_block_template(block& b, const account_public_address& miner_address, difficulty_type& di, uint64_t& height, const blobdata& ex_nonce, uint64_t& template_version);
+
         /**
          * @brief checks if a block is known about with a given hash
          *
@@ -374,7 +411,7 @@ namespace cryptonote
          * @param qblock_ids the foreign chain's "short history" (see get_short_chain_history)
          * @param resp return-by-reference the split height and subsequent blocks' hashes
          *
-         * @return true if a block found in common, else false
+         * @return true if a block found in common and it is not below the pruned height, else false
          */
         bool find_blockchain_supplement(const std::list<crypto::hash>& qblock_ids, NOTIFY_RESPONSE_CHAIN_ENTRY::request& resp) const;
 
@@ -410,12 +447,34 @@ namespace cryptonote
          */
         bool find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<std::pair<block, std::list<transaction> > >& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count) const;
 
+        /**
+         * @brief get recent block blobs for a foreign chain
+         *
+         * As above, but the blocks and their transactions are returned as they
+         * are stored, without being parsed and serialized again.  The
+         * transactions of blocks below the pruned height are returned
+         * pruned, along with their prunable hashes.
+         *
+         * @param req_start_block if non-zero, specifies a start point (otherwise find most recent commonality)
+         * @param qblock_ids the foreign chain's "short history" (see get_short_chain_history)
+         * @param blocks return-by-reference the block blobs and their transaction blobs
+         * @param tx_hashes return-by-reference, per block, the miner tx hash followed by the block's tx hashes
+         * @param total_height return-by-reference our current blockchain height
+         * @param start_height return-by-reference the height of the first block returned
+         * @param max_count the max number of blocks to get
+         *
+         * @return true if a block found in common or req_start_block specified, else false
+         */
+        bool find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<block_complete_entry>& blocks, std::list<std::vector<crypto::hash> >& tx_hashes, uint64_t& total_height, uint64_t& start_height, size_t max_count) const;
+
         /**
          * @brief retrieves a set of blocks and their transactions, and possibly other transactions
          *
          * the request object encapsulates a list of block hashes and a (possibly empty) list of
          * transaction hashes.  for each block hash, the block is fetched along with all of that
          * block's transactions.  Any transactions requested separately are fetched afterwards.
+         * Blocks below the pruned height are reported missed, as their transactions
+         * can't be sent whole.
          *
          * @param arg the request
          * @param rsp return-by-reference the response to fill in
@@ -624,6 +683,21 @@ namespace cryptonote
         template<class t_ids_container, class t_tx_container, class t_missed_container>
         bool get_transactions(const t_ids_container& txs_ids, t_tx_container& txs, t_missed_container& missed_txs) const;
 
+        /**
+         * @brief gets transaction blobs based on a list of transaction hashes
+         *
+         * @tparam t_ids_container a standard-iterable container
+         * @tparam t_tx_container a standard-iterable container
+         * @tparam t_missed_container a standard-iterable container
+         * @param txs_ids a container of hashes for which to get the corresponding transactions
+         * @param txs return-by-reference a container to store result transaction blobs in
+         * @param missed_txs return-by-reference a container to store missed transactions in
+         *
+         * @return false if an unexpected exception occurs, else true
+         */
+        template<class t_ids_container, class t_tx_container, class t_missed_container>
+        bool get_transactions_blobs(const t_ids_container& txs_ids, t_tx_container& txs, t_missed_container& missed_txs) const;
+
 
         //debug functions
 
@@ -647,9 +721,11 @@ namespace cryptonote
         void print_blockchain_index() const;
 
         /**
-         * @brief currently does nothing, candidate for removal
+         * @brief writes all outputs, grouped by amount, to a file
+         *
+         * The outputs are read on several threads, one range of outputs each.
          *
-         * @param file
+         * @param file the file to write to
          */
         void print_blockchain_outs(const std::string& file) const;
 
@@ -697,6 +773,16 @@ namespace cryptonote
          */
         void set_show_time_stats(bool stats) { m_show_time_stats = stats; }
 
+        /**
+         * @brief sets how deep transactions get pruned
+         *
+         * The prunable data of the transactions in blocks deeper than this
+         * is dropped from the db, see BlockchainDB::prune_blockchain.
+         *
+         * @param depth the depth below the top to prune at, 0 to not prune
+         */
+        void set_prune_depth(uint64_t depth) { m_prune_depth = depth; }
+
         /**
          * @brief gets the hardfork voting state object
          *
@@ -828,13 +914,73 @@ namespace cryptonote
                 cryptonote::transaction> &txs) const;
 
         /**
-         * @brief computes the "short" and "long" hashes for a set of blocks
+         * @brief parses and computes the "short" and "long" hashes for incoming blocks
+         *
+         * Workers first claim blobs from m_longhash_blocks one at a time and
+         * parse them, which prepare_handle_incoming_blocks waits for to check
+         * the blocks.  Unless that fails, they then claim the next lanes
+         * blocks until none are left, hash them together, and publish the
+         * hashes to m_blocks_longhash_table as soon as they are computed, so
+         * blocks can be verified while later ones are hashed.
          *
-         * @param hash_ctx pow hash ctx
-         * @param blocks the blocks to be hashed
-         * @param map return-by-reference the hashes for each block
+         * @param lanes the number of blocks hashed at once
          */
-        void block_longhash_worker(cn_pow_hash_v2& hash_ctx, const std::vector<block> &blocks, std::unordered_map<crypto::hash, crypto::hash> &map);
+        void block_longhash_worker(size_t lanes);
+
+        /**
+         * @brief gets a block's longhash computed by prepare_handle_incoming_blocks
+         *
+         * If the hash is still being computed, this waits for it, running
+         * queued verification tasks meanwhile.
+         *
+         * @param id the block's hash
+         * @param pow return-by-reference the block's longhash
+         *
+         * @return true if the longhash was precomputed, otherwise false
+         */
+        bool get_precomputed_longhash(const crypto::hash &id, crypto::hash &pow);
+
+        /**
+         * @brief waits until no longhash precomputation is running
+         */
+        void wait_longhash_workers();
+
+        /**
+         * @brief gets the number of threads in the shared verification pool
+         *
+         * @return the number of worker threads, not counting the calling thread
+         */
+        size_t get_verification_threads_count() const { return m_verification_threads.count(); }
+
+        /**
+         * @brief gets the number of verification tasks waiting for a thread
+         *
+         * @return the number of queued tasks
+         */
+        size_t get_verification_queue_depth() const { return m_verification_threads.queued(); }
+
+        /**
+         * @brief gets throughput statistics of the block sync pipeline stages
+         *
+         * @param pow_blocks return-by-reference blocks whose longhash was precomputed
+         * @param pow_time return-by-reference time spent precomputing them, in ms
+         * @param verify_blocks return-by-reference blocks verified and added to the chain
+         * @param verify_time return-by-reference time spent verifying and adding them, in ms
+         */
+        void get_sync_stats(uint64_t &pow_blocks, uint64_t &pow_time, uint64_t &verify_blocks, uint64_t &verify_time) const
+        {
+          pow_blocks = m_sync_pow_blocks;
+          pow_time = m_sync_pow_time;
+          verify_blocks = m_sync_verify_blocks;
+          verify_time = m_sync_verify_time;
+        }
+
+        /**
+         * @brief empties the pool if blocks are still to be synced against compiled-in hashes
+         *
+         * This has to run once the pool has been loaded.
+         */
+        void flush_pool_for_precomputed_blocks();
 
         void cancel();
 
@@ -871,6 +1017,10 @@ namespace cryptonote
         std::unordered_map<crypto::hash, crypto::hash> m_blocks_longhash_table;
         std::unordered_map<crypto::hash, std::unordered_map<crypto::key_image, bool>> m_check_txin_table;
 
+        // txes whose ringct signatures were verified, keyed by tx and ring members, oldest first
+        std::unordered_set<crypto::hash> m_verified_signatures;
+        std::deque<crypto::hash> m_verified_signatures_order;
+
         // SHA-3 hashes for each block and for fast pow checking
         std::vector<crypto::hash> m_blocks_hash_check;
         std::vector<crypto::hash> m_blocks_txs_check;
@@ -879,6 +1029,8 @@ namespace cryptonote
         bool m_fast_sync;
         bool m_show_time_stats;
         uint64_t m_db_blocks_per_sync;
+        uint64_t m_prune_depth;
+        uint64_t m_pruned_height;
         uint64_t m_max_prepare_blocks_threads;
         uint64_t m_fake_pow_calc_time;
         uint64_t m_fake_scan_time;
@@ -887,10 +1039,16 @@ namespace cryptonote
         std::vector<difficulty_type> m_difficulties;
         uint64_t m_timestamps_and_difficulties_height;
 
+        // header records of the top blocks, oldest first; filled on first use
+        mutable std::vector<block_header_info> m_header_cache;
+
         boost::asio::io_service m_async_service;
         boost::thread_group m_async_pool;
         std::unique_ptr<boost::asio::io_service::work> m_async_work_idle;
 
+        // long lived pool shared by signature, longhash and output scan workers
+        tools::thread_group m_verification_threads;
+
         // all alternative chains
         blocks_ext_by_hash m_alternative_chains; // crypto::hash -> block_extended_info
 
@@ -898,7 +1056,33 @@ namespace cryptonote
         blocks_ext_by_hash m_invalid_blocks;     // crypto::hash -> block_extended_info
 
         cn_pow_hash_v2 m_pow_ctx;
-        std::vector<cn_pow_hash_v2> m_hash_ctxes_multi;
+        boost::thread_specific_ptr<std::vector<cn_pow_hash_v2>> m_hash_ctxes;  // each pool thread's longhash worker ctxes
+
+        // longhashes of incoming blocks are computed in the background while
+        // the first ones are verified; m_blocks_longhash_table is guarded by
+        // m_longhash_lock while m_longhash_jobs batches are outstanding
+        boost::mutex m_longhash_lock;
+        boost::condition_variable m_longhash_ready;
+        size_t m_longhash_jobs;
+        uint64_t m_longhash_start;
+        struct longhash_block
+        {
+          blobdata blob;  // the block blob, then its hashing blob once parsed
+          crypto::hash id;
+          crypto::hash prev_id;
+          bool parsed;
+        };
+        std::vector<longhash_block> m_longhash_blocks;
+        std::atomic<size_t> m_longhash_next_parse;
+        size_t m_longhash_parsed;  // blocks done parsing, under m_longhash_lock
+        std::atomic<bool> m_longhash_skip;  // the blocks failed the checks, don't hash them
+        std::atomic<size_t> m_longhash_next;
+
+        // block sync pipeline stage statistics
+        std::atomic<uint64_t> m_sync_pow_blocks;
+        std::atomic<uint64_t> m_sync_pow_time;
+        std::atomic<uint64_t> m_sync_verify_blocks;
+        std::atomic<uint64_t> m_sync_verify_time;
 
         checkpoints m_checkpoints;
         std::atomic<bool> m_is_in_checkpoint_zone;
@@ -932,6 +1116,23 @@ namespace cryptonote
         template<class visitor_t>
         inline bool scan_outputkeys_for_indexes(size_t tx_version, const txin_to_key& tx_in_to_key, visitor_t &vis, const crypto::hash &tx_prefix_hash, uint64_t* pmax_related_block_height = NULL) const;
 
+        /**
+         * @brief looks up the ring members of all a transaction's inputs at once
+         *
+         * The outputs are fetched from the db in a single batch and stored in
+         * m_scan_table, where scan_outputkeys_for_indexes will find them.
+         * Nothing is done if the table already has an entry for the transaction.
+         *
+         * If any output cannot be found, nothing is stored, and the inputs
+         * are left to be looked up (and rejected) one by one.
+         *
+         * @param tx the transaction
+         * @param tx_prefix_hash the hash of the transaction's prefix
+         *
+         * @return true if an entry was added, which the caller should remove, otherwise false
+         */
+        bool prefetch_ring_members(const transaction& tx, const crypto::hash& tx_prefix_hash);
+
         /**
          * @brief collect output public keys of a transaction input set
          *
@@ -966,15 +1167,42 @@ namespace cryptonote
          * of the most recent block which contains an output used in any input set
          *
          * Currently this function calls ring signature validation for each
-         * transaction.
+         * transaction, unless rct_verification_deferred is given, in which
+         * case only the expanded signatures' structure is checked and the
+         * caller must verify them afterwards (see rct::verRctBatch).
+         * Signatures already verified against the same ring members are not
+         * verified again.
          *
          * @param tx the transaction to validate
          * @param tvc returned information about tx verification
          * @param pmax_related_block_height return-by-pointer the height of the most recent block in the input set
+         * @param rct_verification_deferred if not NULL, skip the ringct signature verification itself, and return-by-pointer whether the caller still has to do it
          *
          * @return false if any validation step fails, otherwise true
          */
-        bool check_tx_inputs(transaction& tx, tx_verification_context &tvc, uint64_t* pmax_used_block_height = NULL);
+        bool check_tx_inputs(transaction& tx, tx_verification_context &tvc, uint64_t* pmax_used_block_height = NULL, bool* rct_verification_deferred = NULL);
+
+        /**
+         * @brief computes the key a transaction's verified signatures are cached under
+         *
+         * @param tx the transaction
+         * @param pubkeys the ring members its inputs were resolved to
+         *
+         * @return a hash of the transaction hash and the ring members
+         */
+        crypto::hash get_verified_signatures_key(const transaction& tx, const std::vector<std::vector<rct::ctkey>>& pubkeys) const;
+
+        /**
+         * @brief remembers a transaction's signatures as verified, evicting the oldest entries past the cache size
+         *
+         * @param key the key from get_verified_signatures_key
+         */
+        void add_verified_signatures(const crypto::hash& key);
+
+        /**
+         * @brief forgets all verified signatures
+         */
+        void clear_verified_signatures();
 
         /**
          * @brief performs a blockchain reorganization according to the longest chain rule
@@ -1121,8 +1349,9 @@ namespace cryptonote
          * @param outs return-by-reference the set the output is to be added to
          * @param amount the output amount (0 for rct inputs)
          * @param i the rct output index
+         * @param data the output's data, as returned by the db
          */
-        void add_out_to_get_rct_random_outs(std::list<COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry>& outs, uint64_t amount, size_t i) const;
+        void add_out_to_get_rct_random_outs(std::list<COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry>& outs, uint64_t amount, size_t i, const output_data_t &data) const;
 
         /**
          * @brief checks if a transaction is unlocked (its outputs spendable)
@@ -1224,6 +1453,16 @@ namespace cryptonote
          * @return true
          */
         bool update_next_cumulative_size_limit();
+
+        /**
+         * @brief prunes the transactions deeper than the prune depth
+         *
+         * This is done CRYPTONOTE_PRUNING_STEP blocks at a time, so it is
+         * cheap to call after each block.  Errors are logged, not returned,
+         * as the blockchain is still usable unpruned.
+         */
+        void prune_blockchain();
+
         void return_tx_to_pool(const std::vector<transaction> &txs);
 
         /**
@@ -262,6 +262,27 @@ namespace cryptonote
       }
     END_SERIALIZE()
 
+    // the prefix and, from version 2, the rct base: everything but the
+    // prunable signature data, which follows it in the serialized tx
+    template<bool W, template <bool> class Archive>
+    bool serialize_base(Archive<W> &ar)
+    {
+      FIELDS(*static_cast<transaction_prefix *>(this))
+
+      if (version > 1)
+      {
+        ar.tag("rct_signatures");
+        if (!vin.empty())
+        {
+          ar.begin_object();
+          bool r = rct_signatures.serialize_rctsig_base(ar, vin.size(), vout.size());
+          if (!r || !ar.stream().good()) return false;
+          ar.end_object();
+        }
+      }
+      return ar.stream().good();
+    }
+
   private:
     static size_t get_signature_size(const txin_v& tx_in);
   };
@@ -45,6 +45,7 @@ using namespace epee;
 #include <csignal>
 #include "cryptonote_core/checkpoints.h"
 #include "ringct/rctTypes.h"
+#include "ringct/rctOps.h"
 #include "blockchain_db/blockchain_db.h"
 #include "blockchain_db/lmdb/db_lmdb.h"
 
@@ -127,6 +128,9 @@ namespace cryptonote
     command_line::add_arg(desc, command_line::arg_db_sync_mode);
     command_line::add_arg(desc, command_line::arg_show_time_stats);
     command_line::add_arg(desc, command_line::arg_block_sync_size);
+    command_line::add_arg(desc, command_line::arg_ring_precomp_cache_size);
+    command_line::add_arg(desc, command_line::arg_prune_blockchain);
+    command_line::add_arg(desc, command_line::arg_prune_blockchain_depth);
 	command_line::add_arg(desc, command_line::arg_print_genesis_tx);
   }
   //-----------------------------------------------------------------------------------------------
@@ -236,9 +240,6 @@ namespace cryptonote
     m_fakechain = test_options != NULL;
     bool r = handle_command_line(vm);
 
-    r = m_mempool.init(m_fakechain ? std::string() : m_config_folder);
-    CHECK_AND_ASSERT_MES(r, false, "Failed to initialize memory pool");
-
     std::string db_sync_mode = command_line::get_arg(vm, command_line::arg_db_sync_mode);
     bool fast_sync = command_line::get_arg(vm, command_line::arg_fast_block_sync) != 0;
     uint64_t blocks_threads = command_line::get_arg(vm, command_line::arg_prep_blocks_threads);
@@ -326,6 +327,16 @@ namespace cryptonote
           db_flags = DEFAULT_FLAGS;
       }
 
+      // safe:background keeps every commit atomic, but leaves flushing the
+      // meta page to a background thread instead of stalling on it per
+      // block, so the most recent commit may be lost on crash. Any other
+      // safe mode stays fully synchronous.
+      if(options.size() >= 2 && safemode && options[1] == "background")
+      {
+        db_flags |= MDB_NOMETASYNC;
+        LOG_PRINT_L0("Database commits are atomic, but the most recent commit may be lost on crash");
+      }
+
       if(options.size() >= 2 && !safemode)
       {
         if(options[1] == "sync")
@@ -345,7 +356,6 @@ namespace cryptonote
       db->open(filename, db_flags);
       if(!db->m_open)
         return false;
-      db->load_aliases();
     }
     catch (const DB_ERROR& e)
     {
@@ -354,8 +364,22 @@ namespace cryptonote
     }
 
     m_blockchain_storage.set_user_options(blocks_threads, blocks_per_sync, sync_mode, fast_sync);
+    if (command_line::get_arg(vm, command_line::arg_prune_blockchain))
+    {
+      uint64_t prune_depth = command_line::get_arg(vm, command_line::arg_prune_blockchain_depth);
+      // peers syncing from us and reorgs both need whole txs near the top
+      CHECK_AND_ASSERT_MES(prune_depth >= CRYPTONOTE_PRUNING_DEFAULT_DEPTH, false, "--prune-blockchain-depth must be at least " << CRYPTONOTE_PRUNING_DEFAULT_DEPTH);
+      m_blockchain_storage.set_prune_depth(prune_depth);
+    }
 
     r = m_blockchain_storage.init(db, m_testnet, test_options);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to initialize blockchain storage");
+
+    // the pool is kept in the blockchain db, so it is loaded from there
+    r = m_mempool.init(!m_fakechain);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to initialize memory pool");
+
+    m_blockchain_storage.flush_pool_for_precomputed_blocks();
 
     // now that we have a valid m_blockchain_storage, we can clean out any
     // transactions in the pool that do not conform to the current fork
@@ -363,12 +387,13 @@ namespace cryptonote
 
     bool show_time_stats = command_line::get_arg(vm, command_line::arg_show_time_stats) != 0;
     m_blockchain_storage.set_show_time_stats(show_time_stats);
-    CHECK_AND_ASSERT_MES(r, false, "Failed to initialize blockchain storage");
 
     block_sync_size = command_line::get_arg(vm, command_line::arg_block_sync_size);
     if (block_sync_size == 0)
       block_sync_size = BLOCKS_SYNCHRONIZING_DEFAULT_COUNT;
 
+    rct::setRingMemberPrecompCacheSize(command_line::get_arg(vm, command_line::arg_ring_precomp_cache_size) * 1024 * 1024);
+
     // load json checkpoints, and verify them
     // with respect to what blocks we already have
     CHECK_AND_ASSERT_MES(update_checkpoints(), false, "One or more checkpoints loaded from json conflicted with existing checkpoints.");
@@ -474,7 +499,7 @@ namespace cryptonote
       return false;
     }
 
-    bool r = add_new_tx(tx, tx_hash, tx_prefixt_hash, tx_blob.size(), tvc, keeped_by_block, relayed);
+    bool r = add_new_tx(tx, tx_hash, tx_prefixt_hash, tx_blob, tvc, keeped_by_block, relayed);
     if(tvc.m_verifivation_failed)
       LOG_PRINT_RED_L1("Transaction verification failed: " << tx_hash);
     else if(tvc.m_verifivation_impossible)
@@ -664,7 +689,7 @@ namespace cryptonote
     crypto::hash tx_prefix_hash = get_transaction_prefix_hash(tx);
     blobdata bl;
     t_serializable_object_to_blob(tx, bl);
-    return add_new_tx(tx, tx_hash, tx_prefix_hash, bl.size(), tvc, keeped_by_block, relayed);
+    return add_new_tx(tx, tx_hash, tx_prefix_hash, bl, tvc, keeped_by_block, relayed);
   }
   //-----------------------------------------------------------------------------------------------
   size_t core::get_blockchain_total_transactions() const
@@ -672,7 +697,7 @@ namespace cryptonote
     return m_blockchain_storage.get_total_transactions();
   }
   //-----------------------------------------------------------------------------------------------
-  bool core::add_new_tx(const transaction& tx, const crypto::hash& tx_hash, const crypto::hash& tx_prefix_hash, size_t blob_size, tx_verification_context& tvc, bool keeped_by_block, bool relayed)
+  bool core::add_new_tx(const transaction& tx, const crypto::hash& tx_hash, const crypto::hash& tx_prefix_hash, const blobdata& tx_blob, tx_verification_context& tvc, bool keeped_by_block, bool relayed)
   {
     if(m_mempool.have_tx(tx_hash))
     {
@@ -687,23 +712,21 @@ namespace cryptonote
     }
 
     uint8_t version = m_blockchain_storage.get_current_hard_fork_version();
-    return m_mempool.add_tx(tx, tx_hash, blob_size, tvc, keeped_by_block, relayed, version);
+    return m_mempool.add_tx(tx, tx_hash, tx_blob, tvc, keeped_by_block, relayed, version);
   }
   //-----------------------------------------------------------------------------------------------
   bool core::relay_txpool_transactions()
   {
     // we attempt to relay txes that should be relayed, but were not
-    std::list<std::pair<crypto::hash, cryptonote::transaction>> txs;
+    std::list<std::pair<crypto::hash, cryptonote::blobdata>> txs;
     if (m_mempool.get_relayable_transactions(txs))
     {
       cryptonote_connection_context fake_context = AUTO_VAL_INIT(fake_context);
       tx_verification_context tvc = AUTO_VAL_INIT(tvc);
       NOTIFY_NEW_TRANSACTIONS::request r;
-      blobdata bl;
       for (auto it = txs.begin(); it != txs.end(); ++it)
       {
-        t_serializable_object_to_blob(it->second, bl);
-        r.txs.push_back(bl);
+        r.txs.push_back(it->second);
       }
       get_protocol()->relay_transactions(r, fake_context);
       m_mempool.set_relayed(txs);
@@ -713,7 +736,7 @@ namespace cryptonote
   //-----------------------------------------------------------------------------------------------
   void core::on_transaction_relayed(const cryptonote::blobdata& tx_blob)
   {
-    std::list<std::pair<crypto::hash, cryptonote::transaction>> txs;
+    std::list<std::pair<crypto::hash, cryptonote::blobdata>> txs;
     cryptonote::transaction tx;
     crypto::hash tx_hash, tx_prefix_hash;
     if (!parse_and_validate_tx_from_blob(tx_blob, tx, tx_hash, tx_prefix_hash))
@@ -721,7 +744,7 @@ namespace cryptonote
       LOG_ERROR("Failed to parse relayed transaction");
       return;
     }
-    txs.push_back(std::make_pair(tx_hash, std::move(tx)));
+    txs.push_back(std::make_pair(tx_hash, tx_blob));
     m_mempool.set_relayed(txs);
   }
   //-----------------------------------------------------------------------------------------------
@@ -730,6 +753,11 @@ namespace cryptonote
     return m_blockchain_storage.create_block_template(b, adr, diffic, height, ex_nonce);
   }
   //-----------------------------------------------------------------------------------------------
+  bool core::get_block_template(block& b, const account_public_address& adr, difficulty_type& diffic, uint64_t& height, const blobdata& ex_nonce, uint64_t& template_version)
+  {
+    return m_blockchain_storage.create_block_template(b, adr, diffic, height, ex_nonce, template_version);
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::find_blockchain_supplement(const std::list<crypto::hash>& qblock_ids, NOTIFY_RESPONSE_CHAIN_ENTRY::request& resp) const
   {
     return m_blockchain_storage.find_blockchain_supplement(qblock_ids, resp);
@@ -740,6 +768,11 @@ namespace cryptonote
     return m_blockchain_storage.find_blockchain_supplement(req_start_block, qblock_ids, blocks, total_height, start_height, max_count);
   }
   //-----------------------------------------------------------------------------------------------
+  bool core::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<block_complete_entry>& blocks, std::list<std::vector<crypto::hash> >& tx_hashes, uint64_t& total_height, uint64_t& start_height, size_t max_count) const
+  {
+    return m_blockchain_storage.find_blockchain_supplement(req_start_block, qblock_ids, blocks, tx_hashes, total_height, start_height, max_count);
+  }
+  //-----------------------------------------------------------------------------------------------
   void core::print_blockchain(uint64_t start_index, uint64_t end_index) const
   {
     m_blockchain_storage.print_blockchain(start_index, end_index);
@@ -896,6 +929,11 @@ namespace cryptonote
     return m_mempool.get_transactions_count();
   }
   //-----------------------------------------------------------------------------------------------
+  bool core::wait_for_block_template_change(uint64_t version, uint64_t timeout_ms) const
+  {
+    return m_mempool.wait_for_template_change(version, timeout_ms);
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::have_block(const crypto::hash& id) const
   {
     return m_blockchain_storage.have_block(id);
@@ -923,9 +961,9 @@ namespace cryptonote
     return true;
   }
   //-----------------------------------------------------------------------------------------------
-  bool core::get_pool_transaction(const crypto::hash &id, transaction& tx) const
+  bool core::get_pool_transaction(const crypto::hash &id, cryptonote::blobdata& tx_blob) const
   {
-    return m_mempool.get_transaction(id, tx);
+    return m_mempool.get_transaction(id, tx_blob);
   }
   //-----------------------------------------------------------------------------------------------
   bool core::get_pool_transactions_and_spent_keys_info(std::vector<tx_info>& tx_infos, std::vector<spent_key_image_info>& key_image_infos) const
@@ -958,6 +996,11 @@ namespace cryptonote
     return m_mempool.print_pool(short_format);
   }
   //-----------------------------------------------------------------------------------------------
+  std::string core::print_pool_lock_stats() const
+  {
+    return m_mempool.print_lock_stats();
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::update_miner_block_template()
   {
     m_miner.on_block_chain_update();
@@ -180,6 +180,13 @@ namespace cryptonote
       */
      virtual bool get_block_template(block& b, const account_public_address& adr, difficulty_type& diffic, uint64_t& height, const blobdata& ex_nonce);
 
+     /**
+      * @copydoc Blockchain::create_block_template(block&, const account_public_address&, difficulty_type&, uint64_t&, const blobdata&, uint64_t&)
+      *
+      * @note see Blockchain::create_block_template(block&, const account_public_address&, difficulty_type&, uint64_t&, const blobdata&, uint64_t&)
+      */
+     bool get_block_template(block& b, const account_public_address& adr, difficulty_type& diffic, uint64_t& height, const blobdata& ex_nonce, uint64_t& template_version);
+
      /**
       * @brief called when a transaction is relayed
       */
@@ -385,7 +392,7 @@ namespace cryptonote
       *
       * @note see tx_memory_pool::get_transaction
       */
-     bool get_pool_transaction(const crypto::hash& id, transaction& tx) const;
+     bool get_pool_transaction(const crypto::hash& id, cryptonote::blobdata& tx_blob) const;
 
      /**
       * @copydoc tx_memory_pool::get_pool_transactions_and_spent_keys_info
@@ -401,6 +408,13 @@ namespace cryptonote
       */
      size_t get_pool_transactions_count() const;
 
+     /**
+      * @copydoc tx_memory_pool::wait_for_template_change
+      *
+      * @note see tx_memory_pool::wait_for_template_change
+      */
+     bool wait_for_block_template_change(uint64_t version, uint64_t timeout_ms) const;
+
      /**
       * @copydoc Blockchain::get_total_transactions
       *
@@ -436,6 +450,13 @@ namespace cryptonote
       */
      bool find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<std::pair<block, std::list<transaction> > >& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count) const;
 
+     /**
+      * @copydoc Blockchain::find_blockchain_supplement(const uint64_t, const std::list<crypto::hash>&, std::list<block_complete_entry>&, std::list<std::vector<crypto::hash> >&, uint64_t&, uint64_t&, size_t) const
+      *
+      * @note see Blockchain::find_blockchain_supplement(const uint64_t, const std::list<crypto::hash>&, std::list<block_complete_entry>&, std::list<std::vector<crypto::hash> >&, uint64_t&, uint64_t&, size_t) const
+      */
+     bool find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<block_complete_entry>& blocks, std::list<std::vector<crypto::hash> >& tx_hashes, uint64_t& total_height, uint64_t& start_height, size_t max_count) const;
+
      /**
       * @brief gets some stats about the daemon
       *
@@ -531,6 +552,13 @@ namespace cryptonote
       */
      std::string print_pool(bool short_format) const;
 
+     /**
+      * @copydoc tx_memory_pool::print_lock_stats
+      *
+      * @note see tx_memory_pool::print_lock_stats
+      */
+     std::string print_pool_lock_stats() const;
+
      /**
       * @copydoc Blockchain::print_blockchain_outs
       *
@@ -633,11 +661,11 @@ namespace cryptonote
       *
       * @param tx_hash the transaction's hash
       * @param tx_prefix_hash the transaction prefix' hash
-      * @param blob_size the size of the transaction
+      * @param tx_blob the transaction as it was serialized
       * @param relayed whether or not the transaction was relayed to us
       *
       */
-     bool add_new_tx(const transaction& tx, const crypto::hash& tx_hash, const crypto::hash& tx_prefix_hash, size_t blob_size, tx_verification_context& tvc, bool keeped_by_block, bool relayed);
+     bool add_new_tx(const transaction& tx, const crypto::hash& tx_hash, const crypto::hash& tx_prefix_hash, const blobdata& tx_blob, tx_verification_context& tvc, bool keeped_by_block, bool relayed);
 
      /**
       * @brief add a new transaction to the transaction pool
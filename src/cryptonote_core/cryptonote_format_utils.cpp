@@ -94,6 +94,16 @@ namespace cryptonote
     return true;
   }
   //---------------------------------------------------------------
+  bool parse_and_validate_tx_base_from_blob(const blobdata& tx_blob, transaction& tx)
+  {
+    std::stringstream ss;
+    ss << tx_blob;
+    binary_archive<false> ba(ss);
+    bool r = tx.serialize_base(ba);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to parse transaction base from blob");
+    return true;
+  }
+  //---------------------------------------------------------------
   bool parse_and_validate_tx_from_blob(const blobdata& tx_blob, transaction& tx, crypto::hash& tx_hash, crypto::hash& tx_prefix_hash)
   {
     std::stringstream ss;
@@ -1174,6 +1184,95 @@ namespace cryptonote
     return true;
   }
   //---------------------------------------------------------------
+  bool get_transaction_hashes(const std::vector<transaction>& txs, std::vector<crypto::hash>& tx_hashes, std::vector<crypto::hash>& tx_prefix_hashes)
+  {
+    // same hashes as get_transaction_hash, but the parts of all the txs are
+    // serialized first, then each kind of part is hashed for all the txs in
+    // one cn_fast_hash_multi call, so the keccak lanes get similar lengths
+    const size_t n = txs.size();
+    std::vector<std::string> blobs(3 * n);
+    std::vector<crypto::hash> hashes(3 * n);
+    std::vector<const void*> data;
+    std::vector<size_t> length;
+    std::vector<char*> out;
+    data.reserve(3 * n);
+    length.reserve(3 * n);
+    out.reserve(3 * n);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+      const transaction &t = txs[i];
+      transaction &tt = const_cast<transaction&>(t);
+      const size_t inputs = t.vin.size();
+      const size_t outputs = t.vout.size();
+
+      // prefix
+      {
+        std::ostringstream ss;
+        binary_archive<true> ba(ss);
+        bool r = ::serialization::serialize(ba, static_cast<transaction_prefix&>(tt));
+        CHECK_AND_ASSERT_MES(r, false, "Failed to serialize transaction prefix");
+        blobs[i] = ss.str();
+      }
+
+      // base rct
+      {
+        std::stringstream ss;
+        binary_archive<true> ba(ss);
+        bool r = tt.rct_signatures.serialize_rctsig_base(ba, inputs, outputs);
+        CHECK_AND_ASSERT_MES(r, false, "Failed to serialize rct signatures base");
+        blobs[n + i] = ss.str();
+      }
+
+      // prunable rct
+      if (t.rct_signatures.type == rct::RCTTypeNull)
+      {
+        hashes[2 * n + i] = cryptonote::null_hash;
+      }
+      else
+      {
+        std::stringstream ss;
+        binary_archive<true> ba(ss);
+        const size_t mixin = t.vin.empty() ? 0 : t.vin[0].type() == typeid(txin_to_key) ? boost::get<txin_to_key>(t.vin[0]).key_offsets.size() - 1 : 0;
+        bool r = tt.rct_signatures.p.serialize_rctsig_prunable(ba, t.rct_signatures.type, inputs, outputs, mixin);
+        CHECK_AND_ASSERT_MES(r, false, "Failed to serialize rct signatures prunable");
+        blobs[2 * n + i] = ss.str();
+      }
+    }
+
+    // prefixes, then bases, then the non null prunable parts
+    for (size_t i = 0; i < 3 * n; ++i)
+    {
+      if (i >= 2 * n && txs[i - 2 * n].rct_signatures.type == rct::RCTTypeNull)
+        continue;
+      data.push_back(blobs[i].data());
+      length.push_back(blobs[i].size());
+      out.push_back(hashes[i].data);
+    }
+    crypto::cn_fast_hash_multi(data.data(), length.data(), out.data(), data.size());
+
+    // the tx hash is the hash of the 3 hashes
+    std::vector<crypto::hash> tx_parts(3 * n);
+    data.clear();
+    length.clear();
+    out.clear();
+    tx_hashes.resize(n);
+    tx_prefix_hashes.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+      tx_parts[3 * i] = hashes[i];
+      tx_parts[3 * i + 1] = hashes[n + i];
+      tx_parts[3 * i + 2] = hashes[2 * n + i];
+      tx_prefix_hashes[i] = hashes[i];
+      data.push_back(&tx_parts[3 * i]);
+      length.push_back(3 * sizeof(crypto::hash));
+      out.push_back(tx_hashes[i].data);
+    }
+    crypto::cn_fast_hash_multi(data.data(), length.data(), out.data(), n);
+
+    return true;
+  }
+  //---------------------------------------------------------------
   bool get_transaction_hash(const transaction& t, crypto::hash& res, size_t& blob_size)
   {
     return get_transaction_hash(t, res, &blob_size);
@@ -1305,6 +1404,41 @@ namespace cryptonote
     return t_serializable_object_to_blob(tx, b_blob);
   }
   //---------------------------------------------------------------
+  bool tx_to_pruned_blob(const transaction& tx, blobdata& b_blob)
+  {
+    std::stringstream ss;
+    binary_archive<true> ba(ss);
+    bool r = const_cast<transaction&>(tx).serialize_base(ba);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to serialize transaction base");
+    b_blob = ss.str();
+    return true;
+  }
+  //---------------------------------------------------------------
+  crypto::hash get_transaction_prunable_hash(const transaction& t, const blobdata& prunable_blob)
+  {
+    // this is the third of the hashes the tx hash is made of
+    if (t.rct_signatures.type == rct::RCTTypeNull)
+      return cryptonote::null_hash;
+    return crypto::cn_fast_hash(prunable_blob.data(), prunable_blob.size());
+  }
+  //---------------------------------------------------------------
+  bool get_pruned_transaction_hash(const transaction& t, const crypto::hash& prunable_hash, crypto::hash& res)
+  {
+    // as get_transaction_hash, with the hash of the pruned data passed in
+    crypto::hash hashes[3];
+    get_transaction_prefix_hash(t, hashes[0]);
+
+    std::stringstream ss;
+    binary_archive<true> ba(ss);
+    bool r = const_cast<transaction&>(t).rct_signatures.serialize_rctsig_base(ba, t.vin.size(), t.vout.size());
+    CHECK_AND_ASSERT_MES(r, false, "Failed to serialize rct signatures base");
+    cryptonote::get_blob_hash(ss.str(), hashes[1]);
+
+    hashes[2] = prunable_hash;
+    res = cn_fast_hash(hashes, sizeof(hashes));
+    return true;
+  }
+  //---------------------------------------------------------------
   void get_tx_tree_hash(const std::vector<crypto::hash>& tx_hashes, crypto::hash& h)
   {
     tree_hash(tx_hashes.data(), tx_hashes.size(), h);
@@ -48,6 +48,7 @@ namespace cryptonote
   crypto::hash get_transaction_prefix_hash(const transaction_prefix& tx);
   bool parse_and_validate_tx_from_blob(const blobdata& tx_blob, transaction& tx, crypto::hash& tx_hash, crypto::hash& tx_prefix_hash);
   bool parse_and_validate_tx_from_blob(const blobdata& tx_blob, transaction& tx);
+  bool parse_and_validate_tx_base_from_blob(const blobdata& tx_blob, transaction& tx);
   bool construct_miner_tx(size_t height, size_t median_size, uint64_t already_generated_coins, size_t current_block_size, uint64_t fee, const account_public_address &miner_address, transaction& tx, const blobdata& extra_nonce = blobdata(), size_t max_outs = 1, uint8_t hard_fork_version = 1);
   bool encrypt_payment_id(std::string& payment_id, const crypto::public_key& public_key, const crypto::secret_key& secret_key);
   bool decrypt_payment_id(std::string& payment_id, const crypto::public_key& public_key, const crypto::secret_key& secret_key);
@@ -148,6 +149,7 @@ namespace cryptonote
   bool get_transaction_hash(const transaction& t, crypto::hash& res);
   bool get_transaction_hash(const transaction& t, crypto::hash& res, size_t& blob_size);
   bool get_transaction_hash(const transaction& t, crypto::hash& res, size_t* blob_size);
+  bool get_transaction_hashes(const std::vector<transaction>& txs, std::vector<crypto::hash>& tx_hashes, std::vector<crypto::hash>& tx_prefix_hashes);
   blobdata get_block_hashing_blob(const block& b);
   bool get_block_hash(const block& b, crypto::hash& res);
   std::string get_genesis_tx_hex();
@@ -270,6 +272,9 @@ namespace cryptonote
   bool block_to_blob(const block& b, blobdata& b_blob);
   blobdata tx_to_blob(const transaction& b);
   bool tx_to_blob(const transaction& b, blobdata& b_blob);
+  bool tx_to_pruned_blob(const transaction& b, blobdata& b_blob);
+  crypto::hash get_transaction_prunable_hash(const transaction& t, const blobdata& prunable_blob);
+  bool get_pruned_transaction_hash(const transaction& t, const crypto::hash& prunable_hash, crypto::hash& res);
   void get_tx_tree_hash(const std::vector<crypto::hash>& tx_hashes, crypto::hash& h);
   crypto::hash get_tx_tree_hash(const std::vector<crypto::hash>& tx_hashes);
   crypto::hash get_tx_tree_hash(const block& b);
@@ -355,7 +355,19 @@ namespace cryptonote
     difficulty_type local_diff = 0;
     uint32_t local_template_ver = 0;
     block b;
-	cn_pow_hash_v2 hash_ctx;
+
+    // hash several nonces at once when the scratchpads of all threads fit in the cache
+    const size_t lanes = cn_slow_hash_optimal_lanes(cn_pow_hash_v2::pad_size, m_threads_total);
+    std::vector<cn_pow_hash_v2> hash_ctx(lanes);
+    std::vector<cn_pow_hash_v2*> ctx(lanes);
+    for (size_t l = 0; l < lanes; ++l)
+      ctx[l] = &hash_ctx[l];
+    std::vector<blobdata> blobs(lanes);
+    std::vector<const void*> in(lanes);
+    std::vector<size_t> len(lanes);
+    std::vector<void*> out(lanes);
+    std::vector<crypto::hash> h(lanes);
+    LOG_PRINT_L1("Miner thread hashes " << lanes << " nonce(s) at a time, scratchpads use " << cn_pad_backing_name(hash_ctx[0].pad_backing()));
 
     while(!m_stop)
     {
@@ -382,21 +394,32 @@ namespace cryptonote
         continue;
       }
 
-      b.nonce = nonce;
-      crypto::hash h;
-      get_block_longhash(b, hash_ctx, h);
-
-      if(check_hash(h, local_diff)) {
-        //we lucky!
-        ++m_config.current_extra_message_index;
-        LOG_PRINT_GREEN("Found block for difficulty: " << local_diff, LOG_LEVEL_0);
-        if(!m_phandler->handle_block_found(b))
-          --m_config.current_extra_message_index;
-        else if (!m_config_folder_path.empty()) //success update, lets update config
-          epee::serialization::store_t_to_json_file(m_config, m_config_folder_path + "/" + MINER_CONFIG_FILE_NAME);
+      for (size_t l = 0; l < lanes; ++l)
+      {
+        b.nonce = nonce + l * m_threads_total;
+        blobs[l] = get_block_hashing_blob(b);
+        in[l] = blobs[l].data();
+        len[l] = blobs[l].size();
+        out[l] = h[l].data;
+      }
+      cn_pow_hash_v2::hash_lanes(ctx.data(), in.data(), len.data(), out.data(), lanes);
+
+      for (size_t l = 0; l < lanes; ++l)
+      {
+        if(check_hash(h[l], local_diff)) {
+          //we lucky!
+          b.nonce = nonce + l * m_threads_total;
+          ++m_config.current_extra_message_index;
+          LOG_PRINT_GREEN("Found block for difficulty: " << local_diff, LOG_LEVEL_0);
+          if(!m_phandler->handle_block_found(b))
+            --m_config.current_extra_message_index;
+          else if (!m_config_folder_path.empty()) //success update, lets update config
+            epee::serialization::store_t_to_json_file(m_config, m_config_folder_path + "/" + MINER_CONFIG_FILE_NAME);
+          break;
+        }
       }
-      nonce+=m_threads_total;
-      ++m_hashes;
+      nonce += lanes * m_threads_total;
+      m_hashes += lanes;
     }
     LOG_PRINT_L0("Miner thread stopped ["<< th_local_index << "]");
     return true;
@@ -31,17 +31,16 @@
 // Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
 
 #include <algorithm>
-#include <boost/filesystem.hpp>
 #include <unordered_set>
 #include <vector>
 
 #include "tx_pool.h"
 #include "cryptonote_format_utils.h"
-#include "cryptonote_boost_serialization.h"
 #include "cryptonote_config.h"
 #include "blockchain.h"
-#include "common/boost_serialization_helper.h"
 #include "common/int-util.h"
+#include "serialization/string.h"
+#include "serialization/binary_utils.h"
 #include "misc_language.h"
 #include "warnings.h"
 #include "common/perf_timer.h"
@@ -49,6 +48,14 @@
 
 DISABLE_VS_WARNINGS(4244 4345 4503) //'boost::foreach_detail_::or_' : decorated name length exceeded, name was truncated
 
+// pool locks, see tx_memory_pool::m_transactions_lock for which one guards what
+#define POOL_LOCK_SHARED() tools::TimedLock<boost::shared_lock<tools::recursive_shared_mutex>> pool_lock(m_transactions_lock, m_pool_lock_hold)
+#define POOL_LOCK_EXCLUSIVE() tools::TimedLock<boost::unique_lock<tools::recursive_shared_mutex>> pool_lock(m_transactions_lock, m_pool_lock_hold)
+#define SHARD_LOCK_SHARED(shard) tools::TimedLock<boost::shared_lock<boost::shared_mutex>> shard_lock((shard).lock, m_shard_lock_hold)
+#define SHARD_LOCK_EXCLUSIVE(shard) tools::TimedLock<boost::unique_lock<boost::shared_mutex>> shard_lock((shard).lock, m_shard_lock_hold)
+#define KEY_IMAGES_LOCK_SHARED() tools::TimedLock<boost::shared_lock<boost::shared_mutex>> key_images_lock(m_spent_key_images_lock, m_key_images_lock_hold)
+#define KEY_IMAGES_LOCK_EXCLUSIVE() tools::TimedLock<boost::unique_lock<boost::shared_mutex>> key_images_lock(m_spent_key_images_lock, m_key_images_lock_hold)
+
 namespace cryptonote
 {
   namespace
@@ -61,6 +68,39 @@ namespace cryptonote
     time_t const MIN_RELAY_TIME = (60 * 5); // only start re-relaying transactions after that many seconds
     time_t const MAX_RELAY_TIME = (60 * 60 * 4); // at most that many seconds between resends
     float const ACCEPT_THRESHOLD = 1.0f;
+    size_t const BLOCK_TEMPLATE_LOOKAHEAD = 16; // candidates each one is weighed against when filling a block template
+    unsigned const DB_WRITE_RETRY_SECONDS = 5; // how long to wait before writing pool changes again after the db failed or put them off
+
+    //! what the blockchain db keeps of a pool transaction, besides its blob
+    /*! The last failed check is not kept, so a reloaded transaction gets
+     *  its inputs checked again.
+     */
+    struct tx_details_record
+    {
+      uint64_t blob_size;
+      uint64_t fee;
+      std::vector<crypto::key_image> key_images;
+      std::string alias;
+      uint64_t max_used_block_height;
+      crypto::hash max_used_block_id;
+      uint64_t receive_time;
+      uint64_t last_relayed_time;
+      bool kept_by_block;
+      bool relayed;
+
+      BEGIN_SERIALIZE_OBJECT()
+        VARINT_FIELD(blob_size)
+        VARINT_FIELD(fee)
+        FIELD(key_images)
+        FIELD(alias)
+        VARINT_FIELD(max_used_block_height)
+        FIELD(max_used_block_id)
+        VARINT_FIELD(receive_time)
+        VARINT_FIELD(last_relayed_time)
+        FIELD(kept_by_block)
+        FIELD(relayed)
+      END_SERIALIZE()
+    };
 
     // a kind of increasing backoff within min/max bounds
     time_t get_relay_delay(time_t now, time_t received)
@@ -78,11 +118,18 @@ namespace cryptonote
   }
 
 
-  tx_memory_pool::tx_memory_pool(Blockchain& bchs): m_blockchain(bchs) {}
+  tx_memory_pool::tx_memory_pool(Blockchain& bchs): m_pool_lock_hold("pool lock"), m_shard_lock_hold("pool shard locks"), m_key_images_lock_hold("pool key image lock"),
+    m_blockchain(bchs), m_template_version(0), m_template_events(0), m_template_filled_events(0),
+    m_persistent(false), m_db_stop(false)
+  {
+    m_template.valid = false;
+    m_template.height = 0;
+  }
 
-  bool tx_memory_pool::add_tx(const transaction &tx, /*const crypto::hash& tx_prefix_hash,*/ const crypto::hash &id, size_t blob_size, tx_verification_context& tvc, bool kept_by_block, bool relayed, uint8_t version)
+  bool tx_memory_pool::add_tx(const transaction &tx, /*const crypto::hash& tx_prefix_hash,*/ const crypto::hash &id, const cryptonote::blobdata &tx_blob, tx_verification_context& tvc, bool kept_by_block, bool relayed, uint8_t version)
   {
     PERF_TIMER(add_tx);
+    const size_t blob_size = tx_blob.size();
     if (tx.version < 2)
     {
       // v0, v1 never accepted
@@ -94,12 +141,16 @@ namespace cryptonote
 
     // we do not accept transactions that timed out before, unless they're
     // kept_by_block
-    if (!kept_by_block && m_timed_out_transactions.find(id) != m_timed_out_transactions.end())
+    if (!kept_by_block)
     {
-      // not clear if we should set that, since verifivation (sic) did not fail before, since
-      // the tx was accepted before timing out.
-      tvc.m_verifivation_failed = true;
-      return false;
+      POOL_LOCK_SHARED();
+      if (m_timed_out_transactions.find(id) != m_timed_out_transactions.end())
+      {
+        // not clear if we should set that, since verifivation (sic) did not fail before, since
+        // the tx was accepted before timing out.
+        tvc.m_verifivation_failed = true;
+        return false;
+      }
     }
 
     if(!check_inputs_types_supported(tx))
@@ -199,30 +250,37 @@ namespace cryptonote
     crypto::hash max_used_block_id = null_hash;
     uint64_t max_used_block_height = 0;
     tx_details txd;
-    txd.tx = tx;
-    bool ch_inp_res = m_blockchain.check_tx_inputs(txd.tx, max_used_block_height, max_used_block_id, tvc, kept_by_block);
+    transaction checked_tx = tx;
+    bool ch_inp_res = m_blockchain.check_tx_inputs(checked_tx, max_used_block_height, max_used_block_id, tvc, kept_by_block);
     bool alias_duplicity = !extra_nonce.nonce.empty() && !m_blockchain.get_db().get_alias_address(extra_nonce.nonce).empty();
     if (alias_duplicity) {
         LOG_PRINT_L1("Alias already exists in blockchain: " << extra_nonce.nonce);
         tvc.m_alias_already_exists = true;
     }
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    bool ready_to_go = false;
+    txd.tx_blob = tx_blob;
+    txd.key_images.reserve(tx.vin.size());
+    BOOST_FOREACH(const auto& in, tx.vin)
+    {
+      CHECKED_GET_SPECIFIC_VARIANT(in, const txin_to_key, txin, false);
+      txd.key_images.push_back(txin.k_image);
+    }
+    txd.alias = extra_nonce.nonce;
+    txd.blob_size = blob_size;
+    txd.kept_by_block = kept_by_block;
+    txd.fee = fee;
+    txd.last_failed_height = 0;
+    txd.last_failed_id = null_hash;
+    txd.receive_time = receive_time;
+    txd.last_relayed_time = time(NULL);
+    txd.relayed = relayed;
     if (!ch_inp_res || alias_duplicity) {
       // if the transaction was valid before (kept_by_block), then it
       // may become valid again, so ignore the failed inputs check.
       if(kept_by_block) {
-        auto txd_p = m_transactions.insert(transactions_container::value_type(id, txd));
-        CHECK_AND_ASSERT_MES(txd_p.second, false, "transaction already exists at inserting in memory pool");
-        txd_p.first->second.blob_size = blob_size;
-        txd_p.first->second.fee = fee;
-        txd_p.first->second.max_used_block_id = null_hash;
-        txd_p.first->second.max_used_block_height = 0;
-        txd_p.first->second.kept_by_block = kept_by_block;
-        txd_p.first->second.receive_time = receive_time;
-        txd_p.first->second.last_relayed_time = time(NULL);
-        txd_p.first->second.relayed = relayed;
+        txd.max_used_block_id = null_hash;
+        txd.max_used_block_height = 0;
         tvc.m_verifivation_impossible = true;
-        tvc.m_added_to_pool = true;
       }
       else {
         LOG_PRINT_L1(std::string(ch_inp_res ? "tx tried to use alias that already exists" : "tx used wrong inputs") + ", rejected");
@@ -231,37 +289,38 @@ namespace cryptonote
       }
     }
     else {
+      txd.max_used_block_id = max_used_block_id;
+      txd.max_used_block_height = max_used_block_height;
+      ready_to_go = true;
+
+      if (txd.fee > 0)
+        tvc.m_should_be_relayed = true;
+    }
+
+    POOL_LOCK_EXCLUSIVE();
+    tx_shard& shard = get_shard(id);
+    {
       //update transactions container
-      auto txd_p = m_transactions.insert(transactions_container::value_type(id, txd));
+      SHARD_LOCK_EXCLUSIVE(shard);
+      auto txd_p = shard.txs.insert(transactions_container::value_type(id, txd));
       CHECK_AND_ASSERT_MES(txd_p.second, false, "internal error: transaction already exists at inserting in memorypool");
-      txd_p.first->second.blob_size = blob_size;
-      txd_p.first->second.kept_by_block = kept_by_block;
-      txd_p.first->second.fee = fee;
-      txd_p.first->second.max_used_block_id = max_used_block_id;
-      txd_p.first->second.max_used_block_height = max_used_block_height;
-      txd_p.first->second.last_failed_height = 0;
-      txd_p.first->second.last_failed_id = null_hash;
-      txd_p.first->second.receive_time = receive_time;
-      txd_p.first->second.last_relayed_time = time(NULL);
-      txd_p.first->second.relayed = relayed;
-      tvc.m_added_to_pool = true;
-
-      if (txd_p.first->second.fee > 0)
-        tvc.m_should_be_relayed = true;
     }
+    tvc.m_added_to_pool = true;
 
     // assume failure during verification steps until success is certain
     tvc.m_verifivation_failed = true;
 
-    BOOST_FOREACH(const auto& in, tx.vin)
     {
-      CHECKED_GET_SPECIFIC_VARIANT(in, const txin_to_key, txin, false);
-      std::unordered_set<crypto::hash>& kei_image_set = m_spent_key_images[txin.k_image];
-      CHECK_AND_ASSERT_MES(kept_by_block || kei_image_set.empty(), false, "internal error: kept_by_block=" << kept_by_block
-        << ",  kei_image_set.size()=" << kei_image_set.size() << ENDL << "txin.k_image=" << txin.k_image << ENDL
-        << "tx_id=" << id);
-      auto ins_res = kei_image_set.insert(id);
-      CHECK_AND_ASSERT_MES(ins_res.second, false, "internal error: try to insert duplicate iterator in key_image set");
+      KEY_IMAGES_LOCK_EXCLUSIVE();
+      for (const crypto::key_image& k_image : txd.key_images)
+      {
+        std::unordered_set<crypto::hash>& kei_image_set = m_spent_key_images[k_image];
+        CHECK_AND_ASSERT_MES(kept_by_block || kei_image_set.empty(), false, "internal error: kept_by_block=" << kept_by_block
+          << ",  kei_image_set.size()=" << kei_image_set.size() << ENDL << "txin.k_image=" << k_image << ENDL
+          << "tx_id=" << id);
+        auto ins_res = kei_image_set.insert(id);
+        CHECK_AND_ASSERT_MES(ins_res.second, false, "internal error: try to insert duplicate iterator in key_image set");
+      }
     }
 
     if (!extra_nonce.nonce.empty()) {
@@ -273,41 +332,39 @@ namespace cryptonote
 
     tvc.m_verifivation_failed = false;
 
-    // Rounding tx fee/blob_size ratio so that txs with the same priority would be sorted by receive_time
-    uint32_t fee_per_size_ratio = (uint32_t)(fee / (double)blob_size);
-    //LOG_PRINT_L1("Tx fee/size ratio (rounded): " << fee_per_size_ratio << ", original: " << (fee / (double)blob_size));
-    m_txs_by_fee_and_receive_time.emplace(std::pair<uint32_t, std::time_t>(fee_per_size_ratio, receive_time), id);
+    tx_by_fee_and_receive_time_entry entry = make_sorted_entry(id, txd);
+    m_txs_by_fee_and_receive_time.insert(entry);
+    queue_db_write(id, txd, true);
+
+    // its inputs were just checked, so it can go straight into the template
+    if (ready_to_go)
+      add_to_block_template(id, txd, entry);
 
     return true;
   }
 
   bool tx_memory_pool::add_tx(const transaction &tx, tx_verification_context& tvc, bool keeped_by_block, bool relayed, uint8_t version)
   {
-    crypto::hash h = null_hash;
-    size_t blob_size = 0;
-    get_transaction_hash(tx, h, blob_size);
-    return add_tx(tx, h, blob_size, tvc, keeped_by_block, relayed, version);
+    crypto::hash h = get_transaction_hash(tx);
+    cryptonote::blobdata bl = tx_to_blob(tx);
+    return add_tx(tx, h, bl, tvc, keeped_by_block, relayed, version);
   }
 
   //FIXME: Can return early before removal of all of the key images.
   //       At the least, need to make sure that a false return here
   //       is treated properly.  Should probably not return early, however.
-  bool tx_memory_pool::remove_transaction_keyimages(const transaction& tx) {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    // ND: Speedup
-    // 1. Move transaction hash calcuation outside of loop. ._.
-    crypto::hash actual_hash = get_transaction_hash(tx);
-    BOOST_FOREACH(const txin_v& vi, tx.vin) {
-      CHECKED_GET_SPECIFIC_VARIANT(vi, const txin_to_key, txin, false);
-      auto it = m_spent_key_images.find(txin.k_image);
-      CHECK_AND_ASSERT_MES(it != m_spent_key_images.end(), false, "failed to find transaction input in key images. img=" << txin.k_image << ENDL
+  bool tx_memory_pool::remove_transaction_keyimages(const crypto::hash& actual_hash, const std::vector<crypto::key_image>& key_images) {
+    KEY_IMAGES_LOCK_EXCLUSIVE();
+    for (const crypto::key_image& k_image : key_images) {
+      auto it = m_spent_key_images.find(k_image);
+      CHECK_AND_ASSERT_MES(it != m_spent_key_images.end(), false, "failed to find transaction input in key images. img=" << k_image << ENDL
         << "transaction id = " << actual_hash);
       std::unordered_set<crypto::hash>& key_image_set = it->second;
-      CHECK_AND_ASSERT_MES(key_image_set.size(), false, "empty key_image set, img=" << txin.k_image << ENDL
+      CHECK_AND_ASSERT_MES(key_image_set.size(), false, "empty key_image set, img=" << k_image << ENDL
         << "transaction id = " << actual_hash);
 
       auto it_in_set = key_image_set.find(actual_hash);
-      CHECK_AND_ASSERT_MES(it_in_set != key_image_set.end(), false, "transaction id not found in key_image set, img=" << txin.k_image << ENDL
+      CHECK_AND_ASSERT_MES(it_in_set != key_image_set.end(), false, "transaction id not found in key_image set, img=" << k_image << ENDL
         << "transaction id = " << actual_hash);
       key_image_set.erase(it_in_set);
       if (key_image_set.empty())
@@ -316,33 +373,19 @@ namespace cryptonote
     return true;
   }
 
-  bool tx_memory_pool::remove_transaction_alias(const transaction& tx) {
-    std::vector<tx_extra_field> tx_extra_fields;
-    tx_extra_nonce extra_nonce;
-    if (parse_tx_extra(tx.extra, tx_extra_fields)
-      && find_tx_extra_field_by_type(tx_extra_fields, extra_nonce, 2) && !extra_nonce.nonce.empty() && extra_nonce.nonce.front() == (char)TX_EXTRA_NONCE_SIGNATURE
-      && find_tx_extra_field_by_type(tx_extra_fields, extra_nonce, 1) && !extra_nonce.nonce.empty() && extra_nonce.nonce.front() == (char)TX_EXTRA_NONCE_ADDRESS
-      && find_tx_extra_field_by_type(tx_extra_fields, extra_nonce, 0) && !extra_nonce.nonce.empty() && extra_nonce.nonce.front() == (char)TX_EXTRA_NONCE_ALIAS)
-    {
-      extra_nonce.nonce.erase(extra_nonce.nonce.begin());
-      cryptonote::convert_alias(extra_nonce.nonce);
-    }
-    else
+  bool tx_memory_pool::remove_transaction_alias(const crypto::hash& actual_hash, const std::string& alias) {
+    if (alias.empty())
       return true;
 
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-
-    crypto::hash actual_hash = get_transaction_hash(tx);
-
-    auto it = m_pending_aliases.find(extra_nonce.nonce);
-    CHECK_AND_ASSERT_MES(it != m_pending_aliases.end(), false, "failed to find alias in pending aliases. alias=" << extra_nonce.nonce << ENDL
+    auto it = m_pending_aliases.find(alias);
+    CHECK_AND_ASSERT_MES(it != m_pending_aliases.end(), false, "failed to find alias in pending aliases. alias=" << alias << ENDL
       << "transaction id = " << actual_hash);
     std::unordered_set<crypto::hash>& alias_txs = it->second;
-    CHECK_AND_ASSERT_MES(!alias_txs.empty(), false, "empty alias set, alias=" << extra_nonce.nonce << ENDL
+    CHECK_AND_ASSERT_MES(!alias_txs.empty(), false, "empty alias set, alias=" << alias << ENDL
       << "transaction id = " << actual_hash);
 
     auto it_in_set = alias_txs.find(actual_hash);
-    CHECK_AND_ASSERT_MES(it_in_set != alias_txs.end(), false, "transaction id not found in alias set, alias=" << extra_nonce.nonce << ENDL
+    CHECK_AND_ASSERT_MES(it_in_set != alias_txs.end(), false, "transaction id not found in alias set, alias=" << alias << ENDL
       << "transaction id = " << actual_hash);
     alias_txs.erase(it_in_set);
     if (alias_txs.empty())
@@ -352,155 +395,215 @@ namespace cryptonote
 
   bool tx_memory_pool::take_tx(const crypto::hash &id, transaction &tx, size_t& blob_size, uint64_t& fee, bool &relayed)
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    auto it = m_transactions.find(id);
-    if(it == m_transactions.end())
+    POOL_LOCK_EXCLUSIVE();
+    tx_shard& shard = get_shard(id);
+    SHARD_LOCK_EXCLUSIVE(shard);
+    auto it = shard.txs.find(id);
+    if(it == shard.txs.end())
       return false;
 
-    auto sorted_it = find_tx_in_sorted_container(id);
+    auto sorted_it = find_tx_in_sorted_container(id, it->second);
 
     if (sorted_it == m_txs_by_fee_and_receive_time.end())
       return false;
 
-    tx = it->second.tx;
+    if (!parse_and_validate_tx_from_blob(it->second.tx_blob, tx))
+    {
+      LOG_ERROR("Failed to parse tx " << id << " from the pool");
+      return false;
+    }
     blob_size = it->second.blob_size;
     fee = it->second.fee;
     relayed = it->second.relayed;
-    remove_transaction_keyimages(it->second.tx);
-    remove_transaction_alias(it->second.tx);
-    m_transactions.erase(it);
+    remove_transaction_keyimages(id, it->second.key_images);
+    remove_transaction_alias(id, it->second.alias);
+    remove_from_block_template(id);
+    shard.txs.erase(it);
     m_txs_by_fee_and_receive_time.erase(sorted_it);
+    queue_db_remove(id);
     return true;
   }
   //---------------------------------------------------------------------------------
   void tx_memory_pool::on_idle()
   {
     m_remove_stuck_tx_interval.do_call([this](){return remove_stuck_transactions();});
+    m_print_lock_stats_interval.do_call([this](){
+      LOG_PRINT_L1("Transaction pool lock hold times:" << ENDL << print_lock_stats());
+      return true;
+    });
+  }
+  //---------------------------------------------------------------------------------
+  tx_memory_pool::tx_shard& tx_memory_pool::get_shard(const crypto::hash& id)
+  {
+    return m_tx_shards[reinterpret_cast<const unsigned char*>(&id)[0] % TX_SHARDS];
   }
   //---------------------------------------------------------------------------------
-  sorted_tx_container::iterator tx_memory_pool::find_tx_in_sorted_container(const crypto::hash& id) const
+  const tx_memory_pool::tx_shard& tx_memory_pool::get_shard(const crypto::hash& id) const
   {
-    return std::find_if( m_txs_by_fee_and_receive_time.begin(), m_txs_by_fee_and_receive_time.end()
-                       , [&](const sorted_tx_container::value_type& a){
-                         return a.second == id;
-                       }
-    );
+    return m_tx_shards[reinterpret_cast<const unsigned char*>(&id)[0] % TX_SHARDS];
+  }
+  //---------------------------------------------------------------------------------
+  sorted_tx_container::iterator tx_memory_pool::find_tx_in_sorted_container(const crypto::hash& id, const tx_details& txd) const
+  {
+    return m_txs_by_fee_and_receive_time.find(make_sorted_entry(id, txd));
+  }
+  //---------------------------------------------------------------------------------
+  tx_by_fee_and_receive_time_entry tx_memory_pool::make_sorted_entry(const crypto::hash& id, const tx_details& txd)
+  {
+    return tx_by_fee_and_receive_time_entry(std::pair<tx_fee_rate, std::time_t>({txd.fee, txd.blob_size}, txd.receive_time), id);
   }
   //---------------------------------------------------------------------------------
   //TODO: investigate whether boolean return is appropriate
   bool tx_memory_pool::remove_stuck_transactions()
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    for(auto it = m_transactions.begin(); it!= m_transactions.end();)
+    POOL_LOCK_EXCLUSIVE();
+    const time_t now = time(nullptr);
+    for (tx_shard& shard : m_tx_shards)
     {
-      uint64_t tx_age = time(nullptr) - it->second.receive_time;
-
-      if((tx_age > CRYPTONOTE_MEMPOOL_TX_LIVETIME && !it->second.kept_by_block) ||
-         (tx_age > CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME && it->second.kept_by_block) )
+      SHARD_LOCK_EXCLUSIVE(shard);
+      for(auto it = shard.txs.begin(); it!= shard.txs.end();)
       {
-        LOG_PRINT_L1("Tx " << it->first << " removed from tx pool due to outdated, age: " << tx_age );
-        remove_transaction_keyimages(it->second.tx);
-        remove_transaction_alias(it->second.tx);
-        auto sorted_it = find_tx_in_sorted_container(it->first);
-        if (sorted_it == m_txs_by_fee_and_receive_time.end())
-        {
-          LOG_PRINT_L1("Removing tx " << it->first << " from tx pool, but it was not found in the sorted txs container!");
-        }
-        else
+        uint64_t tx_age = now - it->second.receive_time;
+
+        if((tx_age > CRYPTONOTE_MEMPOOL_TX_LIVETIME && !it->second.kept_by_block) ||
+           (tx_age > CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME && it->second.kept_by_block) )
         {
-          m_txs_by_fee_and_receive_time.erase(sorted_it);
-        }
-        m_timed_out_transactions.insert(it->first);
-        auto pit = it++;
-        m_transactions.erase(pit);
-      }else
-        ++it;
+          LOG_PRINT_L1("Tx " << it->first << " removed from tx pool due to outdated, age: " << tx_age );
+          remove_transaction_keyimages(it->first, it->second.key_images);
+          remove_transaction_alias(it->first, it->second.alias);
+          auto sorted_it = find_tx_in_sorted_container(it->first, it->second);
+          if (sorted_it == m_txs_by_fee_and_receive_time.end())
+          {
+            LOG_PRINT_L1("Removing tx " << it->first << " from tx pool, but it was not found in the sorted txs container!");
+          }
+          else
+          {
+            m_txs_by_fee_and_receive_time.erase(sorted_it);
+          }
+          m_timed_out_transactions.insert(it->first);
+          remove_from_block_template(it->first);
+          queue_db_remove(it->first);
+          auto pit = it++;
+          shard.txs.erase(pit);
+        }else
+          ++it;
+      }
     }
     return true;
   }
   //---------------------------------------------------------------------------------
   //TODO: investigate whether boolean return is appropriate
-  bool tx_memory_pool::get_relayable_transactions(std::list<std::pair<crypto::hash, cryptonote::transaction>> &txs) const
+  bool tx_memory_pool::get_relayable_transactions(std::list<std::pair<crypto::hash, cryptonote::blobdata>> &txs) const
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
     const time_t now = time(NULL);
-    for(auto it = m_transactions.begin(); it!= m_transactions.end();)
+    for (const tx_shard& shard : m_tx_shards)
     {
-      // 0 fee transactions are never relayed
-      if(it->second.fee > 0 && now - it->second.last_relayed_time > get_relay_delay(now, it->second.receive_time))
+      SHARD_LOCK_SHARED(shard);
+      for(auto it = shard.txs.begin(); it!= shard.txs.end();)
       {
-        // if the tx is older than half the max lifetime, we don't re-relay it, to avoid a problem
-        // mentioned by smooth where nodes would flush txes at slightly different times, causing
-        // flushed txes to be re-added when received from a node which was just about to flush it
-        time_t max_age = it->second.kept_by_block ? CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME : CRYPTONOTE_MEMPOOL_TX_LIVETIME;
-        if (now - it->second.receive_time <= max_age / 2)
+        // 0 fee transactions are never relayed
+        if(it->second.fee > 0 && now - it->second.last_relayed_time > get_relay_delay(now, it->second.receive_time))
         {
-          txs.push_back(std::make_pair(it->first, it->second.tx));
+          // if the tx is older than half the max lifetime, we don't re-relay it, to avoid a problem
+          // mentioned by smooth where nodes would flush txes at slightly different times, causing
+          // flushed txes to be re-added when received from a node which was just about to flush it
+          time_t max_age = it->second.kept_by_block ? CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME : CRYPTONOTE_MEMPOOL_TX_LIVETIME;
+          if (now - it->second.receive_time <= max_age / 2)
+          {
+            txs.push_back(std::make_pair(it->first, it->second.tx_blob));
+          }
         }
+        ++it;
       }
-      ++it;
     }
     return true;
   }
   //---------------------------------------------------------------------------------
-  void tx_memory_pool::set_relayed(const std::list<std::pair<crypto::hash, cryptonote::transaction>> &txs)
+  void tx_memory_pool::set_relayed(const std::list<std::pair<crypto::hash, cryptonote::blobdata>> &txs)
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
     const time_t now = time(NULL);
     for (auto it = txs.begin(); it != txs.end(); ++it)
     {
-      auto i = m_transactions.find(it->first);
-      if (i != m_transactions.end())
+      tx_shard& shard = get_shard(it->first);
+      SHARD_LOCK_EXCLUSIVE(shard);
+      auto i = shard.txs.find(it->first);
+      if (i != shard.txs.end())
       {
         i->second.relayed = true;
         i->second.last_relayed_time = now;
+        queue_db_write(it->first, i->second, false);
       }
     }
   }
   //---------------------------------------------------------------------------------
   size_t tx_memory_pool::get_transactions_count() const
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    return m_transactions.size();
+    size_t count = 0;
+    for (const tx_shard& shard : m_tx_shards)
+    {
+      SHARD_LOCK_SHARED(shard);
+      count += shard.txs.size();
+    }
+    return count;
   }
   //---------------------------------------------------------------------------------
   void tx_memory_pool::get_transactions(std::list<transaction>& txs) const
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    BOOST_FOREACH(const auto& tx_vt, m_transactions)
-      txs.push_back(tx_vt.second.tx);
+    for (const tx_shard& shard : m_tx_shards)
+    {
+      SHARD_LOCK_SHARED(shard);
+      BOOST_FOREACH(const auto& tx_vt, shard.txs)
+      {
+        transaction tx;
+        if (!parse_and_validate_tx_from_blob(tx_vt.second.tx_blob, tx))
+        {
+          LOG_ERROR("Failed to parse tx " << tx_vt.first << " from the pool");
+          continue;
+        }
+        txs.push_back(std::move(tx));
+      }
+    }
   }
   //------------------------------------------------------------------
   void tx_memory_pool::get_transaction_hashes(std::vector<crypto::hash>& txs) const
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    for(const auto& tx_vt: m_transactions)
-      txs.push_back(get_transaction_hash(tx_vt.second.tx));
+    for (const tx_shard& shard : m_tx_shards)
+    {
+      SHARD_LOCK_SHARED(shard);
+      for(const auto& tx_vt: shard.txs)
+        txs.push_back(tx_vt.first);
+    }
   }
   //------------------------------------------------------------------
   //TODO: investigate whether boolean return is appropriate
   bool tx_memory_pool::get_transactions_and_spent_keys_info(std::vector<tx_info>& tx_infos, std::vector<spent_key_image_info>& key_image_infos) const
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    for (const auto& tx_vt : m_transactions)
-    {
-      tx_info txi;
-      const tx_details& txd = tx_vt.second;
-      txi.id_hash = epee::string_tools::pod_to_hex(tx_vt.first);
-      txi.tx_json = obj_to_json_str(*const_cast<transaction*>(&txd.tx));
-      txi.blob_size = txd.blob_size;
-      txi.fee = txd.fee;
-      txi.kept_by_block = txd.kept_by_block;
-      txi.max_used_block_height = txd.max_used_block_height;
-      txi.max_used_block_id_hash = epee::string_tools::pod_to_hex(txd.max_used_block_id);
-      txi.last_failed_height = txd.last_failed_height;
-      txi.last_failed_id_hash = epee::string_tools::pod_to_hex(txd.last_failed_id);
-      txi.receive_time = txd.receive_time;
-      txi.relayed = txd.relayed;
-      txi.last_relayed_time = txd.last_relayed_time;
-      tx_infos.push_back(txi);
+    for (const tx_shard& shard : m_tx_shards)
+    {
+      SHARD_LOCK_SHARED(shard);
+      for (const auto& tx_vt : shard.txs)
+      {
+        tx_info txi;
+        const tx_details& txd = tx_vt.second;
+        txi.id_hash = epee::string_tools::pod_to_hex(tx_vt.first);
+        transaction tx;
+        if (parse_and_validate_tx_from_blob(txd.tx_blob, tx))
+          txi.tx_json = obj_to_json_str(tx);
+        txi.blob_size = txd.blob_size;
+        txi.fee = txd.fee;
+        txi.kept_by_block = txd.kept_by_block;
+        txi.max_used_block_height = txd.max_used_block_height;
+        txi.max_used_block_id_hash = epee::string_tools::pod_to_hex(txd.max_used_block_id);
+        txi.last_failed_height = txd.last_failed_height;
+        txi.last_failed_id_hash = epee::string_tools::pod_to_hex(txd.last_failed_id);
+        txi.receive_time = txd.receive_time;
+        txi.relayed = txd.relayed;
+        txi.last_relayed_time = txd.last_relayed_time;
+        tx_infos.push_back(txi);
+      }
     }
 
+    KEY_IMAGES_LOCK_SHARED();
     for (const key_images_container::value_type& kee : m_spent_key_images) {
       const crypto::key_image& k_image = kee.first;
       const std::unordered_set<crypto::hash>& kei_image_set = kee.second;
@@ -517,46 +620,70 @@ namespace cryptonote
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::get_transaction(const crypto::hash& id, transaction& tx) const
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    auto it = m_transactions.find(id);
-    if(it == m_transactions.end())
+    const tx_shard& shard = get_shard(id);
+    SHARD_LOCK_SHARED(shard);
+    auto it = shard.txs.find(id);
+    if(it == shard.txs.end())
+      return false;
+    if (!parse_and_validate_tx_from_blob(it->second.tx_blob, tx))
+    {
+      LOG_ERROR("Failed to parse tx " << id << " from the pool");
       return false;
-    tx = it->second.tx;
+    }
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_memory_pool::get_transaction(const crypto::hash& id, cryptonote::blobdata& tx_blob) const
+  {
+    const tx_shard& shard = get_shard(id);
+    SHARD_LOCK_SHARED(shard);
+    auto it = shard.txs.find(id);
+    if(it == shard.txs.end())
+      return false;
+    tx_blob = it->second.tx_blob;
     return true;
   }
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::on_blockchain_inc(uint64_t new_block_height, const crypto::hash& top_block_id)
   {
+    POOL_LOCK_EXCLUSIVE();
+    // a new top block changes the template, and which txes are ready to go
+    m_template.valid = false;
+    notify_template_change(true);
     return true;
   }
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::on_blockchain_dec(uint64_t new_block_height, const crypto::hash& top_block_id)
   {
+    POOL_LOCK_EXCLUSIVE();
+    m_template.valid = false;
+    notify_template_change(true);
     return true;
   }
 
   bool tx_memory_pool::have_tx(const crypto::hash &id) const {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    return m_transactions.count(id);
+    const tx_shard& shard = get_shard(id);
+    SHARD_LOCK_SHARED(shard);
+    return shard.txs.count(id);
   }
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::have_tx_keyimges_as_spent(const transaction& tx) const {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    KEY_IMAGES_LOCK_SHARED();
     BOOST_FOREACH(const auto& in, tx.vin) {
       CHECKED_GET_SPECIFIC_VARIANT(in, const txin_to_key, tokey_in, true);//should never fail
-      if (have_tx_keyimg_as_spent(tokey_in.k_image))
+      if (m_spent_key_images.find(tokey_in.k_image) != m_spent_key_images.end())
         return true;
     }
     return false;
   }
 
   bool tx_memory_pool::have_tx_keyimg_as_spent(const crypto::key_image& key_im) const {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    KEY_IMAGES_LOCK_SHARED();
     return m_spent_key_images.find(key_im) != m_spent_key_images.end();
   }
 
   bool tx_memory_pool::has_alias(const std::string& alias) const {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    POOL_LOCK_SHARED();
     return m_pending_aliases.find(alias) != m_pending_aliases.end();
   }
 
@@ -572,6 +699,18 @@ namespace cryptonote
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::is_transaction_ready_to_go(tx_details& txd) const
   {
+    // only parse the tx if its inputs actually need checking
+    auto check_tx_inputs = [&]() {
+      transaction tx;
+      if (!parse_and_validate_tx_from_blob(txd.tx_blob, tx))
+      {
+        LOG_ERROR("Failed to parse tx from the pool");
+        return false;
+      }
+      tx_verification_context tvc;
+      return m_blockchain.check_tx_inputs(tx, txd.max_used_block_height, txd.max_used_block_id, tvc);
+    };
+
     //not the best implementation at this time, sorry :(
     //check is ring_signature already checked ?
     if(txd.max_used_block_id == null_hash)
@@ -580,8 +719,7 @@ namespace cryptonote
       if(txd.last_failed_id != null_hash && m_blockchain.get_current_blockchain_height() > txd.last_failed_height && txd.last_failed_id == m_blockchain.get_block_id_by_height(txd.last_failed_height))
         return false;//we already sure that this tx is broken for this height
 
-      tx_verification_context tvc;
-      if(!m_blockchain.check_tx_inputs(txd.tx, txd.max_used_block_height, txd.max_used_block_id, tvc))
+      if(!check_tx_inputs())
       {
         txd.last_failed_height = m_blockchain.get_current_blockchain_height()-1;
         txd.last_failed_id = m_blockchain.get_block_id_by_height(txd.last_failed_height);
@@ -597,8 +735,7 @@ namespace cryptonote
         if(txd.last_failed_id == m_blockchain.get_block_id_by_height(txd.last_failed_height))
           return false;
         //check ring signature again, it is possible (with very small chance) that this transaction become again valid
-        tx_verification_context tvc;
-        if(!m_blockchain.check_tx_inputs(txd.tx, txd.max_used_block_height, txd.max_used_block_id, tvc))
+        if(!check_tx_inputs())
         {
           txd.last_failed_height = m_blockchain.get_current_blockchain_height()-1;
           txd.last_failed_id = m_blockchain.get_block_id_by_height(txd.last_failed_height);
@@ -607,45 +744,35 @@ namespace cryptonote
       }
     }
     //if we here, transaction seems valid, but, anyway, check for key_images collisions with blockchain, just to be sure
-    if(m_blockchain.have_tx_keyimges_as_spent(txd.tx))
-      return false;
-
-    std::vector<tx_extra_field> tx_extra_fields;
-    tx_extra_nonce extra_nonce;
-    if (parse_tx_extra(txd.tx.extra, tx_extra_fields)
-      && find_tx_extra_field_by_type(tx_extra_fields, extra_nonce, 2) && !extra_nonce.nonce.empty() && extra_nonce.nonce.front() == (char)TX_EXTRA_NONCE_SIGNATURE
-      && find_tx_extra_field_by_type(tx_extra_fields, extra_nonce, 1) && !extra_nonce.nonce.empty() && extra_nonce.nonce.front() == (char)TX_EXTRA_NONCE_ADDRESS
-      && find_tx_extra_field_by_type(tx_extra_fields, extra_nonce, 0) && !extra_nonce.nonce.empty() && extra_nonce.nonce.front() == (char)TX_EXTRA_NONCE_ALIAS)
+    for (const crypto::key_image& k_image : txd.key_images)
     {
-      extra_nonce.nonce.erase(extra_nonce.nonce.begin());
-      cryptonote::convert_alias(extra_nonce.nonce);
-
-      if (!extra_nonce.nonce.empty() && !m_blockchain.get_db().get_alias_address(extra_nonce.nonce).empty())
+      if(m_blockchain.have_tx_keyimg_as_spent(k_image))
         return false;
     }
 
+    if (!txd.alias.empty() && !m_blockchain.get_db().get_alias_address(txd.alias).empty())
+      return false;
+
     //transaction is ok.
     return true;
   }
   //---------------------------------------------------------------------------------
-  bool tx_memory_pool::have_key_images(const std::unordered_set<crypto::key_image>& k_images, const transaction& tx)
+  bool tx_memory_pool::have_key_images(const std::unordered_set<crypto::key_image>& k_images, const std::vector<crypto::key_image>& key_images)
   {
-    for(size_t i = 0; i!= tx.vin.size(); i++)
+    for(const crypto::key_image& k_image : key_images)
     {
-      CHECKED_GET_SPECIFIC_VARIANT(tx.vin[i], const txin_to_key, itk, false);
-      if(k_images.count(itk.k_image))
+      if(k_images.count(k_image))
         return true;
     }
     return false;
   }
   //---------------------------------------------------------------------------------
-  bool tx_memory_pool::append_key_images(std::unordered_set<crypto::key_image>& k_images, const transaction& tx)
+  bool tx_memory_pool::append_key_images(std::unordered_set<crypto::key_image>& k_images, const std::vector<crypto::key_image>& key_images)
   {
-    for(size_t i = 0; i!= tx.vin.size(); i++)
+    for(const crypto::key_image& k_image : key_images)
     {
-      CHECKED_GET_SPECIFIC_VARIANT(tx.vin[i], const txin_to_key, itk, false);
-      auto i_res = k_images.insert(itk.k_image);
-      CHECK_AND_ASSERT_MES(i_res.second, false, "internal error: key images pool cache - inserted duplicate image in set: " << itk.k_image);
+      auto i_res = k_images.insert(k_image);
+      CHECK_AND_ASSERT_MES(i_res.second, false, "internal error: key images pool cache - inserted duplicate image in set: " << k_image);
     }
     return true;
   }
@@ -653,163 +780,501 @@ namespace cryptonote
   std::string tx_memory_pool::print_pool(bool short_format) const
   {
     std::stringstream ss;
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    for (const transactions_container::value_type& txe : m_transactions) {
-      const tx_details& txd = txe.second;
-      ss << "id: " << txe.first << std::endl;
-      if (!short_format) {
-        ss << obj_to_json_str(*const_cast<transaction*>(&txd.tx)) << std::endl;
+    for (const tx_shard& shard : m_tx_shards) {
+      SHARD_LOCK_SHARED(shard);
+      for (const transactions_container::value_type& txe : shard.txs) {
+        const tx_details& txd = txe.second;
+        ss << "id: " << txe.first << std::endl;
+        if (!short_format) {
+          transaction tx;
+          if (parse_and_validate_tx_from_blob(txd.tx_blob, tx))
+            ss << obj_to_json_str(tx) << std::endl;
+        }
+        ss << "blob_size: " << txd.blob_size << std::endl
+          << "fee: " << print_money(txd.fee) << std::endl
+          << "kept_by_block: " << (txd.kept_by_block ? 'T' : 'F') << std::endl
+          << "max_used_block_height: " << txd.max_used_block_height << std::endl
+          << "max_used_block_id: " << txd.max_used_block_id << std::endl
+          << "last_failed_height: " << txd.last_failed_height << std::endl
+          << "last_failed_id: " << txd.last_failed_id << std::endl;
       }
-      ss << "blob_size: " << txd.blob_size << std::endl
-        << "fee: " << print_money(txd.fee) << std::endl
-        << "kept_by_block: " << (txd.kept_by_block ? 'T' : 'F') << std::endl
-        << "max_used_block_height: " << txd.max_used_block_height << std::endl
-        << "max_used_block_id: " << txd.max_used_block_id << std::endl
-        << "last_failed_height: " << txd.last_failed_height << std::endl
-        << "last_failed_id: " << txd.last_failed_id << std::endl;
     }
 
     return ss.str();
   }
   //---------------------------------------------------------------------------------
-  //TODO: investigate whether boolean return is appropriate
-  bool tx_memory_pool::fill_block_template(block &bl, size_t median_size, uint64_t already_generated_coins, size_t &total_size, uint64_t &fee, uint64_t height)
+  std::string tx_memory_pool::print_lock_stats() const
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    return m_pool_lock_hold.print() + "\n" + m_shard_lock_hold.print() + "\n" + m_key_images_lock_hold.print();
+  }
+  //---------------------------------------------------------------------------------
+  // needs m_transactions_lock held exclusively
+  void tx_memory_pool::rebuild_block_template(size_t median_size, uint64_t already_generated_coins, uint64_t height)
+  {
+    std::vector<block_candidate> candidates;
+    std::vector<sorted_tx_container::const_iterator> sorted_its;
+    candidates.reserve(m_txs_by_fee_and_receive_time.size());
+    sorted_its.reserve(m_txs_by_fee_and_receive_time.size());
+    for (auto sorted_it = m_txs_by_fee_and_receive_time.begin(); sorted_it != m_txs_by_fee_and_receive_time.end(); ++sorted_it)
+    {
+      candidates.push_back({static_cast<size_t>(sorted_it->first.first.blob_size), sorted_it->first.first.fee});
+      sorted_its.push_back(sorted_it);
+    }
 
-    uint64_t best_coinbase = 0;
+    LOG_PRINT_L2("Filling block template, median size " << median_size << ", " << candidates.size() << " txes in the pool");
+    std::unordered_set<crypto::key_image> k_images;
+    auto try_take = [&](size_t i) {
+      // exclusive, as checking a tx records in it when it last failed
+      tx_shard& shard = get_shard(sorted_its[i]->second);
+      SHARD_LOCK_EXCLUSIVE(shard);
+      auto tx_it = shard.txs.find(sorted_its[i]->second);
+      // Skip transactions that are not ready to be
+      // included into the blockchain or that are
+      // missing key images
+      if (!is_transaction_ready_to_go(tx_it->second))
+      {
+        LOG_PRINT_L2("  " << tx_it->first << " not ready to go");
+        return false;
+      }
+      if (have_key_images(k_images, tx_it->second.key_images))
+      {
+        LOG_PRINT_L2("  " << tx_it->first << " key images already seen");
+        return false;
+      }
+      append_key_images(k_images, tx_it->second.key_images);
+      return true;
+    };
+
+    std::vector<size_t> chosen;
+    size_t total_size;
+    uint64_t fee;
+    const uint64_t best_coinbase = select_block_txes(candidates, median_size, already_generated_coins, height, BLOCK_TEMPLATE_LOOKAHEAD, try_take, chosen, total_size, fee);
+
+    std::vector<crypto::hash> tx_hashes;
+    tx_hashes.reserve(chosen.size());
+    for (size_t i : chosen)
+      tx_hashes.push_back(sorted_its[i]->second);
+    if (!chosen.empty())
+      m_template.lowest = *sorted_its[chosen.back()];
+
+    LOG_PRINT_L2("Block template filled with " << tx_hashes.size() << " txes, size "
+      << total_size << ", coinbase " << print_money(best_coinbase)
+      << " (including " << print_money(fee) << " in fees)");
+
+    const bool changed = m_template.height != height || m_template.tx_hashes != tx_hashes;
+    m_template.valid = true;
+    m_template.height = height;
+    m_template.median_size = median_size;
+    m_template.already_generated_coins = already_generated_coins;
+    m_template.tx_set = std::unordered_set<crypto::hash>(tx_hashes.begin(), tx_hashes.end());
+    m_template.tx_hashes.swap(tx_hashes);
+    m_template.k_images.swap(k_images);
+    m_template.total_size = total_size;
+    m_template.fee = fee;
+    m_template.best_coinbase = best_coinbase;
+    if (changed)
+      notify_template_change(true);
+  }
+  //---------------------------------------------------------------------------------
+  uint64_t tx_memory_pool::select_block_txes(const std::vector<block_candidate>& candidates, size_t median_size, uint64_t already_generated_coins, uint64_t height, size_t lookahead, const std::function<bool(size_t)>& try_take, std::vector<size_t>& chosen, size_t& total_size, uint64_t& fee)
+  {
     total_size = 0;
     fee = 0;
 
+    // block reward plus fees for a block of txes of the given size, false if too big
+    auto get_coinbase = [&](size_t size, uint64_t fees, uint64_t& coinbase) {
+      uint64_t block_reward;
+      if (!get_block_reward(median_size, size + CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE, already_generated_coins, block_reward, height))
+        return false;
+      coinbase = block_reward + fees;
+      return true;
+    };
+
+    // the coinbase the greedy pass would reach from the given block within
+    // the candidates [from, from + lookahead), plus the space it leaves
+    // valued at the fee per byte of the first candidate past those, so that
+    // leaving room for later txes is not counted as a loss
+    const size_t max_size = std::max(2 * median_size, MAX_BLOCK_SIZE_NOT_CHECKED) - CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE;
+    auto look_ahead = [&](size_t from, size_t size, uint64_t fees) {
+      uint64_t best = 0;
+      if (!get_coinbase(size, fees, best))
+        return best;
+      const size_t end = std::min(candidates.size(), from + lookahead);
+      for (size_t i = from; i < end; ++i)
+      {
+        uint64_t coinbase;
+        if (get_coinbase(size + candidates[i].blob_size, fees + candidates[i].fee, coinbase) && coinbase >= best)
+        {
+          size += candidates[i].blob_size;
+          fees += candidates[i].fee;
+          best = coinbase;
+        }
+      }
+      if (end < candidates.size() && size < max_size)
+        best += (max_size - size) * (double)candidates[end].fee / candidates[end].blob_size;
+      return best;
+    };
+
     //baseline empty block
+    uint64_t best_coinbase = 0;
     get_block_reward(median_size, total_size, already_generated_coins, best_coinbase, height);
 
-    std::unordered_set<crypto::key_image> k_images;
-
-    LOG_PRINT_L2("Filling block template, median size " << median_size << ", " << m_txs_by_fee_and_receive_time.size() << " txes in the pool");
-    auto sorted_it = m_txs_by_fee_and_receive_time.begin();
-    while (sorted_it != m_txs_by_fee_and_receive_time.end()) {
-      auto tx_it = m_transactions.find(sorted_it->second);
-      LOG_PRINT_L2("Considering " << tx_it->first << ", size " << tx_it->second.blob_size << ", current block size " << total_size << ", current coinbase " << print_money(best_coinbase));
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+      const block_candidate& c = candidates[i];
+      LOG_PRINT_L2("Considering candidate " << i << ", size " << c.blob_size << ", current block size " << total_size << ", current coinbase " << print_money(best_coinbase));
 
-      uint64_t block_reward;
-      if (!get_block_reward(median_size, total_size + tx_it->second.blob_size + CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE, already_generated_coins, block_reward, height))
+      uint64_t coinbase;
+      if (!get_coinbase(total_size + c.blob_size, fee + c.fee, coinbase))
       {
         LOG_PRINT_L2("  would exceed maximum block size");
-        sorted_it++;
         continue;
       }
-      uint64_t coinbase = block_reward + fee + tx_it->second.fee;
       if (coinbase < template_accept_threshold(best_coinbase))
       {
         LOG_PRINT_L2("  would decrease coinbase to " << print_money(coinbase));
-        sorted_it++;
         continue;
       }
-
-      // Skip transactions that are not ready to be
-      // included into the blockchain or that are
-      // missing key images
-      if (!is_transaction_ready_to_go(tx_it->second))
+      if (lookahead && look_ahead(i + 1, total_size, fee) > look_ahead(i + 1, total_size + c.blob_size, fee + c.fee))
       {
-        LOG_PRINT_L2("  not ready to go");
-        sorted_it++;
+        LOG_PRINT_L2("  the next candidates would earn more without it");
         continue;
       }
-      if (have_key_images(k_images, tx_it->second.tx))
-      {
-        LOG_PRINT_L2("  key images already seen");
-        sorted_it++;
+      if (!try_take(i))
         continue;
-      }
 
-      bl.tx_hashes.push_back(tx_it->first);
-      total_size += tx_it->second.blob_size;
-      fee += tx_it->second.fee;
+      chosen.push_back(i);
+      total_size += c.blob_size;
+      fee += c.fee;
       best_coinbase = coinbase;
-
-      append_key_images(k_images, tx_it->second.tx);
-      sorted_it++;
       LOG_PRINT_L2("  added, new block size " << total_size << ", coinbase " << print_money(best_coinbase));
     }
+    return best_coinbase;
+  }
+  //---------------------------------------------------------------------------------
+  // needs m_transactions_lock held exclusively
+  void tx_memory_pool::add_to_block_template(const crypto::hash& id, const tx_details& txd, const tx_by_fee_and_receive_time_entry& entry)
+  {
+    if (!m_template.valid)
+    {
+      notify_template_change(false);
+      return;
+    }
 
-    LOG_PRINT_L2("Block template filled with " << bl.tx_hashes.size() << " txes, size "
-      << total_size << ", coinbase " << print_money(best_coinbase)
-      << " (including " << print_money(fee) << " in fees)");
+    // A tx sorting after every chosen one is where a full pass would get to
+    // it last, so appending it if it fits is what that pass would do. One
+    // sorting earlier could change what the pass picks after it, through
+    // the size budget and the lookahead, so the template is chosen again.
+    if (!m_template.tx_hashes.empty() && txCompare()(entry, m_template.lowest))
+    {
+      m_template.valid = false;
+      notify_template_change(false);
+      return;
+    }
+
+    bool fits = !have_key_images(m_template.k_images, txd.key_images);
+    uint64_t coinbase = 0;
+    if (fits)
+    {
+      uint64_t block_reward;
+      fits = get_block_reward(m_template.median_size, m_template.total_size + txd.blob_size + CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE, m_template.already_generated_coins, block_reward, m_template.height);
+      coinbase = block_reward + m_template.fee + txd.fee;
+      fits = fits && coinbase >= template_accept_threshold(m_template.best_coinbase);
+    }
+
+    if (!fits)
+      return;
+
+    m_template.tx_hashes.push_back(id);
+    m_template.tx_set.insert(id);
+    append_key_images(m_template.k_images, txd.key_images);
+    m_template.total_size += txd.blob_size;
+    m_template.fee += txd.fee;
+    m_template.best_coinbase = coinbase;
+    m_template.lowest = entry;
+    LOG_PRINT_L2("Added " << id << " to block template, new block size " << m_template.total_size << ", coinbase " << print_money(coinbase));
+    notify_template_change(true);
+  }
+  //---------------------------------------------------------------------------------
+  // needs m_transactions_lock held exclusively
+  void tx_memory_pool::remove_from_block_template(const crypto::hash& id)
+  {
+    if (!m_template.valid || !m_template.tx_set.count(id))
+      return;
+    m_template.valid = false;
+    notify_template_change(true);
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::notify_template_change(bool changed)
+  {
+    boost::lock_guard<boost::mutex> lock(m_template_mutex);
+    if (changed)
+      ++m_template_version;
+    ++m_template_events;
+    m_template_cond.notify_all();
+  }
+  //---------------------------------------------------------------------------------
+  //TODO: investigate whether boolean return is appropriate
+  bool tx_memory_pool::fill_block_template(block &bl, size_t median_size, uint64_t already_generated_coins, size_t &total_size, uint64_t &fee, uint64_t height, uint64_t &template_version)
+  {
+    auto template_matches = [&]() {
+      return m_template.valid && m_template.height == height && m_template.median_size == median_size && m_template.already_generated_coins == already_generated_coins;
+    };
+    auto copy_template = [&]() {
+      bl.tx_hashes.insert(bl.tx_hashes.end(), m_template.tx_hashes.begin(), m_template.tx_hashes.end());
+      total_size = m_template.total_size;
+      fee = m_template.fee;
+      // the version only moves under an exclusive pool lock, so it matches
+      // the copied template
+      boost::lock_guard<boost::mutex> lock(m_template_mutex);
+      template_version = m_template_version;
+      m_template_filled_events = m_template_events;
+    };
+
+    // the common case is an up to date template, which readers can share
+    {
+      POOL_LOCK_SHARED();
+      if (template_matches())
+      {
+        copy_template();
+        return true;
+      }
+    }
+
+    POOL_LOCK_EXCLUSIVE();
+    if (!template_matches())
+      rebuild_block_template(median_size, already_generated_coins, height);
+    copy_template();
     return true;
   }
   //---------------------------------------------------------------------------------
+  bool tx_memory_pool::wait_for_template_change(uint64_t version, uint64_t timeout_ms) const
+  {
+    boost::unique_lock<boost::mutex> lock(m_template_mutex);
+    return m_template_cond.wait_for(lock, boost::chrono::milliseconds(timeout_ms), [&]() {
+      return m_template_version != version || m_template_events != m_template_filled_events;
+    });
+  }
+  //---------------------------------------------------------------------------------
   size_t tx_memory_pool::validate(uint8_t version)
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    POOL_LOCK_EXCLUSIVE();
     size_t n_removed = 0;
     size_t tx_size_limit = TRANSACTION_SIZE_LIMIT;
-    for (auto it = m_transactions.begin(); it != m_transactions.end(); ) {
-      bool remove = false;
-      const crypto::hash &txid = get_transaction_hash(it->second.tx);
-      if (it->second.blob_size >= tx_size_limit) {
-        LOG_PRINT_L1("Transaction " << txid << " is too big (" << it->second.blob_size << " bytes), removing it from pool");
-        remove = true;
-      }
-      else if (m_blockchain.have_tx(txid)) {
-        LOG_PRINT_L1("Transaction " << txid << " is in the blockchain, removing it from pool");
-        remove = true;
-      }
-      if (remove) {
-        remove_transaction_keyimages(it->second.tx);
-        auto sorted_it = find_tx_in_sorted_container(txid);
-        if (sorted_it == m_txs_by_fee_and_receive_time.end())
-        {
-          LOG_PRINT_L1("Removing tx " << txid << " from tx pool, but it was not found in the sorted txs container!");
+    for (tx_shard& shard : m_tx_shards)
+    {
+      SHARD_LOCK_EXCLUSIVE(shard);
+      for (auto it = shard.txs.begin(); it != shard.txs.end(); ) {
+        bool remove = false;
+        const crypto::hash &txid = it->first;
+        if (it->second.blob_size >= tx_size_limit) {
+          LOG_PRINT_L1("Transaction " << txid << " is too big (" << it->second.blob_size << " bytes), removing it from pool");
+          remove = true;
         }
-        else
-        {
-          m_txs_by_fee_and_receive_time.erase(sorted_it);
+        else if (m_blockchain.have_tx(txid)) {
+          LOG_PRINT_L1("Transaction " << txid << " is in the blockchain, removing it from pool");
+          remove = true;
         }
-        auto pit = it++;
-        m_transactions.erase(pit);
-        ++n_removed;
-        continue;
+        if (remove) {
+          remove_transaction_keyimages(txid, it->second.key_images);
+          auto sorted_it = find_tx_in_sorted_container(txid, it->second);
+          if (sorted_it == m_txs_by_fee_and_receive_time.end())
+          {
+            LOG_PRINT_L1("Removing tx " << txid << " from tx pool, but it was not found in the sorted txs container!");
+          }
+          else
+          {
+            m_txs_by_fee_and_receive_time.erase(sorted_it);
+          }
+          remove_from_block_template(txid);
+          queue_db_remove(txid);
+          auto pit = it++;
+          shard.txs.erase(pit);
+          ++n_removed;
+          continue;
+        }
+        it++;
       }
-      it++;
     }
     return n_removed;
   }
   //---------------------------------------------------------------------------------
-  //TODO: investigate whether only ever returning true is correct
-  bool tx_memory_pool::init(const std::string& config_folder)
+  void tx_memory_pool::queue_db_write(const crypto::hash& id, const tx_details& txd, bool with_blob)
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    if (!m_persistent)
+      return;
+
+    tx_details_record rec;
+    rec.blob_size = txd.blob_size;
+    rec.fee = txd.fee;
+    rec.key_images = txd.key_images;
+    rec.alias = txd.alias;
+    rec.max_used_block_height = txd.max_used_block_height;
+    rec.max_used_block_id = txd.max_used_block_id;
+    rec.receive_time = txd.receive_time;
+    rec.last_relayed_time = txd.last_relayed_time;
+    rec.kept_by_block = txd.kept_by_block;
+    rec.relayed = txd.relayed;
+
+    txpool_tx_update update;
+    update.txid = id;
+    update.remove = false;
+    if (!::serialization::dump_binary(rec, update.meta))
+    {
+      LOG_ERROR("Failed to serialize pool tx " << id << " for the db");
+      return;
+    }
+    if (with_blob)
+      update.blob = txd.tx_blob;
 
-    m_config_folder = config_folder;
-    if (m_config_folder.empty())
-      return true;
+    boost::lock_guard<boost::mutex> lock(m_db_mutex);
+    auto it = m_db_updates.find(id);
+    if (it == m_db_updates.end())
+      m_db_updates.emplace(id, std::move(update));
+    else
+      merge_db_update(it->second, update);
+    m_db_cond.notify_one();
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::queue_db_remove(const crypto::hash& id)
+  {
+    if (!m_persistent)
+      return;
 
-    std::string state_file_path = config_folder + "/" + CRYPTONOTE_POOLDATA_FILENAME;
-    boost::system::error_code ec;
-    if(!boost::filesystem::exists(state_file_path, ec))
-      return true;
-    bool res = tools::unserialize_obj_from_file(*this, state_file_path);
-    if(!res)
+    txpool_tx_update update;
+    update.txid = id;
+    update.remove = true;
+
+    boost::lock_guard<boost::mutex> lock(m_db_mutex);
+    m_db_updates[id] = std::move(update);
+    m_db_cond.notify_one();
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::merge_db_update(txpool_tx_update& pending, const txpool_tx_update& update)
+  {
+    // new info alone keeps the blob still to be written, and does not bring
+    // back a transaction which is on its way out
+    if (!update.remove && update.blob.empty())
+    {
+      if (!pending.remove)
+        pending.meta = update.meta;
+      return;
+    }
+    pending = update;
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::db_writer()
+  {
+    boost::unique_lock<boost::mutex> lock(m_db_mutex);
+    while (true)
     {
-      LOG_ERROR("Failed to load memory pool from file " << state_file_path);
+      while (!m_db_stop && m_db_updates.empty())
+        m_db_cond.wait(lock);
+      if (m_db_updates.empty())
+        break;
 
-      m_transactions.clear();
-      m_txs_by_fee_and_receive_time.clear();
-      m_spent_key_images.clear();
-      m_pending_aliases.clear();
+      // write what has piled up in one db txn, without holding up the pool
+      std::unordered_map<crypto::hash, txpool_tx_update> pending;
+      pending.swap(m_db_updates);
+      lock.unlock();
+
+      std::vector<txpool_tx_update> updates;
+      updates.reserve(pending.size());
+      for (auto& e : pending)
+        updates.push_back(std::move(e.second));
+      bool written = false;
+      try
+      {
+        written = m_blockchain.get_db().update_txpool_txes(updates);
+      }
+      catch (const std::exception& e)
+      {
+        LOG_ERROR("Failed to write " << updates.size() << " pool changes to the db: " << e.what());
+      }
+
+      lock.lock();
+      if (written)
+        continue;
+      if (m_db_stop)
+      {
+        LOG_ERROR("Giving up on writing the pool to the db, " << updates.size() + m_db_updates.size() << " changes are lost");
+        m_db_updates.clear();
+        break;
+      }
+      // put back what was not superseded meanwhile, and try again later
+      for (txpool_tx_update& u : updates)
+      {
+        auto it = m_db_updates.find(u.txid);
+        if (it != m_db_updates.end())
+        {
+          merge_db_update(u, it->second);
+          it->second = std::move(u);
+        }
+        else
+          m_db_updates.emplace(u.txid, std::move(u));
+      }
+      m_db_cond.wait_for(lock, boost::chrono::seconds(DB_WRITE_RETRY_SECONDS));
     }
+  }
+  //---------------------------------------------------------------------------------
+  //TODO: investigate whether only ever returning true is correct
+  bool tx_memory_pool::init(bool persistent)
+  {
+    m_persistent = persistent;
+    if (!m_persistent)
+      return true;
 
-    // no need to store queue of sorted transactions, as it's easy to generate.
-    for (const auto& tx : m_transactions)
+    PERF_TIMER(init);
+    size_t n_loaded = 0;
     {
-      // Rounding tx fee/blob_size ratio so that txs with same priority level
-      // and the ratios not much diff would be sorted by receive_time
-      uint32_t fee_per_size_ratio = (uint32_t)(tx.second.fee / (double)tx.second.blob_size);
-      m_txs_by_fee_and_receive_time.emplace(std::pair<uint32_t, time_t>(fee_per_size_ratio, tx.second.receive_time), tx.first);
+      POOL_LOCK_EXCLUSIVE();
+      m_blockchain.get_db().for_all_txpool_txes([&](const crypto::hash& id, const cryptonote::blobdata& meta, const cryptonote::blobdata& blob) {
+        tx_details_record rec;
+        if (!::serialization::parse_binary(meta, rec))
+        {
+          LOG_ERROR("Failed to parse pool tx " << id << " from the db, dropping it");
+          queue_db_remove(id);
+          return true;
+        }
+
+        tx_details txd;
+        txd.tx_blob = blob;
+        txd.key_images = std::move(rec.key_images);
+        txd.alias = std::move(rec.alias);
+        txd.blob_size = rec.blob_size;
+        txd.fee = rec.fee;
+        txd.max_used_block_id = rec.max_used_block_id;
+        txd.max_used_block_height = rec.max_used_block_height;
+        txd.kept_by_block = rec.kept_by_block;
+        txd.last_failed_height = 0;
+        txd.last_failed_id = null_hash;
+        txd.receive_time = rec.receive_time;
+        txd.last_relayed_time = rec.last_relayed_time;
+        txd.relayed = rec.relayed;
+
+        tx_shard& shard = get_shard(id);
+        SHARD_LOCK_EXCLUSIVE(shard);
+        auto ins = shard.txs.insert(transactions_container::value_type(id, std::move(txd)));
+        if (!ins.second)
+          return true;
+        const tx_details& inserted = ins.first->second;
+        {
+          // same order as add_tx: shard, then key images
+          KEY_IMAGES_LOCK_EXCLUSIVE();
+          for (const crypto::key_image& k_image : inserted.key_images)
+            m_spent_key_images[k_image].insert(id);
+        }
+        if (!inserted.alias.empty())
+          m_pending_aliases[inserted.alias].insert(id);
+        m_txs_by_fee_and_receive_time.insert(make_sorted_entry(id, inserted));
+        ++n_loaded;
+        return true;
+      });
     }
+    LOG_PRINT_L0("Loaded " << n_loaded << " transactions into the pool from the db");
 
-    // Ignore deserialization error
+    m_db_stop = false;
+    m_db_thread = boost::thread(&tx_memory_pool::db_writer, this);
     return true;
   }
 
@@ -819,30 +1284,16 @@ namespace cryptonote
   {
     LOG_PRINT_L1("Received signal to deactivate memory pool store");
 
-    if (m_config_folder.empty())
-    {
-      LOG_PRINT_L1("Memory pool store already empty");
+    if (!m_db_thread.joinable())
       return true;
-    }
 
-    if (!tools::create_directories_if_necessary(m_config_folder))
     {
-      LOG_ERROR("Failed to create memory pool data directory: " << m_config_folder);
-      return false;
+      boost::lock_guard<boost::mutex> lock(m_db_mutex);
+      m_db_stop = true;
+      m_db_cond.notify_one();
     }
-
-    std::string state_file_path = m_config_folder + "/" + CRYPTONOTE_POOLDATA_FILENAME;
-    bool res = tools::serialize_obj_to_file(*this, state_file_path);
-    if(!res)
-    {
-      LOG_ERROR("Failed to serialize memory pool to file " << state_file_path);
-      return false;
-    }
-    else
-    {
-      LOG_PRINT_L1("Memory pool store deactivated successfully");
-      return true;
-    }
-
+    m_db_thread.join();
+    LOG_PRINT_L1("Memory pool store deactivated successfully");
+    return true;
   }
 }
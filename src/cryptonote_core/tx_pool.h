@@ -33,12 +33,16 @@
 #pragma once
 #include "include_base_utils.h"
 
+#include <functional>
 #include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <queue>
-#include <boost/serialization/version.hpp>
 #include <boost/utility.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 #include "string_tools.h"
 #include "syncobj.h"
@@ -46,7 +50,11 @@
 #include "cryptonote_basic_impl.h"
 #include "verification_context.h"
 #include "crypto/hash.h"
+#include "common/int-util.h"
+#include "common/perf_timer.h"
+#include "common/recursive_shared_mutex.h"
 #include "rpc/core_rpc_server_commands_defs.h"
+#include "blockchain_db/blockchain_db.h"
 
 namespace cryptonote
 {
@@ -55,21 +63,31 @@ namespace cryptonote
   /*                                                                      */
   /************************************************************************/
 
-  //! pair of <transaction fee, transaction hash> for organization
-  typedef std::pair<std::pair<uint32_t, std::time_t>, crypto::hash> tx_by_fee_and_receive_time_entry;
+  //! a transaction's fee and size, which together give its exact fee per byte
+  struct tx_fee_rate
+  {
+    uint64_t fee;
+    uint64_t blob_size;
+  };
+
+  //! pair of <<fee rate, receive time>, transaction hash> for organization
+  typedef std::pair<std::pair<tx_fee_rate, std::time_t>, crypto::hash> tx_by_fee_and_receive_time_entry;
 
   class txCompare
   {
   public:
-    bool operator()(const tx_by_fee_and_receive_time_entry& a, const tx_by_fee_and_receive_time_entry& b)
+    bool operator()(const tx_by_fee_and_receive_time_entry& a, const tx_by_fee_and_receive_time_entry& b) const
     {
-      // sort by greatest first, not least
-      if (a.first.first > b.first.first) return true;
-      else if (a.first.first < b.first.first) return false;
-      else if (a.first.second < b.first.second) return true;
-      else if (a.first.second > b.first.second) return false;
-      else if (a.second != b.second) return true;
-      else return false;
+      // sort by greatest fee per byte first, comparing fee_a * size_b with
+      // fee_b * size_a so that no precision is lost to a division
+      uint64_t hi_a, hi_b;
+      const uint64_t lo_a = mul128(a.first.first.fee, b.first.first.blob_size, &hi_a);
+      const uint64_t lo_b = mul128(b.first.first.fee, a.first.first.blob_size, &hi_b);
+      if (hi_a != hi_b) return hi_a > hi_b;
+      if (lo_a != lo_b) return lo_a > lo_b;
+      // then oldest first
+      if (a.first.second != b.first.second) return a.first.second < b.first.second;
+      return std::memcmp(&a.second, &b.second, sizeof(crypto::hash)) < 0;
     }
   };
 
@@ -105,9 +123,9 @@ namespace cryptonote
      * @copydoc add_tx(const transaction&, tx_verification_context&, bool, bool, uint8_t)
      *
      * @param id the transaction's hash
-     * @param blob_size the transaction's size
+     * @param tx_blob the transaction as it was serialized, which is what the pool keeps
      */
-    bool add_tx(const transaction &tx, const crypto::hash &id, size_t blob_size, tx_verification_context& tvc, bool kept_by_block, bool relayed, uint8_t version);
+    bool add_tx(const transaction &tx, const crypto::hash &id, const cryptonote::blobdata &tx_blob, tx_verification_context& tvc, bool kept_by_block, bool relayed, uint8_t version);
 
     /**
      * @brief add a transaction to the transaction pool
@@ -136,7 +154,8 @@ namespace cryptonote
      * @param fee the transaction fee
      * @param relayed return-by-reference was transaction relayed to us by the network?
      *
-     * @return true unless the transaction cannot be found in the pool
+     * @return true unless the transaction cannot be found in the pool, or
+     * cannot be parsed
      */
     bool take_tx(const crypto::hash &id, transaction &tx, size_t& blob_size, uint64_t& fee, bool &relayed);
 
@@ -152,7 +171,7 @@ namespace cryptonote
     /**
      * @brief action to take when notified of a block added to the blockchain
      *
-     * Currently does nothing
+     * Invalidates the cached block template
      *
      * @param new_block_height the height of the blockchain after the change
      * @param top_block_id the hash of the new top block
@@ -164,7 +183,7 @@ namespace cryptonote
     /**
      * @brief action to take when notified of a block removed from the blockchain
      *
-     * Currently does nothing
+     * Invalidates the cached block template
      *
      * @param new_block_height the height of the blockchain after the change
      * @param top_block_id the hash of the new top block
@@ -176,12 +195,17 @@ namespace cryptonote
     /**
      * @brief action to take periodically
      *
-     * Currently checks transaction pool for stale ("stuck") transactions
+     * Currently checks transaction pool for stale ("stuck") transactions,
+     * and logs how long the pool's locks have been held
      */
     void on_idle();
 
     /**
      * @brief locks the transaction pool
+     *
+     * Takes the pool-wide lock exclusively, which keeps transactions from
+     * being added or removed, but not from being looked up. The calling
+     * thread can still use the pool while it holds the lock.
      */
     void lock() const;
 
@@ -193,37 +217,93 @@ namespace cryptonote
     // load/store operations
 
     /**
-     * @brief loads pool state (if any) from disk, and initializes pool
+     * @brief loads the pool from the blockchain db (if persistent), and
+     * initializes pool
      *
-     * @param config_folder folder name where pool state will be
+     * Must be called once the blockchain is initialized.  While the pool is
+     * persistent, transactions entering and leaving it are written to the
+     * db as they come and go, by a thread of its own.
+     *
+     * @param persistent whether to keep the pool in the blockchain db
      *
      * @return true
      */
-    bool init(const std::string& config_folder);
+    bool init(bool persistent);
 
     /**
-     * @brief attempts to save the transaction pool state to disk
-     *
-     * Currently fails (returns false) if the data directory from init()
-     * does not exist and cannot be created, but returns true even if
-     * saving to disk is unsuccessful.
+     * @brief writes out pending pool changes and stops the db writer
      *
-     * @return true in most cases (see above)
+     * @return true
      */
     bool deinit();
 
     /**
      * @brief Chooses transactions for a block to include
      *
+     * The choice is cached and kept up to date as transactions enter and
+     * leave the pool, so the pool is only scanned in full again once the
+     * chain or the given parameters change.
+     *
      * @param bl return-by-reference the block to fill in with transactions
      * @param median_size the current median block size
      * @param already_generated_coins the current total number of coins "minted"
      * @param total_size return-by-reference the total size of the new block
      * @param fee return-by-reference the total of fees from the included transactions
+     * @param template_version return-by-reference the version of the template
+     *        copied into bl, which changes whenever the chosen transactions or
+     *        the block they are chosen on top of change
      *
      * @return true
      */
-    bool fill_block_template(block &bl, size_t median_size, uint64_t already_generated_coins, size_t &total_size, uint64_t &fee, uint64_t height);
+    bool fill_block_template(block &bl, size_t median_size, uint64_t already_generated_coins, size_t &total_size, uint64_t &fee, uint64_t height, uint64_t &template_version);
+
+    /**
+     * @brief wait for the block template to change
+     *
+     * Returns once the template version differs from the one given, or once
+     * the pool or the chain changed since the template was last filled (the
+     * caller then has to fill it again to see if the version moved), or once
+     * the timeout expires.
+     *
+     * @param version the block template version the caller has
+     * @param timeout_ms the maximum time to wait, in milliseconds
+     *
+     * @return false if the timeout expired, otherwise true
+     */
+    bool wait_for_template_change(uint64_t version, uint64_t timeout_ms) const;
+
+    //! size and fee of a transaction which could go in a block
+    struct block_candidate
+    {
+      size_t blob_size;
+      uint64_t fee;
+    };
+
+    /**
+     * @brief choose which candidates to include in a block
+     *
+     * Goes through the candidates in order (best fee per byte first), taking
+     * each one which does not decrease the coinbase, ie whose fee outweighs
+     * any block reward penalty it causes. With a nonzero lookahead, a
+     * candidate is also passed over if the following candidates would earn
+     * more without it, which matters when a large tx would otherwise use up
+     * the space left in the block. The lookahead assumes the following
+     * candidates can all be taken.
+     *
+     * @param candidates the candidates, sorted by decreasing fee per byte
+     * @param median_size the current median block size
+     * @param already_generated_coins the current total number of coins "minted"
+     * @param height the height of the block to be created
+     * @param lookahead how many following candidates to weigh each one against, 0 for plain greedy
+     * @param try_take called with the index of a candidate about to be taken;
+     *        returning false leaves it out (eg if it is not ready to go)
+     * @param chosen return-by-reference the indices of the chosen candidates
+     * @param total_size return-by-reference the total size of the chosen candidates
+     * @param fee return-by-reference the total fee of the chosen candidates
+     *
+     * @return the coinbase (block reward plus fees) of the resulting block
+     */
+    static uint64_t select_block_txes(const std::vector<block_candidate>& candidates, size_t median_size, uint64_t already_generated_coins, uint64_t height, size_t lookahead, const std::function<bool(size_t)>& try_take, std::vector<size_t>& chosen, size_t& total_size, uint64_t& fee);
 
     /**
      * @brief get a list of all transactions in the pool
@@ -261,6 +341,16 @@ namespace cryptonote
      */
     bool get_transaction(const crypto::hash& h, transaction& tx) const;
 
+    /**
+     * @brief get a specific transaction from the pool, without parsing it
+     *
+     * @param h the hash of the transaction to get
+     * @param tx_blob return-by-reference the transaction's blob
+     *
+     * @return true if the transaction is found, otherwise false
+     */
+    bool get_transaction(const crypto::hash& h, cryptonote::blobdata& tx_blob) const;
+
     /**
      * @brief get a list of all relayable transactions and their hashes
      *
@@ -269,18 +359,18 @@ namespace cryptonote
      *   hasn't been relayed too recently
      *   isn't old enough that relaying it is considered harmful
      *
-     * @param txs return-by-reference the transactions and their hashes
+     * @param txs return-by-reference the transactions' hashes and blobs
      *
      * @return true
      */
-    bool get_relayable_transactions(std::list<std::pair<crypto::hash, cryptonote::transaction>>& txs) const;
+    bool get_relayable_transactions(std::list<std::pair<crypto::hash, cryptonote::blobdata>>& txs) const;
 
     /**
      * @brief tell the pool that certain transactions were just relayed
      *
-     * @param txs the list of transactions (and their hashes)
+     * @param txs the list of transactions' hashes (and blobs)
      */
-    void set_relayed(const std::list<std::pair<crypto::hash, cryptonote::transaction>>& txs);
+    void set_relayed(const std::list<std::pair<crypto::hash, cryptonote::blobdata>>& txs);
 
     /**
      * @brief get the total number of transactions in the pool
@@ -298,6 +388,13 @@ namespace cryptonote
      */
     std::string print_pool(bool short_format) const;
 
+    /**
+     * @brief get a string with how long the pool's locks have been held
+     *
+     * @return the string, with a histogram of hold times per lock
+     */
+    std::string print_lock_stats() const;
+
     /**
      * @brief remove transactions from the pool which are no longer valid
      *
@@ -311,39 +408,18 @@ namespace cryptonote
      */
     size_t validate(uint8_t version);
 
-
-#define CURRENT_MEMPOOL_ARCHIVE_VER    11
-#define CURRENT_MEMPOOL_TX_DETAILS_ARCHIVE_VER    11
-
-    /**
-     * @brief serialize the transaction pool to/from disk
-     *
-     * If the archive version passed is older than the version compiled
-     * in, this function does nothing, as it cannot deserialize after a
-     * format change.
-     *
-     * @tparam archive_t the archive class
-     * @param a the archive to serialize to/from
-     * @param version the archive version
-     */
-    template<class archive_t>
-    void serialize(archive_t & a, const unsigned int version)
-    {
-      if(version < CURRENT_MEMPOOL_ARCHIVE_VER )
-        return;
-      CRITICAL_REGION_LOCAL(m_transactions_lock);
-      a & m_transactions;
-      a & m_spent_key_images;
-      a & m_pending_aliases;
-      a & m_timed_out_transactions;
-    }
-
     /**
      * @brief information about a single transaction
+     *
+     * The transaction is kept as the blob it arrived as, along with what
+     * the pool needs to know about it without parsing it. It is only
+     * parsed when needed in full, e.g. to check its inputs.
      */
     struct tx_details
     {
-      transaction tx;  //!< the transaction
+      cryptonote::blobdata tx_blob;  //!< the transaction
+      std::vector<crypto::key_image> key_images;  //!< the key images spent by the transaction's inputs
+      std::string alias;  //!< the alias the transaction registers, if any
       size_t blob_size;  //!< the transaction's size
       uint64_t fee;  //!< the transaction's fee amount
       crypto::hash max_used_block_id;  //!< the hash of the highest block referenced by an input
@@ -419,32 +495,33 @@ namespace cryptonote
      * convenience/speed, so this is part of the process of removing
      * a transaction from the pool.
      *
-     * @param tx the transaction
+     * @param id the transaction's hash
+     * @param key_images the transaction's spent key images
      *
      * @return false if any key images to be removed cannot be found, otherwise true
      */
-    bool remove_transaction_keyimages(const transaction& tx);
-    bool remove_transaction_alias(const transaction& tx);
+    bool remove_transaction_keyimages(const crypto::hash& id, const std::vector<crypto::key_image>& key_images);
+    bool remove_transaction_alias(const crypto::hash& id, const std::string& alias);
 
     /**
      * @brief check if any of a transaction's spent key images are present in a given set
      *
      * @param kic the set of key images to check against
-     * @param tx the transaction to check
+     * @param key_images the transaction's spent key images
      *
      * @return true if any key images present in the set, otherwise false
      */
-    static bool have_key_images(const std::unordered_set<crypto::key_image>& kic, const transaction& tx);
+    static bool have_key_images(const std::unordered_set<crypto::key_image>& kic, const std::vector<crypto::key_image>& key_images);
 
     /**
      * @brief append the key images from a transaction to the given set
      *
      * @param kic the set of key images to append to
-     * @param tx the transaction
+     * @param key_images the transaction's spent key images
      *
      * @return false if any append fails, otherwise true
      */
-    static bool append_key_images(std::unordered_set<crypto::key_image>& kic, const transaction& tx);
+    static bool append_key_images(std::unordered_set<crypto::key_image>& kic, const std::vector<crypto::key_image>& key_images);
 
     /**
      * @brief check if a transaction is a valid candidate for inclusion in a block
@@ -455,6 +532,42 @@ namespace cryptonote
      */
     bool is_transaction_ready_to_go(tx_details& txd) const;
 
+    /**
+     * @brief choose the transactions for the block template from scratch
+     *
+     * @param median_size the current median block size
+     * @param already_generated_coins the current total number of coins "minted"
+     * @param height the height of the block to be created
+     */
+    void rebuild_block_template(size_t median_size, uint64_t already_generated_coins, uint64_t height);
+
+    /**
+     * @brief add a newly accepted transaction to the block template if it fits
+     *
+     * If the transaction does not fit but outranks a transaction already
+     * chosen, the template is chosen again on the next request instead.
+     *
+     * @param id the hash of the transaction
+     * @param txd the transaction and info about it
+     * @param entry the transaction's entry in the sorted container
+     */
+    void add_to_block_template(const crypto::hash& id, const tx_details& txd, const tx_by_fee_and_receive_time_entry& entry);
+
+    /**
+     * @brief drop the block template if it contains a transaction leaving the pool
+     *
+     * @param id the hash of the transaction leaving the pool
+     */
+    void remove_from_block_template(const crypto::hash& id);
+
+    /**
+     * @brief wake up anything waiting for the block template to change
+     *
+     * @param changed whether the template is known to have changed, rather
+     *        than just needing to be filled again
+     */
+    void notify_template_change(bool changed);
+
     //! map transactions (and related info) by their hashes
     typedef std::unordered_map<crypto::hash, tx_details > transactions_container;
 
@@ -469,17 +582,59 @@ namespace cryptonote
      */
     typedef std::unordered_map<crypto::key_image, std::unordered_set<crypto::hash> > key_images_container;
 
+    //! number of shards the transactions in the pool are spread over, by hash
+    static const size_t TX_SHARDS = 16;
+
+    //! a part of the transactions in the pool, with its own lock
+    struct tx_shard
+    {
+      mutable boost::shared_mutex lock;  //!< lock for txs
+      transactions_container txs;  //!< the transactions whose hash maps to this shard
+    };
+
 #if defined(DEBUG_CREATE_BLOCK_TEMPLATE)
 public:
 #endif
-    mutable epee::critical_section m_transactions_lock;  //!< lock for the pool
-    transactions_container m_transactions;  //!< container for transactions in the pool
+    //! lock for the pool as a whole
+    /*! Held shared to read, and exclusive to change, everything but the
+     *  transactions themselves and the spent key images, which have their
+     *  own locks. Adding or removing a transaction takes it exclusive.
+     *
+     *  A shard's lock is enough to look at (shared) or update (exclusive)
+     *  its transactions, so single lookups and whole pool listings do not
+     *  wait for a transaction being added elsewhere.
+     *
+     *  Locks are taken in the order: m_transactions_lock, shard locks,
+     *  m_spent_key_images_lock.
+     *
+     *  Blockchain holds m_transactions_lock exclusively (see lock()) while
+     *  it adds a block, and calls back into the pool under it, so its
+     *  owner may take it again.
+     */
+    mutable tools::recursive_shared_mutex m_transactions_lock;
+    tx_shard m_tx_shards[TX_SHARDS];  //!< container for transactions in the pool
+
+    /**
+     * @brief get the shard a transaction belongs in
+     *
+     * @param id the hash of the transaction
+     *
+     * @return the shard
+     */
+    tx_shard& get_shard(const crypto::hash& id);
+    const tx_shard& get_shard(const crypto::hash& id) const;
 #if defined(DEBUG_CREATE_BLOCK_TEMPLATE)
 private:
 #endif
 
     //! container for spent key images from the transactions in the pool
     key_images_container m_spent_key_images;
+    mutable boost::shared_mutex m_spent_key_images_lock;  //!< lock for m_spent_key_images
+
+    //! how long each of the locks above was held
+    mutable tools::LockHoldHistogram m_pool_lock_hold;
+    mutable tools::LockHoldHistogram m_shard_lock_hold;
+    mutable tools::LockHoldHistogram m_key_images_lock_hold;
 
     std::unordered_map<std::string, std::unordered_set<crypto::hash>> m_pending_aliases;
 
@@ -487,6 +642,9 @@ private:
     //! interval on which to check for stale/"stuck" transactions
     epee::math_helper::once_a_time_seconds<30> m_remove_stuck_tx_interval;
 
+    //! interval on which to log the lock hold times
+    epee::math_helper::once_a_time_seconds<600> m_print_lock_stats_interval;
+
     //TODO: look into doing this better
     //!< container for transactions organized by fee per size and receive time
     sorted_tx_container m_txs_by_fee_and_receive_time;
@@ -495,10 +653,45 @@ private:
      * @brief get an iterator to a transaction in the sorted container
      *
      * @param id the hash of the transaction to look for
+     * @param txd the transaction's info
      *
      * @return an iterator, possibly to the end of the container if not found
      */
-    sorted_tx_container::iterator find_tx_in_sorted_container(const crypto::hash& id) const;
+    sorted_tx_container::iterator find_tx_in_sorted_container(const crypto::hash& id, const tx_details& txd) const;
+
+    /**
+     * @brief make a transaction's entry for the sorted container
+     *
+     * @param id the hash of the transaction
+     * @param txd the transaction's info
+     *
+     * @return the entry
+     */
+    static tx_by_fee_and_receive_time_entry make_sorted_entry(const crypto::hash& id, const tx_details& txd);
+
+    //! the transactions chosen for the current block template
+    struct block_template_cache
+    {
+      bool valid;  //!< false if the transactions have to be chosen again
+      uint64_t height;  //!< the height the transactions were chosen for
+      size_t median_size;  //!< the median block size they were chosen for
+      uint64_t already_generated_coins;  //!< the coins "minted" when they were chosen
+      std::vector<crypto::hash> tx_hashes;  //!< the chosen transactions, in order
+      std::unordered_set<crypto::hash> tx_set;  //!< the chosen transactions, for lookups
+      std::unordered_set<crypto::key_image> k_images;  //!< key images the chosen transactions spend
+      size_t total_size;  //!< the total size of the chosen transactions
+      uint64_t fee;  //!< the total fee of the chosen transactions
+      uint64_t best_coinbase;  //!< the coinbase reward with the chosen transactions
+      tx_by_fee_and_receive_time_entry lowest;  //!< the lowest ranked chosen transaction
+    };
+
+    block_template_cache m_template;  //!< guarded by m_transactions_lock
+
+    mutable boost::mutex m_template_mutex;  //!< lock for the counters below
+    mutable boost::condition_variable m_template_cond;  //!< signalled when they change
+    uint64_t m_template_version;  //!< bumped when the template contents change
+    uint64_t m_template_events;  //!< bumped when the template may have changed
+    uint64_t m_template_filled_events;  //!< m_template_events when the template was last filled
 
     //! transactions which are unlikely to be included in blocks
     /*! These transactions are kept in RAM in case they *are* included
@@ -506,33 +699,40 @@ private:
      */
     std::unordered_set<crypto::hash> m_timed_out_transactions;
 
-    std::string m_config_folder;  //!< the folder to save state to
+    /**
+     * @brief queue a transaction to be written to the blockchain db
+     *
+     * @param id the hash of the transaction
+     * @param txd the transaction's info
+     * @param with_blob false if only the info changed
+     */
+    void queue_db_write(const crypto::hash& id, const tx_details& txd, bool with_blob);
+
+    /**
+     * @brief queue a transaction to be removed from the blockchain db
+     *
+     * @param id the hash of the transaction
+     */
+    void queue_db_remove(const crypto::hash& id);
+
+    /**
+     * @brief fold a queued db change into the one pending for the same transaction
+     *
+     * @param pending the change already queued
+     * @param update the newer change
+     */
+    static void merge_db_update(txpool_tx_update& pending, const txpool_tx_update& update);
+
+    //! writes the queued changes to the blockchain db until deinit()
+    void db_writer();
+
+    bool m_persistent;  //!< whether the pool is kept in the blockchain db
+    std::unordered_map<crypto::hash, txpool_tx_update> m_db_updates;  //!< changes not yet written, by transaction
+    boost::mutex m_db_mutex;  //!< lock for m_db_updates and m_db_stop
+    boost::condition_variable m_db_cond;  //!< signalled when changes are queued, or on stop
+    bool m_db_stop;  //!< tells the writer to write what is left and exit
+    boost::thread m_db_thread;  //!< the writer
+
     Blockchain& m_blockchain;  //!< reference to the Blockchain object
   };
 }
-
-namespace boost
-{
-  namespace serialization
-  {
-    template<class archive_t>
-    void serialize(archive_t & ar, cryptonote::tx_memory_pool::tx_details& td, const unsigned int version)
-    {
-      ar & td.blob_size;
-      ar & td.fee;
-      ar & td.tx;
-      ar & td.max_used_block_height;
-      ar & td.max_used_block_id;
-      ar & td.last_failed_height;
-      ar & td.last_failed_id;
-      ar & td.receive_time;
-      ar & td.last_relayed_time;
-      ar & td.relayed;
-      if (version < 11)
-        return;
-      ar & td.kept_by_block;
-    }
-  }
-}
-BOOST_CLASS_VERSION(cryptonote::tx_memory_pool, CURRENT_MEMPOOL_ARCHIVE_VER)
-BOOST_CLASS_VERSION(cryptonote::tx_memory_pool::tx_details, CURRENT_MEMPOOL_TX_DETAILS_ARCHIVE_VER)
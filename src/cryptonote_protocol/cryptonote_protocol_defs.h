@@ -100,9 +100,16 @@ namespace cryptonote
   {
     blobdata block;
     std::list<blobdata> txs;
+    bool pruned; // txs only hold the prefix and rct base, see prunable_hashes
+    std::vector<crypto::hash> prunable_hashes; // one per tx when pruned
+
+    block_complete_entry(): pruned(false) {}
+
     BEGIN_KV_SERIALIZE_MAP()
       KV_SERIALIZE(block)
       KV_SERIALIZE(txs)
+      KV_SERIALIZE(pruned)
+      KV_SERIALIZE_CONTAINER_POD_AS_BLOB(prunable_hashes)
     END_KV_SERIALIZE_MAP()
   };
 
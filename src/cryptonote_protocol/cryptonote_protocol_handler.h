@@ -107,6 +107,7 @@ namespace cryptonote
     bool on_callback(cryptonote_connection_context& context);
     t_core& get_core(){return m_core;}
     bool is_synchronized(){return m_synchronized;}
+    void get_sync_download_stats(uint64_t& blocks, uint64_t& time) const { blocks = m_sync_download_blocks; time = m_sync_download_time; }
     void log_connections();
     std::list<connection_info> get_connections();
     void stop();
@@ -137,6 +138,9 @@ namespace cryptonote
     std::atomic<bool> m_synchronized;
     bool m_one_request = true;
     std::atomic<bool> m_stopping;
+    std::atomic<uint32_t> m_queued_spans; // downloaded spans of blocks not yet handled by the core
+    std::atomic<uint64_t> m_sync_download_blocks;
+    std::atomic<uint64_t> m_sync_download_time; // ms from request to delivery
 
 		// static std::ofstream m_logreq;
     boost::mutex m_buffer_mutex;
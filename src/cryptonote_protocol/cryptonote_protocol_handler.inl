@@ -61,7 +61,10 @@ namespace cryptonote
                                                                                                               m_p2p(p_net_layout),
                                                                                                               m_syncronized_connections_count(0),
                                                                                                               m_synchronized(false),
-                                                                                                              m_stopping(false)
+                                                                                                              m_stopping(false),
+                                                                                                              m_queued_spans(0),
+                                                                                                              m_sync_download_blocks(0),
+                                                                                                              m_sync_download_time(0)
 
   {
     if(!m_p2p)
@@ -476,7 +479,8 @@ namespace cryptonote
 
           // we might already have the tx that the peer
           // sent in our pool, so don't verify again..
-          if(!m_core.get_pool_transaction(tx_hash, tx))
+          blobdata pool_tx_blob;
+          if(!m_core.get_pool_transaction(tx_hash, pool_tx_blob))
           {
             cryptonote::tx_verification_context tvc = AUTO_VAL_INIT(tvc);
             if(!m_core.handle_incoming_tx(tx_blob, tvc, true, true) || tvc.m_verifivation_failed)
@@ -532,9 +536,10 @@ namespace cryptonote
       size_t tx_idx = 0;
       BOOST_FOREACH(auto& tx_hash, new_block.tx_hashes)
       {
-        if(m_core.get_pool_transaction(tx_hash, tx))
+        blobdata tx_blob;
+        if(m_core.get_pool_transaction(tx_hash, tx_blob))
         {
-          have_tx.push_back(tx_to_blob(tx));
+          have_tx.push_back(std::move(tx_blob));
         }
         else
         {
@@ -849,6 +854,19 @@ namespace cryptonote
       return 1;
     }
 
+    m_sync_download_blocks += arg.blocks.size();
+    m_sync_download_time += epee::misc_utils::get_tick_count() - context.m_last_request_time;
+
+    // ask for the next span now so it downloads while this one is verified,
+    // unless enough spans are already waiting for the core
+    ++m_queued_spans;
+    epee::misc_utils::auto_scope_leave_caller queued_scope_exit_handler = epee::misc_utils::create_scope_leave_handler([this]() { --m_queued_spans; });
+    bool requested_ahead = false;
+    if (m_queued_spans <= BLOCKS_SYNCHRONIZING_MAX_QUEUED_SPANS && context.m_needed_objects.size())
+    {
+      request_missing_objects(context, true);
+      requested_ahead = true;
+    }
 
     {
       m_core.pause_mine();
@@ -925,7 +943,8 @@ namespace cryptonote
 
 
     }
-    request_missing_objects(context, true);
+    if (!requested_ahead)
+      request_missing_objects(context, true);
     return 1;
   }
   //------------------------------------------------------------------------------------------------------------------------
@@ -986,6 +1005,7 @@ namespace cryptonote
           << "requested blocks count=" << count << " / " << count_limit);
       //epee::net_utils::network_throttle_manager::get_global_throttle_inreq().logger_handle_net("log/dr-sumokoin/net/req-all.data", sec, get_avg_block_size());
 
+      context.m_last_request_time = epee::misc_utils::get_tick_count();
       post_notify<NOTIFY_REQUEST_GET_OBJECTS>(req, context);
     }else if(context.m_last_response_height < context.m_remote_blockchain_height-1)
     {//we have to fetch more objects ids, request blockchain entry
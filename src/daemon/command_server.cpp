@@ -114,7 +114,7 @@ t_command_server::t_command_server(
   m_command_lookup.set_handler(
       "print_pool_stats"
     , std::bind(&t_command_parser_executor::print_transaction_pool_stats, &m_parser, p::_1)
-    , "Print transaction pool statistics"
+    , "Print transaction pool statistics and lock hold times"
     );
   m_command_lookup.set_handler(
       "show_hr"
@@ -887,6 +887,8 @@ bool t_rpc_command_executor::print_transaction_pool_stats() {
   tools::msg_writer() << n_transactions << " tx(es), " << bytes << " bytes total (min " << min_bytes << ", max " << max_bytes << ", avg " << avg_bytes << ")" << std::endl
       << "fees " << cryptonote::print_money(fee) << " (avg " << cryptonote::print_money(n_transactions ? fee / n_transactions : 0) << " per tx)" << std::endl
       << n_not_relayed << " not relayed, " << n_failing << " failing, " << n_10m << " older than 10 minutes (oldest " << (oldest == 0 ? "-" : get_human_time_ago(oldest, now)) << ")" << std::endl;
+  if (!res.lock_stats.empty())
+    tools::msg_writer() << "lock hold times:" << std::endl << res.lock_stats;
 
   return true;
 }
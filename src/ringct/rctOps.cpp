@@ -28,6 +28,10 @@
 // STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
 // THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <atomic>
+#include <list>
+#include <unordered_map>
+
 #include "misc_log_ex.h"
 #include "rctOps.h"
 using namespace crypto;
@@ -256,6 +260,133 @@ namespace rct {
     }
 
 
+    //addKeys2 with B precomputed
+    void addKeys2(key &aGbB, const key &a, const key &b, const ge_dsmp B) {
+        ge_p2 rv;
+        ge_double_scalarmult_base_precomp_vartime(&rv, b.bytes, B, a.bytes);
+        ge_tobytes(aGbB.bytes, &rv);
+    }
+
+    //addKeys3 with A and B precomputed
+    void addKeys3(key &aAbB, const key &a, const ge_dsmp A, const key &b, const ge_dsmp B) {
+        ge_p2 rv;
+        ge_double_scalarmult_precomp2_vartime(&rv, a.bytes, A, b.bytes, B);
+        ge_tobytes(aAbB.bytes, &rv);
+    }
+
+    //Ring member precomputation cache
+    //split in shards so verification threads rarely wait on each other
+    namespace {
+        struct key_hash {
+            size_t operator()(const key &k) const {
+                size_t h;
+                memcpy(&h, k.bytes, sizeof(h));
+                return h;
+            }
+        };
+
+        class ringMemberPrecompCache {
+        public:
+            static const size_t SHARDS = 16;
+            static const size_t ENTRY_SIZE = sizeof(ringMemberPrecomp) + sizeof(key) * 2 + 64; // list node + map node overhead
+
+            ringMemberPrecompCache(): max_entries_per_shard(0), hits(0), misses(0) {}
+
+            std::shared_ptr<const ringMemberPrecomp> get(const key &P) {
+                shard &s = shards[P.bytes[0] % SHARDS];
+                {
+                    std::lock_guard<std::mutex> lock(s.mutex);
+                    auto it = s.index.find(P);
+                    if (it != s.index.end()) {
+                        s.lru.splice(s.lru.begin(), s.lru, it->second);
+                        ++hits;
+                        return it->second->second;
+                    }
+                }
+                ++misses;
+
+                std::shared_ptr<ringMemberPrecomp> e = std::make_shared<ringMemberPrecomp>();
+                ge_p3 p3;
+                ge_p2 p2;
+                ge_p1p1 p1;
+                CHECK_AND_ASSERT_THROW_MES(ge_frombytes_vartime(&p3, P.bytes) == 0, "ge_frombytes_vartime failed at "+boost::lexical_cast<std::string>(__LINE__));
+                ge_dsm_precomp(e->P, &p3);
+                key h = cn_fast_hash(P);
+                ge_fromfe_frombytes_vartime(&p2, h.bytes);
+                ge_mul8(&p1, &p2);
+                ge_p1p1_to_p3(&p3, &p1);
+                ge_dsm_precomp(e->HP, &p3);
+
+                const size_t max_entries = max_entries_per_shard;
+                if (max_entries == 0)
+                    return e;
+
+                std::lock_guard<std::mutex> lock(s.mutex);
+                if (s.index.find(P) == s.index.end()) {
+                    s.lru.emplace_front(P, e);
+                    s.index.emplace(P, s.lru.begin());
+                }
+                while (s.lru.size() > max_entries) {
+                    s.index.erase(s.lru.back().first);
+                    s.lru.pop_back();
+                }
+                return e;
+            }
+
+            void set_size(size_t bytes) {
+                max_entries_per_shard = bytes / ENTRY_SIZE / SHARDS;
+                for (shard &s: shards) {
+                    std::lock_guard<std::mutex> lock(s.mutex);
+                    while (s.lru.size() > max_entries_per_shard) {
+                        s.index.erase(s.lru.back().first);
+                        s.lru.pop_back();
+                    }
+                }
+            }
+
+            void get_stats(uint64_t &h, uint64_t &m, size_t &entries, size_t &max_entries) {
+                h = hits;
+                m = misses;
+                entries = 0;
+                for (shard &s: shards) {
+                    std::lock_guard<std::mutex> lock(s.mutex);
+                    entries += s.lru.size();
+                }
+                max_entries = max_entries_per_shard * SHARDS;
+            }
+
+        private:
+            typedef std::list<std::pair<key, std::shared_ptr<const ringMemberPrecomp>>> lru_list;
+            struct shard {
+                std::mutex mutex;
+                lru_list lru;
+                std::unordered_map<key, lru_list::iterator, key_hash> index;
+            };
+
+            shard shards[SHARDS];
+            std::atomic<size_t> max_entries_per_shard;
+            std::atomic<uint64_t> hits;
+            std::atomic<uint64_t> misses;
+        };
+
+        ringMemberPrecompCache &ring_member_precomp_cache() {
+            static ringMemberPrecompCache cache;
+            return cache;
+        }
+    }
+
+    std::shared_ptr<const ringMemberPrecomp> getRingMemberPrecomp(const key &P) {
+        return ring_member_precomp_cache().get(P);
+    }
+
+    void setRingMemberPrecompCacheSize(size_t bytes) {
+        ring_member_precomp_cache().set_size(bytes);
+    }
+
+    void getRingMemberPrecompCacheStats(uint64_t &hits, uint64_t &misses, size_t &entries, size_t &max_entries) {
+        ring_member_precomp_cache().get_stats(hits, misses, entries, max_entries);
+    }
+
     //subtract Keys (subtracts curve points)
     //AB = A - B where A, B are curve points
     void subKeys(key & AB, const key &A, const key &B) {
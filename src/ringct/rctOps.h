@@ -35,6 +35,7 @@
 #define RCTOPS_H
 
 #include <cstddef>
+#include <memory>
 #include <mutex>
 #include <vector>
 #include <tuple>
@@ -138,6 +139,21 @@ namespace rct {
     //aAbB = a*A + b*B where a, b are scalars, A, B are curve points
     //B must be input after applying "precomp"
     void addKeys3(key &aAbB, const key &a, const key &A, const key &b, const ge_dsmp B);
+    //same as addKeys2 / addKeys3, with every point already run through "precomp"
+    void addKeys2(key &aGbB, const key &a, const key &b, const ge_dsmp B);
+    void addKeys3(key &aAbB, const key &a, const ge_dsmp A, const key &b, const ge_dsmp B);
+
+    //Ring member precomputation cache
+    //   MLSAG_Ver needs the precomp of each ring member P and of HashToPoint(P). Popular
+    //   decoys are ring members in many txes, so these are kept in a LRU cache bounded
+    //   to a number of bytes (0 disables the cache)
+    struct ringMemberPrecomp {
+        ge_dsmp P;
+        ge_dsmp HP;
+    };
+    std::shared_ptr<const ringMemberPrecomp> getRingMemberPrecomp(const key &P);
+    void setRingMemberPrecompCacheSize(size_t bytes);
+    void getRingMemberPrecompCacheStats(uint64_t &hits, uint64_t &misses, size_t &entries, size_t &max_entries);
     //AB = A - B where A, B are curve points
     void subKeys(key &AB, const key &A, const  key &B);
     //checks if A, B are equal as curve points
@@ -75,18 +75,31 @@ namespace rct {
     }
 
     //see above.
-    bool verifyBorromean(const boroSig &bb, const key64 P1, const key64 P2) {
+    //P1 and P2 already decompressed, saves a ge_frombytes_vartime per addKeys2
+    static bool verifyBorromean(const boroSig &bb, const ge_p3 P1[64], const ge_p3 P2[64]) {
         key64 Lv1; key chash, LL;
+        ge_p2 rv;
         int ii = 0;
         for (ii = 0 ; ii < 64 ; ii++) {
-            addKeys2(LL, bb.s0[ii], bb.ee, P1[ii]);
+            ge_double_scalarmult_base_vartime(&rv, bb.ee.bytes, &P1[ii], bb.s0[ii].bytes);
+            ge_tobytes(LL.bytes, &rv);
             chash = hash_to_scalar(LL);
-            addKeys2(Lv1[ii], bb.s1[ii], chash, P2[ii]);
+            ge_double_scalarmult_base_vartime(&rv, chash.bytes, &P2[ii], bb.s1[ii].bytes);
+            ge_tobytes(Lv1[ii].bytes, &rv);
         }
         key eeComputed = hash_to_scalar(Lv1); //hash function fine
         return equalKeys(eeComputed, bb.ee);
     }
 
+    bool verifyBorromean(const boroSig &bb, const key64 P1, const key64 P2) {
+        ge_p3 P1_p3[64], P2_p3[64];
+        for (int ii = 0 ; ii < 64 ; ii++) {
+            CHECK_AND_ASSERT_THROW_MES(ge_frombytes_vartime(&P1_p3[ii], P1[ii].bytes) == 0, "point conv failed");
+            CHECK_AND_ASSERT_THROW_MES(ge_frombytes_vartime(&P2_p3[ii], P2[ii].bytes) == 0, "point conv failed");
+        }
+        return verifyBorromean(bb, P1_p3, P2_p3);
+    }
+
     //Multilayered Spontaneous Anonymous Group Signatures (MLSAG signatures)
     //These are aka MG signatutes in earlier drafts of the ring ct paper
     // c.f. http://eprint.iacr.org/2015/1098 section 2.
@@ -167,9 +180,9 @@ namespace rct {
             rv.ss[i] = skvGen(rows);
             sc_0(c.bytes);
             for (j = 0; j < dsRows; j++) {
-                addKeys2(L, rv.ss[i][j], c_old, pk[i][j]);
-                hashToPoint(Hi, pk[i][j]);
-                addKeys3(R, rv.ss[i][j], Hi, c_old, Ip[j].k);
+                std::shared_ptr<const ringMemberPrecomp> pre = getRingMemberPrecomp(pk[i][j]);
+                addKeys2(L, rv.ss[i][j], c_old, pre->P);
+                addKeys3(R, rv.ss[i][j], pre->HP, c_old, Ip[j].k);
                 toHash[3 * j + 1] = pk[i][j];
                 toHash[3 * j + 2] = L;
                 toHash[3 * j + 3] = R;
@@ -224,7 +237,7 @@ namespace rct {
         CHECK_AND_ASSERT_MES(sc_check(rv.cc.bytes) == 0, false, "Bad cc");
 
         size_t i = 0, j = 0, ii = 0;
-        key c,  L, R, Hi;
+        key c,  L, R;
         key c_old = copy(rv.cc);
         vector<geDsmp> Ip(dsRows);
         for (i = 0 ; i < dsRows ; i++) {
@@ -237,9 +250,9 @@ namespace rct {
         while (i < cols) {
             sc_0(c.bytes);
             for (j = 0; j < dsRows; j++) {
-                addKeys2(L, rv.ss[i][j], c_old, pk[i][j]);
-                hashToPoint(Hi, pk[i][j]);
-                addKeys3(R, rv.ss[i][j], Hi, c_old, Ip[j].k);
+                std::shared_ptr<const ringMemberPrecomp> pre = getRingMemberPrecomp(pk[i][j]);
+                addKeys2(L, rv.ss[i][j], c_old, pre->P);
+                addKeys3(R, rv.ss[i][j], pre->HP, c_old, Ip[j].k);
                 toHash[3 * j + 1] = pk[i][j];
                 toHash[3 * j + 2] = L;
                 toHash[3 * j + 3] = R;
@@ -298,20 +311,47 @@ namespace rct {
     //   thus this proves that "amount" is in [0, 2^64]
     //   mask is a such that C = aG + bH, and b = amount
     //verRange verifies that \sum Ci = C and that each Ci is a commitment to 0 or 2^i
+    //H2 decompressed once, in the form ge_sub wants it
+    struct H2_cached_t {
+        ge_cached H[64];
+        H2_cached_t() {
+            ge_p3 p3;
+            for (int i = 0; i < 64; i++) {
+                CHECK_AND_ASSERT_THROW_MES(ge_frombytes_vartime(&p3, H2[i].bytes) == 0, "point conv failed");
+                ge_p3_to_cached(&H[i], &p3);
+            }
+        }
+    };
+
+    //each Ci is decompressed once and kept as a ge_p3 for the sum, the Ci - 2^i H
+    //differences and both Borromean double scalar mults, instead of going through
+    //the byte form (one sqrt to decompress, one inversion to compress) at every step
     bool verRange(const key & C, const rangeSig & as) {
       try
       {
         PERF_TIMER(verRange);
-        key64 CiH;
+        static const H2_cached_t H2_cached;
+        ge_p3 Ci[64], CiH[64], Ctmp_p3;
+        ge_cached cached;
+        ge_p1p1 p1;
         int i = 0;
-        key Ctmp = identity();
         for (i = 0; i < 64; i++) {
-            subKeys(CiH[i], as.Ci[i], H2[i]);
-            addKeys(Ctmp, Ctmp, as.Ci[i]);
+            CHECK_AND_ASSERT_THROW_MES(ge_frombytes_vartime(&Ci[i], as.Ci[i].bytes) == 0, "point conv failed");
+            ge_sub(&p1, &Ci[i], &H2_cached.H[i]);
+            ge_p1p1_to_p3(&CiH[i], &p1);
+            if (i == 0) {
+                Ctmp_p3 = Ci[0];
+            } else {
+                ge_p3_to_cached(&cached, &Ci[i]);
+                ge_add(&p1, &Ctmp_p3, &cached);
+                ge_p1p1_to_p3(&Ctmp_p3, &p1);
+            }
         }
+        key Ctmp;
+        ge_p3_tobytes(Ctmp.bytes, &Ctmp_p3);
         if (!equalKeys(C, Ctmp))
           return false;
-        if (!verifyBorromean(as.asig, as.Ci, CiH))
+        if (!verifyBorromean(as.asig, Ci, CiH))
           return false;
         return true;
       }
@@ -714,6 +754,11 @@ namespace rct {
     //   uses the attached ecdh info to find the amounts represented by each output commitment
     //   must know the destination private key to find the correct amount, else will return a random number
     bool verRct(const rctSig & rv, bool semantics) {
+        tools::thread_group threadpool(tools::thread_group::optimal_with_max(semantics ? rv.outPk.size() : 0));
+        return verRct(rv, semantics, threadpool);
+    }
+
+    bool verRct(const rctSig & rv, bool semantics, tools::thread_group & threadpool) {
         PERF_TIMER(verRct);
         CHECK_AND_ASSERT_MES(rv.type == RCTTypeFull, false, "verRct called on non-full rctSig");
         if (semantics)
@@ -732,9 +777,9 @@ namespace rct {
         {
           if (semantics) {
             std::deque<bool> results(rv.outPk.size(), false);
-            tools::thread_group threadpool(tools::thread_group::optimal_with_max(rv.outPk.size()));
+            tools::thread_group inline_threads(0);
 
-            tools::task_region(threadpool, [&] (tools::task_region_handle& region) {
+            tools::task_region(rv.outPk.size() > 1 ? threadpool : inline_threads, [&] (tools::task_region_handle& region) {
               DP("range proofs verified?");
               for (size_t i = 0; i < rv.outPk.size(); i++) {
                 region.run([&, i] {
@@ -774,6 +819,12 @@ namespace rct {
     //ver RingCT simple
     //assumes only post-rct style inputs (at least for max anonymity)
     bool verRctSimple(const rctSig & rv, bool semantics) {
+      const size_t threads = semantics ? rv.outPk.size() : rv.mixRing.size();
+      tools::thread_group threadpool(tools::thread_group::optimal_with_max(threads));
+      return verRctSimple(rv, semantics, threadpool);
+    }
+
+    bool verRctSimple(const rctSig & rv, bool semantics, tools::thread_group & threadpool) {
       try
       {
         PERF_TIMER(verRctSimple);
@@ -794,7 +845,7 @@ namespace rct {
         const size_t threads = std::max(rv.outPk.size(), rv.mixRing.size());
 
         std::deque<bool> results(threads);
-        tools::thread_group threadpool(tools::thread_group::optimal_with_max(threads));
+        tools::thread_group inline_threads(0);
 
         if (semantics) {
           key sumOutpks = identity();
@@ -819,7 +870,7 @@ namespace rct {
 
           results.clear();
           results.resize(rv.outPk.size());
-          tools::task_region(threadpool, [&] (tools::task_region_handle& region) {
+          tools::task_region(rv.outPk.size() > 1 ? threadpool : inline_threads, [&] (tools::task_region_handle& region) {
             for (size_t i = 0; i < rv.outPk.size(); i++) {
               region.run([&, i] {
                   results[i] = verRange(rv.outPk[i].mask, rv.p.rangeSigs[i]);
@@ -839,7 +890,7 @@ namespace rct {
 
           results.clear();
           results.resize(rv.mixRing.size());
-          tools::task_region(threadpool, [&] (tools::task_region_handle& region) {
+          tools::task_region(rv.mixRing.size() > 1 ? threadpool : inline_threads, [&] (tools::task_region_handle& region) {
             for (size_t i = 0 ; i < rv.mixRing.size() ; i++) {
               region.run([&, i] {
                 results[i] = verRctMGSimple(message, rv.p.MGs[i], rv.mixRing[i], rv.pseudoOuts[i]);
@@ -861,6 +912,123 @@ namespace rct {
       catch (...) { return false; }
     }
 
+    //ver RingCT batch
+    //the cheap structural and sum checks are done serially, then every range proof and
+    //MG sig of every rctSig becomes one job, so a block with a few large txes still keeps
+    //all threads busy
+    bool verRctBatch(const std::vector<const rctSig *> & rvs, std::vector<bool> & results, tools::thread_group & threadpool) {
+      PERF_TIMER(verRctBatch);
+
+      struct job
+      {
+        size_t sig;   // index in rvs
+        size_t index; // output index for range proofs, input index for MG sigs
+        bool range;
+      };
+
+      results.assign(rvs.size(), true);
+      std::vector<job> jobs;
+      std::vector<key> messages(rvs.size());
+      std::vector<key> txnFeeKeys(rvs.size());
+
+      for (size_t n = 0; n < rvs.size(); ++n) {
+        const rctSig & rv = *rvs[n];
+        try
+        {
+          if (rv.type == RCTTypeSimple) {
+            if (rv.outPk.size() != rv.p.rangeSigs.size() || rv.outPk.size() != rv.ecdhInfo.size() ||
+                rv.pseudoOuts.size() != rv.p.MGs.size() || rv.pseudoOuts.size() != rv.mixRing.size()) {
+                LOG_PRINT_L1("Mismatched sizes in rct sig " << n);
+                results[n] = false;
+                continue;
+            }
+
+            key sumOutpks = identity();
+            for (size_t i = 0; i < rv.outPk.size(); i++) {
+                addKeys(sumOutpks, sumOutpks, rv.outPk[i].mask);
+            }
+            key txnFeeKey = scalarmultH(d2h(rv.txnFee));
+            addKeys(sumOutpks, txnFeeKey, sumOutpks);
+
+            key sumPseudoOuts = identity();
+            for (size_t i = 0 ; i < rv.pseudoOuts.size() ; i++) {
+                addKeys(sumPseudoOuts, sumPseudoOuts, rv.pseudoOuts[i]);
+            }
+
+            if (!equalKeys(sumPseudoOuts, sumOutpks)) {
+                LOG_PRINT_L1("Sum check failed for rct sig " << n);
+                results[n] = false;
+                continue;
+            }
+
+            for (size_t i = 0; i < rv.mixRing.size(); ++i)
+              jobs.push_back({n, i, false});
+          }
+          else if (rv.type == RCTTypeFull) {
+            if (rv.outPk.size() != rv.p.rangeSigs.size() || rv.outPk.size() != rv.ecdhInfo.size() || rv.p.MGs.size() != 1) {
+                LOG_PRINT_L1("Mismatched sizes in rct sig " << n);
+                results[n] = false;
+                continue;
+            }
+
+            txnFeeKeys[n] = scalarmultH(d2h(rv.txnFee));
+            jobs.push_back({n, 0, false});
+          }
+          else {
+            LOG_PRINT_L1("Unsupported rct type in batch: " << rv.type);
+            results[n] = false;
+            continue;
+          }
+
+          messages[n] = get_pre_mlsag_hash(rv);
+          for (size_t i = 0; i < rv.outPk.size(); ++i)
+            jobs.push_back({n, i, true});
+        }
+        catch (...)
+        {
+          results[n] = false;
+        }
+      }
+
+      std::deque<bool> jobs_ok(jobs.size(), false);
+      tools::thread_group inline_threads(0);
+      tools::task_region(jobs.size() > 1 ? threadpool : inline_threads, [&] (tools::task_region_handle& region) {
+        for (size_t j = 0; j < jobs.size(); ++j) {
+          region.run([&, j] {
+            const job & jb = jobs[j];
+            const rctSig & rv = *rvs[jb.sig];
+            try
+            {
+              if (jb.range)
+                jobs_ok[j] = verRange(rv.outPk[jb.index].mask, rv.p.rangeSigs[jb.index]);
+              else if (rv.type == RCTTypeSimple)
+                jobs_ok[j] = verRctMGSimple(messages[jb.sig], rv.p.MGs[jb.index], rv.mixRing[jb.index], rv.pseudoOuts[jb.index]);
+              else
+                jobs_ok[j] = verRctMG(rv.p.MGs[0], rv.mixRing, rv.outPk, txnFeeKeys[jb.sig], messages[jb.sig]);
+            }
+            catch (...)
+            {
+              jobs_ok[j] = false;
+            }
+          });
+        }
+      });
+
+      bool all_ok = true;
+      for (size_t j = 0; j < jobs.size(); ++j) {
+        if (!jobs_ok[j]) {
+          if (jobs[j].range)
+            LOG_PRINT_L1("Range proof verified failed for output " << jobs[j].index << " of rct sig " << jobs[j].sig);
+          else
+            LOG_PRINT_L1("MG signature verification failed for input " << jobs[j].index << " of rct sig " << jobs[j].sig);
+          results[jobs[j].sig] = false;
+        }
+      }
+      for (size_t n = 0; n < results.size(); ++n)
+        all_ok &= results[n];
+      return all_ok;
+    }
+
     //RingCT protocol
     //genRct:
     //   creates an rctSig with all data necessary to verify the rangeProofs and that the signer owns one of the
@@ -47,6 +47,7 @@ extern "C" {
 #include "crypto/keccak.h"
 }
 #include "crypto/crypto.h"
+#include "common/common_fwd.h"
 
 
 #include "rctTypes.h"
@@ -126,10 +127,20 @@ namespace rct {
     rctSig genRct(const key &message, const ctkeyV & inSk, const ctkeyV  & inPk, const keyV & destinations, const vector<xmr_amount> & amounts, const keyV &amount_keys, const int mixin);
     rctSig genRctSimple(const key & message, const ctkeyV & inSk, const ctkeyV & inPk, const keyV & destinations, const vector<xmr_amount> & inamounts, const vector<xmr_amount> & outamounts, const keyV &amount_keys, xmr_amount txnFee, unsigned int mixin);
     rctSig genRctSimple(const key & message, const ctkeyV & inSk, const keyV & destinations, const vector<xmr_amount> & inamounts, const vector<xmr_amount> & outamounts, xmr_amount txnFee, const ctkeyM & mixRing, const keyV &amount_keys, const std::vector<unsigned int> & index, ctkeyV &outSk);
+    //   the overloads taking a thread_group fan out onto that (long lived) pool instead of
+    //   spawning threads per call; a single range proof / MG is always verified on the caller's thread
     bool verRct(const rctSig & rv, bool semantics);
+    bool verRct(const rctSig & rv, bool semantics, tools::thread_group & threadpool);
     static inline bool verRct(const rctSig & rv) { return verRct(rv, true) && verRct(rv, false); }
+    static inline bool verRct(const rctSig & rv, tools::thread_group & threadpool) { return verRct(rv, true, threadpool) && verRct(rv, false, threadpool); }
     bool verRctSimple(const rctSig & rv, bool semantics);
+    bool verRctSimple(const rctSig & rv, bool semantics, tools::thread_group & threadpool);
     static inline bool verRctSimple(const rctSig & rv) { return verRctSimple(rv, true) && verRctSimple(rv, false); }
+    static inline bool verRctSimple(const rctSig & rv, tools::thread_group & threadpool) { return verRctSimple(rv, true, threadpool) && verRctSimple(rv, false, threadpool); }
+    //verRctBatch:
+    //   verifies several expanded rctSigs (eg all txes of a block) at once, flattening their range proofs
+    //   and MG sigs into one job list on threadpool. results[n] tells whether rvs[n] verified
+    bool verRctBatch(const std::vector<const rctSig *> & rvs, std::vector<bool> & results, tools::thread_group & threadpool);
     xmr_amount decodeRct(const rctSig & rv, const key & sk, unsigned int i, key & mask, bool enable_errors = true);
     xmr_amount decodeRct(const rctSig & rv, const key & sk, unsigned int i);
     xmr_amount decodeRctSimple(const rctSig & rv, const key & sk, unsigned int i, key & mask, bool enable_errors = true);
@@ -40,6 +40,7 @@ using namespace epee;
 #include "cryptonote_core/cryptonote_basic_impl.h"
 #include "misc_language.h"
 #include "crypto/hash.h"
+#include "ringct/rctOps.h"
 #include "rpc/rpc_args.h"
 #include "core_rpc_server_error_codes.h"
 
@@ -47,6 +48,16 @@ using namespace epee;
 
 namespace cryptonote
 {
+  namespace
+  {
+    // how long getblocktemplate may wait for a new template, in seconds
+    const uint64_t DEFAULT_LONG_POLL_TIMEOUT = 30;
+    const uint64_t MAX_LONG_POLL_TIMEOUT = 120;
+    // the daemon serves RPC with two threads, so at most one of them may be
+    // parked in a long poll; other pollers get the current template at once
+    // and have to poll again
+    const unsigned MAX_CONCURRENT_LONG_POLLS = 1;
+  }
 
   //-----------------------------------------------------------------------------------
   void core_rpc_server::init_options(boost::program_options::options_description& desc)
@@ -63,6 +74,7 @@ namespace cryptonote
     )
     : m_core(cr)
     , m_p2p(p2p)
+    , m_long_polls(0)
   {}
   //------------------------------------------------------------------------------------------------------------------------------
   bool core_rpc_server::init(
@@ -144,6 +156,14 @@ namespace cryptonote
     res.hash_rate = res.difficulty/res.target;
     res.testnet = m_testnet;
     res.cumulative_difficulty = m_core.get_blockchain_storage().get_db().get_block_cumulative_difficulty(res.height - 1);
+    res.verification_threads = m_core.get_blockchain_storage().get_verification_threads_count();
+    res.verification_queue_depth = m_core.get_blockchain_storage().get_verification_queue_depth();
+    size_t precomp_entries, precomp_max_entries;
+    rct::getRingMemberPrecompCacheStats(res.ring_precomp_cache_hits, res.ring_precomp_cache_misses, precomp_entries, precomp_max_entries);
+    res.ring_precomp_cache_entries = precomp_entries;
+    res.ring_precomp_cache_max_entries = precomp_max_entries;
+    m_p2p.get_payload_object().get_sync_download_stats(res.sync_download_blocks, res.sync_download_time);
+    m_core.get_blockchain_storage().get_sync_stats(res.sync_pow_blocks, res.sync_pow_time, res.sync_verify_blocks, res.sync_verify_time);
     res.status = CORE_RPC_STATUS_OK;
     return true;
   }
@@ -151,38 +171,45 @@ namespace cryptonote
   bool core_rpc_server::on_get_blocks(const COMMAND_RPC_GET_BLOCKS_FAST::request& req, COMMAND_RPC_GET_BLOCKS_FAST::response& res)
   {
     CHECK_CORE_BUSY();
-    std::list<std::pair<block, std::list<transaction> > > bs;
+    std::list<block_complete_entry> bs;
+    std::list<std::vector<crypto::hash> > tx_hashes;
 
-    if(!m_core.find_blockchain_supplement(req.start_height, req.block_ids, bs, res.current_height, res.start_height, COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT))
+    if(!m_core.find_blockchain_supplement(req.start_height, req.block_ids, bs, tx_hashes, res.current_height, res.start_height, COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT))
     {
       res.status = "Failed";
       return false;
     }
 
-    BOOST_FOREACH(auto& b, bs)
+    // the blobs are passed through as stored, and the hashes needed to look
+    // up the output indices come from the parse done by the supplement
+    auto hashes = tx_hashes.begin();
+    BOOST_FOREACH(auto& bd, bs)
     {
-      res.blocks.resize(res.blocks.size()+1);
-      res.blocks.back().block = block_to_blob(b.first);
+      const std::vector<crypto::hash>& block_tx_hashes = *hashes++;
+      if (block_tx_hashes.size() != bd.txs.size() + 1)
+      {
+        res.status = "Failed";
+        return false;
+      }
       res.output_indices.push_back(COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices());
       res.output_indices.back().indices.push_back(COMMAND_RPC_GET_BLOCKS_FAST::tx_output_indices());
-      bool r = m_core.get_tx_outputs_gindexs(get_transaction_hash(b.first.miner_tx), res.output_indices.back().indices.back().indices);
+      bool r = m_core.get_tx_outputs_gindexs(block_tx_hashes[0], res.output_indices.back().indices.back().indices);
       if (!r)
       {
         res.status = "Failed";
         return false;
       }
-      size_t txidx = 0;
-      BOOST_FOREACH(auto& t, b.second)
+      for (size_t txidx = 1; txidx < block_tx_hashes.size(); ++txidx)
       {
-        res.blocks.back().txs.push_back(tx_to_blob(t));
         res.output_indices.back().indices.push_back(COMMAND_RPC_GET_BLOCKS_FAST::tx_output_indices());
-        bool r = m_core.get_tx_outputs_gindexs(b.first.tx_hashes[txidx++], res.output_indices.back().indices.back().indices);
+        bool r = m_core.get_tx_outputs_gindexs(block_tx_hashes[txidx], res.output_indices.back().indices.back().indices);
         if (!r)
         {
           res.status = "Failed";
           return false;
         }
       }
+      res.blocks.push_back(std::move(bd));
     }
 
     res.status = CORE_RPC_STATUS_OK;
@@ -711,6 +738,7 @@ namespace cryptonote
   {
     CHECK_CORE_BUSY();
     m_core.get_pool_transactions_and_spent_keys_info(res.transactions, res.spent_key_images);
+    res.lock_stats = m_core.print_pool_lock_stats();
     res.status = CORE_RPC_STATUS_OK;
     return true;
   }
@@ -836,12 +864,36 @@ namespace cryptonote
     block b = AUTO_VAL_INIT(b);
     cryptonote::blobdata blob_reserve;
     blob_reserve.resize(req.reserve_size, 0);
-    if(!m_core.get_block_template(b, info.address, res.difficulty, res.height, blob_reserve))
+
+    // long poll: keep the request open until the template differs from the
+    // one the caller already has
+    const uint64_t timeout_ms = std::min<uint64_t>(req.long_poll_timeout ? req.long_poll_timeout : DEFAULT_LONG_POLL_TIMEOUT, MAX_LONG_POLL_TIMEOUT) * 1000;
+    const uint64_t deadline = epee::misc_utils::get_tick_count() + timeout_ms;
+    while (true)
     {
-      error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
-      error_resp.message = "Internal error: failed to create block template";
-      LOG_ERROR("Failed to create block template");
-      return false;
+      b = AUTO_VAL_INIT(b);
+      if(!m_core.get_block_template(b, info.address, res.difficulty, res.height, blob_reserve, res.template_version))
+      {
+        error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
+        error_resp.message = "Internal error: failed to create block template";
+        LOG_ERROR("Failed to create block template");
+        return false;
+      }
+      if (!req.template_version || res.template_version != req.template_version)
+        break;
+      const uint64_t now = epee::misc_utils::get_tick_count();
+      if (now >= deadline)
+        break;
+      if (m_long_polls.fetch_add(1) >= MAX_CONCURRENT_LONG_POLLS)
+      {
+        --m_long_polls;
+        LOG_PRINT_L2("Too many getblocktemplate long polls, returning the unchanged template");
+        break;
+      }
+      const bool changed = m_core.wait_for_block_template_change(res.template_version, deadline - now);
+      --m_long_polls;
+      if (!changed)
+        break;
     }
     blobdata block_blob = t_serializable_object_to_blob(b);
     crypto::public_key tx_pub_key = cryptonote::get_tx_pub_key_from_extra(b.miner_tx);
@@ -957,6 +1009,24 @@ namespace cryptonote
     response.block_size = m_core.get_blockchain_storage().get_db().get_block_size(height);
     return true;
   }
+
+  bool core_rpc_server::fill_block_header_response(const block_header_info& bhi, bool orphan_status, uint64_t chain_height, block_header_response& response)
+  {
+    response.major_version = bhi.major_version;
+    response.minor_version = bhi.minor_version;
+    response.timestamp = bhi.timestamp;
+    response.prev_hash = string_tools::pod_to_hex(bhi.prev_id);
+    response.nonce = bhi.nonce;
+    response.orphan_status = orphan_status;
+    response.height = bhi.height;
+    response.depth = chain_height - bhi.height - 1;
+    response.hash = string_tools::pod_to_hex(bhi.hash);
+    response.difficulty = bhi.difficulty;
+    response.reward = bhi.reward;
+    response.fee = bhi.fee;
+    response.block_size = bhi.size;
+    return true;
+  }
   //------------------------------------------------------------------------------------------------------------------------------
   bool core_rpc_server::on_get_last_block_header(const COMMAND_RPC_GET_LAST_BLOCK_HEADER::request& req, COMMAND_RPC_GET_LAST_BLOCK_HEADER::response& res, epee::json_rpc::error& error_resp)
   {
@@ -966,24 +1036,16 @@ namespace cryptonote
       error_resp.message = "Core is busy.";
       return false;
     }
-    uint64_t last_block_height;
-    crypto::hash last_block_hash;
-    bool have_last_block_hash = m_core.get_blockchain_top(last_block_height, last_block_hash);
-    if (!have_last_block_hash)
-    {
-      error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
-      error_resp.message = "Internal error: can't get last block hash.";
-      return false;
-    }
-    block last_block;
-    bool have_last_block = m_core.get_block_by_hash(last_block_hash, last_block);
+    const uint64_t bc_height = m_core.get_current_blockchain_height();
+    std::vector<block_header_info> infos;
+    bool have_last_block = bc_height && m_core.get_blockchain_storage().get_block_header_info_range(bc_height - 1, bc_height - 1, infos);
     if (!have_last_block)
     {
       error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
       error_resp.message = "Internal error: can't get last block.";
       return false;
     }
-    bool response_filled = fill_block_header_response(last_block, false, last_block_height, last_block_hash, res.block_header);
+    bool response_filled = fill_block_header_response(infos.front(), false, bc_height, res.block_header);
     if (!response_filled)
     {
       error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
@@ -1049,32 +1111,18 @@ namespace cryptonote
       error_resp.message = "Invalid start/end heights.";
       return false;
     }
-    for (uint64_t h = req.start_height; h <= req.end_height; ++h)
+    std::vector<block_header_info> infos;
+    bool have_blocks = m_core.get_blockchain_storage().get_block_header_info_range(req.start_height, req.end_height, infos);
+    if (!have_blocks)
+    {
+      error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
+      error_resp.message = "Internal error: can't get blocks by height. Heights = " + boost::lexical_cast<std::string>(req.start_height) + " to " + boost::lexical_cast<std::string>(req.end_height) + '.';
+      return false;
+    }
+    for (const block_header_info& bhi : infos)
     {
-      crypto::hash block_hash = m_core.get_block_id_by_height(h);
-      block blk;
-      bool have_block = m_core.get_block_by_hash(block_hash, blk);
-      if (!have_block)
-      {
-        error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
-        error_resp.message = "Internal error: can't get block by height. Height = " + boost::lexical_cast<std::string>(h) + ". Hash = " + epee::string_tools::pod_to_hex(block_hash) + '.';
-        return false;
-      }
-      if (blk.miner_tx.vin.front().type() != typeid(txin_gen))
-      {
-        error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
-        error_resp.message = "Internal error: coinbase transaction in the block has the wrong type";
-        return false;
-      }
-      uint64_t block_height = boost::get<txin_gen>(blk.miner_tx.vin.front()).height;
-      if (block_height != h)
-      {
-        error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
-        error_resp.message = "Internal error: coinbase transaction in the block has the wrong height";
-        return false;
-      }
       res.headers.push_back(block_header_response());
-      bool responce_filled = fill_block_header_response(blk, false, block_height, block_hash, res.headers.back());
+      bool responce_filled = fill_block_header_response(bhi, false, bc_height, res.headers.back());
       if (!responce_filled)
       {
         error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
@@ -1104,16 +1152,15 @@ namespace cryptonote
       error_resp.message = std::string("Too big height: ") + std::to_string(req.height) + ", current blockchain height = " +  std::to_string(m_core.get_current_blockchain_height());
       return false;
     }
-    crypto::hash block_hash = m_core.get_block_id_by_height(req.height);
-    block blk;
-    bool have_block = m_core.get_block_by_hash(block_hash, blk);
+    std::vector<block_header_info> infos;
+    bool have_block = m_core.get_blockchain_storage().get_block_header_info_range(req.height, req.height, infos);
     if (!have_block)
     {
       error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
       error_resp.message = "Internal error: can't get block by height. Height = " + std::to_string(req.height) + '.';
       return false;
     }
-    bool response_filled = fill_block_header_response(blk, false, req.height, block_hash, res.block_header);
+    bool response_filled = fill_block_header_response(infos.front(), false, m_core.get_current_blockchain_height(), res.block_header);
     if (!response_filled)
     {
       error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
@@ -1236,6 +1283,14 @@ namespace cryptonote
     res.testnet = m_testnet;
     res.cumulative_difficulty = m_core.get_blockchain_storage().get_db().get_block_cumulative_difficulty(res.height - 1);
     res.hash_rate = res.difficulty/res.target;
+    res.verification_threads = m_core.get_blockchain_storage().get_verification_threads_count();
+    res.verification_queue_depth = m_core.get_blockchain_storage().get_verification_queue_depth();
+    size_t precomp_entries, precomp_max_entries;
+    rct::getRingMemberPrecompCacheStats(res.ring_precomp_cache_hits, res.ring_precomp_cache_misses, precomp_entries, precomp_max_entries);
+    res.ring_precomp_cache_entries = precomp_entries;
+    res.ring_precomp_cache_max_entries = precomp_max_entries;
+    m_p2p.get_payload_object().get_sync_download_stats(res.sync_download_blocks, res.sync_download_time);
+    m_core.get_blockchain_storage().get_sync_stats(res.sync_pow_blocks, res.sync_pow_time, res.sync_verify_blocks, res.sync_verify_time);
     res.status = CORE_RPC_STATUS_OK;
     return true;
   }
@@ -1317,17 +1372,14 @@ namespace cryptonote
     std::list<crypto::hash> txids;
     if (req.txids.empty())
     {
-      std::list<transaction> pool_txs;
-      bool r = m_core.get_pool_transactions(pool_txs);
+      std::vector<crypto::hash> pool_txids;
+      bool r = m_core.get_pool_transaction_hashes(pool_txids);
       if (!r)
       {
         res.status = "Failed to get txpool contents";
         return true;
       }
-      for (const auto &tx: pool_txs)
-      {
-        txids.push_back(cryptonote::get_transaction_hash(tx));
-      }
+      txids.insert(txids.end(), pool_txids.begin(), pool_txids.end());
     }
     else
     {
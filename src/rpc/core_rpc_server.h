@@ -31,6 +31,7 @@
 
 #pragma  once
 
+#include <atomic>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/variables_map.hpp>
 
@@ -184,10 +185,12 @@ private:
     uint64_t get_block_reward(const block& blk);
     uint64_t get_block_fee(const block& blk);
     bool fill_block_header_response(const block& blk, bool orphan_status, uint64_t height, const crypto::hash& hash, block_header_response& response);
+    bool fill_block_header_response(const block_header_info& bhi, bool orphan_status, uint64_t chain_height, block_header_response& response);
 
     core& m_core;
     nodetool::node_server<cryptonote::t_cryptonote_protocol_handler<cryptonote::core> >& m_p2p;
     bool m_testnet;
     bool m_restricted;
+    std::atomic<unsigned> m_long_polls;  //!< getblocktemplate requests waiting for a new template
   };
 }
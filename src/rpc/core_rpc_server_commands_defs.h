@@ -50,7 +50,7 @@ namespace cryptonote
 // advance which version they will stop working with
 // Don't go over 32767 for any of these
 #define CORE_RPC_VERSION_MAJOR 2
-#define CORE_RPC_VERSION_MINOR 0
+#define CORE_RPC_VERSION_MINOR 5
 #define CORE_RPC_VERSION (((CORE_RPC_VERSION_MAJOR)<<16)|(CORE_RPC_VERSION_MINOR))
 
   struct COMMAND_RPC_GET_HEIGHT
@@ -537,6 +537,18 @@ namespace cryptonote
       std::string top_block_hash;
       uint64_t cumulative_difficulty;
       uint64_t hash_rate;
+      uint64_t verification_threads;
+      uint64_t verification_queue_depth;
+      uint64_t ring_precomp_cache_hits;
+      uint64_t ring_precomp_cache_misses;
+      uint64_t ring_precomp_cache_entries;
+      uint64_t ring_precomp_cache_max_entries;
+      uint64_t sync_download_blocks;
+      uint64_t sync_download_time;
+      uint64_t sync_pow_blocks;
+      uint64_t sync_pow_time;
+      uint64_t sync_verify_blocks;
+      uint64_t sync_verify_time;
 
       BEGIN_KV_SERIALIZE_MAP()
         KV_SERIALIZE(status)
@@ -555,6 +567,18 @@ namespace cryptonote
         KV_SERIALIZE(top_block_hash)
         KV_SERIALIZE(cumulative_difficulty)
         KV_SERIALIZE(hash_rate)
+        KV_SERIALIZE(verification_threads)
+        KV_SERIALIZE(verification_queue_depth)
+        KV_SERIALIZE(ring_precomp_cache_hits)
+        KV_SERIALIZE(ring_precomp_cache_misses)
+        KV_SERIALIZE(ring_precomp_cache_entries)
+        KV_SERIALIZE(ring_precomp_cache_max_entries)
+        KV_SERIALIZE(sync_download_blocks)
+        KV_SERIALIZE(sync_download_time)
+        KV_SERIALIZE(sync_pow_blocks)
+        KV_SERIALIZE(sync_pow_time)
+        KV_SERIALIZE(sync_verify_blocks)
+        KV_SERIALIZE(sync_verify_time)
       END_KV_SERIALIZE_MAP()
     };
   };
@@ -704,10 +728,14 @@ namespace cryptonote
     {
       uint64_t reserve_size;       //max 255 bytes
       std::string wallet_address;
+      uint64_t template_version;   //if nonzero, wait until the template differs from this version
+      uint64_t long_poll_timeout;  //seconds to wait at most, 0 for the default
 
       BEGIN_KV_SERIALIZE_MAP()
         KV_SERIALIZE(reserve_size)
         KV_SERIALIZE(wallet_address)
+        KV_SERIALIZE(template_version)
+        KV_SERIALIZE(long_poll_timeout)
       END_KV_SERIALIZE_MAP()
     };
 
@@ -719,6 +747,7 @@ namespace cryptonote
       std::string prev_hash;
       blobdata blocktemplate_blob;
       blobdata blockhashing_blob;
+      uint64_t template_version;
       std::string status;
 
       BEGIN_KV_SERIALIZE_MAP()
@@ -728,6 +757,7 @@ namespace cryptonote
         KV_SERIALIZE(prev_hash)
         KV_SERIALIZE(blocktemplate_blob)
         KV_SERIALIZE(blockhashing_blob)
+        KV_SERIALIZE(template_version)
         KV_SERIALIZE(status)
       END_KV_SERIALIZE_MAP()
     };
@@ -1018,11 +1048,13 @@ namespace cryptonote
       std::string status;
       std::vector<tx_info> transactions;
       std::vector<spent_key_image_info> spent_key_images;
+      std::string lock_stats;  //how long the pool's locks have been held
 
       BEGIN_KV_SERIALIZE_MAP()
         KV_SERIALIZE(status)
         KV_SERIALIZE(transactions)
         KV_SERIALIZE(spent_key_images)
+        KV_SERIALIZE(lock_stats)
       END_KV_SERIALIZE_MAP()
     };
   };
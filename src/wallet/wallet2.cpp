@@ -1181,11 +1181,28 @@ void wallet2::process_new_blockchain_entry(const cryptonote::block& b, const cry
 
     TIME_MEASURE_START(txs_handle_time);
     size_t idx = 0;
+    THROW_WALLET_EXCEPTION_IF(bche.pruned && bche.prunable_hashes.size() != bche.txs.size(), error::wallet_internal_error,
+        "pruned block transactions=" + std::to_string(bche.txs.size()) +
+        " not match with prunable hashes=" + std::to_string(bche.prunable_hashes.size()));
     BOOST_FOREACH(auto& txblob, bche.txs)
     {
       cryptonote::transaction tx;
-      bool r = parse_and_validate_tx_from_blob(txblob, tx);
-      THROW_WALLET_EXCEPTION_IF(!r, error::tx_parse_error, txblob);
+      if (bche.pruned)
+      {
+        // a pruned daemon sends what is left without the signatures, which
+        // is all that is needed to find our outputs and spends
+        bool r = parse_and_validate_tx_base_from_blob(txblob, tx);
+        THROW_WALLET_EXCEPTION_IF(!r, error::tx_parse_error, txblob);
+        crypto::hash tx_hash;
+        r = get_pruned_transaction_hash(tx, bche.prunable_hashes[idx], tx_hash);
+        THROW_WALLET_EXCEPTION_IF(!r || tx_hash != b.tx_hashes[idx], error::wallet_internal_error,
+            "pruned transaction does not match its block");
+      }
+      else
+      {
+        bool r = parse_and_validate_tx_from_blob(txblob, tx);
+        THROW_WALLET_EXCEPTION_IF(!r, error::tx_parse_error, txblob);
+      }
       process_new_transaction(b.tx_hashes[idx], tx, o_indices.indices[txidx++].indices, height, b.timestamp, false, false);
       ++idx;
     }
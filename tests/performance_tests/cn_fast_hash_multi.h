@@ -0,0 +1,68 @@
+// Copyright (c) 2014-2018, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+
+#pragma once
+
+#include <array>
+
+#include "crypto/crypto.h"
+
+// hashes 4 inputs per call, compare time per call / 4 against test_cn_fast_hash
+template <size_t bytes>
+class test_cn_fast_hash_multi
+{
+  public:
+	static const size_t loop_count = bytes < 256 ? 100000 : bytes < 4096 ? 10000 : 1000;
+
+	bool init()
+	{
+		for(size_t i = 0; i < 4; ++i)
+		{
+			crypto::rand(bytes, m_data[i].data());
+			m_in[i] = m_data[i].data();
+			m_len[i] = bytes;
+			m_out[i] = m_hash[i].data;
+		}
+		return true;
+	}
+
+	bool test()
+	{
+		crypto::cn_fast_hash_multi(m_in, m_len, m_out, 4);
+		return true;
+	}
+
+  private:
+	std::array<uint8_t, bytes> m_data[4];
+	crypto::hash m_hash[4];
+	const void *m_in[4];
+	size_t m_len[4];
+	char *m_out[4];
+};
@@ -0,0 +1,80 @@
+// Copyright (c) 2014-2018, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+#pragma once
+
+#include "crypto/crypto.h"
+#include "crypto/cn_slow_hash.hpp"
+
+// Each call hashes `lanes` inputs together, so compare time per call / lanes
+// against test_cn_slow_hash_lanes<hash_t, 1>
+template <typename hash_t, size_t lanes>
+class test_cn_slow_hash_lanes
+{
+  public:
+	static const size_t loop_count = 10;
+
+	bool init()
+	{
+		for(size_t i = 0; i < lanes; ++i)
+		{
+			m_data[i] = crypto::rand<crypto::hash>();
+			m_ctx_ptr[i] = &m_ctx[i];
+			m_in[i] = &m_data[i];
+			m_len[i] = sizeof(m_data[i]);
+			m_out[i] = &m_hash[i];
+		}
+
+		// lanes must give the same hashes as hashing the inputs one by one
+		hash_t::hash_lanes(m_ctx_ptr, m_in, m_len, m_out, lanes);
+		for(size_t i = 0; i < lanes; ++i)
+		{
+			crypto::hash single;
+			m_ctx[0].hash(&m_data[i], sizeof(m_data[i]), &single);
+			if(single != m_hash[i])
+				return false;
+		}
+		return true;
+	}
+
+	bool test()
+	{
+		hash_t::hash_lanes(m_ctx_ptr, m_in, m_len, m_out, lanes);
+		return true;
+	}
+
+  private:
+	hash_t m_ctx[lanes];
+	hash_t *m_ctx_ptr[lanes];
+	crypto::hash m_data[lanes];
+	crypto::hash m_hash[lanes];
+	const void *m_in[lanes];
+	size_t m_len[lanes];
+	void *m_out[lanes];
+};
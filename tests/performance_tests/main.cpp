@@ -38,7 +38,9 @@
 // tests
 #include "check_tx_signature.h"
 #include "cn_fast_hash.h"
+#include "cn_fast_hash_multi.h"
 #include "cn_slow_hash.h"
+#include "cn_slow_hash_lanes.h"
 #include "construct_tx.h"
 #include "derive_public_key.h"
 #include "derive_secret_key.h"
@@ -50,6 +52,7 @@
 #include "is_out_to_acc.h"
 #include "rct_mlsag.h"
 #include "sc_reduce32.h"
+#include "select_block_txes.h"
 #include "subaddress_expand.h"
 
 namespace po = boost::program_options;
@@ -157,8 +160,21 @@ int main(int argc, char **argv)
 	TEST_PERFORMANCE2(filter, test_wallet2_expand_subaddresses, 50, 200);
 
 	TEST_PERFORMANCE0(filter, test_cn_slow_hash);
+	TEST_PERFORMANCE2(filter, test_cn_slow_hash_lanes, cn_pow_hash_v1, 1);
+	TEST_PERFORMANCE2(filter, test_cn_slow_hash_lanes, cn_pow_hash_v1, 2);
+	TEST_PERFORMANCE2(filter, test_cn_slow_hash_lanes, cn_pow_hash_v1, 4);
+	TEST_PERFORMANCE2(filter, test_cn_slow_hash_lanes, cn_pow_hash_v2, 1);
+	TEST_PERFORMANCE2(filter, test_cn_slow_hash_lanes, cn_pow_hash_v2, 2);
+	TEST_PERFORMANCE2(filter, test_cn_slow_hash_lanes, cn_pow_hash_v2, 4);
 	TEST_PERFORMANCE1(filter, test_cn_fast_hash, 32);
 	TEST_PERFORMANCE1(filter, test_cn_fast_hash, 16384);
+	TEST_PERFORMANCE1(filter, test_cn_fast_hash_multi, 32);
+	TEST_PERFORMANCE1(filter, test_cn_fast_hash_multi, 16384);
+
+	TEST_PERFORMANCE2(filter, test_select_block_txes, 1000, 0);
+	TEST_PERFORMANCE2(filter, test_select_block_txes, 1000, 16);
+	TEST_PERFORMANCE2(filter, test_select_block_txes, 5000, 0);
+	TEST_PERFORMANCE2(filter, test_select_block_txes, 5000, 16);
 
 	TEST_PERFORMANCE3(filter, test_ringct_mlsag, 1, 3, false);
 	TEST_PERFORMANCE3(filter, test_ringct_mlsag, 1, 5, false);
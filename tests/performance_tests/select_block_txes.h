@@ -0,0 +1,104 @@
+// Copyright (c) 2014-2018, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "cryptonote_core/cryptonote_format_utils.h"
+#include "cryptonote_core/tx_pool.h"
+
+// A pool snapshot generated from a fixed seed, so runs compare like for
+// like, sorted by fee per byte as the pool hands candidates over. The unit
+// tests check the selectors against it too.
+inline std::vector<cryptonote::tx_memory_pool::block_candidate> make_pool_snapshot(size_t pool_size)
+{
+	std::vector<cryptonote::tx_memory_pool::block_candidate> candidates;
+	std::mt19937 rng(0x5eed);
+	std::uniform_int_distribution<size_t> inputs(1, 8);
+	std::lognormal_distribution<double> fee_per_byte(std::log(2000000.0), 1.0);
+	for(size_t i = 0; i < pool_size; ++i)
+	{
+		cryptonote::tx_memory_pool::block_candidate c;
+		// ~1.5 kB per input, plus now and then a large consolidation tx
+		c.blob_size = 1200 + inputs(rng) * 1500 + (rng() % 50 == 0 ? 60000 : 0);
+		c.fee = static_cast<uint64_t>(fee_per_byte(rng) * c.blob_size);
+		candidates.push_back(c);
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const cryptonote::tx_memory_pool::block_candidate& a, const cryptonote::tx_memory_pool::block_candidate& b) {
+		return a.fee * (double)b.blob_size > b.fee * (double)a.blob_size;
+	});
+	return candidates;
+}
+
+// Replays make_pool_snapshot through tx_memory_pool::select_block_txes.
+// init() prints the coinbase each selector earns from it.
+template <size_t pool_size, size_t lookahead>
+class test_select_block_txes
+{
+  public:
+	static const size_t loop_count = pool_size < 1000 ? 100 : 10;
+
+	bool init()
+	{
+		m_candidates = make_pool_snapshot(pool_size);
+
+		size_t total_size;
+		uint64_t fee;
+		const uint64_t coinbase = select(total_size, fee);
+		std::cout << "  chose " << m_chosen.size() << " of " << pool_size << " txes, size " << total_size
+			<< ", fees " << cryptonote::print_money(fee) << ", coinbase " << cryptonote::print_money(coinbase) << std::endl;
+		return true;
+	}
+
+	bool test()
+	{
+		size_t total_size;
+		uint64_t fee;
+		select(total_size, fee);
+		return true;
+	}
+
+  private:
+	uint64_t select(size_t& total_size, uint64_t& fee)
+	{
+		m_chosen.clear();
+		return cryptonote::tx_memory_pool::select_block_txes(m_candidates, MEDIAN_SIZE, 0, HEIGHT, lookahead,
+			[](size_t) { return true; }, m_chosen, total_size, fee);
+	}
+
+	static const size_t MEDIAN_SIZE = 300000;
+	static const uint64_t HEIGHT = 100000;
+
+	std::vector<cryptonote::tx_memory_pool::block_candidate> m_candidates;
+	std::vector<size_t> m_chosen;
+};
@@ -0,0 +1,527 @@
+// Copyright (c) 2014-2018, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <boost/filesystem.hpp>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+
+#include "gtest/gtest.h"
+
+#include "blockchain_db/blockchain_db.h"
+#include "blockchain_db/lmdb/db_lmdb.h"
+#include "cryptonote_core/account.h"
+#include "cryptonote_core/cryptonote_basic_impl.h"
+#include "cryptonote_core/cryptonote_format_utils.h"
+#include "ringct/rctOps.h"
+#include "string_tools.h"
+#include "lmdb.h"
+#include "unit_tests_utils.h"
+
+using namespace cryptonote;
+using epee::string_tools::pod_to_hex;
+
+#define ASSERT_HASH_EQ(a, b) ASSERT_EQ(pod_to_hex(a), pod_to_hex(b))
+
+namespace
+{ // anonymous namespace
+
+// a tx registering alias for address; the db doesn't check the signature
+// when it stores an alias
+transaction make_alias_tx(const std::string &alias, const std::string &address)
+{
+	transaction tx = unit_test::make_rct_tx();
+	add_extra_nonce_to_tx_extra(tx.extra, std::string(1, TX_EXTRA_NONCE_ALIAS) + alias);
+	add_extra_nonce_to_tx_extra(tx.extra, std::string(1, TX_EXTRA_NONCE_ADDRESS) + address);
+	add_extra_nonce_to_tx_extra(tx.extra, std::string(1, TX_EXTRA_NONCE_SIGNATURE) + "signature");
+	return tx;
+}
+
+std::string make_address()
+{
+	account_base account;
+	account.generate();
+	return get_account_address_as_str(false, false, account.get_keys().m_account_address);
+}
+
+txpool_tx_update pool_put(const crypto::hash &txid, const blobdata &meta, const blobdata &blob)
+{
+	txpool_tx_update u;
+	u.txid = txid;
+	u.remove = false;
+	u.meta = meta;
+	u.blob = blob;
+	return u;
+}
+
+txpool_tx_update pool_remove(const crypto::hash &txid)
+{
+	txpool_tx_update u;
+	u.txid = txid;
+	u.remove = true;
+	return u;
+}
+
+class BlockchainLMDBTest : public testing::Test
+{
+  protected:
+	BlockchainLMDBTest() : m_db(new BlockchainLMDB()), m_hardfork(*m_db, 1, 0)
+	{
+		m_prefix = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+	}
+
+	~BlockchainLMDBTest()
+	{
+		delete m_db;
+		boost::filesystem::remove_all(m_prefix);
+	}
+
+	void open()
+	{
+		m_db->open(m_prefix);
+		m_hardfork.init();
+		m_db->set_hard_fork(&m_hardfork);
+	}
+
+	// adds a block holding txs on top of the chain
+	void add_block(const std::vector<transaction> &txs)
+	{
+		const uint64_t height = m_db->height();
+		block b;
+		b.major_version = 1;
+		b.minor_version = 0;
+		b.timestamp = 1000000 + height * 120;
+		b.prev_id = height ? m_db->top_block_hash() : null_hash;
+		b.nonce = height;
+		uint64_t fee = 0;
+		for (const transaction &tx : txs)
+		{
+			b.tx_hashes.push_back(get_transaction_hash(tx));
+			fee += get_tx_fee(tx);
+		}
+		account_base miner;
+		miner.generate();
+		ASSERT_TRUE(construct_miner_tx(height, 0, 0, 0, fee, miner.get_keys().m_account_address, b.miner_tx));
+		m_db->add_block(b, 1000, height + 1, height * 1000, txs);
+		m_blocks.push_back(b);
+	}
+
+	// puts the closed db back in an older format by running f over it in a
+	// raw LMDB write txn, then marks it with that version
+	void rewrite(uint32_t version, const std::function<void(MDB_txn *)> &f)
+	{
+		MDB_env *env;
+		ASSERT_EQ(0, mdb_env_create(&env));
+		ASSERT_EQ(0, mdb_env_set_maxdbs(env, 32));
+		ASSERT_EQ(0, mdb_env_open(env, m_prefix.c_str(), 0, 0644));
+		MDB_txn *txn;
+		ASSERT_EQ(0, mdb_txn_begin(env, NULL, 0, &txn));
+		f(txn);
+		MDB_dbi properties;
+		ASSERT_EQ(0, mdb_dbi_open(txn, "properties", 0, &properties));
+		MDB_val k = {sizeof("version"), (void *)"version"};
+		MDB_val v = {sizeof(version), &version};
+		ASSERT_EQ(0, mdb_put(txn, properties, &k, &v, 0));
+		ASSERT_EQ(0, mdb_txn_commit(txn));
+		mdb_env_close(env);
+	}
+
+	uint32_t read_version()
+	{
+		uint32_t version = 0;
+		read_raw([&](MDB_txn *txn) {
+			MDB_dbi properties;
+			MDB_val k = {sizeof("version"), (void *)"version"};
+			MDB_val v;
+			if (mdb_dbi_open(txn, "properties", 0, &properties) == 0 && mdb_get(txn, properties, &k, &v) == 0)
+				version = *(const uint32_t *)v.mv_data;
+		});
+		return version;
+	}
+
+	void read_raw(const std::function<void(MDB_txn *)> &f)
+	{
+		MDB_env *env;
+		ASSERT_EQ(0, mdb_env_create(&env));
+		ASSERT_EQ(0, mdb_env_set_maxdbs(env, 32));
+		ASSERT_EQ(0, mdb_env_open(env, m_prefix.c_str(), MDB_RDONLY, 0644));
+		MDB_txn *txn;
+		ASSERT_EQ(0, mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+		f(txn);
+		mdb_txn_abort(txn);
+		mdb_env_close(env);
+	}
+
+	// the persisted pool, txid -> (meta, blob)
+	std::unordered_map<crypto::hash, std::pair<blobdata, blobdata>> pool_txes()
+	{
+		std::unordered_map<crypto::hash, std::pair<blobdata, blobdata>> txes;
+		m_db->for_all_txpool_txes([&](const crypto::hash &txid, const blobdata &meta, const blobdata &blob) {
+			txes[txid] = std::make_pair(meta, blob);
+			return true;
+		});
+		return txes;
+	}
+
+	BlockchainDB *m_db;
+	HardFork m_hardfork;
+	std::string m_prefix;
+	std::vector<block> m_blocks;
+};
+
+TEST_F(BlockchainLMDBTest, PrunedTxReads)
+{
+	ASSERT_NO_THROW(this->open());
+	std::vector<transaction> txs = {unit_test::make_rct_tx(), unit_test::make_rct_tx()};
+	ASSERT_NO_FATAL_FAILURE(this->add_block({}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({txs[0]}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({txs[1]}));
+
+	std::vector<blobdata> blobs, pruned_blobs;
+	std::vector<crypto::hash> prunable_hashes;
+	for (const transaction &tx : txs)
+	{
+		blobs.push_back(tx_to_blob(tx));
+		pruned_blobs.push_back(blobdata());
+		ASSERT_TRUE(tx_to_pruned_blob(tx, pruned_blobs.back()));
+		ASSERT_LT(pruned_blobs.back().size(), blobs.back().size());
+		prunable_hashes.push_back(get_transaction_prunable_hash(tx, blobs.back().substr(pruned_blobs.back().size())));
+	}
+
+	// only the txs below height 2 lose their prunable data: both miner txs,
+	// though theirs is empty, and txs[0]
+	ASSERT_EQ(0, m_db->get_pruned_height());
+	ASSERT_EQ(3, m_db->prune_blockchain(2));
+	ASSERT_EQ(2, m_db->get_pruned_height());
+	ASSERT_EQ(0, m_db->prune_blockchain(1));
+
+	const crypto::hash h0 = get_transaction_hash(txs[0]);
+	blobdata bd;
+	ASSERT_FALSE(m_db->get_tx_blob(h0, bd));
+	ASSERT_FALSE(m_db->get_prunable_tx_blob(h0, bd));
+	ASSERT_TRUE(m_db->get_pruned_tx_blob(h0, bd));
+	ASSERT_EQ(pruned_blobs[0], bd);
+	crypto::hash prunable_hash;
+	ASSERT_TRUE(m_db->get_prunable_tx_hash(h0, prunable_hash));
+	ASSERT_HASH_EQ(prunable_hashes[0], prunable_hash);
+	transaction tx;
+	ASSERT_NO_THROW(tx = m_db->get_pruned_tx(h0));
+	ASSERT_HASH_EQ(get_transaction_prefix_hash(txs[0]), get_transaction_prefix_hash(tx));
+	ASSERT_EQ(rct::RCTTypeSimple, tx.rct_signatures.type);
+	ASSERT_EQ(txs[0].rct_signatures.txnFee, tx.rct_signatures.txnFee);
+	ASSERT_TRUE(m_db->tx_exists(h0));
+
+	const crypto::hash h1 = get_transaction_hash(txs[1]);
+	ASSERT_TRUE(m_db->get_tx_blob(h1, bd));
+	ASSERT_EQ(blobs[1], bd);
+	ASSERT_TRUE(m_db->get_prunable_tx_blob(h1, bd));
+	ASSERT_EQ(blobs[1].substr(pruned_blobs[1].size()), bd);
+
+	// the pruned height survives a restart
+	ASSERT_NO_THROW(m_db->close());
+	ASSERT_NO_THROW(m_db->open(m_prefix));
+	ASSERT_EQ(2, m_db->get_pruned_height());
+	ASSERT_FALSE(m_db->get_prunable_tx_blob(h0, bd));
+}
+
+TEST_F(BlockchainLMDBTest, MigrateTxsToPrunedAndPrunable)
+{
+	ASSERT_NO_THROW(this->open());
+	std::vector<transaction> txs = {unit_test::make_rct_tx(), unit_test::make_rct_tx(), unit_test::make_rct_tx()};
+	ASSERT_NO_FATAL_FAILURE(this->add_block({}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({txs[0], txs[1]}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({txs[2]}));
+	ASSERT_NO_THROW(m_db->close());
+
+	// before version 1, each tx was a whole blob in the txs table
+	ASSERT_NO_FATAL_FAILURE(this->rewrite(0, [](MDB_txn *txn) {
+		MDB_dbi txs_pruned, txs_prunable, txs_prunable_hash, txs_old;
+		ASSERT_EQ(0, mdb_dbi_open(txn, "txs_pruned", 0, &txs_pruned));
+		ASSERT_EQ(0, mdb_dbi_open(txn, "txs_prunable", 0, &txs_prunable));
+		ASSERT_EQ(0, mdb_dbi_open(txn, "txs_prunable_hash", 0, &txs_prunable_hash));
+		ASSERT_EQ(0, mdb_dbi_open(txn, "txs", MDB_INTEGERKEY | MDB_CREATE, &txs_old));
+		MDB_cursor *c;
+		ASSERT_EQ(0, mdb_cursor_open(txn, txs_pruned, &c));
+		MDB_val k, v, p;
+		for (int r = mdb_cursor_get(c, &k, &v, MDB_FIRST); r == 0; r = mdb_cursor_get(c, &k, &v, MDB_NEXT))
+		{
+			ASSERT_EQ(0, mdb_get(txn, txs_prunable, &k, &p));
+			blobdata bd((const char *)v.mv_data, v.mv_size);
+			bd.append((const char *)p.mv_data, p.mv_size);
+			MDB_val vb = {bd.size(), (void *)bd.data()};
+			ASSERT_EQ(0, mdb_put(txn, txs_old, &k, &vb, MDB_APPEND));
+		}
+		mdb_cursor_close(c);
+		ASSERT_EQ(0, mdb_drop(txn, txs_pruned, 0));
+		ASSERT_EQ(0, mdb_drop(txn, txs_prunable, 0));
+		ASSERT_EQ(0, mdb_drop(txn, txs_prunable_hash, 0));
+	}));
+
+	ASSERT_NO_THROW(m_db->open(m_prefix));
+	ASSERT_EQ(3, m_db->height());
+	ASSERT_EQ(6, m_db->get_tx_count());
+	for (const transaction &tx : txs)
+	{
+		const crypto::hash h = get_transaction_hash(tx);
+		const blobdata blob = tx_to_blob(tx);
+		blobdata bd, pruned;
+		ASSERT_TRUE(tx_to_pruned_blob(tx, pruned));
+		ASSERT_TRUE(m_db->get_tx_blob(h, bd));
+		ASSERT_EQ(blob, bd);
+		ASSERT_TRUE(m_db->get_pruned_tx_blob(h, bd));
+		ASSERT_EQ(pruned, bd);
+		crypto::hash prunable_hash;
+		ASSERT_TRUE(m_db->get_prunable_tx_hash(h, prunable_hash));
+		ASSERT_HASH_EQ(get_transaction_prunable_hash(tx, blob.substr(pruned.size())), prunable_hash);
+	}
+	for (const block &b : m_blocks)
+		ASSERT_TRUE(m_db->tx_exists(get_transaction_hash(b.miner_tx)));
+	ASSERT_NO_THROW(m_db->close());
+	ASSERT_EQ(4, this->read_version());
+}
+
+TEST_F(BlockchainLMDBTest, BlockHeaderInfo)
+{
+	ASSERT_NO_THROW(this->open());
+	ASSERT_NO_FATAL_FAILURE(this->add_block({}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({unit_test::make_rct_tx(), unit_test::make_rct_tx()}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({}));
+
+	for (uint64_t h = 0; h < m_blocks.size(); ++h)
+	{
+		const block &b = m_blocks[h];
+		block_header_info bhi;
+		ASSERT_NO_THROW(bhi = m_db->get_block_header_info(h));
+		ASSERT_EQ(h, bhi.height);
+		ASSERT_HASH_EQ(get_block_hash(b), bhi.hash);
+		ASSERT_HASH_EQ(b.prev_id, bhi.prev_id);
+		ASSERT_EQ(b.timestamp, bhi.timestamp);
+		ASSERT_EQ(b.nonce, bhi.nonce);
+		ASSERT_EQ(b.major_version, bhi.major_version);
+		ASSERT_EQ(b.minor_version, bhi.minor_version);
+		ASSERT_EQ(b.tx_hashes.size(), bhi.tx_count);
+		ASSERT_EQ(get_outs_money_amount(b.miner_tx), bhi.reward);
+		ASSERT_EQ(m_db->get_block_already_generated_coins(h), bhi.coins);
+		ASSERT_EQ(1000, bhi.size);
+		ASSERT_EQ(1, bhi.difficulty);
+		ASSERT_EQ(h + 1, bhi.cumulative_difficulty);
+	}
+	ASSERT_EQ(0, m_db->get_block_header_info(0).fee);
+	ASSERT_EQ(2000, m_db->get_block_header_info(1).fee);
+
+	std::vector<block_header_info> range;
+	ASSERT_NO_THROW(range = m_db->get_block_header_info_range(1, 2));
+	ASSERT_EQ(2, range.size());
+	for (size_t i = 0; i < range.size(); ++i)
+	{
+		const block_header_info bhi = m_db->get_block_header_info(1 + i);
+		ASSERT_EQ(0, memcmp(&range[i], &bhi, sizeof(bhi)));
+	}
+	ASSERT_THROW(m_db->get_block_header_info_range(1, 3), BLOCK_DNE);
+
+	// popping a block drops its record
+	block b;
+	std::vector<transaction> txs;
+	ASSERT_NO_THROW(m_db->pop_block(b, txs));
+	ASSERT_THROW(m_db->get_block_header_info(2), BLOCK_DNE);
+	ASSERT_NO_THROW(m_db->get_block_header_info(1));
+}
+
+TEST_F(BlockchainLMDBTest, MigrateBlockHeaderInfo)
+{
+	ASSERT_NO_THROW(this->open());
+	ASSERT_NO_FATAL_FAILURE(this->add_block({}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({unit_test::make_rct_tx(), unit_test::make_rct_tx()}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({unit_test::make_rct_tx()}));
+	std::vector<block_header_info> infos;
+	ASSERT_NO_THROW(infos = m_db->get_block_header_info_range(0, 2));
+	ASSERT_NO_THROW(m_db->close());
+
+	// before version 2, there were no header records
+	ASSERT_NO_FATAL_FAILURE(this->rewrite(1, [](MDB_txn *txn) {
+		MDB_dbi block_header_info;
+		ASSERT_EQ(0, mdb_dbi_open(txn, "block_header_info", 0, &block_header_info));
+		ASSERT_EQ(0, mdb_drop(txn, block_header_info, 0));
+	}));
+
+	ASSERT_NO_THROW(m_db->open(m_prefix));
+	for (uint64_t h = 0; h < infos.size(); ++h)
+	{
+		block_header_info bhi;
+		ASSERT_NO_THROW(bhi = m_db->get_block_header_info(h));
+		ASSERT_EQ(0, memcmp(&infos[h], &bhi, sizeof(bhi))) << "at height " << h;
+	}
+	ASSERT_NO_THROW(m_db->close());
+	ASSERT_EQ(4, this->read_version());
+}
+
+TEST_F(BlockchainLMDBTest, AliasLookups)
+{
+	ASSERT_NO_THROW(this->open());
+	const std::string a = make_address(), b = make_address();
+	ASSERT_NO_FATAL_FAILURE(this->add_block({}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({make_alias_tx("alice", a)}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({make_alias_tx("Alice2", a), make_alias_tx("bob", b)}));
+
+	ASSERT_EQ(a, m_db->get_alias_address("alice"));
+	ASSERT_EQ(a, m_db->get_alias_address("alice2"));
+	ASSERT_EQ(b, m_db->get_alias_address("bob"));
+	ASSERT_EQ("", m_db->get_alias_address("carol"));
+
+	std::vector<alias> aliases = m_db->get_address_aliases(a);
+	ASSERT_EQ(2, aliases.size());
+	ASSERT_EQ("alice", aliases[0].alias);
+	ASSERT_EQ(1, aliases[0].height);
+	ASSERT_EQ("alice2", aliases[1].alias);
+	ASSERT_EQ(2, aliases[1].height);
+	aliases = m_db->get_address_aliases(b);
+	ASSERT_EQ(1, aliases.size());
+	ASSERT_EQ("bob", aliases[0].alias);
+	ASSERT_TRUE(m_db->get_address_aliases(make_address()).empty());
+
+	// an alias only counts once it is as deep as a spendable tx
+	ASSERT_EQ("", m_db->get_alias_address("alice", false));
+	while (m_db->height() < 1 + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE)
+		ASSERT_NO_FATAL_FAILURE(this->add_block({}));
+	ASSERT_EQ(a, m_db->get_alias_address("alice", false));
+	ASSERT_EQ("", m_db->get_alias_address("alice2", false));
+}
+
+TEST_F(BlockchainLMDBTest, MigrateAliases)
+{
+	ASSERT_NO_THROW(this->open());
+	const std::string a = make_address(), b = make_address();
+	ASSERT_EQ(98, a.size());
+	ASSERT_NO_FATAL_FAILURE(this->add_block({}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({make_alias_tx("alice", a)}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({make_alias_tx("alice2", a), make_alias_tx("bob", b)}));
+	ASSERT_NO_THROW(m_db->close());
+
+	// before version 3, an alias record was its height in decimal, then the
+	// address and a NUL, and there was no index by address
+	ASSERT_NO_FATAL_FAILURE(this->rewrite(2, [](MDB_txn *txn) {
+		MDB_dbi aliases, alias_addresses;
+		ASSERT_EQ(0, mdb_dbi_open(txn, "aliases", 0, &aliases));
+		ASSERT_EQ(0, mdb_dbi_open(txn, "alias_addresses", 0, &alias_addresses));
+		std::vector<std::pair<std::string, std::string>> records;
+		MDB_cursor *c;
+		ASSERT_EQ(0, mdb_cursor_open(txn, aliases, &c));
+		MDB_val k, v;
+		for (int r = mdb_cursor_get(c, &k, &v, MDB_FIRST); r == 0; r = mdb_cursor_get(c, &k, &v, MDB_NEXT))
+		{
+			uint64_t height;
+			memcpy(&height, v.mv_data, sizeof(height));
+			const std::string address((const char *)v.mv_data + sizeof(height), v.mv_size - sizeof(height));
+			records.push_back({std::string((const char *)k.mv_data, k.mv_size), std::to_string(height) + address + '\0'});
+		}
+		mdb_cursor_close(c);
+		ASSERT_EQ(3, records.size());
+		for (const auto &r : records)
+		{
+			MDB_val kr = {r.first.size(), (void *)r.first.data()};
+			MDB_val vr = {r.second.size(), (void *)r.second.data()};
+			ASSERT_EQ(0, mdb_put(txn, aliases, &kr, &vr, 0));
+		}
+		ASSERT_EQ(0, mdb_drop(txn, alias_addresses, 0));
+	}));
+
+	ASSERT_NO_THROW(m_db->open(m_prefix));
+	ASSERT_EQ(a, m_db->get_alias_address("alice"));
+	ASSERT_EQ(a, m_db->get_alias_address("alice2"));
+	ASSERT_EQ(b, m_db->get_alias_address("bob"));
+	std::vector<alias> aliases = m_db->get_address_aliases(a);
+	ASSERT_EQ(2, aliases.size());
+	ASSERT_EQ("alice", aliases[0].alias);
+	ASSERT_EQ(1, aliases[0].height);
+	ASSERT_EQ("alice2", aliases[1].alias);
+	ASSERT_EQ(2, aliases[1].height);
+	aliases = m_db->get_address_aliases(b);
+	ASSERT_EQ(1, aliases.size());
+	ASSERT_EQ("bob", aliases[0].alias);
+	ASSERT_EQ(2, aliases[0].height);
+	ASSERT_NO_THROW(m_db->close());
+	ASSERT_EQ(4, this->read_version());
+}
+
+TEST_F(BlockchainLMDBTest, TxpoolTxes)
+{
+	ASSERT_NO_THROW(this->open());
+	ASSERT_NO_FATAL_FAILURE(this->add_block({}));
+	const crypto::hash t1 = crypto::rand<crypto::hash>(), t2 = crypto::rand<crypto::hash>(), t3 = crypto::rand<crypto::hash>();
+	ASSERT_TRUE(this->pool_txes().empty());
+
+	ASSERT_TRUE(m_db->update_txpool_txes({pool_put(t1, "meta1", "blob1"), pool_put(t2, "meta2", "blob2"), pool_put(t3, "meta3", "blob3")}));
+	std::unordered_map<crypto::hash, std::pair<blobdata, blobdata>> txes = this->pool_txes();
+	ASSERT_EQ(3, txes.size());
+	ASSERT_EQ(std::make_pair(blobdata("meta2"), blobdata("blob2")), txes[t2]);
+
+	// an update without a blob keeps the stored one, and removing a tx which
+	// is not there is fine
+	ASSERT_TRUE(m_db->update_txpool_txes({pool_put(t1, "meta1b", ""), pool_remove(t2), pool_remove(crypto::rand<crypto::hash>())}));
+	txes = this->pool_txes();
+	ASSERT_EQ(2, txes.size());
+	ASSERT_EQ(std::make_pair(blobdata("meta1b"), blobdata("blob1")), txes[t1]);
+	ASSERT_EQ(std::make_pair(blobdata("meta3"), blobdata("blob3")), txes[t3]);
+
+	size_t calls = 0;
+	ASSERT_FALSE(m_db->for_all_txpool_txes([&](const crypto::hash &, const blobdata &, const blobdata &) { ++calls; return false; }));
+	ASSERT_EQ(1, calls);
+
+	// and it is all there after a restart
+	ASSERT_NO_THROW(m_db->close());
+	ASSERT_NO_THROW(m_db->open(m_prefix));
+	ASSERT_TRUE(txes == this->pool_txes());
+}
+
+TEST_F(BlockchainLMDBTest, MigrateTxpoolTables)
+{
+	ASSERT_NO_THROW(this->open());
+	ASSERT_NO_FATAL_FAILURE(this->add_block({}));
+	ASSERT_NO_FATAL_FAILURE(this->add_block({unit_test::make_rct_tx()}));
+	ASSERT_NO_THROW(m_db->close());
+
+	// before version 4, the pool was not kept in the db
+	ASSERT_NO_FATAL_FAILURE(this->rewrite(3, [](MDB_txn *txn) {
+		MDB_dbi txpool_meta, txpool_blob;
+		ASSERT_EQ(0, mdb_dbi_open(txn, "txpool_meta", 0, &txpool_meta));
+		ASSERT_EQ(0, mdb_dbi_open(txn, "txpool_blob", 0, &txpool_blob));
+		ASSERT_EQ(0, mdb_drop(txn, txpool_meta, 1));
+		ASSERT_EQ(0, mdb_drop(txn, txpool_blob, 1));
+	}));
+
+	ASSERT_NO_THROW(m_db->open(m_prefix));
+	ASSERT_EQ(2, m_db->height());
+	ASSERT_TRUE(this->pool_txes().empty());
+	const crypto::hash txid = crypto::rand<crypto::hash>();
+	ASSERT_TRUE(m_db->update_txpool_txes({pool_put(txid, "meta", "blob")}));
+	ASSERT_EQ(1, this->pool_txes().size());
+	ASSERT_NO_THROW(m_db->close());
+	ASSERT_EQ(4, this->read_version());
+}
+
+} // anonymous namespace
@@ -0,0 +1,183 @@
+// Copyright (c) 2014-2018, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "gtest/gtest.h"
+
+#include "blockchain_db/lmdb/db_lmdb.h"
+#include "cryptonote_core/account.h"
+#include "cryptonote_core/cryptonote_core.h"
+#include "cryptonote_core/cryptonote_format_utils.h"
+#include "cryptonote_core/miner.h"
+#include "rpc/core_rpc_server.h"
+#include "storages/portable_storage_template_helper.h"
+#include "unit_tests_utils.h"
+
+using namespace cryptonote;
+
+namespace
+{ // anonymous namespace
+
+const std::pair<uint8_t, uint64_t> test_hard_forks[] = {std::make_pair((uint8_t)1, (uint64_t)0), std::make_pair((uint8_t)0, (uint64_t)0)};
+const test_options rpc_test_options = {test_hard_forks};
+
+typedef nodetool::node_server<t_cryptonote_protocol_handler<core>> p2p_server;
+
+class CoreRpcServerTest : public testing::Test
+{
+  protected:
+	CoreRpcServerTest() : m_core(nullptr), m_protocol(m_core, nullptr), m_p2p(m_protocol), m_rpc(m_core, m_p2p)
+	{
+		m_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+	}
+
+	~CoreRpcServerTest()
+	{
+		if (m_initialized)
+			m_core.deinit();
+		boost::filesystem::remove_all(m_dir);
+	}
+
+	// writes a chain of blocks straight to the db the core will load, one
+	// ringct tx in each but the first, as nothing checks them on the way
+	void make_chain(size_t n_blocks, uint64_t prune_below)
+	{
+		const boost::filesystem::path folder = m_dir / "fake" / "lmdb";
+		ASSERT_TRUE(boost::filesystem::create_directories(folder));
+		BlockchainLMDB db;
+		db.open(folder.string());
+		HardFork hardfork(db, 1, 0);
+		hardfork.init();
+		db.set_hard_fork(&hardfork);
+		account_base miner;
+		miner.generate();
+		for (uint64_t height = 0; height < n_blocks; ++height)
+		{
+			std::vector<transaction> txs;
+			if (height > 0)
+				txs.push_back(unit_test::make_rct_tx());
+			block b;
+			b.major_version = 1;
+			b.minor_version = 0;
+			b.timestamp = 1000000 + height * 120;
+			b.prev_id = height ? db.top_block_hash() : null_hash;
+			b.nonce = height;
+			for (const transaction &tx : txs)
+				b.tx_hashes.push_back(get_transaction_hash(tx));
+			ASSERT_TRUE(construct_miner_tx(height, 0, 0, 0, 0, miner.get_keys().m_account_address, b.miner_tx));
+			db.add_block(b, 1000, height + 1, height * 1000, txs);
+			m_txs.insert(m_txs.end(), txs.begin(), txs.end());
+		}
+		db.prune_blockchain(prune_below);
+		ASSERT_EQ(prune_below, db.get_pruned_height());
+		db.close();
+	}
+
+	void init()
+	{
+		boost::program_options::options_description desc;
+		core::init_options(desc);
+		miner::init_options(desc);
+		const std::string data_dir = m_dir.string();
+		const char *argv[] = {"unit_tests", "--data-dir", data_dir.c_str()};
+		boost::program_options::variables_map vm;
+		boost::program_options::store(boost::program_options::parse_command_line(3, argv, desc), vm);
+		boost::program_options::notify(vm);
+		ASSERT_TRUE(m_core.init(vm, &rpc_test_options));
+		m_initialized = true;
+	}
+
+	boost::filesystem::path m_dir;
+	core m_core;
+	t_cryptonote_protocol_handler<core> m_protocol;
+	p2p_server m_p2p;
+	core_rpc_server m_rpc;
+	std::vector<transaction> m_txs;
+	bool m_initialized = false;
+};
+
+TEST_F(CoreRpcServerTest, GetBlocksServesPrunedTxs)
+{
+	ASSERT_NO_FATAL_FAILURE(make_chain(5, 3));
+	ASSERT_NO_FATAL_FAILURE(init());
+
+	COMMAND_RPC_GET_BLOCKS_FAST::request req;
+	req.start_height = 1;
+	COMMAND_RPC_GET_BLOCKS_FAST::response served;
+	ASSERT_TRUE(m_rpc.on_get_blocks(req, served));
+	ASSERT_EQ(CORE_RPC_STATUS_OK, served.status);
+
+	// as a wallet gets it
+	std::string buf;
+	ASSERT_TRUE(epee::serialization::store_t_to_binary(served, buf));
+	COMMAND_RPC_GET_BLOCKS_FAST::response res;
+	ASSERT_TRUE(epee::serialization::load_t_from_binary(res, buf));
+
+	ASSERT_EQ(1, res.start_height);
+	ASSERT_EQ(5, res.current_height);
+	ASSERT_EQ(4, res.blocks.size());
+	ASSERT_EQ(4, res.output_indices.size());
+	uint64_t height = 1;
+	for (const block_complete_entry &entry : res.blocks)
+	{
+		block b;
+		ASSERT_TRUE(parse_and_validate_block_from_blob(entry.block, b));
+		ASSERT_EQ(1, b.tx_hashes.size());
+		ASSERT_EQ(1, entry.txs.size());
+		ASSERT_EQ(2, res.output_indices[height - 1].indices.size());
+		ASSERT_EQ(2, res.output_indices[height - 1].indices[1].indices.size());
+		const transaction &tx = m_txs[height - 1];
+		transaction served_tx;
+		crypto::hash served_hash;
+		if (height < 3)
+		{
+			// the pruned tx and its prunable hash give back the tx hash
+			ASSERT_TRUE(entry.pruned) << "at height " << height;
+			ASSERT_EQ(1, entry.prunable_hashes.size());
+			blobdata pruned_blob;
+			ASSERT_TRUE(tx_to_pruned_blob(tx, pruned_blob));
+			ASSERT_EQ(pruned_blob, entry.txs.front());
+			ASSERT_TRUE(parse_and_validate_tx_base_from_blob(entry.txs.front(), served_tx));
+			ASSERT_TRUE(get_pruned_transaction_hash(served_tx, entry.prunable_hashes.front(), served_hash));
+		}
+		else
+		{
+			ASSERT_FALSE(entry.pruned) << "at height " << height;
+			ASSERT_TRUE(entry.prunable_hashes.empty());
+			ASSERT_EQ(tx_to_blob(tx), entry.txs.front());
+			ASSERT_TRUE(parse_and_validate_tx_from_blob(entry.txs.front(), served_tx));
+			ASSERT_TRUE(get_transaction_hash(served_tx, served_hash));
+		}
+		ASSERT_EQ(b.tx_hashes.front(), served_hash) << "at height " << height;
+		++height;
+	}
+}
+
+}  // anonymous namespace
@@ -64,6 +64,11 @@ class TestDB : public BlockchainDB
 	virtual blobdata get_block_blob_from_height(const uint64_t &height) const { return cryptonote::t_serializable_object_to_blob(get_block_from_height(height)); }
 	virtual blobdata get_block_blob(const crypto::hash &h) const { return blobdata(); }
 	virtual bool get_tx_blob(const crypto::hash &h, cryptonote::blobdata &tx) const { return false; }
+	virtual bool get_pruned_tx_blob(const crypto::hash &h, cryptonote::blobdata &tx) const { return false; }
+	virtual bool get_prunable_tx_blob(const crypto::hash &h, cryptonote::blobdata &tx) const { return false; }
+	virtual bool get_prunable_tx_hash(const crypto::hash& tx_hash, crypto::hash &prunable_hash) const { return false; }
+	virtual uint64_t prune_blockchain(uint64_t height) { return 0; }
+	virtual uint64_t get_pruned_height() const { return 0; }
 	virtual uint64_t get_block_height(const crypto::hash &h) const { return 0; }
 	virtual block_header get_block_header(const crypto::hash &h) const { return block_header(); }
 	virtual uint64_t get_block_timestamp(const uint64_t &height) const { return 0; }
@@ -73,8 +78,11 @@ class TestDB : public BlockchainDB
 	virtual difficulty_type get_block_difficulty(const uint64_t &height) const { return 0; }
 	virtual uint64_t get_block_already_generated_coins(const uint64_t &height) const { return 10000000000; }
 	virtual crypto::hash get_block_hash_from_height(const uint64_t &height) const { return crypto::hash(); }
+	virtual block_header_info get_block_header_info(const uint64_t &height) const { return block_header_info(); }
+	virtual std::vector<block_header_info> get_block_header_info_range(const uint64_t &h1, const uint64_t &h2) const { return std::vector<block_header_info>(); }
 	virtual std::vector<block> get_blocks_range(const uint64_t &h1, const uint64_t &h2) const { return std::vector<block>(); }
 	virtual std::vector<crypto::hash> get_hashes_range(const uint64_t &h1, const uint64_t &h2) const { return std::vector<crypto::hash>(); }
+	virtual std::vector<blobdata> get_blocks_blobs_range(const uint64_t &h1, const uint64_t &h2) const { return std::vector<blobdata>(); }
 	virtual crypto::hash top_block_hash() const { return crypto::hash(); }
 	virtual block get_top_block() const { return block(); }
 	virtual uint64_t height() const { return blocks.size(); }
@@ -82,6 +90,7 @@ class TestDB : public BlockchainDB
 	virtual bool tx_exists(const crypto::hash &h, uint64_t &tx_index) const { return false; }
 	virtual uint64_t get_tx_unlock_time(const crypto::hash &h) const { return 0; }
 	virtual transaction get_tx(const crypto::hash &h) const { return transaction(); }
+	virtual transaction get_pruned_tx(const crypto::hash &h) const { return transaction(); }
 	virtual bool get_tx(const crypto::hash &h, transaction &tx) const { return false; }
 	virtual uint64_t get_tx_count() const { return 0; }
 	virtual std::vector<transaction> get_tx_list(const std::vector<crypto::hash> &hlist) const { return std::vector<transaction>(); }
@@ -94,6 +103,7 @@ class TestDB : public BlockchainDB
 	virtual tx_out_index get_output_tx_and_index(const uint64_t &amount, const uint64_t &index) const { return tx_out_index(); }
 	virtual void get_output_tx_and_index(const uint64_t &amount, const std::vector<uint64_t> &offsets, std::vector<tx_out_index> &indices) const {}
 	virtual void get_output_key(const uint64_t &amount, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs, bool allow_partial = false) {}
+	virtual void get_output_keys(const std::vector<uint64_t> &amounts, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs, std::vector<tx_out_index> *tx_out_indices = NULL) const {}
 	virtual bool can_thread_bulk_indices() const { return false; }
 	virtual std::vector<uint64_t> get_tx_output_indices(const crypto::hash &h) const { return std::vector<uint64_t>(); }
 	virtual std::vector<uint64_t> get_tx_amount_output_indices(const uint64_t tx_index) const { return std::vector<uint64_t>(); }
@@ -111,6 +121,11 @@ class TestDB : public BlockchainDB
 	virtual bool for_all_transactions(std::function<bool(const crypto::hash &, const cryptonote::transaction &)>) const { return true; }
 	virtual bool for_all_outputs(std::function<bool(uint64_t amount, const crypto::hash &tx_hash, uint64_t height, size_t tx_idx)> f) const { return true; }
 	virtual bool for_all_outputs(uint64_t amount, const std::function<bool(uint64_t height)> &f) const { return true; }
+	virtual bool for_blocks_parallel(uint64_t h1, uint64_t h2, size_t num_shards, std::function<bool(size_t, uint64_t, const crypto::hash&, const cryptonote::block&)> f) const { return true; }
+	virtual bool for_all_transactions_parallel(size_t num_shards, std::function<bool(size_t, const crypto::hash&, const cryptonote::transaction&)> f) const { return true; }
+	virtual bool for_all_outputs_parallel(size_t num_shards, std::function<bool(size_t, uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx)> f) const { return true; }
+	virtual bool update_txpool_txes(const std::vector<txpool_tx_update> &updates) { return true; }
+	virtual bool for_all_txpool_txes(std::function<bool(const crypto::hash&, const cryptonote::blobdata&, const cryptonote::blobdata&)> f) const { return true; }
 	virtual bool is_read_only() const { return false; }
 	virtual std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> get_output_histogram(const std::vector<uint64_t> &amounts, bool unlocked, uint64_t recent_cutoff, uint64_t min_count) const { return std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>>(); }
 	virtual bool get_output_distribution(uint64_t amount, uint64_t from_height, uint64_t to_height, std::vector<uint64_t> &distribution, uint64_t &base) const { return false; }
@@ -125,7 +140,7 @@ class TestDB : public BlockchainDB
 	virtual cryptonote::blobdata get_txpool_tx_blob(const crypto::hash &txid) const { return ""; }
 	virtual bool for_all_txpool_txes(std::function<bool(const crypto::hash &, const txpool_tx_meta_t &, const cryptonote::blobdata *)>, bool include_blob = false, bool include_unrelayed_txes = false) const { return false; }
 
-	virtual void add_block(const block &blk, const size_t &block_size, const difficulty_type &cumulative_difficulty, const uint64_t &coins_generated, const crypto::hash &blk_hash)
+	virtual void add_block(const block &blk, const size_t &block_size, const difficulty_type &cumulative_difficulty, const uint64_t &coins_generated, const uint64_t &fee, const crypto::hash &blk_hash)
 	{
 		blocks.push_back(blk);
 	}
@@ -0,0 +1,83 @@
+// Copyright (c) 2014-2018, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "cryptonote_core/cryptonote_format_utils.h"
+#include "unit_tests_utils.h"
+
+namespace
+{
+	cryptonote::transaction make_null_rct_tx(uint64_t height)
+	{
+		cryptonote::transaction tx;
+		tx.version = 2;
+		tx.unlock_time = height + 60;
+		cryptonote::txin_gen in;
+		in.height = height;
+		tx.vin.push_back(in);
+		cryptonote::tx_out out;
+		out.amount = 1000 * (height + 1);
+		out.target = cryptonote::txout_to_key(rct::rct2pk(rct::pkGen()));
+		tx.vout.push_back(out);
+		tx.rct_signatures.type = rct::RCTTypeNull;
+		return tx;
+	}
+}
+
+TEST(get_transaction_hashes, same_as_get_transaction_hash)
+{
+	// enough txs to fill a few groups of lanes and leave a partial one,
+	// with null prunable parts in between
+	std::vector<cryptonote::transaction> txs;
+	for (size_t i = 0; i < 11; ++i)
+		txs.push_back(i % 3 == 0 ? make_null_rct_tx(i) : unit_test::make_rct_tx());
+
+	std::vector<crypto::hash> tx_hashes, tx_prefix_hashes;
+	ASSERT_TRUE(cryptonote::get_transaction_hashes(txs, tx_hashes, tx_prefix_hashes));
+	ASSERT_EQ(txs.size(), tx_hashes.size());
+	ASSERT_EQ(txs.size(), tx_prefix_hashes.size());
+	for (size_t i = 0; i < txs.size(); ++i)
+	{
+		ASSERT_EQ(cryptonote::get_transaction_hash(txs[i]), tx_hashes[i]);
+		ASSERT_EQ(cryptonote::get_transaction_prefix_hash(txs[i]), tx_prefix_hashes[i]);
+	}
+}
+
+TEST(get_transaction_hashes, empty)
+{
+	std::vector<cryptonote::transaction> txs;
+	std::vector<crypto::hash> tx_hashes(1), tx_prefix_hashes(1);
+	ASSERT_TRUE(cryptonote::get_transaction_hashes(txs, tx_hashes, tx_prefix_hashes));
+	ASSERT_TRUE(tx_hashes.empty());
+	ASSERT_TRUE(tx_prefix_hashes.empty());
+}
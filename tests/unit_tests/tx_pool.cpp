@@ -0,0 +1,703 @@
+// Copyright (c) 2014-2018, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "gtest/gtest.h"
+
+#include "blockchain_db/lmdb/db_lmdb.h"
+#include "cryptonote_core/account.h"
+#include "cryptonote_core/blockchain.h"
+#include "cryptonote_core/cryptonote_core.h"
+#include "cryptonote_core/cryptonote_format_utils.h"
+#include "cryptonote_core/miner.h"
+#include "cryptonote_core/tx_pool.h"
+#include "serialization/binary_utils.h"
+#include "serialization/string.h"
+
+#include "../performance_tests/select_block_txes.h"
+
+using namespace cryptonote;
+
+namespace
+{ // anonymous namespace
+
+const std::pair<uint8_t, uint64_t> test_hard_forks[] = {std::make_pair((uint8_t)1, (uint64_t)0), std::make_pair((uint8_t)0, (uint64_t)0)};
+const test_options pool_test_options = {test_hard_forks};
+
+// a tx the pool only keeps because it came from a block: its input refers
+// to nothing on the chain, so a block including it fails verification
+transaction make_unverifiable_tx()
+{
+	transaction tx;
+	tx.version = 2;
+	tx.unlock_time = 0;
+
+	txin_to_key in;
+	in.amount = 0;
+	in.key_offsets.push_back(0);
+	keypair image_keys = keypair::generate();
+	in.k_image = *reinterpret_cast<const crypto::key_image*>(&image_keys.pub);
+	tx.vin.push_back(in);
+
+	tx_out out;
+	out.amount = 0;
+	out.target = txout_to_key(keypair::generate().pub);
+	tx.vout.push_back(out);
+
+	add_tx_pub_key_to_extra(tx, keypair::generate().pub);
+	tx.rct_signatures.type = rct::RCTTypeNull;
+	return tx;
+}
+
+class PoolBlockTest : public testing::Test
+{
+  protected:
+	PoolBlockTest() : m_pool(m_bc), m_bc(m_pool)
+	{
+		m_prefix = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+		m_miner.generate();
+	}
+
+	~PoolBlockTest()
+	{
+		if (m_initialized)
+			m_bc.deinit();
+		boost::filesystem::remove_all(m_prefix);
+	}
+
+	// runs f on its own thread, so a pool lock taken twice by add_new_block
+	// fails the test instead of hanging it
+	static bool in_time(const std::function<void()> &f)
+	{
+		boost::thread t(f);
+		if (t.try_join_for(boost::chrono::seconds(60)))
+			return true;
+		t.detach();
+		return false;
+	}
+
+	void init(bool persistent = false)
+	{
+		ASSERT_NO_FATAL_FAILURE(init(m_bc, m_pool, m_prefix, persistent));
+		m_initialized = true;
+	}
+
+	static void init(Blockchain &bc, tx_memory_pool &pool, const std::string &prefix, bool persistent)
+	{
+		BlockchainDB *db = new BlockchainLMDB();
+		db->open(prefix);
+		// the genesis block already goes through add_new_block
+		bool r = false;
+		ASSERT_TRUE(in_time([&]() { r = bc.init(db, false, &pool_test_options); })) << "adding the genesis block deadlocked";
+		ASSERT_TRUE(r);
+		ASSERT_TRUE(pool.init(persistent));
+	}
+
+	// a block holding exactly txs, whatever the template picked from the pool;
+	// blocks are stamped DIFFICULTY_TARGET apart, so difficulty stays at 1
+	void make_block(block &b, const std::vector<crypto::hash> &txs)
+	{
+		difficulty_type diffic;
+		uint64_t height;
+		ASSERT_TRUE(m_bc.create_block_template(b, m_miner.get_keys().m_account_address, diffic, height, blobdata()));
+		ASSERT_EQ(1, diffic);
+		b.timestamp = m_bc.get_db().get_block_timestamp(0) + height * DIFFICULTY_TARGET;
+		b.tx_hashes = txs;
+		ASSERT_TRUE(miner::find_nonce_for_given_block(b, diffic, height));
+	}
+
+	// a block on top of prev, which need not be the top block; the miner tx
+	// pays the reward as of generated_coins, no more than a block there may
+	void make_block_on(block &b, const block &prev, uint64_t height, uint64_t generated_coins)
+	{
+		ASSERT_NO_FATAL_FAILURE(make_block(b, {}));
+		b.prev_id = get_block_hash(prev);
+		b.timestamp = m_bc.get_db().get_block_timestamp(0) + height * DIFFICULTY_TARGET;
+		ASSERT_TRUE(construct_miner_tx(height, 0, generated_coins, 0, 0, m_miner.get_keys().m_account_address, b.miner_tx));
+		ASSERT_TRUE(miner::find_nonce_for_given_block(b, 1, height));
+	}
+
+	// the headers Blockchain serves, partly from its cache, match the table
+	void check_header_range(uint64_t start_height, uint64_t end_height)
+	{
+		std::vector<block_header_info> infos;
+		ASSERT_TRUE(m_bc.get_block_header_info_range(start_height, end_height, infos));
+		const std::vector<block_header_info> stored = m_bc.get_db().get_block_header_info_range(start_height, end_height);
+		ASSERT_EQ(stored.size(), infos.size());
+		for (size_t i = 0; i < infos.size(); ++i)
+			ASSERT_EQ(0, memcmp(&stored[i], &infos[i], sizeof(block_header_info))) << "at height " << start_height + i;
+	}
+
+	bool add_block_in_time(const block &b, block_verification_context &bvc)
+	{
+		return in_time([&]() { m_bc.add_new_block(b, bvc); });
+	}
+
+	tx_memory_pool m_pool;
+	Blockchain m_bc;
+	account_base m_miner;
+	std::string m_prefix;
+	bool m_initialized = false;
+};
+
+TEST_F(PoolBlockTest, AddBlockWithPoolTxs)
+{
+	ASSERT_NO_FATAL_FAILURE(this->init());
+	ASSERT_EQ(1, m_bc.get_current_blockchain_height());
+
+	transaction tx = make_unverifiable_tx();
+	const crypto::hash txid = get_transaction_hash(tx);
+	tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+	ASSERT_TRUE(m_pool.add_tx(tx, tvc, true, false, 1));
+	ASSERT_TRUE(m_pool.have_tx(txid));
+
+	// the block takes its tx from the pool and hands it back when the tx
+	// fails verification, both under the pool lock add_new_block holds
+	block b;
+	ASSERT_NO_FATAL_FAILURE(make_block(b, {txid}));
+	block_verification_context bvc = AUTO_VAL_INIT(bvc);
+	ASSERT_TRUE(add_block_in_time(b, bvc)) << "add_new_block deadlocked on a block with pool txs";
+	ASSERT_TRUE(bvc.m_verifivation_failed);
+	ASSERT_EQ(1, m_bc.get_current_blockchain_height());
+	ASSERT_TRUE(m_pool.have_tx(txid));
+
+	// an accepted block tells the pool about the new height under that lock
+	ASSERT_NO_FATAL_FAILURE(make_block(b, {}));
+	bvc = AUTO_VAL_INIT(bvc);
+	ASSERT_TRUE(add_block_in_time(b, bvc)) << "add_new_block deadlocked";
+	ASSERT_FALSE(bvc.m_verifivation_failed);
+	ASSERT_TRUE(bvc.m_added_to_main_chain);
+	ASSERT_EQ(2, m_bc.get_current_blockchain_height());
+	ASSERT_TRUE(m_pool.have_tx(txid));
+}
+
+TEST_F(PoolBlockTest, PoolReloadsFromDb)
+{
+	ASSERT_NO_FATAL_FAILURE(this->init(true));
+	std::vector<crypto::hash> txids;
+	for (int i = 0; i < 3; ++i)
+	{
+		transaction tx = make_unverifiable_tx();
+		txids.push_back(get_transaction_hash(tx));
+		tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+		ASSERT_TRUE(m_pool.add_tx(tx, tvc, true, false, 1));
+	}
+	transaction tx;
+	size_t blob_size;
+	uint64_t fee;
+	bool relayed;
+	ASSERT_TRUE(m_pool.take_tx(txids[1], tx, blob_size, fee, relayed));
+	ASSERT_EQ(txids[1], get_transaction_hash(tx));
+
+	// deinit writes out what is still queued
+	ASSERT_TRUE(m_pool.deinit());
+	m_bc.deinit();
+	m_initialized = false;
+
+	struct node
+	{
+		node() : pool(bc), bc(pool) {}
+		tx_memory_pool pool;
+		Blockchain bc;
+	} restarted;
+	ASSERT_NO_FATAL_FAILURE(init(restarted.bc, restarted.pool, m_prefix, true));
+	EXPECT_EQ(2, restarted.pool.get_transactions_count());
+	EXPECT_TRUE(restarted.pool.have_tx(txids[0]));
+	EXPECT_FALSE(restarted.pool.have_tx(txids[1]));
+	EXPECT_TRUE(restarted.pool.have_tx(txids[2]));
+	EXPECT_TRUE(restarted.pool.take_tx(txids[2], tx, blob_size, fee, relayed));
+	EXPECT_EQ(txids[2], get_transaction_hash(tx));
+	restarted.pool.deinit();
+	restarted.bc.deinit();
+}
+
+TEST_F(PoolBlockTest, HeaderCacheFollowsReorgs)
+{
+	ASSERT_NO_FATAL_FAILURE(this->init());
+	block b;
+	for (int i = 0; i < 3; ++i)
+	{
+		ASSERT_NO_FATAL_FAILURE(make_block(b, {}));
+		block_verification_context bvc = AUTO_VAL_INIT(bvc);
+		ASSERT_TRUE(add_block_in_time(b, bvc));
+		ASSERT_TRUE(bvc.m_added_to_main_chain);
+	}
+	ASSERT_EQ(4, m_bc.get_current_blockchain_height());
+	ASSERT_NO_FATAL_FAILURE(check_header_range(0, 3));
+	std::vector<block_header_info> infos;
+	ASSERT_FALSE(m_bc.get_block_header_info_range(2, 4, infos));
+
+	// a longer chain forking off block 1 pops blocks 3 and 2 off the cached
+	// headers and adds its own
+	const uint64_t coins = m_bc.get_db().get_block_already_generated_coins(3);
+	block prev = m_bc.get_db().get_block_from_height(1);
+	for (uint64_t height = 2; height <= 4; ++height)
+	{
+		ASSERT_NO_FATAL_FAILURE(make_block_on(b, prev, height, coins));
+		block_verification_context bvc = AUTO_VAL_INIT(bvc);
+		ASSERT_TRUE(add_block_in_time(b, bvc));
+		ASSERT_FALSE(bvc.m_verifivation_failed);
+		prev = b;
+	}
+	ASSERT_EQ(5, m_bc.get_current_blockchain_height());
+	ASSERT_EQ(get_block_hash(b), m_bc.get_tail_id());
+	ASSERT_NO_FATAL_FAILURE(check_header_range(0, 4));
+	ASSERT_NO_FATAL_FAILURE(check_header_range(3, 4));
+}
+
+// what the pool keeps of a tx in the db, as tx_pool.cpp writes it
+struct pool_tx_record
+{
+	uint64_t blob_size;
+	uint64_t fee;
+	std::vector<crypto::key_image> key_images;
+	std::string alias;
+	uint64_t max_used_block_height;
+	crypto::hash max_used_block_id;
+	uint64_t receive_time;
+	uint64_t last_relayed_time;
+	bool kept_by_block;
+	bool relayed;
+
+	BEGIN_SERIALIZE_OBJECT()
+		VARINT_FIELD(blob_size)
+		VARINT_FIELD(fee)
+		FIELD(key_images)
+		FIELD(alias)
+		VARINT_FIELD(max_used_block_height)
+		FIELD(max_used_block_id)
+		VARINT_FIELD(receive_time)
+		VARINT_FIELD(last_relayed_time)
+		FIELD(kept_by_block)
+		FIELD(relayed)
+	END_SERIALIZE()
+};
+
+void sort_hashes(std::vector<crypto::hash> &hashes)
+{
+	std::sort(hashes.begin(), hashes.end(), [](const crypto::hash &a, const crypto::hash &b) {
+		return memcmp(&a, &b, sizeof(a)) < 0;
+	});
+}
+
+// what fill_block_template hands out
+struct filled_template
+{
+	std::vector<crypto::hash> tx_hashes;
+	size_t total_size;
+	uint64_t fee;
+	uint64_t version;
+};
+
+class PoolTemplateTest : public PoolBlockTest
+{
+  protected:
+	// blocks mined before the test, enough for the coinbase outputs of the
+	// first ones to be spendable
+	static const uint64_t MINED_BLOCKS = 24;
+
+	void init_spendable(bool persistent = false)
+	{
+		ASSERT_NO_FATAL_FAILURE(this->init(persistent));
+		while (m_bc.get_current_blockchain_height() < MINED_BLOCKS)
+			ASSERT_NO_FATAL_FAILURE(add_block({}, 0));
+	}
+
+	// a block on top of the chain holding exactly txs, which pay fee in
+	// total, whatever the template holds
+	void add_block(const std::vector<crypto::hash> &txs, uint64_t fee)
+	{
+		block b;
+		ASSERT_NO_FATAL_FAILURE(make_block(b, txs));
+		const uint64_t height = m_bc.get_current_blockchain_height();
+		const uint64_t coins = m_bc.get_db().get_block_already_generated_coins(height - 1);
+		ASSERT_TRUE(construct_miner_tx(height, 0, coins, 0, fee, m_miner.get_keys().m_account_address, b.miner_tx));
+		ASSERT_TRUE(miner::find_nonce_for_given_block(b, 1, height));
+		block_verification_context bvc = AUTO_VAL_INIT(bvc);
+		ASSERT_TRUE(add_block_in_time(b, bvc));
+		ASSERT_TRUE(bvc.m_added_to_main_chain);
+	}
+
+	// a valid tx sending the coinbase of the block at height back to the
+	// miner, with the first outputs past the genesis block as decoys
+	void make_spend(uint64_t height, uint64_t fee, transaction &tx)
+	{
+		const transaction miner_tx = m_bc.get_db().get_block_from_height(height).miner_tx;
+		std::vector<uint64_t> indices;
+		ASSERT_TRUE(m_bc.get_tx_outputs_gindexs(get_transaction_hash(miner_tx), indices));
+		ASSERT_GT(miner_tx.vout[0].amount, fee);
+
+		std::vector<uint64_t> ring;
+		for (uint64_t i = 1; ring.size() < DEFAULT_MIXIN; ++i)
+			if (i != indices[0])
+				ring.push_back(i);
+		ring.push_back(indices[0]);
+		std::sort(ring.begin(), ring.end());
+
+		tx_source_entry src;
+		src.amount = miner_tx.vout[0].amount;
+		src.real_out_tx_key = get_tx_pub_key_from_extra(miner_tx);
+		src.real_output_in_tx_index = 0;
+		// coinbase outputs are kept as rct outputs with a mask of 1
+		src.rct = true;
+		src.mask = rct::identity();
+		for (uint64_t i : ring)
+		{
+			if (i == indices[0])
+				src.real_output = src.outputs.size();
+			const output_data_t out = m_bc.get_db().get_output_key(0, i);
+			rct::ctkey key;
+			key.dest = rct::pk2rct(out.pubkey);
+			key.mask = out.commitment;
+			src.outputs.push_back(std::make_pair(i, key));
+		}
+
+		std::vector<tx_destination_entry> destinations;
+		destinations.push_back(tx_destination_entry(src.amount - fee, m_miner.get_keys().m_account_address, false));
+		ASSERT_TRUE(construct_tx(m_miner.get_keys(), {src}, destinations, std::vector<uint8_t>(), tx, 0));
+	}
+
+	// makes a tx spending the coinbase at height and adds it to the pool
+	void add_spend(uint64_t height, uint64_t fee, crypto::hash &txid)
+	{
+		transaction tx;
+		ASSERT_NO_FATAL_FAILURE(make_spend(height, fee, tx));
+		txid = get_transaction_hash(tx);
+		tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+		ASSERT_TRUE(m_pool.add_tx(tx, tvc, false, false, 1));
+		ASSERT_FALSE(tvc.m_verifivation_failed);
+	}
+
+	// the template for the next block, as create_block_template asks for it
+	static filled_template fill(Blockchain &bc, tx_memory_pool &pool, size_t median_size = 0)
+	{
+		filled_template t;
+		block b;
+		const uint64_t height = bc.get_current_blockchain_height();
+		if (!median_size)
+			median_size = bc.get_current_cumulative_blocksize_limit() / 2;
+		EXPECT_TRUE(pool.fill_block_template(b, median_size, 0, t.total_size, t.fee, height, t.version));
+		t.tx_hashes = b.tx_hashes;
+		return t;
+	}
+
+	// the template chosen from scratch: asking for another median size
+	// first makes the pool drop what it kept
+	static filled_template fill_rebuilt(Blockchain &bc, tx_memory_pool &pool)
+	{
+		fill(bc, pool, bc.get_current_cumulative_blocksize_limit() / 2 + 1);
+		return fill(bc, pool);
+	}
+
+	// the template kept up to date since the last fill holds what choosing
+	// it again from the whole pool would, in the same order
+	static void check_template(Blockchain &bc, tx_memory_pool &pool, std::vector<crypto::hash> expected)
+	{
+		const filled_template kept = fill(bc, pool);
+		const filled_template rebuilt = fill_rebuilt(bc, pool);
+		std::vector<crypto::hash> kept_set = kept.tx_hashes;
+		sort_hashes(kept_set);
+		sort_hashes(expected);
+		ASSERT_EQ(expected, kept_set);
+		ASSERT_EQ(rebuilt.tx_hashes, kept.tx_hashes);
+		ASSERT_EQ(rebuilt.total_size, kept.total_size);
+		ASSERT_EQ(rebuilt.fee, kept.fee);
+	}
+
+	filled_template fill() { return fill(m_bc, m_pool); }
+	filled_template fill_rebuilt() { return fill_rebuilt(m_bc, m_pool); }
+	void check_template(const std::vector<crypto::hash> &expected) { check_template(m_bc, m_pool, expected); }
+};
+
+TEST_F(PoolTemplateTest, KeptTemplateMatchesRebuild)
+{
+	ASSERT_NO_FATAL_FAILURE(init_spendable());
+	ASSERT_NO_FATAL_FAILURE(check_template({}));
+
+	// txs join the template as they come, whatever their rank
+	const uint64_t fee = 10000000000;
+	crypto::hash a, b, c;
+	ASSERT_NO_FATAL_FAILURE(add_spend(2, fee, a));
+	ASSERT_NO_FATAL_FAILURE(check_template({a}));
+	ASSERT_NO_FATAL_FAILURE(add_spend(3, 3 * fee, b));
+	ASSERT_NO_FATAL_FAILURE(check_template({a, b}));
+	ASSERT_NO_FATAL_FAILURE(add_spend(4, 2 * fee, c));
+	ASSERT_NO_FATAL_FAILURE(check_template({a, b, c}));
+
+	// a tx which is not ready to go stays out
+	transaction tx = make_unverifiable_tx();
+	const crypto::hash unverifiable = get_transaction_hash(tx);
+	tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+	ASSERT_TRUE(m_pool.add_tx(tx, tvc, true, false, 1));
+	ASSERT_NO_FATAL_FAILURE(check_template({a, b, c}));
+
+	size_t blob_size;
+	uint64_t tx_fee;
+	bool relayed;
+	ASSERT_TRUE(m_pool.take_tx(a, tx, blob_size, tx_fee, relayed));
+	ASSERT_NO_FATAL_FAILURE(check_template({b, c}));
+	ASSERT_TRUE(m_pool.take_tx(unverifiable, tx, blob_size, tx_fee, relayed));
+	ASSERT_NO_FATAL_FAILURE(check_template({b, c}));
+
+	// a block takes its txs out of the pool, and moves the template on
+	ASSERT_NO_FATAL_FAILURE(add_block({c}, 2 * fee));
+	ASSERT_NO_FATAL_FAILURE(check_template({b}));
+
+	// a tx coming back from a block while the block is still on the chain
+	// cannot go in, and validate drops it
+	transaction mined = m_bc.get_db().get_tx(c);
+	tvc = AUTO_VAL_INIT(tvc);
+	ASSERT_TRUE(m_pool.add_tx(mined, tvc, true, false, 1));
+	ASSERT_TRUE(m_pool.have_tx(c));
+	ASSERT_NO_FATAL_FAILURE(check_template({b}));
+	ASSERT_EQ(1, m_pool.validate(1));
+	ASSERT_FALSE(m_pool.have_tx(c));
+	ASSERT_NO_FATAL_FAILURE(check_template({b}));
+
+	// nothing is old enough to be stuck yet; the first on_idle looks
+	ASSERT_NO_THROW(m_pool.on_idle());
+	ASSERT_NO_FATAL_FAILURE(check_template({b}));
+
+	// a longer chain without the block holding c pops it, and c comes back
+	// into the pool and the template
+	const uint64_t height = m_bc.get_current_blockchain_height();
+	const uint64_t coins = m_bc.get_db().get_block_already_generated_coins(height - 1);
+	block prev = m_bc.get_db().get_block_from_height(height - 2);
+	block alt;
+	for (uint64_t h = height - 1; h <= height; ++h)
+	{
+		ASSERT_NO_FATAL_FAILURE(make_block_on(alt, prev, h, coins));
+		block_verification_context bvc = AUTO_VAL_INIT(bvc);
+		ASSERT_TRUE(add_block_in_time(alt, bvc));
+		ASSERT_FALSE(bvc.m_verifivation_failed);
+		prev = alt;
+	}
+	ASSERT_EQ(get_block_hash(alt), m_bc.get_tail_id());
+	ASSERT_TRUE(m_pool.have_tx(c));
+	ASSERT_NO_FATAL_FAILURE(check_template({b, c}));
+
+	// once the template is past the median size, a tx paying less than the
+	// chosen ones is appended, and one paying more than some of them has
+	// the template chosen again, with the tx at its place in the fee order
+	std::vector<crypto::hash> expected = {b, c};
+	const size_t median_size = m_bc.get_current_cumulative_blocksize_limit() / 2;
+	uint64_t h = 5;
+	do
+	{
+		ASSERT_LT(h, height - CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW);
+		crypto::hash low;
+		ASSERT_NO_FATAL_FAILURE(add_spend(h++, fee / 2, low));
+		expected.push_back(low);
+		ASSERT_NO_FATAL_FAILURE(check_template(expected));
+	} while (fill().total_size <= median_size);
+	crypto::hash high;
+	ASSERT_NO_FATAL_FAILURE(add_spend(height - CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW, 5 * fee, high));
+	expected.push_back(high);
+	ASSERT_NO_FATAL_FAILURE(check_template(expected));
+	ASSERT_EQ(high, fill().tx_hashes.front());
+	ASSERT_GT(fill().total_size, median_size);
+}
+
+TEST_F(PoolTemplateTest, BadRingctTxLeavesPool)
+{
+	ASSERT_NO_FATAL_FAILURE(init_spendable());
+	const uint64_t fee = 10000000000;
+	crypto::hash good;
+	ASSERT_NO_FATAL_FAILURE(add_spend(2, fee, good));
+
+	// the pool keeps a tx from a block even when its signature is wrong
+	transaction tx;
+	ASSERT_NO_FATAL_FAILURE(make_spend(3, fee, tx));
+	tx.rct_signatures.p.MGs[0].cc.bytes[0] ^= 1;
+	const crypto::hash bad = get_transaction_hash(tx);
+	tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+	ASSERT_TRUE(m_pool.add_tx(tx, tvc, true, false, 1));
+	ASSERT_TRUE(m_pool.have_tx(bad));
+
+	// a block holding it fails, and of its txs only the good one goes back
+	const uint64_t height = m_bc.get_current_blockchain_height();
+	block b;
+	ASSERT_NO_FATAL_FAILURE(make_block(b, {good, bad}));
+	block_verification_context bvc = AUTO_VAL_INIT(bvc);
+	ASSERT_TRUE(add_block_in_time(b, bvc));
+	ASSERT_TRUE(bvc.m_verifivation_failed);
+	ASSERT_EQ(height, m_bc.get_current_blockchain_height());
+	ASSERT_TRUE(m_pool.have_tx(good));
+	ASSERT_FALSE(m_pool.have_tx(bad));
+}
+
+TEST_F(PoolTemplateTest, StuckTxLeavesTemplate)
+{
+	ASSERT_NO_FATAL_FAILURE(init_spendable(true));
+	const uint64_t fee = 10000000000;
+	crypto::hash a, b;
+	ASSERT_NO_FATAL_FAILURE(add_spend(2, fee, a));
+	ASSERT_NO_FATAL_FAILURE(add_spend(3, 2 * fee, b));
+	ASSERT_TRUE(m_pool.deinit());
+	m_bc.deinit();
+	m_initialized = false;
+
+	// a restarted pool takes the time a tx was received from the db
+	{
+		BlockchainLMDB db;
+		db.open(m_prefix);
+		std::vector<txpool_tx_update> updates;
+		db.for_all_txpool_txes([&](const crypto::hash &id, const blobdata &meta, const blobdata &blob) {
+			if (id != a)
+				return true;
+			pool_tx_record rec;
+			EXPECT_TRUE(::serialization::parse_binary(meta, rec));
+			rec.receive_time -= CRYPTONOTE_MEMPOOL_TX_LIVETIME + 1;
+			txpool_tx_update update;
+			update.txid = id;
+			update.remove = false;
+			EXPECT_TRUE(::serialization::dump_binary(rec, update.meta));
+			updates.push_back(update);
+			return true;
+		});
+		ASSERT_EQ(1, updates.size());
+		ASSERT_TRUE(db.update_txpool_txes(updates));
+		db.close();
+	}
+
+	struct node
+	{
+		node() : pool(bc), bc(pool) {}
+		tx_memory_pool pool;
+		Blockchain bc;
+	} restarted;
+	ASSERT_NO_FATAL_FAILURE(init(restarted.bc, restarted.pool, m_prefix, true));
+	EXPECT_NO_FATAL_FAILURE(check_template(restarted.bc, restarted.pool, {a, b}));
+	// the first on_idle looks for stuck txs
+	EXPECT_NO_THROW(restarted.pool.on_idle());
+	EXPECT_FALSE(restarted.pool.have_tx(a));
+	EXPECT_NO_FATAL_FAILURE(check_template(restarted.bc, restarted.pool, {b}));
+	restarted.pool.deinit();
+	restarted.bc.deinit();
+}
+
+TEST_F(PoolTemplateTest, VersionFollowsContents)
+{
+	ASSERT_NO_FATAL_FAILURE(init_spendable());
+	const uint64_t v0 = fill().version;
+	ASSERT_EQ(v0, fill().version);
+
+	// choosing the same txs again, or a tx staying out of it, keeps the version
+	ASSERT_EQ(v0, fill_rebuilt().version);
+	transaction tx = make_unverifiable_tx();
+	tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+	ASSERT_TRUE(m_pool.add_tx(tx, tvc, true, false, 1));
+	ASSERT_EQ(v0, fill().version);
+
+	const uint64_t fee = 10000000000;
+	crypto::hash a;
+	ASSERT_NO_FATAL_FAILURE(add_spend(2, fee, a));
+	const filled_template t1 = fill();
+	ASSERT_NE(v0, t1.version);
+	ASSERT_EQ(std::vector<crypto::hash>{a}, t1.tx_hashes);
+	ASSERT_EQ(t1.version, fill_rebuilt().version);
+
+	// a new top block moves the version even with the same txs
+	ASSERT_NO_FATAL_FAILURE(add_block({}, 0));
+	const filled_template t2 = fill();
+	ASSERT_NE(t1.version, t2.version);
+	ASSERT_EQ(t1.tx_hashes, t2.tx_hashes);
+	ASSERT_EQ(t2.version, fill().version);
+}
+
+TEST_F(PoolTemplateTest, WaitForTemplateChange)
+{
+	ASSERT_NO_FATAL_FAILURE(init_spendable());
+	const uint64_t version = fill().version;
+
+	// nothing happening means waiting until the timeout
+	const auto start = boost::chrono::steady_clock::now();
+	ASSERT_FALSE(m_pool.wait_for_template_change(version, 200));
+	ASSERT_GE(boost::chrono::steady_clock::now() - start, boost::chrono::milliseconds(200));
+
+	// a tx entering the template wakes up a waiter long before its timeout
+	bool woken = false;
+	boost::thread waiter([&]() { woken = m_pool.wait_for_template_change(version, 20000); });
+	crypto::hash a;
+	EXPECT_NO_FATAL_FAILURE(add_spend(2, 10000000000, a));
+	const bool joined = waiter.try_join_for(boost::chrono::seconds(10));
+	if (!joined)
+		waiter.join();
+	ASSERT_TRUE(joined);
+	ASSERT_TRUE(woken);
+	ASSERT_NE(version, fill().version);
+}
+
+uint64_t select_coinbase(const std::vector<tx_memory_pool::block_candidate> &candidates, size_t lookahead, std::vector<size_t> &chosen)
+{
+	size_t total_size;
+	uint64_t fee;
+	return tx_memory_pool::select_block_txes(candidates, 300000, 0, 100000, lookahead,
+		[](size_t) { return true; }, chosen, total_size, fee);
+}
+
+uint64_t select_coinbase(const std::vector<tx_memory_pool::block_candidate> &candidates, size_t lookahead)
+{
+	std::vector<size_t> chosen;
+	return select_coinbase(candidates, lookahead, chosen);
+}
+
+TEST(SelectBlockTxes, LookaheadEarnsAtLeastGreedyOnSnapshot)
+{
+	for (size_t pool_size : {100, 1000, 10000})
+	{
+		const std::vector<tx_memory_pool::block_candidate> candidates = make_pool_snapshot(pool_size);
+		ASSERT_GE(select_coinbase(candidates, 16), select_coinbase(candidates, 0)) << "pool of " << pool_size;
+	}
+}
+
+TEST(SelectBlockTxes, LookaheadSkipsLargeTxNearSizeLimit)
+{
+	// the block may grow to 5 MB: the large tx pays the most per byte, but
+	// once in, neither of the two next ones fits, while both together fit
+	// and pay more than it
+	std::vector<tx_memory_pool::block_candidate> candidates(3);
+	candidates[0].blob_size = 4000000;
+	candidates[0].fee = 10 * candidates[0].blob_size;
+	candidates[1].blob_size = candidates[2].blob_size = 2600000;
+	candidates[1].fee = candidates[2].fee = 9 * candidates[1].blob_size;
+
+	std::vector<size_t> greedy, lookahead;
+	const uint64_t greedy_coinbase = select_coinbase(candidates, 0, greedy);
+	const uint64_t lookahead_coinbase = select_coinbase(candidates, 16, lookahead);
+	ASSERT_EQ(std::vector<size_t>{0}, greedy);
+	ASSERT_EQ((std::vector<size_t>{1, 2}), lookahead);
+	ASSERT_EQ(greedy_coinbase + 2 * candidates[1].fee - candidates[0].fee, lookahead_coinbase);
+}
+
+}  // anonymous namespace
@@ -33,6 +33,10 @@
 #include <atomic>
 #include <boost/filesystem.hpp>
 
+#include "cryptonote_core/cryptonote_basic.h"
+#include "cryptonote_core/cryptonote_format_utils.h"
+#include "ringct/rctOps.h"
+
 namespace unit_test
 {
 extern boost::filesystem::path data_dir;
@@ -64,6 +68,49 @@ class call_counter
   private:
 	std::atomic<size_t> m_counter;
 };
+
+// a simple ringct tx with one input and two outputs; its signatures are
+// random, the db doesn't check them, but give it prunable data to store
+inline cryptonote::transaction make_rct_tx()
+{
+	cryptonote::transaction tx;
+	tx.version = 2;
+	tx.unlock_time = 0;
+
+	cryptonote::txin_to_key in;
+	in.amount = 0;
+	in.key_offsets.push_back(0);
+	in.k_image = rct::rct2ki(rct::pkGen());
+	tx.vin.push_back(in);
+
+	rct::rctSig &rv = tx.rct_signatures;
+	rv.type = rct::RCTTypeSimple;
+	rv.txnFee = 1000;
+	rv.pseudoOuts.push_back(rct::pkGen());
+	for (size_t i = 0; i < 2; ++i)
+	{
+		cryptonote::tx_out out;
+		out.amount = 0;
+		out.target = cryptonote::txout_to_key(rct::rct2pk(rct::pkGen()));
+		tx.vout.push_back(out);
+		rv.ecdhInfo.push_back({rct::skGen(), rct::skGen(), rct::zero()});
+		rct::ctkey pk;
+		pk.dest = rct::pkGen();
+		pk.mask = rct::pkGen();
+		rv.outPk.push_back(pk);
+		rv.p.rangeSigs.push_back(rct::rangeSig());
+		rv.p.rangeSigs.back().asig.ee = rct::skGen();
+	}
+	cryptonote::add_tx_pub_key_to_extra(tx, rct::rct2pk(rct::pkGen()));
+
+	rct::mgSig mg;
+	mg.ss.resize(1, rct::keyV(2));
+	mg.ss[0][0] = rct::skGen();
+	mg.ss[0][1] = rct::skGen();
+	mg.cc = rct::skGen();
+	rv.p.MGs.push_back(mg);
+	return tx;
+}
 }
 
 #define ASSERT_EQ_MAP(val, map, key)     \